@@ -0,0 +1,866 @@
+#include "APU.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include "Cartridge.hpp"
+#include "SaveState.hpp"
+
+namespace
+{
+	constexpr uint8_t kLengthTable[32] =
+	{
+		10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+		12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+	};
+
+	constexpr uint8_t kDutyTable[4][8] =
+	{
+		{ 0, 1, 0, 0, 0, 0, 0, 0 },
+		{ 0, 1, 1, 0, 0, 0, 0, 0 },
+		{ 0, 1, 1, 1, 1, 0, 0, 0 },
+		{ 1, 0, 0, 1, 1, 1, 1, 1 },
+	};
+
+	// NTSC timer periods, in CPU cycles.
+	constexpr uint16_t kNoisePeriods[16] = { 4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068 };
+	constexpr uint16_t kDMCPeriods[16] = { 428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54 };
+
+	// CPU cycles from the start of the frame counter's sequence to each step.
+	constexpr uint32_t kFourStepCycles[4] = { 7457, 14913, 22371, 29829 };
+	constexpr uint32_t kFourStepPeriod = 29830;
+	constexpr uint32_t kFiveStepCycles[5] = { 7457, 14913, 22371, 29829, 37281 };
+	constexpr uint32_t kFiveStepPeriod = 37282;
+
+	// How much one step of each channel's output moves the final sample. The
+	// real mixer is non-linear, this is the usual linear approximation of it
+	// (https://www.nesdev.org/wiki/APU_Mixer) scaled to 16 bit samples, which
+	// lets each channel's steps go into the buffer independently.
+	constexpr float kChannelWeights[5] = { 263.0f, 263.0f, 298.0f, 173.0f, 117.0f };
+
+	// Moves a timer to its first clock at or after until without stepping
+	// through the ones in between, for when they wouldn't change anything.
+	// Returns how many clocks were skipped.
+	uint64_t SkipClocks(uint64_t& nextClock, uint64_t period, uint64_t until)
+	{
+		if (nextClock >= until)
+		{
+			return 0;
+		}
+
+		uint64_t clocks = (until - nextClock + period - 1) / period;
+		nextClock += clocks * period;
+
+		return clocks;
+	}
+}
+
+APU::APU(Cartridge& cartridge)
+	: mCartridge(cartridge)
+	, mOutput(8192)
+{
+	ResetFrameCounter();
+}
+
+void APU::Reset()
+{
+	WriteRegister(0x4015, 0x00);
+
+	// Real hardware powers on with the frame IRQ enabled, but also comes out
+	// of reset with IRQs masked, which CPU::Reset() doesn't do. Programs that
+	// want the frame IRQ enable it themselves.
+	WriteRegister(0x4017, 0x40);
+	mFrameIRQ = false;
+	mDMC.irq = false;
+}
+
+void APU::CatchUp(uint64_t cpuCycles)
+{
+	while (mCycle < cpuCycles)
+	{
+		uint64_t until = std::min(cpuCycles, mNextFrameCounterCycle);
+
+		// Nothing the CPU can see depends on the tone channels' timers.
+		if (IsSynthesisEnabled())
+		{
+			RunPulse(mPulse1, CH_Pulse1, until);
+			RunPulse(mPulse2, CH_Pulse2, until);
+			RunTriangle(until);
+			RunNoise(until);
+		}
+
+		RunDMC(until);
+
+		mCycle = until;
+
+		if (mCycle == mNextFrameCounterCycle)
+		{
+			ClockFrameCounter();
+		}
+	}
+}
+
+uint64_t APU::GetNextEventCycle() const
+{
+	uint64_t cycle = std::numeric_limits<uint64_t>::max();
+
+	if (!mFiveStepMode && !mFrameIRQInhibit && !mFrameIRQ)
+	{
+		cycle = mFrameCounterStart + kFourStepCycles[3];
+	}
+
+	if (mDMC.irqEnabled && !mDMC.loop && !mDMC.irq && mDMC.bytesRemaining > 0)
+	{
+		// The last byte is fetched when the one before it starts playing,
+		// which happens on the output clock that empties the shift register.
+		uint64_t fetches = mDMC.isBufferFull ? mDMC.bytesRemaining : mDMC.bytesRemaining - 1;
+		uint64_t fetchCycle = mCycle;
+
+		if (fetches > 0)
+		{
+			fetchCycle = mDMC.nextClock + (mDMC.bitsRemaining - 1 + (fetches - 1) * 8) * mDMC.period + 1;
+		}
+
+		cycle = std::min(cycle, fetchCycle);
+	}
+
+	return cycle;
+}
+
+uint8_t APU::ReadStatus()
+{
+	uint8_t status = 0;
+
+	status |= mPulse1.length > 0 ? 0x01 : 0x00;
+	status |= mPulse2.length > 0 ? 0x02 : 0x00;
+	status |= mTriangle.length > 0 ? 0x04 : 0x00;
+	status |= mNoise.length > 0 ? 0x08 : 0x00;
+	status |= mDMC.bytesRemaining > 0 ? 0x10 : 0x00;
+	status |= mFrameIRQ ? 0x40 : 0x00;
+	status |= mDMC.irq ? 0x80 : 0x00;
+
+	// Reading acknowledges the frame IRQ, but not the DMC's.
+	mFrameIRQ = false;
+
+	return status;
+}
+
+void APU::WriteRegister(uint16_t address, uint8_t data)
+{
+	if (address <= 0x4007)
+	{
+		Pulse& pulse = address < 0x4004 ? mPulse1 : mPulse2;
+		uint8_t enableBit = address < 0x4004 ? 0x01 : 0x02;
+
+		switch (address & 0x03)
+		{
+			case 0:
+				pulse.duty = data >> 6;
+				pulse.envelope.loop = data & 0x20;
+				pulse.envelope.constant = data & 0x10;
+				pulse.envelope.period = data & 0x0F;
+				break;
+			case 1:
+				pulse.sweepEnabled = data & 0x80;
+				pulse.sweepPeriod = (data >> 4) & 0x07;
+				pulse.sweepNegate = data & 0x08;
+				pulse.sweepShift = data & 0x07;
+				pulse.sweepReload = true;
+				break;
+			case 2:
+				pulse.period = (pulse.period & 0x0700) | data;
+				break;
+			case 3:
+				pulse.period = (pulse.period & 0x00FF) | ((data & 0x07) << 8);
+				if (mChannelsEnabled & enableBit)
+				{
+					pulse.length = kLengthTable[data >> 3];
+				}
+				pulse.sequence = 0;
+				pulse.envelope.start = true;
+				break;
+		}
+	}
+	else if (address == 0x4008)
+	{
+		mTriangle.control = data & 0x80;
+		mTriangle.linearReloadValue = data & 0x7F;
+	}
+	else if (address == 0x400A)
+	{
+		mTriangle.period = (mTriangle.period & 0x0700) | data;
+	}
+	else if (address == 0x400B)
+	{
+		mTriangle.period = (mTriangle.period & 0x00FF) | ((data & 0x07) << 8);
+		if (mChannelsEnabled & 0x04)
+		{
+			mTriangle.length = kLengthTable[data >> 3];
+		}
+		mTriangle.linearReload = true;
+	}
+	else if (address == 0x400C)
+	{
+		mNoise.envelope.loop = data & 0x20;
+		mNoise.envelope.constant = data & 0x10;
+		mNoise.envelope.period = data & 0x0F;
+	}
+	else if (address == 0x400E)
+	{
+		mNoise.mode = data & 0x80;
+		mNoise.period = kNoisePeriods[data & 0x0F];
+	}
+	else if (address == 0x400F)
+	{
+		if (mChannelsEnabled & 0x08)
+		{
+			mNoise.length = kLengthTable[data >> 3];
+		}
+		mNoise.envelope.start = true;
+	}
+	else if (address == 0x4010)
+	{
+		mDMC.irqEnabled = data & 0x80;
+		mDMC.loop = data & 0x40;
+		mDMC.period = kDMCPeriods[data & 0x0F];
+
+		if (!mDMC.irqEnabled)
+		{
+			mDMC.irq = false;
+		}
+	}
+	else if (address == 0x4011)
+	{
+		mDMC.level = data & 0x7F;
+		SetOutput(mDMC.output, CH_DMC, mDMC.level, mCycle);
+	}
+	else if (address == 0x4012)
+	{
+		mDMC.sampleAddress = 0xC000 + data * 64;
+	}
+	else if (address == 0x4013)
+	{
+		mDMC.sampleLength = data * 16 + 1;
+	}
+	else if (address == 0x4015)
+	{
+		mChannelsEnabled = data & 0x1F;
+
+		// Disabling a channel silences it straight away.
+		if (!(data & 0x01)) mPulse1.length = 0;
+		if (!(data & 0x02)) mPulse2.length = 0;
+		if (!(data & 0x04)) mTriangle.length = 0;
+		if (!(data & 0x08)) mNoise.length = 0;
+
+		mDMC.irq = false;
+
+		if (!(data & 0x10))
+		{
+			mDMC.bytesRemaining = 0;
+		}
+		else if (mDMC.bytesRemaining == 0)
+		{
+			RestartDMCSample();
+			FetchDMCSample();
+		}
+	}
+	else if (address == 0x4017)
+	{
+		mFiveStepMode = data & 0x80;
+		mFrameIRQInhibit = data & 0x40;
+
+		if (mFrameIRQInhibit)
+		{
+			mFrameIRQ = false;
+		}
+
+		// Writing restarts the sequence, and the 5 step sequence clocks
+		// everything straight away.
+		ResetFrameCounter();
+		if (mFiveStepMode)
+		{
+			ClockQuarterFrame();
+			ClockHalfFrame();
+		}
+	}
+
+	UpdateOutputs(mCycle);
+}
+
+void APU::SetSampleRate(double sampleRate)
+{
+	if (sampleRate > 0.0 && !IsSynthesisEnabled())
+	{
+		mOutputFrameStart = mCycle;
+		ResumeTimers();
+	}
+
+	bool wasEnabled = IsSynthesisEnabled();
+	mSampleRate = sampleRate;
+
+	if (IsSynthesisEnabled())
+	{
+		mOutput.SetRates(kClockRate, mSampleRate);
+	}
+
+	// Take whatever the channels output now as the starting level, rather
+	// than stepping up to it with a pop.
+	if (IsSynthesisEnabled() && !wasEnabled)
+	{
+		UpdateOutputs(mCycle);
+		mOutput.Clear();
+	}
+}
+
+void APU::EndFrame()
+{
+	if (IsSynthesisEnabled())
+	{
+		mOutput.EndFrame(static_cast<uint32_t>(mCycle - mOutputFrameStart));
+		mOutputFrameStart = mCycle;
+	}
+}
+
+void APU::SaveState(StateWriter& writer) const
+{
+	for (const Pulse* pulse : { &mPulse1, &mPulse2 })
+	{
+		pulse->envelope.SaveState(writer);
+		writer.Write(pulse->duty);
+		writer.Write(pulse->sequence);
+		writer.Write(pulse->period);
+		writer.Write(pulse->length);
+		writer.Write(pulse->sweepEnabled);
+		writer.Write(pulse->sweepNegate);
+		writer.Write(pulse->sweepReload);
+		writer.Write(pulse->sweepPeriod);
+		writer.Write(pulse->sweepShift);
+		writer.Write(pulse->sweepDivider);
+		writer.Write(pulse->nextClock);
+		writer.Write(static_cast<int8_t>(pulse->output));
+	}
+
+	writer.Write(mTriangle.control);
+	writer.Write(mTriangle.linearReload);
+	writer.Write(mTriangle.linearReloadValue);
+	writer.Write(mTriangle.linearCounter);
+	writer.Write(mTriangle.sequence);
+	writer.Write(mTriangle.period);
+	writer.Write(mTriangle.length);
+	writer.Write(mTriangle.nextClock);
+	writer.Write(static_cast<int8_t>(mTriangle.output));
+
+	mNoise.envelope.SaveState(writer);
+	writer.Write(mNoise.mode);
+	writer.Write(mNoise.period);
+	writer.Write(mNoise.shift);
+	writer.Write(mNoise.length);
+	writer.Write(mNoise.nextClock);
+	writer.Write(static_cast<int8_t>(mNoise.output));
+
+	writer.Write(mDMC.irqEnabled);
+	writer.Write(mDMC.loop);
+	writer.Write(mDMC.irq);
+	writer.Write(mDMC.period);
+	writer.Write(mDMC.level);
+	writer.Write(mDMC.sampleAddress);
+	writer.Write(mDMC.sampleLength);
+	writer.Write(mDMC.currentAddress);
+	writer.Write(mDMC.bytesRemaining);
+	writer.Write(mDMC.buffer);
+	writer.Write(mDMC.isBufferFull);
+	writer.Write(mDMC.shift);
+	writer.Write(mDMC.bitsRemaining);
+	writer.Write(mDMC.silence);
+	writer.Write(mDMC.nextClock);
+	writer.Write(static_cast<int8_t>(mDMC.output));
+
+	writer.Write(mChannelsEnabled);
+
+	writer.Write(mFiveStepMode);
+	writer.Write(mFrameIRQInhibit);
+	writer.Write(mFrameIRQ);
+	writer.Write(mFrameStep);
+	writer.Write(mFrameCounterStart);
+	writer.Write(mNextFrameCounterCycle);
+
+	writer.Write(mCycle);
+	writer.Write(mStallCycles);
+}
+
+void APU::LoadState(StateReader& reader)
+{
+	// Levels being output now, to step from to the loaded ones.
+	const int outputs[CH_Count] = { mPulse1.output, mPulse2.output, mTriangle.output, mNoise.output, mDMC.output };
+
+	auto readOutput = [&reader](int& output)
+	{
+		int8_t value = 0;
+		reader.Read(value);
+		output = value;
+	};
+
+	for (Pulse* pulse : { &mPulse1, &mPulse2 })
+	{
+		pulse->envelope.LoadState(reader);
+		reader.Read(pulse->duty);
+		reader.Read(pulse->sequence);
+		reader.Read(pulse->period);
+		reader.Read(pulse->length);
+		reader.Read(pulse->sweepEnabled);
+		reader.Read(pulse->sweepNegate);
+		reader.Read(pulse->sweepReload);
+		reader.Read(pulse->sweepPeriod);
+		reader.Read(pulse->sweepShift);
+		reader.Read(pulse->sweepDivider);
+		reader.Read(pulse->nextClock);
+		readOutput(pulse->output);
+	}
+
+	reader.Read(mTriangle.control);
+	reader.Read(mTriangle.linearReload);
+	reader.Read(mTriangle.linearReloadValue);
+	reader.Read(mTriangle.linearCounter);
+	reader.Read(mTriangle.sequence);
+	reader.Read(mTriangle.period);
+	reader.Read(mTriangle.length);
+	reader.Read(mTriangle.nextClock);
+	readOutput(mTriangle.output);
+
+	mNoise.envelope.LoadState(reader);
+	reader.Read(mNoise.mode);
+	reader.Read(mNoise.period);
+	reader.Read(mNoise.shift);
+	reader.Read(mNoise.length);
+	reader.Read(mNoise.nextClock);
+	readOutput(mNoise.output);
+
+	reader.Read(mDMC.irqEnabled);
+	reader.Read(mDMC.loop);
+	reader.Read(mDMC.irq);
+	reader.Read(mDMC.period);
+	reader.Read(mDMC.level);
+	reader.Read(mDMC.sampleAddress);
+	reader.Read(mDMC.sampleLength);
+	reader.Read(mDMC.currentAddress);
+	reader.Read(mDMC.bytesRemaining);
+	reader.Read(mDMC.buffer);
+	reader.Read(mDMC.isBufferFull);
+	reader.Read(mDMC.shift);
+	reader.Read(mDMC.bitsRemaining);
+	reader.Read(mDMC.silence);
+	reader.Read(mDMC.nextClock);
+	readOutput(mDMC.output);
+
+	reader.Read(mChannelsEnabled);
+
+	reader.Read(mFiveStepMode);
+	reader.Read(mFrameIRQInhibit);
+	reader.Read(mFrameIRQ);
+	reader.Read(mFrameStep);
+	reader.Read(mFrameCounterStart);
+	reader.Read(mNextFrameCounterCycle);
+
+	reader.Read(mCycle);
+	reader.Read(mStallCycles);
+
+	// Whatever's already in the output buffer stays, and the new levels
+	// carry on from the end of it.
+	if (IsSynthesisEnabled())
+	{
+		mOutputFrameStart = mCycle;
+		ResumeTimers();
+
+		int* loaded[CH_Count] = { &mPulse1.output, &mPulse2.output, &mTriangle.output, &mNoise.output, &mDMC.output };
+		for (int channel = 0; channel < CH_Count; ++channel)
+		{
+			int value = *loaded[channel];
+			*loaded[channel] = outputs[channel];
+			SetOutput(*loaded[channel], static_cast<Channel>(channel), value, mCycle);
+		}
+	}
+}
+
+size_t APU::ReadSamples(int16_t* samples, size_t count)
+{
+	return mOutput.ReadSamples(samples, count);
+}
+
+void APU::Envelope::Clock()
+{
+	if (start)
+	{
+		start = false;
+		decay = 15;
+		divider = period;
+	}
+	else if (divider == 0)
+	{
+		divider = period;
+
+		if (decay > 0)
+		{
+			--decay;
+		}
+		else if (loop)
+		{
+			decay = 15;
+		}
+	}
+	else
+	{
+		--divider;
+	}
+}
+
+void APU::Envelope::SaveState(StateWriter& writer) const
+{
+	writer.Write(loop);
+	writer.Write(constant);
+	writer.Write(start);
+	writer.Write(period);
+	writer.Write(divider);
+	writer.Write(decay);
+}
+
+void APU::Envelope::LoadState(StateReader& reader)
+{
+	reader.Read(loop);
+	reader.Read(constant);
+	reader.Read(start);
+	reader.Read(period);
+	reader.Read(divider);
+	reader.Read(decay);
+}
+
+// Pulse 1 negates with ones' complement, pulse 2 with two's complement.
+uint16_t APU::Pulse::GetSweepTarget(bool onesComplement) const
+{
+	uint16_t change = period >> sweepShift;
+
+	if (sweepNegate)
+	{
+		uint16_t subtract = change + (onesComplement ? 1 : 0);
+		return subtract > period ? 0 : period - subtract;
+	}
+
+	return period + change;
+}
+
+bool APU::Pulse::IsMuted(bool onesComplement) const
+{
+	return period < 8 || GetSweepTarget(onesComplement) > 0x7FF;
+}
+
+void APU::RunPulse(Pulse& pulse, Channel channel, uint64_t until)
+{
+	const uint64_t period = (pulse.period + 1) * 2;
+
+	if (pulse.length == 0 || pulse.envelope.GetVolume() == 0 || pulse.IsMuted(channel == CH_Pulse1))
+	{
+		pulse.sequence = (pulse.sequence + SkipClocks(pulse.nextClock, period, until)) & 0x07;
+		return;
+	}
+
+	while (pulse.nextClock < until)
+	{
+		pulse.sequence = (pulse.sequence + 1) & 0x07;
+		UpdatePulseOutput(pulse, channel, pulse.nextClock);
+		pulse.nextClock += period;
+	}
+}
+
+void APU::RunTriangle(uint64_t until)
+{
+	const uint64_t period = mTriangle.period + 1;
+
+	// When stopped the triangle holds its level rather than going silent.
+	// Periods under 2 are far too high to hear, so treat those as stopped too
+	// rather than stepping it every cycle.
+	if (mTriangle.length == 0 || mTriangle.linearCounter == 0 || mTriangle.period < 2)
+	{
+		SkipClocks(mTriangle.nextClock, period, until);
+		return;
+	}
+
+	while (mTriangle.nextClock < until)
+	{
+		mTriangle.sequence = (mTriangle.sequence + 1) & 0x1F;
+		UpdateTriangleOutput(mTriangle.nextClock);
+		mTriangle.nextClock += period;
+	}
+}
+
+void APU::RunNoise(uint64_t until)
+{
+	if (mNoise.length == 0 || mNoise.envelope.GetVolume() == 0)
+	{
+		SkipClocks(mNoise.nextClock, mNoise.period, until);
+		return;
+	}
+
+	while (mNoise.nextClock < until)
+	{
+		uint16_t feedback = (mNoise.shift ^ (mNoise.shift >> (mNoise.mode ? 6 : 1))) & 0x01;
+		mNoise.shift = (mNoise.shift >> 1) | (feedback << 14);
+
+		UpdateNoiseOutput(mNoise.nextClock);
+		mNoise.nextClock += mNoise.period;
+	}
+}
+
+void APU::RunDMC(uint64_t until)
+{
+	// Idle, so only the bit counter moves.
+	if (mDMC.silence && !mDMC.isBufferFull && mDMC.bytesRemaining == 0)
+	{
+		uint64_t clocks = SkipClocks(mDMC.nextClock, mDMC.period, until);
+		mDMC.bitsRemaining = static_cast<uint8_t>((mDMC.bitsRemaining + 7 - clocks % 8) % 8 + 1);
+		return;
+	}
+
+	while (mDMC.nextClock < until)
+	{
+		if (!mDMC.silence)
+		{
+			if (mDMC.shift & 0x01)
+			{
+				if (mDMC.level <= 125)
+				{
+					mDMC.level += 2;
+				}
+			}
+			else if (mDMC.level >= 2)
+			{
+				mDMC.level -= 2;
+			}
+
+			SetOutput(mDMC.output, CH_DMC, mDMC.level, mDMC.nextClock);
+		}
+
+		mDMC.shift >>= 1;
+
+		if (--mDMC.bitsRemaining == 0)
+		{
+			mDMC.bitsRemaining = 8;
+			mDMC.silence = !mDMC.isBufferFull;
+
+			if (mDMC.isBufferFull)
+			{
+				mDMC.shift = mDMC.buffer;
+				mDMC.isBufferFull = false;
+				FetchDMCSample();
+			}
+		}
+
+		mDMC.nextClock += mDMC.period;
+	}
+}
+
+void APU::FetchDMCSample()
+{
+	if (mDMC.isBufferFull || mDMC.bytesRemaining == 0)
+	{
+		return;
+	}
+
+	// The fetch takes the bus away from the CPU for a few cycles.
+	mDMC.buffer = mCartridge.Read(mDMC.currentAddress);
+	mDMC.isBufferFull = true;
+	mStallCycles += 4;
+
+	mDMC.currentAddress = mDMC.currentAddress == 0xFFFF ? 0x8000 : mDMC.currentAddress + 1;
+
+	if (--mDMC.bytesRemaining == 0)
+	{
+		if (mDMC.loop)
+		{
+			RestartDMCSample();
+		}
+		else if (mDMC.irqEnabled)
+		{
+			mDMC.irq = true;
+		}
+	}
+}
+
+void APU::RestartDMCSample()
+{
+	mDMC.currentAddress = mDMC.sampleAddress;
+	mDMC.bytesRemaining = mDMC.sampleLength;
+}
+
+void APU::ClockFrameCounter()
+{
+	if (!mFiveStepMode)
+	{
+		ClockQuarterFrame();
+
+		if (mFrameStep == 1 || mFrameStep == 3)
+		{
+			ClockHalfFrame();
+		}
+
+		if (mFrameStep == 3 && !mFrameIRQInhibit)
+		{
+			mFrameIRQ = true;
+		}
+	}
+	else
+	{
+		if (mFrameStep != 3)
+		{
+			ClockQuarterFrame();
+		}
+
+		if (mFrameStep == 1 || mFrameStep == 4)
+		{
+			ClockHalfFrame();
+		}
+	}
+
+	UpdateOutputs(mCycle);
+
+	const uint8_t stepCount = mFiveStepMode ? 5 : 4;
+	if (++mFrameStep == stepCount)
+	{
+		mFrameStep = 0;
+		mFrameCounterStart += mFiveStepMode ? kFiveStepPeriod : kFourStepPeriod;
+	}
+
+	mNextFrameCounterCycle = mFrameCounterStart + (mFiveStepMode ? kFiveStepCycles : kFourStepCycles)[mFrameStep];
+}
+
+void APU::ClockQuarterFrame()
+{
+	mPulse1.envelope.Clock();
+	mPulse2.envelope.Clock();
+	mNoise.envelope.Clock();
+
+	if (mTriangle.linearReload)
+	{
+		mTriangle.linearCounter = mTriangle.linearReloadValue;
+	}
+	else if (mTriangle.linearCounter > 0)
+	{
+		--mTriangle.linearCounter;
+	}
+
+	if (!mTriangle.control)
+	{
+		mTriangle.linearReload = false;
+	}
+}
+
+void APU::ClockHalfFrame()
+{
+	auto clockLength = [](uint8_t& length, bool halt)
+	{
+		if (length > 0 && !halt)
+		{
+			--length;
+		}
+	};
+
+	clockLength(mPulse1.length, mPulse1.envelope.loop);
+	clockLength(mPulse2.length, mPulse2.envelope.loop);
+	clockLength(mTriangle.length, mTriangle.control);
+	clockLength(mNoise.length, mNoise.envelope.loop);
+
+	for (Pulse* pulse : { &mPulse1, &mPulse2 })
+	{
+		bool onesComplement = pulse == &mPulse1;
+
+		if (pulse->sweepDivider == 0 && pulse->sweepEnabled && pulse->sweepShift > 0 && !pulse->IsMuted(onesComplement))
+		{
+			pulse->period = pulse->GetSweepTarget(onesComplement);
+		}
+
+		if (pulse->sweepDivider == 0 || pulse->sweepReload)
+		{
+			pulse->sweepDivider = pulse->sweepPeriod;
+			pulse->sweepReload = false;
+		}
+		else
+		{
+			--pulse->sweepDivider;
+		}
+	}
+}
+
+void APU::ResetFrameCounter()
+{
+	mFrameStep = 0;
+	mFrameCounterStart = mCycle;
+	mNextFrameCounterCycle = mFrameCounterStart + kFourStepCycles[0];
+}
+
+void APU::UpdatePulseOutput(Pulse& pulse, Channel channel, uint64_t cycle)
+{
+	int value = 0;
+
+	if (pulse.length > 0 && !pulse.IsMuted(channel == CH_Pulse1) && kDutyTable[pulse.duty][pulse.sequence])
+	{
+		value = pulse.envelope.GetVolume();
+	}
+
+	SetOutput(pulse.output, channel, value, cycle);
+}
+
+void APU::UpdateTriangleOutput(uint64_t cycle)
+{
+	int value = mTriangle.sequence < 16 ? 15 - mTriangle.sequence : mTriangle.sequence - 16;
+	SetOutput(mTriangle.output, CH_Triangle, value, cycle);
+}
+
+void APU::UpdateNoiseOutput(uint64_t cycle)
+{
+	int value = 0;
+
+	if (mNoise.length > 0 && !(mNoise.shift & 0x01))
+	{
+		value = mNoise.envelope.GetVolume();
+	}
+
+	SetOutput(mNoise.output, CH_Noise, value, cycle);
+}
+
+// The tone channels' timers stand still while synthesis is off, so pick them
+// up from now rather than running through every clock they missed.
+void APU::ResumeTimers()
+{
+	mPulse1.nextClock = std::max(mPulse1.nextClock, mCycle);
+	mPulse2.nextClock = std::max(mPulse2.nextClock, mCycle);
+	mTriangle.nextClock = std::max(mTriangle.nextClock, mCycle);
+	mNoise.nextClock = std::max(mNoise.nextClock, mCycle);
+}
+
+// Called whenever something other than a timer may have changed what the
+// channels output, e.g. a register write or the frame counter.
+void APU::UpdateOutputs(uint64_t cycle)
+{
+	if (!IsSynthesisEnabled())
+	{
+		return;
+	}
+
+	UpdatePulseOutput(mPulse1, CH_Pulse1, cycle);
+	UpdatePulseOutput(mPulse2, CH_Pulse2, cycle);
+	UpdateTriangleOutput(cycle);
+	UpdateNoiseOutput(cycle);
+}
+
+void APU::SetOutput(int& output, Channel channel, int value, uint64_t cycle)
+{
+	if (value == output)
+	{
+		return;
+	}
+
+	if (IsSynthesisEnabled())
+	{
+		mOutput.AddDelta(static_cast<uint32_t>(cycle - mOutputFrameStart), (value - output) * kChannelWeights[channel]);
+	}
+
+	output = value;
+}
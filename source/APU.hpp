@@ -0,0 +1,205 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "BlipBuffer.hpp"
+
+class Cartridge;
+class StateReader;
+class StateWriter;
+
+// Audio processing unit: two pulse channels, triangle, noise and DMC, plus
+// the frame counter that clocks their envelopes and lengths. Like the PPU it
+// is left alone until something needs it and then catches up, stepping each
+// channel from one timer clock to the next rather than cycle by cycle. Every
+// change in a channel's output goes into a BlipBuffer as a band-limited step.
+// See https://www.nesdev.org/wiki/APU.
+class APU
+{
+public:
+	static constexpr double kClockRate = 1789773.0;
+
+	explicit APU(Cartridge& cartridge);
+
+	void Reset();
+
+	// Runs the APU up to the given CPU cycle.
+	void CatchUp(uint64_t cpuCycles);
+
+	// The first CPU cycle at which the APU next raises an IRQ, from the frame
+	// counter or the end of a DMC sample.
+	uint64_t GetNextEventCycle() const;
+
+	bool IsIRQPending() const { return mFrameIRQ || mDMC.irq; }
+
+	// CPU cycles stolen by DMC sample fetches since the last call.
+	uint32_t TakeStallCycles()
+	{
+		uint32_t cycles = mStallCycles;
+		mStallCycles = 0;
+		return cycles;
+	}
+
+	// 0x4000-0x4013, 0x4015 and 0x4017. Call CatchUp() first.
+	uint8_t ReadStatus();
+	void    WriteRegister(uint16_t address, uint8_t data);
+
+	// Channel and frame counter state, not the output buffer.
+	void    SaveState(StateWriter& writer) const;
+	void    LoadState(StateReader& reader);
+
+	// Output. Synthesis is off until a sample rate is set, e.g. when running
+	// headless, which leaves only what the CPU can see (lengths, IRQs, DMC).
+	void    SetSampleRate(double sampleRate);
+
+	// Makes everything up to the last CatchUp() available to ReadSamples().
+	void    EndFrame();
+	size_t  GetSamplesAvailable() const { return mOutput.GetSamplesAvailable(); }
+	size_t  ReadSamples(int16_t* samples, size_t count);
+
+private:
+	struct Envelope
+	{
+		bool    loop = false;
+		bool    constant = false;
+		bool    start = false;
+		uint8_t period = 0;
+		uint8_t divider = 0;
+		uint8_t decay = 0;
+
+		void    Clock();
+		uint8_t GetVolume() const { return constant ? period : decay; }
+
+		void    SaveState(StateWriter& writer) const;
+		void    LoadState(StateReader& reader);
+	};
+
+	struct Pulse
+	{
+		Envelope envelope;
+		uint8_t  duty = 0;
+		uint8_t  sequence = 0;
+		uint16_t period = 0;
+		uint8_t  length = 0;
+
+		bool     sweepEnabled = false;
+		bool     sweepNegate = false;
+		bool     sweepReload = false;
+		uint8_t  sweepPeriod = 0;
+		uint8_t  sweepShift = 0;
+		uint8_t  sweepDivider = 0;
+
+		uint64_t nextClock = 0;
+		int      output = 0;
+
+		uint16_t GetSweepTarget(bool onesComplement) const;
+		bool     IsMuted(bool onesComplement) const;
+	};
+
+	struct Triangle
+	{
+		bool     control = false;
+		bool     linearReload = false;
+		uint8_t  linearReloadValue = 0;
+		uint8_t  linearCounter = 0;
+		uint8_t  sequence = 0;
+		uint16_t period = 0;
+		uint8_t  length = 0;
+
+		uint64_t nextClock = 0;
+		int      output = 0;
+	};
+
+	struct Noise
+	{
+		Envelope envelope;
+		bool     mode = false;
+		uint16_t period = 4;
+		uint16_t shift = 1;
+		uint8_t  length = 0;
+
+		uint64_t nextClock = 0;
+		int      output = 0;
+	};
+
+	struct DMC
+	{
+		bool     irqEnabled = false;
+		bool     loop = false;
+		bool     irq = false;
+		uint16_t period = 428;
+		uint8_t  level = 0;
+
+		uint16_t sampleAddress = 0xC000;
+		uint16_t sampleLength = 1;
+		uint16_t currentAddress = 0xC000;
+		uint16_t bytesRemaining = 0;
+
+		uint8_t  buffer = 0;
+		bool     isBufferFull = false;
+		uint8_t  shift = 0;
+		uint8_t  bitsRemaining = 8;
+		bool     silence = true;
+
+		uint64_t nextClock = 0;
+		int      output = 0;
+	};
+
+	enum Channel : uint8_t
+	{
+		CH_Pulse1,
+		CH_Pulse2,
+		CH_Triangle,
+		CH_Noise,
+		CH_DMC,
+		CH_Count
+	};
+
+	void     RunPulse(Pulse& pulse, Channel channel, uint64_t until);
+	void     RunTriangle(uint64_t until);
+	void     RunNoise(uint64_t until);
+	void     RunDMC(uint64_t until);
+	void     FetchDMCSample();
+	void     RestartDMCSample();
+
+	void     ClockFrameCounter();
+	void     ClockQuarterFrame();
+	void     ClockHalfFrame();
+	void     ResetFrameCounter();
+
+	void     UpdatePulseOutput(Pulse& pulse, Channel channel, uint64_t cycle);
+	void     UpdateTriangleOutput(uint64_t cycle);
+	void     UpdateNoiseOutput(uint64_t cycle);
+	void     UpdateOutputs(uint64_t cycle);
+	void     SetOutput(int& output, Channel channel, int value, uint64_t cycle);
+
+	bool     IsSynthesisEnabled() const { return mSampleRate > 0.0; }
+	void     ResumeTimers();
+
+	Cartridge& mCartridge;
+
+	Pulse    mPulse1;
+	Pulse    mPulse2;
+	Triangle mTriangle;
+	Noise    mNoise;
+	DMC      mDMC;
+
+	// Written to 0x4015, a disabled channel can't have its length loaded.
+	uint8_t  mChannelsEnabled = 0;
+
+	// Frame counter, see https://www.nesdev.org/wiki/APU_Frame_Counter.
+	bool     mFiveStepMode = false;
+	bool     mFrameIRQInhibit = true;
+	bool     mFrameIRQ = false;
+	uint8_t  mFrameStep = 0;
+	uint64_t mFrameCounterStart = 0;
+	uint64_t mNextFrameCounterCycle = 0;
+
+	uint64_t mCycle = 0;
+	uint32_t mStallCycles = 0;
+
+	double     mSampleRate = 0.0;
+	BlipBuffer mOutput;
+	uint64_t   mOutputFrameStart = 0;
+};
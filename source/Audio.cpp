@@ -0,0 +1,65 @@
+#include "Audio.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+#include <spdlog/spdlog.h>
+
+#include <SDL3/SDL.h>
+
+#include "Scheduler.hpp"
+
+Audio::Audio(Scheduler& scheduler)
+	: mScheduler(scheduler)
+{
+}
+
+Audio::~Audio()
+{
+	// Stops the callback before anything it uses goes away.
+	if (mStream)
+	{
+		SDL_DestroyAudioStream(mStream);
+	}
+}
+
+bool Audio::Init()
+{
+	const SDL_AudioSpec spec = { SDL_AUDIO_S16, 1, kSampleRate };
+	mStream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, &Audio::Feed, this);
+
+	if (!mStream)
+	{
+		SPDLOG_ERROR("Failed to open audio device! Error code: {}", SDL_GetError());
+		return false;
+	}
+
+	mScheduler.EnableAudio(kSampleRate);
+	SDL_ResumeAudioStreamDevice(mStream);
+
+	return true;
+}
+
+void Audio::Feed(void* userdata, SDL_AudioStream* stream, int additionalAmount, int /*totalAmount*/)
+{
+	Audio* audio = static_cast<Audio*>(userdata);
+
+	int16_t samples[1024];
+	size_t needed = additionalAmount / sizeof(int16_t);
+
+	while (needed > 0)
+	{
+		size_t count = std::min(needed, std::size(samples));
+		size_t read = audio->mScheduler.ReadAudio(samples, count);
+
+		if (read > 0)
+		{
+			audio->mLastSample = samples[read - 1];
+		}
+
+		std::fill(samples + read, samples + count, audio->mLastSample);
+
+		SDL_PutAudioStreamData(stream, samples, static_cast<int>(count * sizeof(int16_t)));
+		needed -= count;
+	}
+}
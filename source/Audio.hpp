@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+
+class Scheduler;
+struct SDL_AudioStream;
+
+// Plays the APU's output through an SDL audio stream. SDL asks for samples on
+// its own thread whenever it's running low, and gets them straight from the
+// scheduler's ring buffer, so nothing on the UI thread is involved.
+class Audio
+{
+public:
+	static constexpr int kSampleRate = 48000;
+
+	explicit Audio(Scheduler& scheduler);
+	~Audio();
+
+	Audio(const Audio&) = delete;
+	Audio& operator=(const Audio&) = delete;
+
+	bool Init();
+
+private:
+	static void Feed(void* userdata, SDL_AudioStream* stream, int additionalAmount, int totalAmount);
+
+	Scheduler&       mScheduler;
+	SDL_AudioStream* mStream = nullptr;
+
+	// Repeated when the emulator can't keep up, a flat line rather than a click.
+	int16_t          mLastSample = 0;
+};
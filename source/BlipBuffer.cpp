@@ -0,0 +1,142 @@
+#include "BlipBuffer.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	// Close to 1Hz at the usual output rates, only there to stop any DC
+	// offset building up in the running sum.
+	constexpr float kHighPass = 0.999f;
+}
+
+BlipBuffer::BlipBuffer(size_t capacity)
+	: mDeltas(capacity + kTaps + 1, 0.0f)
+{
+}
+
+void BlipBuffer::SetRates(double clockRate, double sampleRate)
+{
+	mSamplesPerClock = sampleRate / clockRate;
+}
+
+// Windowed sinc steps, one set of taps for each fraction of a sample a step
+// can start at. Each set sums to 1, so a delta always moves the output by
+// exactly that much once it has settled.
+const BlipBuffer::Kernel& BlipBuffer::GetKernel()
+{
+	static const Kernel kernel = []()
+	{
+		constexpr double kPi = 3.14159265358979323846;
+		constexpr double kHalfWidth = kTaps / 2;
+
+		// Roll off a little below Nyquist.
+		constexpr double kCutoff = 0.9;
+
+		Kernel taps = {};
+
+		for (int phase = 0; phase <= kPhases; ++phase)
+		{
+			double centre = kHalfWidth - 1.0 + static_cast<double>(phase) / kPhases;
+			double sum = 0.0;
+
+			for (int tap = 0; tap < kTaps; ++tap)
+			{
+				double x = tap - centre;
+				double sinc = x == 0.0 ? 1.0 : std::sin(kPi * kCutoff * x) / (kPi * kCutoff * x);
+				double window = 0.42 + 0.5 * std::cos(kPi * x / kHalfWidth) + 0.08 * std::cos(2.0 * kPi * x / kHalfWidth);
+
+				taps[phase][tap] = static_cast<float>(sinc * window);
+				sum += taps[phase][tap];
+			}
+
+			for (float& tap : taps[phase])
+			{
+				tap = static_cast<float>(tap / sum);
+			}
+		}
+
+		return taps;
+	}();
+
+	return kernel;
+}
+
+void BlipBuffer::AddDelta(uint32_t clockTime, float delta)
+{
+	double position = mFrameStart + clockTime * mSamplesPerClock;
+	size_t index = static_cast<size_t>(position);
+
+	if (index + kTaps > mDeltas.size())
+	{
+		return;
+	}
+
+	int phase = static_cast<int>((position - index) * kPhases + 0.5);
+	const std::array<float, kTaps>& taps = GetKernel()[phase];
+
+	float* deltas = mDeltas.data() + index;
+	for (int tap = 0; tap < kTaps; ++tap)
+	{
+		deltas[tap] += taps[tap] * delta;
+	}
+}
+
+void BlipBuffer::EndFrame(uint32_t clockDuration)
+{
+	// A frame longer than the buffer loses its end, and the next one starts
+	// where the buffer does.
+	const size_t capacity = mDeltas.size() - kTaps - 1;
+	mFrameStart = std::min(mFrameStart + clockDuration * mSamplesPerClock, static_cast<double>(capacity));
+
+	// Steps can reach kTaps samples past the start of the next frame, so
+	// anything before it is final.
+	mSamplesAvailable = static_cast<size_t>(mFrameStart);
+
+	// Nobody is reading, drop the oldest samples to make room for more.
+	const size_t limit = capacity / 2;
+	if (mSamplesAvailable > limit)
+	{
+		RemoveSamples(nullptr, mSamplesAvailable - limit);
+	}
+}
+
+size_t BlipBuffer::ReadSamples(int16_t* samples, size_t count)
+{
+	count = std::min(count, mSamplesAvailable);
+	RemoveSamples(samples, count);
+
+	return count;
+}
+
+void BlipBuffer::RemoveSamples(int16_t* samples, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		mIntegrator += mDeltas[i];
+
+		mHighPassOutput = mIntegrator - mHighPassInput + kHighPass * mHighPassOutput;
+		mHighPassInput = mIntegrator;
+
+		if (samples)
+		{
+			samples[i] = static_cast<int16_t>(std::clamp(std::lround(mHighPassOutput), -32768l, 32767l));
+		}
+	}
+
+	std::move(mDeltas.begin() + count, mDeltas.end(), mDeltas.begin());
+	std::fill(mDeltas.end() - count, mDeltas.end(), 0.0f);
+
+	mFrameStart -= count;
+	mSamplesAvailable -= count;
+}
+
+void BlipBuffer::Clear()
+{
+	std::fill(mDeltas.begin(), mDeltas.end(), 0.0f);
+	mFrameStart = 0.0;
+	mSamplesAvailable = 0;
+	mIntegrator = 0.0f;
+	mHighPassInput = 0.0f;
+	mHighPassOutput = 0.0f;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Band-limited step synthesis, in the style of blargg's Blip_Buffer. Rather
+// than generating a waveform at the clock rate and filtering it down, each
+// change in amplitude is added at its exact time as a band-limited step, so
+// the cost is per change rather than per clock.
+// See http://www.slack.net/~ant/bl-synth/.
+class BlipBuffer
+{
+public:
+	// Capacity is in output samples, and bounds how long a frame can be.
+	explicit BlipBuffer(size_t capacity);
+
+	// Can be changed between frames, e.g. to nudge the output rate.
+	void   SetRates(double clockRate, double sampleRate);
+
+	// Adds a change in amplitude at the given clock, counted from the start of
+	// the current frame.
+	void   AddDelta(uint32_t clockTime, float delta);
+
+	// Ends the current frame after the given number of clocks, making every
+	// sample before then available.
+	void   EndFrame(uint32_t clockDuration);
+
+	size_t GetSamplesAvailable() const { return mSamplesAvailable; }
+
+	// Removes up to count samples, returns how many there were.
+	size_t ReadSamples(int16_t* samples, size_t count);
+
+	void   Clear();
+
+private:
+	static constexpr int kPhases = 32;
+	static constexpr int kTaps = 16;
+
+	using Kernel = std::array<std::array<float, kTaps>, kPhases + 1>;
+	static const Kernel& GetKernel();
+
+	void   RemoveSamples(int16_t* samples, size_t count);
+
+	// Differences between samples, turned back into samples by ReadSamples().
+	std::vector<float> mDeltas;
+
+	double mSamplesPerClock = 0.0;
+
+	// Position of the start of the current frame, in samples.
+	double mFrameStart = 0.0;
+	size_t mSamplesAvailable = 0;
+
+	// Running sum of the deltas, and the DC blocking filter after it.
+	float  mIntegrator = 0.0f;
+	float  mHighPassInput = 0.0f;
+	float  mHighPassOutput = 0.0f;
+};
@@ -1,942 +1,1215 @@
 #include "CPU.hpp"
 
+#include <type_traits>
+
 #include <spdlog/spdlog.h>
 
+#include "JIT.hpp"
+#include "SaveState.hpp"
 #include "System.hpp"
+#include "Trace.hpp"
 
-void CPU::ConnectSystem(std::shared_ptr<System> system)
+namespace
 {
-	mSystem = system;
+	// Ops have different signatures, so can only be compared once the types
+	// are known to match.
+	template <auto Op, auto Other>
+	constexpr bool IsOp()
+	{
+		if constexpr (std::is_same_v<decltype(Op), decltype(Other)>)
+		{
+			return Op == Other;
+		}
+		else
+		{
+			return false;
+		}
+	}
 }
 
-void CPU::Reset()
+constexpr uint8_t CPU::GetInstructionLength(AddressingMode mode)
 {
-	// Use uint16_t to ensure bit shifts don't wrap.
-	uint16_t PC_lo = mSystem->Read(0xFFFC);
-	uint16_t PC_hi = mSystem->Read(0xFFFD);
+	switch (mode)
+	{
+		case AM_Implied:
+		case AM_Accumulator:
+			return 1;
+		case AM_Absolute:
+		case AM_AbsoluteX:
+		case AM_AbsoluteY:
+		case AM_Indirect:
+			return 3;
+		default:
+			return 2;
+	}
+}
 
-	registers.PC = PC_lo | PC_hi << 8;
+template <CPU::AddressingMode Mode>
+uint16_t CPU::FetchOperandBytes()
+{
+	constexpr uint8_t length = GetInstructionLength(Mode);
 
-	registers.SP = 0xFD;
+	if constexpr (length == 1)
+	{
+		return 0;
+	}
+	else if constexpr (length == 2)
+	{
+		return mSystem.Read(registers.PC++);
+	}
+	else
+	{
+		uint16_t lo = mSystem.Read(registers.PC++);
+		uint16_t hi = mSystem.Read(registers.PC++);
+
+		return lo | hi << 8;
+	}
 }
 
-bool CPU::Process()
+// Returns the operand's address, or its value for immediate addressing.
+// Indexed modes note whether indexing crossed into the next page.
+template <CPU::AddressingMode Mode>
+uint16_t CPU::GetOperand(uint16_t operandBytes)
 {
-	bool shouldContinue = true;
+	if constexpr (Mode == AM_Implied || Mode == AM_Accumulator)
+	{
+		return 0;
+	}
+	else if constexpr (Mode == AM_Immediate || Mode == AM_ZeroPage || Mode == AM_Absolute)
+	{
+		return operandBytes;
+	}
+	else if constexpr (Mode == AM_ZeroPageX)
+	{
+		return operandBytes + registers.IX;
+	}
+	else if constexpr (Mode == AM_ZeroPageY)
+	{
+		return operandBytes + registers.IY;
+	}
+	else if constexpr (Mode == AM_AbsoluteX || Mode == AM_AbsoluteY)
+	{
+		uint16_t address = operandBytes + (Mode == AM_AbsoluteX ? registers.IX : registers.IY);
+		mPageCrossed = (operandBytes & 0xFF00) != (address & 0xFF00);
 
-	SPDLOG_INFO("PC is {:#06x}", registers.PC);
-	Opcodes opcode = static_cast<Opcodes>(mSystem->Read(registers.PC++));
-	mCurrentOpcode = opcode;
-	SPDLOG_INFO("Executing opcode {} ({:#04x})", OpcodeToString(opcode), static_cast<uint8_t>(opcode));
-	auto opcodeIter = opTable.find(opcode);
-	if (opcodeIter != opTable.end())
+		return address;
+	}
+	else if constexpr (Mode == AM_Indirect)
 	{
-		auto& OpFuncs = opcodeIter->second;
-		auto fetchFunc = std::bind(OpFuncs.fetchFunc, this);
-		auto opFunc = std::bind(OpFuncs.opFunc, this, std::placeholders::_1);
+		uint16_t baseAddress = operandBytes;
 
-		DecodedOperand operand = fetchFunc();
-		mCurrentOperand = operand;
-		opFunc(operand);
+		uint16_t indirectAddress_lo = mSystem.Read(baseAddress);
+		uint16_t indirectAddress_hi = mSystem.Read(++baseAddress);
 
-		SPDLOG_INFO("Registers: ACC = {:#04x} IX = {:#04x} IY = {:#04x}, PC = {:#06x}, PS = {:#04x}, SP = {:#04x}", registers.ACC, registers.IX, registers.IY, registers.PC, registers.PS, registers.SP);
-		if (opcode == Opcodes::BRK)
-		{
-			shouldContinue = false;
-		}
+		return indirectAddress_lo | indirectAddress_hi << 8;
 	}
-	else
+	else if constexpr (Mode == AM_IndirectX)
 	{
-		SPDLOG_ERROR("Illegal opcode {:#04x}", static_cast<uint8_t>(opcode));
-		shouldContinue = false;
+		// The pointer is in the zero page and wraps around within it.
+		uint8_t pointerAddress = static_cast<uint8_t>(operandBytes + registers.IX);
+
+		uint16_t pointer_lo = mSystem.Read(pointerAddress);
+		uint16_t pointer_hi = mSystem.Read(static_cast<uint8_t>(pointerAddress + 1));
+
+		return pointer_lo | pointer_hi << 8;
 	}
+	else if constexpr (Mode == AM_IndirectY)
+	{
+		// As above, but Y is added to the pointer rather than X to where it's kept.
+		uint8_t pointerAddress = static_cast<uint8_t>(operandBytes);
 
-	return shouldContinue;
-}
+		uint16_t pointer_lo = mSystem.Read(pointerAddress);
+		uint16_t pointer_hi = mSystem.Read(static_cast<uint8_t>(pointerAddress + 1));
+		uint16_t pointer = pointer_lo | pointer_hi << 8;
 
-CPU::DecodedOperand CPU::fetch_immediate()
-{
-	SPDLOG_INFO("{}", __func__);
+		uint16_t address = pointer + registers.IY;
+		mPageCrossed = (pointer & 0xFF00) != (address & 0xFF00);
+
+		return address;
+	}
+	else
+	{
+		static_assert(Mode == AM_Relative);
 
-	DecodedOperand decoded;
+		// Offset is signed, relative to the next instruction.
+		int8_t relativeAddress = static_cast<int8_t>(operandBytes);
 
-	decoded.operand = mSystem->Read(registers.PC++);
-	decoded.operandType = OT_Value;
+		uint16_t address = registers.PC + relativeAddress;
+		mPageCrossed = (registers.PC & 0xFF00) != (address & 0xFF00);
 
-	return decoded;
+		return address;
+	}
 }
 
-CPU::DecodedOperand CPU::fetch_zeropage()
+template <CPU::AddressingMode Mode, auto Op>
+constexpr CPU::OpEntry CPU::MakeEntry(uint8_t cycles)
 {
-	SPDLOG_INFO("{}", __func__);
-	DecodedOperand decoded;
-
-	decoded.operand = mSystem->Read(registers.PC++);
-	decoded.operandType = OT_Address;
+	BlockEnd blockEnd = BE_Continue;
+	if constexpr (IsOp<Op, &CPU::BRK>() || IsOp<Op, &CPU::ILL>())
+	{
+		blockEnd = BE_Before;
+	}
+	else if constexpr (Mode == AM_Relative || IsOp<Op, &CPU::JMP>() || IsOp<Op, &CPU::JSR>() || IsOp<Op, &CPU::RTS>() || IsOp<Op, &CPU::RTI>())
+	{
+		blockEnd = BE_After;
+	}
 
-	return decoded;
+	return { &CPU::Exec<Mode, Op>, &CPU::ExecDecoded<Mode, Op>, cycles, GetInstructionLength(Mode), blockEnd, Mode };
 }
 
-CPU::DecodedOperand CPU::fetch_zeropage_X()
+constexpr std::array<CPU::OpEntry, 256> CPU::BuildOpTable()
 {
-	SPDLOG_INFO("{}", __func__);
-	DecodedOperand decoded;
+	std::array<OpEntry, 256> table{};
+	table.fill(MakeEntry<AM_Implied, &CPU::ILL>(2));
 
-	decoded.operand = mSystem->Read(registers.PC++) + registers.IX;
-	decoded.operandType = OT_Address;
+	// Cycle counts from https://www.masswerk.at/6502/6502_instruction_set.html.
+	// Reads using indexed addressing take an extra cycle when indexing crosses
+	// a page boundary, which is added in CPU::ExecDecoded(). Writes and
+	// read-modify-writes always take that cycle, so it's part of their count.
+	// Taken branches are handled in CPU::Branch().
+	auto add = [&table](Opcodes opcode, OpEntry entry)
+	{
+		table[static_cast<uint8_t>(opcode)] = entry;
+	};
 
-	return decoded;
-}
+	add(Opcodes::ADC_immediate, MakeEntry<AM_Immediate, &CPU::ADC>(2));
+	add(Opcodes::ADC_zeropage, MakeEntry<AM_ZeroPage, &CPU::ADC>(3));
+	add(Opcodes::ADC_zeropage_X, MakeEntry<AM_ZeroPageX, &CPU::ADC>(4));
+	add(Opcodes::ADC_absolute, MakeEntry<AM_Absolute, &CPU::ADC>(4));
+	add(Opcodes::ADC_absolute_X, MakeEntry<AM_AbsoluteX, &CPU::ADC>(4));
+	add(Opcodes::ADC_absolute_Y, MakeEntry<AM_AbsoluteY, &CPU::ADC>(4));
+	add(Opcodes::ADC_indirect_X, MakeEntry<AM_IndirectX, &CPU::ADC>(6));
+	add(Opcodes::ADC_indirect_Y, MakeEntry<AM_IndirectY, &CPU::ADC>(5));
 
-CPU::DecodedOperand CPU::fetch_zeropage_Y()
-{
-	SPDLOG_INFO("{}", __func__);
-	DecodedOperand decoded;
+	add(Opcodes::AND_immediate, MakeEntry<AM_Immediate, &CPU::AND>(2));
+	add(Opcodes::AND_zeropage, MakeEntry<AM_ZeroPage, &CPU::AND>(3));
+	add(Opcodes::AND_zeropage_X, MakeEntry<AM_ZeroPageX, &CPU::AND>(4));
+	add(Opcodes::AND_absolute, MakeEntry<AM_Absolute, &CPU::AND>(4));
+	add(Opcodes::AND_absolute_X, MakeEntry<AM_AbsoluteX, &CPU::AND>(4));
+	add(Opcodes::AND_absolute_Y, MakeEntry<AM_AbsoluteY, &CPU::AND>(4));
+	add(Opcodes::AND_indirect_X, MakeEntry<AM_IndirectX, &CPU::AND>(6));
+	add(Opcodes::AND_indirect_Y, MakeEntry<AM_IndirectY, &CPU::AND>(5));
 
-	decoded.operand = mSystem->Read(registers.PC++) + registers.IY;
-	decoded.operandType = OT_Address;
+	add(Opcodes::ASL_accumulator, MakeEntry<AM_Accumulator, &CPU::ASL>(2));
+	add(Opcodes::ASL_zeropage, MakeEntry<AM_ZeroPage, &CPU::ASL>(5));
+	add(Opcodes::ASL_zeropage_X, MakeEntry<AM_ZeroPageX, &CPU::ASL>(6));
+	add(Opcodes::ASL_absolute, MakeEntry<AM_Absolute, &CPU::ASL>(6));
+	add(Opcodes::ASL_absolute_X, MakeEntry<AM_AbsoluteX, &CPU::ASL>(7));
 
-	return decoded;
-}
+	add(Opcodes::BCC_relative, MakeEntry<AM_Relative, &CPU::BCC>(2));
 
-CPU::DecodedOperand CPU::fetch_absolute()
-{
-	SPDLOG_INFO("{}", __func__);
+	add(Opcodes::BCS_relative, MakeEntry<AM_Relative, &CPU::BCS>(2));
 
-	DecodedOperand decoded;
+	add(Opcodes::BEQ_relative, MakeEntry<AM_Relative, &CPU::BEQ>(2));
 
-	uint16_t lo = mSystem->Read(registers.PC++);
-	uint16_t hi = mSystem->Read(registers.PC++);
+	add(Opcodes::BIT_zeropage, MakeEntry<AM_ZeroPage, &CPU::BIT>(3));
+	add(Opcodes::BIT_absolute, MakeEntry<AM_Absolute, &CPU::BIT>(4));
 
-	decoded.operand = lo | hi << 8;
-	decoded.operandType = OT_Address;
+	add(Opcodes::BMI_relative, MakeEntry<AM_Relative, &CPU::BMI>(2));
 
-	return decoded;
-}
+	add(Opcodes::BNE_relative, MakeEntry<AM_Relative, &CPU::BNE>(2));
+
+	add(Opcodes::BPL_relative, MakeEntry<AM_Relative, &CPU::BPL>(2));
 
-CPU::DecodedOperand CPU::fetch_absolute_X()
-{
-	SPDLOG_INFO("{}", __func__);
-	DecodedOperand decoded;
+	add(Opcodes::BRK, MakeEntry<AM_Implied, &CPU::BRK>(7));
 
-	uint16_t lo = mSystem->Read(registers.PC++);
-	uint16_t hi = mSystem->Read(registers.PC++);
+	add(Opcodes::BVC_relative, MakeEntry<AM_Relative, &CPU::BVC>(2));
 
-	uint8_t baseAddress = lo | hi << 8;
-	decoded.operand = baseAddress + registers.IX;
-	decoded.operandType = OT_Address;
+	add(Opcodes::BVS_relative, MakeEntry<AM_Relative, &CPU::BVS>(2));
 
-	return decoded;
-}
+	add(Opcodes::CLC, MakeEntry<AM_Implied, &CPU::CLC>(2));
 
-CPU::DecodedOperand CPU::fetch_absolute_Y()
-{
-	SPDLOG_INFO("{}", __func__);
-	DecodedOperand decoded;
+	add(Opcodes::CLD, MakeEntry<AM_Implied, &CPU::CLD>(2));
+
+	add(Opcodes::CLI, MakeEntry<AM_Implied, &CPU::CLI>(2));
+
+	add(Opcodes::CLV, MakeEntry<AM_Implied, &CPU::CLV>(2));
+
+	add(Opcodes::CMP_immediate, MakeEntry<AM_Immediate, &CPU::CMP>(2));
+	add(Opcodes::CMP_zeropage, MakeEntry<AM_ZeroPage, &CPU::CMP>(3));
+	add(Opcodes::CMP_zeropage_X, MakeEntry<AM_ZeroPageX, &CPU::CMP>(4));
+	add(Opcodes::CMP_absolute, MakeEntry<AM_Absolute, &CPU::CMP>(4));
+	add(Opcodes::CMP_absolute_X, MakeEntry<AM_AbsoluteX, &CPU::CMP>(4));
+	add(Opcodes::CMP_absolute_Y, MakeEntry<AM_AbsoluteY, &CPU::CMP>(4));
+	add(Opcodes::CMP_indirect_X, MakeEntry<AM_IndirectX, &CPU::CMP>(6));
+	add(Opcodes::CMP_indirect_Y, MakeEntry<AM_IndirectY, &CPU::CMP>(5));
+
+	add(Opcodes::CPX_immediate, MakeEntry<AM_Immediate, &CPU::CPX>(2));
+	add(Opcodes::CPX_zeropage, MakeEntry<AM_ZeroPage, &CPU::CPX>(3));
+	add(Opcodes::CPX_absolute, MakeEntry<AM_Absolute, &CPU::CPX>(4));
+
+	add(Opcodes::CPY_immediate, MakeEntry<AM_Immediate, &CPU::CPY>(2));
+	add(Opcodes::CPY_zeropage, MakeEntry<AM_ZeroPage, &CPU::CPY>(3));
+	add(Opcodes::CPY_absolute, MakeEntry<AM_Absolute, &CPU::CPY>(4));
+
+	add(Opcodes::DEC_zeropage, MakeEntry<AM_ZeroPage, &CPU::DEC>(5));
+	add(Opcodes::DEC_zeropage_X, MakeEntry<AM_ZeroPageX, &CPU::DEC>(6));
+	add(Opcodes::DEC_absolute, MakeEntry<AM_Absolute, &CPU::DEC>(6));
+	add(Opcodes::DEC_absolute_X, MakeEntry<AM_AbsoluteX, &CPU::DEC>(7));
+
+	add(Opcodes::DEX, MakeEntry<AM_Implied, &CPU::DEX>(2));
+	add(Opcodes::DEY, MakeEntry<AM_Implied, &CPU::DEY>(2));
+
+	add(Opcodes::EOR_immediate, MakeEntry<AM_Immediate, &CPU::EOR>(2));
+	add(Opcodes::EOR_zeropage, MakeEntry<AM_ZeroPage, &CPU::EOR>(3));
+	add(Opcodes::EOR_zeropage_X, MakeEntry<AM_ZeroPageX, &CPU::EOR>(4));
+	add(Opcodes::EOR_absolute, MakeEntry<AM_Absolute, &CPU::EOR>(4));
+	add(Opcodes::EOR_absolute_X, MakeEntry<AM_AbsoluteX, &CPU::EOR>(4));
+	add(Opcodes::EOR_absolute_Y, MakeEntry<AM_AbsoluteY, &CPU::EOR>(4));
+	add(Opcodes::EOR_indirect_X, MakeEntry<AM_IndirectX, &CPU::EOR>(6));
+	add(Opcodes::EOR_indirect_Y, MakeEntry<AM_IndirectY, &CPU::EOR>(5));
+
+	add(Opcodes::INC_zeropage, MakeEntry<AM_ZeroPage, &CPU::INC>(5));
+	add(Opcodes::INC_zeropage_X, MakeEntry<AM_ZeroPageX, &CPU::INC>(6));
+	add(Opcodes::INC_absolute, MakeEntry<AM_Absolute, &CPU::INC>(6));
+	add(Opcodes::INC_absolute_X, MakeEntry<AM_AbsoluteX, &CPU::INC>(7));
+
+	add(Opcodes::INX, MakeEntry<AM_Implied, &CPU::INX>(2));
+
+	add(Opcodes::INY, MakeEntry<AM_Implied, &CPU::INY>(2));
+
+	add(Opcodes::JMP_absolute, MakeEntry<AM_Absolute, &CPU::JMP>(3));
+	add(Opcodes::JMP_indirect, MakeEntry<AM_Indirect, &CPU::JMP>(5));
+
+	add(Opcodes::JSR, MakeEntry<AM_Absolute, &CPU::JSR>(6));
+
+	add(Opcodes::LDA_immediate, MakeEntry<AM_Immediate, &CPU::LDA>(2));
+	add(Opcodes::LDA_zeropage, MakeEntry<AM_ZeroPage, &CPU::LDA>(3));
+	add(Opcodes::LDA_zeropage_X, MakeEntry<AM_ZeroPageX, &CPU::LDA>(4));
+	add(Opcodes::LDA_absolute, MakeEntry<AM_Absolute, &CPU::LDA>(4));
+	add(Opcodes::LDA_absolute_X, MakeEntry<AM_AbsoluteX, &CPU::LDA>(4));
+	add(Opcodes::LDA_absolute_Y, MakeEntry<AM_AbsoluteY, &CPU::LDA>(4));
+	add(Opcodes::LDA_indirect_X, MakeEntry<AM_IndirectX, &CPU::LDA>(6));
+	add(Opcodes::LDA_indirect_Y, MakeEntry<AM_IndirectY, &CPU::LDA>(5));
+
+	add(Opcodes::LDX_immediate, MakeEntry<AM_Immediate, &CPU::LDX>(2));
+	add(Opcodes::LDX_zeropage, MakeEntry<AM_ZeroPage, &CPU::LDX>(3));
+	add(Opcodes::LDX_zeropage_Y, MakeEntry<AM_ZeroPageY, &CPU::LDX>(4));
+	add(Opcodes::LDX_absolute, MakeEntry<AM_Absolute, &CPU::LDX>(4));
+	add(Opcodes::LDX_absolute_Y, MakeEntry<AM_AbsoluteY, &CPU::LDX>(4));
+
+	add(Opcodes::LDY_immediate, MakeEntry<AM_Immediate, &CPU::LDY>(2));
+	add(Opcodes::LDY_zeropage, MakeEntry<AM_ZeroPage, &CPU::LDY>(3));
+	add(Opcodes::LDY_zeropage_X, MakeEntry<AM_ZeroPageX, &CPU::LDY>(4));
+	add(Opcodes::LDY_absolute, MakeEntry<AM_Absolute, &CPU::LDY>(4));
+	add(Opcodes::LDY_absolute_X, MakeEntry<AM_AbsoluteX, &CPU::LDY>(4));
+
+	add(Opcodes::LSR_accumulator, MakeEntry<AM_Accumulator, &CPU::LSR>(2));
+	add(Opcodes::LSR_zeropage, MakeEntry<AM_ZeroPage, &CPU::LSR>(5));
+	add(Opcodes::LSR_zeropage_X, MakeEntry<AM_ZeroPageX, &CPU::LSR>(6));
+	add(Opcodes::LSR_absolute, MakeEntry<AM_Absolute, &CPU::LSR>(6));
+	add(Opcodes::LSR_absolute_X, MakeEntry<AM_AbsoluteX, &CPU::LSR>(7));
+
+	add(Opcodes::NOP, MakeEntry<AM_Implied, &CPU::NOP>(2));
+
+	add(Opcodes::ORA_immediate, MakeEntry<AM_Immediate, &CPU::ORA>(2));
+	add(Opcodes::ORA_zeropage, MakeEntry<AM_ZeroPage, &CPU::ORA>(3));
+	add(Opcodes::ORA_zeropage_X, MakeEntry<AM_ZeroPageX, &CPU::ORA>(4));
+	add(Opcodes::ORA_absolute, MakeEntry<AM_Absolute, &CPU::ORA>(4));
+	add(Opcodes::ORA_absolute_X, MakeEntry<AM_AbsoluteX, &CPU::ORA>(4));
+	add(Opcodes::ORA_absolute_Y, MakeEntry<AM_AbsoluteY, &CPU::ORA>(4));
+	add(Opcodes::ORA_indirect_X, MakeEntry<AM_IndirectX, &CPU::ORA>(6));
+	add(Opcodes::ORA_indirect_Y, MakeEntry<AM_IndirectY, &CPU::ORA>(5));
+
+	add(Opcodes::PHA, MakeEntry<AM_Implied, &CPU::PHA>(3));
+
+	add(Opcodes::PHP, MakeEntry<AM_Implied, &CPU::PHP>(3));
+
+	add(Opcodes::PLA, MakeEntry<AM_Implied, &CPU::PLA>(4));
+
+	add(Opcodes::PLP, MakeEntry<AM_Implied, &CPU::PLP>(4));
+
+	add(Opcodes::ROL_accumulator, MakeEntry<AM_Accumulator, &CPU::ROL>(2));
+	add(Opcodes::ROL_zeropage, MakeEntry<AM_ZeroPage, &CPU::ROL>(5));
+	add(Opcodes::ROL_zeropage_X, MakeEntry<AM_ZeroPageX, &CPU::ROL>(6));
+	add(Opcodes::ROL_absolute, MakeEntry<AM_Absolute, &CPU::ROL>(6));
+	add(Opcodes::ROL_absolute_X, MakeEntry<AM_AbsoluteX, &CPU::ROL>(7));
+
+	add(Opcodes::ROR_accumulator, MakeEntry<AM_Accumulator, &CPU::ROR>(2));
+	add(Opcodes::ROR_zeropage, MakeEntry<AM_ZeroPage, &CPU::ROR>(5));
+	add(Opcodes::ROR_zeropage_X, MakeEntry<AM_ZeroPageX, &CPU::ROR>(6));
+	add(Opcodes::ROR_absolute, MakeEntry<AM_Absolute, &CPU::ROR>(6));
+	add(Opcodes::ROR_absolute_X, MakeEntry<AM_AbsoluteX, &CPU::ROR>(7));
+
+	add(Opcodes::RTI, MakeEntry<AM_Implied, &CPU::RTI>(6));
+
+	add(Opcodes::RTS, MakeEntry<AM_Implied, &CPU::RTS>(6));
+
+	add(Opcodes::SBC_immediate, MakeEntry<AM_Immediate, &CPU::SBC>(2));
+	add(Opcodes::SBC_zeropage, MakeEntry<AM_ZeroPage, &CPU::SBC>(3));
+	add(Opcodes::SBC_zeropage_X, MakeEntry<AM_ZeroPageX, &CPU::SBC>(4));
+	add(Opcodes::SBC_absolute, MakeEntry<AM_Absolute, &CPU::SBC>(4));
+	add(Opcodes::SBC_absolute_X, MakeEntry<AM_AbsoluteX, &CPU::SBC>(4));
+	add(Opcodes::SBC_absolute_Y, MakeEntry<AM_AbsoluteY, &CPU::SBC>(4));
+	add(Opcodes::SBC_indirect_X, MakeEntry<AM_IndirectX, &CPU::SBC>(6));
+	add(Opcodes::SBC_indirect_Y, MakeEntry<AM_IndirectY, &CPU::SBC>(5));
+
+	add(Opcodes::SEC, MakeEntry<AM_Implied, &CPU::SEC>(2));
+	add(Opcodes::SED, MakeEntry<AM_Implied, &CPU::SED>(2));
+	add(Opcodes::SEI, MakeEntry<AM_Implied, &CPU::SEI>(2));
+
+	add(Opcodes::STA_zeropage, MakeEntry<AM_ZeroPage, &CPU::STA>(3));
+	add(Opcodes::STA_zeropage_X, MakeEntry<AM_ZeroPageX, &CPU::STA>(4));
+	add(Opcodes::STA_absolute, MakeEntry<AM_Absolute, &CPU::STA>(4));
+	add(Opcodes::STA_absolute_X, MakeEntry<AM_AbsoluteX, &CPU::STA>(5));
+	add(Opcodes::STA_absolute_Y, MakeEntry<AM_AbsoluteY, &CPU::STA>(5));
+	add(Opcodes::STA_indirect_X, MakeEntry<AM_IndirectX, &CPU::STA>(6));
+	add(Opcodes::STA_indirect_Y, MakeEntry<AM_IndirectY, &CPU::STA>(6));
 
-	uint16_t lo = mSystem->Read(registers.PC++);
-	uint16_t hi = mSystem->Read(registers.PC++);
+	add(Opcodes::STX_zeropage, MakeEntry<AM_ZeroPage, &CPU::STX>(3));
+	add(Opcodes::STX_zeropage_Y, MakeEntry<AM_ZeroPageY, &CPU::STX>(4));
+	add(Opcodes::STX_absolute, MakeEntry<AM_Absolute, &CPU::STX>(4));
 
-	uint8_t baseAddress = lo | hi << 8;
-	decoded.operand = baseAddress + registers.IY;
-	decoded.operandType = OT_Address;
+	add(Opcodes::STY_zeropage, MakeEntry<AM_ZeroPage, &CPU::STY>(3));
+	add(Opcodes::STY_zeropage_X, MakeEntry<AM_ZeroPageX, &CPU::STY>(4));
+	add(Opcodes::STY_absolute, MakeEntry<AM_Absolute, &CPU::STY>(4));
 
-	return decoded;
+	add(Opcodes::TAX, MakeEntry<AM_Implied, &CPU::TAX>(2));
+	add(Opcodes::TAY, MakeEntry<AM_Implied, &CPU::TAY>(2));
+	add(Opcodes::TSX, MakeEntry<AM_Implied, &CPU::TSX>(2));
+	add(Opcodes::TXA, MakeEntry<AM_Implied, &CPU::TXA>(2));
+	add(Opcodes::TXS, MakeEntry<AM_Implied, &CPU::TXS>(2));
+	add(Opcodes::TYA, MakeEntry<AM_Implied, &CPU::TYA>(2));
+
+	return table;
 }
 
-CPU::DecodedOperand CPU::fetch_indirect()
-{
-	SPDLOG_INFO("{}", __func__);
+constexpr std::array<CPU::OpEntry, 256> CPU::kOpTable = CPU::BuildOpTable();
 
-	DecodedOperand decoded;
+CPU::CPU(System& system)
+	: mSystem(system)
+{
+}
 
-	uint16_t baseAddress_lo = mSystem->Read(registers.PC++);
-	uint16_t baseAddress_hi = mSystem->Read(registers.PC++);
+CPU::~CPU() = default;
 
-	uint16_t baseAddress = baseAddress_lo | baseAddress_hi << 8;
-	
-	uint16_t indirectAddress_lo = mSystem->Read(baseAddress);
-	uint16_t indirectAddress_hi = mSystem->Read(++baseAddress);
+void CPU::Reset()
+{
+	// Use uint16_t to ensure bit shifts don't wrap.
+	uint16_t PC_lo = mSystem.Read(0xFFFC);
+	uint16_t PC_hi = mSystem.Read(0xFFFD);
 
-	uint16_t indirectAddress = indirectAddress_lo | indirectAddress_hi << 8;
+	registers.PC = PC_lo | PC_hi << 8;
 
-	decoded.operand = indirectAddress;
-	decoded.operandType = OT_Address;
+	registers.SP = 0xFD;
 
-	return decoded;
+	mJammed = false;
+	mNMIPending = false;
 }
 
-CPU::DecodedOperand CPU::fetch_indirect_X()
+void CPU::SaveState(StateWriter& writer) const
 {
-	SPDLOG_INFO("{}", __func__);
+	writer.Write(registers.PC);
+	writer.Write(registers.SP);
+	writer.Write(registers.ACC);
+	writer.Write(registers.IX);
+	writer.Write(registers.IY);
+	writer.Write(GetStatus());
 
-	DecodedOperand decoded;
+	writer.Write(mCycles);
+	writer.Write(mJammed);
+	writer.Write(mNMIPending);
+	writer.Write(mIRQAsserted);
+}
 
-	// TODO: I have no idea if this is right, the description is a bit unclear...
-	uint8_t baseAddress = mSystem->Read(registers.PC++);
-	decoded.operand = mSystem->Read(baseAddress + registers.IX + (registers.PS & PS_CarryFlag));
-	decoded.operandType = OT_Address;
+void CPU::LoadState(StateReader& reader)
+{
+	reader.Read(registers.PC);
+	reader.Read(registers.SP);
+	reader.Read(registers.ACC);
+	reader.Read(registers.IX);
+	reader.Read(registers.IY);
+	uint8_t status = 0;
+	reader.Read(status);
+	SetStatus(status);
 
-	return decoded;
+	reader.Read(mCycles);
+	reader.Read(mJammed);
+	reader.Read(mNMIPending);
+	reader.Read(mIRQAsserted);
 }
 
-CPU::DecodedOperand CPU::fetch_indirect_Y()
+uint8_t CPU::GetStatus() const
 {
-	SPDLOG_INFO("{}", __func__);
+	uint8_t status = registers.PS & (PS_InterruptDisable | PS_DecimalMode | PS_BreakCommand | PS_Ignored);
 
-	DecodedOperand decoded;
+	status |= (mCarryResult >> 8) & PS_CarryFlag;
+	status |= mZResult == 0 ? PS_ZeroFlag : 0;
+	status |= (mOverflowResult >> 1) & PS_OverflowFlag;
+	status |= mNResult & PS_NegativeFlag;
 
-	// TODO: No idea if this is right, copied from fetch_indirect_X()...
-	uint8_t baseAddress = mSystem->Read(registers.PC++);
-	decoded.operand = mSystem->Read(baseAddress + registers.IY + (registers.PS & PS_CarryFlag));
-	decoded.operandType = OT_Address;
+	return status;
+}
 
-	return decoded;
+void CPU::SetStatus(uint8_t status)
+{
+	registers.PS = status & (PS_InterruptDisable | PS_DecimalMode | PS_BreakCommand | PS_Ignored);
+
+	mCarryResult = (status & PS_CarryFlag) << 8;
+	mZResult = (status & PS_ZeroFlag) ^ PS_ZeroFlag;
+	mOverflowResult = (status & PS_OverflowFlag) << 1;
+	mNResult = status & PS_NegativeFlag;
 }
 
-CPU::DecodedOperand CPU::fetch_accumulator()
+bool CPU::Process()
 {
-	SPDLOG_INFO("{}", __func__);
+	return Step();
+}
 
-	DecodedOperand decoded;
+bool CPU::RunCycles(uint64_t cycles)
+{
+	mRunUntilCycles = mCycles + cycles;
 
-	decoded.operand = registers.ACC;
-	decoded.operandType = OT_Value;
+	while (mCycles < mRunUntilCycles)
+	{
+		// Blocks never contain anything that halts, that's left to Step().
+		if (Block* block = FindBlock())
+		{
+			if (NativeFunc native = GetNativeCode(*block))
+			{
+				native(this);
+			}
+			else
+			{
+				RunBlock(*block);
+			}
+		}
+		else if (!Step())
+		{
+			return false;
+		}
+	}
 
-	return decoded;
+	return true;
 }
 
-CPU::DecodedOperand CPU::fetch_relative()
+CPU::Block* CPU::FindBlock()
 {
-	SPDLOG_INFO("{}", __func__);
+	if (!mBlockCacheEnabled || IsInterruptPending())
+	{
+		return nullptr;
+	}
 
-	DecodedOperand decoded;
+	if constexpr (kTraceEnabled)
+	{
+		if (mTraceSink)
+		{
+			return nullptr;
+		}
+	}
 
-	int16_t relativeAddress = mSystem->Read(registers.PC++);
-	if (relativeAddress > 0x80)
+	// Only ROM, writes to RAM would go unnoticed.
+	const uint8_t* page = mSystem.GetReadOnlyPage(registers.PC >> 8);
+	if (!page)
 	{
-		relativeAddress -= 0xFF;
+		return nullptr;
 	}
 
-	decoded.operand = registers.PC + relativeAddress;
-	decoded.operandType = OT_Address;
+	if (mBlocks.empty()) [[unlikely]]
+	{
+		mBlocks.resize(kBlockCacheSize);
+	}
+
+	Block& block = mBlocks[(registers.PC ^ (registers.PC >> 10)) & (kBlockCacheSize - 1)];
+	if (block.PC != registers.PC || block.page != page || block.generation != mBlockGeneration)
+	{
+		DecodeBlock(block, page);
+	}
 
-	return decoded;
+	return block.length > 0 ? &block : nullptr;
 }
 
-CPU::DecodedOperand CPU::fetch_implied()
+void CPU::DecodeBlock(Block& block, const uint8_t* page)
 {
-	SPDLOG_INFO("{}", __func__);
+	block.PC = registers.PC;
+	block.page = page;
+	block.generation = mBlockGeneration;
+	block.length = 0;
+	block.runs = 0;
+	block.native = nullptr;
+
+	size_t offset = registers.PC & 0xFF;
+
+	while (block.length < kMaxBlockLength)
+	{
+		Opcodes opcode = static_cast<Opcodes>(page[offset]);
+		const OpEntry& entry = kOpTable[page[offset]];
+
+		// The next page may not be the next bit of ROM, so instructions that
+		// run over into it are left to Step().
+		if (entry.blockEnd == BE_Before || offset + entry.length > 0x100)
+		{
+			break;
+		}
+
+		DecodedInstruction& instruction = block.instructions[block.length++];
+		instruction.func = entry.decodedFunc;
+		instruction.operandBytes = 0;
+		instruction.cycles = entry.cycles;
+		instruction.length = entry.length;
+		instruction.opcode = opcode;
+		instruction.mode = entry.mode;
+
+		if (entry.length > 1)
+		{
+			instruction.operandBytes = page[offset + 1];
+		}
+		if (entry.length > 2)
+		{
+			instruction.operandBytes |= page[offset + 2] << 8;
+		}
+
+		offset += entry.length;
+
+		if (entry.blockEnd == BE_After)
+		{
+			break;
+		}
+	}
+}
 
-	DecodedOperand decoded;
+void CPU::RunBlock(const Block& block)
+{
+	for (uint8_t i = 0; i < block.length; ++i)
+	{
+		const DecodedInstruction& instruction = block.instructions[i];
 
-	decoded.operand = 0;
-	decoded.operandType = OT_Value;
+		mCurrentOpcode = instruction.opcode;
+		registers.PC += instruction.length;
+		(this->*instruction.func)(instruction.operandBytes, instruction.cycles);
 
-	return decoded;
+		if (!CanContinueBlock(block))
+		{
+			return;
+		}
+	}
 }
 
-void CPU::ADC(DecodedOperand decoded)
+// Stop where Step() would have, or if the instruction switched the block's
+// bank out or otherwise changed ROM.
+bool CPU::CanContinueBlock(const Block& block) const
 {
-	SPDLOG_INFO("{}", __func__);
+	return mCycles < mRunUntilCycles && !IsInterruptPending() &&
+		block.generation == mBlockGeneration && mSystem.GetReadOnlyPage(block.PC >> 8) == block.page;
+}
 
-	uint8_t value = 0;
-	if (decoded.operandType == OT_Address)
+CPU::NativeFunc CPU::GetNativeCode(Block& block)
+{
+	if constexpr (!kJitEnabled)
 	{
-		value = mSystem->Read(decoded.operand);
+		return nullptr;
 	}
-	else
+
+	if (!mJitEnabled)
 	{
-		value = decoded.operand;
+		return nullptr;
 	}
 
-	uint16_t result = registers.ACC + value + (registers.PS & PS_CarryFlag);
-
-	SetProcessorStatus(PS_CarryFlag, result > 0xFF);
-	SetProcessorStatus(PS_ZeroFlag, (result & 0xFF) == 0);
+	if (block.native || ++block.runs < kJitThreshold)
+	{
+		return block.native;
+	}
 
-	bool lhsNeg = (registers.ACC & 0x80) == 0x80;
-	bool rhsNeg = (value & 0x80) == 0x80;
-	bool resultNeg = (result & 0x80) == 0x80;
+	if (!mJit)
+	{
+		mJit = std::make_unique<JIT>(*this, mSystem);
+	}
 
-	bool overflow = false;
-	if (lhsNeg && rhsNeg)
+	// When the code buffer is full everything compiled so far goes, and
+	// blocks that are still hot get compiled again.
+	block.native = mJit->Compile(block);
+	if (!block.native)
 	{
-		overflow = !resultNeg;
+		mJit->Reset();
+		for (Block& other : mBlocks)
+		{
+			other.native = nullptr;
+			other.runs = 0;
+		}
+
+		block.native = mJit->Compile(block);
+		if (!block.native)
+		{
+			SPDLOG_ERROR("Couldn't compile the block at {:#06x}, running without the JIT", block.PC);
+			mJitEnabled = false;
+		}
 	}
-	else if (!lhsNeg && !rhsNeg)
+
+	return block.native;
+}
+
+void CPU::Interrupt()
+{
+	uint16_t vector = 0xFFFE;
+	if (mNMIPending)
 	{
-		overflow = resultNeg;
+		mNMIPending = false;
+		vector = 0xFFFA;
 	}
-	SetProcessorStatus(PS_OverflowFlag, overflow);
 
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
+	mSystem.Write(0x100 + registers.SP--, registers.PC >> 8);
+	mSystem.Write(0x100 + registers.SP--, registers.PC & 0xFF);
+	mSystem.Write(0x100 + registers.SP--, (GetStatus() & ~PS_BreakCommand) | PS_Ignored);
 
-	registers.ACC = result & 0xFF;
+	SetProcessorStatus(PS_InterruptDisable, true);
+
+	// Use uint16_t to ensure bit shifts don't wrap.
+	uint16_t PC_lo = mSystem.Read(vector);
+	uint16_t PC_hi = mSystem.Read(vector + 1);
+	registers.PC = PC_lo | PC_hi << 8;
+
+	mCycles += 7;
 }
 
-void CPU::AND(DecodedOperand decoded)
+bool CPU::Step()
 {
-	SPDLOG_INFO("{}", __func__);
+	bool shouldContinue = true;
 
-	uint8_t value = 0;
-	if (decoded.operandType == OT_Address)
+	if (IsInterruptPending()) [[unlikely]]
 	{
-		value = mSystem->Read(decoded.operand);
+		Interrupt();
 	}
-	else
+
+	Opcodes opcode = static_cast<Opcodes>(mSystem.Read(registers.PC++));
+	mCurrentOpcode = opcode;
+	const OpEntry& entry = kOpTable[static_cast<uint8_t>(opcode)];
+
+	if constexpr (kTraceEnabled)
 	{
-		value = decoded.operand;
+		if (mTraceSink)
+		{
+			TraceInstruction(entry.length);
+		}
 	}
 
-	uint16_t result = registers.ACC & value;
+	(this->*entry.execFunc)(entry.cycles);
 
-	SetProcessorStatus(PS_ZeroFlag, (result & 0xFF) == 0x00);
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
+	if (opcode == Opcodes::BRK || mJammed)
+	{
+		shouldContinue = false;
+	}
 
-	registers.ACC = result & 0xFF;
+	return shouldContinue;
+}
+
+void CPU::TraceInstruction(uint8_t length)
+{
+	TraceRecord record;
+
+	// Only the opcode has been read so far.
+	const CPURegisters before = GetRegisters();
+
+	record.PC = before.PC - 1;
+	record.opcode = static_cast<uint8_t>(mCurrentOpcode);
+	record.length = length;
+
+	// Read the operand bytes here rather than adding tracing to every mode.
+	record.operand[0] = record.length > 1 ? mSystem.Read(record.PC + 1) : 0;
+	record.operand[1] = record.length > 2 ? mSystem.Read(record.PC + 2) : 0;
+
+	record.ACC = before.ACC;
+	record.IX = before.IX;
+	record.IY = before.IY;
+	record.PS = before.PS;
+	record.SP = before.SP;
+	record.cycles = mCycles;
+
+	mTraceSink->Push(record);
 }
 
-void CPU::ASL(DecodedOperand decoded)
+template <CPU::AddressingMode Mode>
+uint8_t CPU::ReadOperand(uint16_t operand)
 {
-	SPDLOG_INFO("{}", __func__);
-	uint8_t value = 0;
-	if (decoded.operandType == OT_Address)
+	if constexpr (Mode == AM_Immediate)
 	{
-		value = mSystem->Read(decoded.operand);
+		return static_cast<uint8_t>(operand);
+	}
+	else if constexpr (Mode == AM_Accumulator)
+	{
+		return registers.ACC;
 	}
 	else
 	{
-		value = decoded.operand;
+		return mSystem.Read(operand);
 	}
+}
 
-	uint16_t result = value << 1;
-
-	SetProcessorStatus(PS_CarryFlag, result > 0xFF);
-	SetProcessorStatus(PS_ZeroFlag, (result & 0xFF) == 0x00);
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
-
-	if (decoded.operandType == OT_Address)
+template <CPU::AddressingMode Mode>
+void CPU::WriteOperand(uint16_t operand, uint8_t value)
+{
+	if constexpr (Mode == AM_Accumulator)
 	{
-		mSystem->Write(decoded.operand, result & 0xFF);
+		registers.ACC = value;
 	}
 	else
 	{
-		registers.ACC = result & 0xFF;
+		mSystem.Write(operand, value);
 	}
 }
 
-void CPU::BCC(DecodedOperand decoded)
+template <CPU::AddressingMode Mode, auto Op>
+void CPU::Exec(uint8_t cycles)
 {
-	SPDLOG_INFO("{}", __func__);
-	if (!GetProcessorStatus(PS_CarryFlag))
-	{
-		registers.PC = decoded.operand;
-	}
+	ExecDecoded<Mode, Op>(FetchOperandBytes<Mode>(), cycles);
 }
 
-void CPU::BCS(DecodedOperand decoded)
+// The kind of op is known from its signature: reads take the operand's value,
+// read-modify-writes return the value to write back, and the rest take the
+// address or nothing at all.
+template <CPU::AddressingMode Mode, auto Op>
+void CPU::ExecDecoded(uint16_t operandBytes, uint8_t cycles)
 {
-	SPDLOG_INFO("{}", __func__);
-	if (GetProcessorStatus(PS_CarryFlag))
+	using OpType = decltype(Op);
+
+	uint16_t operand = GetOperand<Mode>(operandBytes);
+	mCurrentOperand = operand;
+
+	mCycles += cycles;
+
+	if constexpr (std::is_same_v<OpType, void (CPU::*)(uint8_t)>)
+	{
+		if constexpr (Mode == AM_AbsoluteX || Mode == AM_AbsoluteY || Mode == AM_IndirectY)
+		{
+			mCycles += mPageCrossed;
+		}
+
+		(this->*Op)(ReadOperand<Mode>(operand));
+	}
+	else if constexpr (std::is_same_v<OpType, uint8_t (CPU::*)(uint8_t)>)
+	{
+		WriteOperand<Mode>(operand, (this->*Op)(ReadOperand<Mode>(operand)));
+	}
+	else if constexpr (std::is_same_v<OpType, void (CPU::*)(uint16_t)>)
+	{
+		(this->*Op)(operand);
+	}
+	else
 	{
-		registers.PC = decoded.operand;
+		static_assert(std::is_same_v<OpType, void (CPU::*)()>);
+		(this->*Op)();
 	}
 }
 
-void CPU::BEQ(DecodedOperand decoded)
+// Subtraction is an add of the inverted operand, with carry meaning no
+// borrow. Compares subtract without the incoming borrow and leave V alone.
+template <CPU::AluOperation Operation>
+uint8_t CPU::Alu(uint8_t lhs, uint8_t value)
 {
-	SPDLOG_INFO("{}", __func__);
-	if (GetProcessorStatus(PS_ZeroFlag))
+	uint16_t carry = mCarryResult >> 8;
+	if constexpr (Operation != AO_Add)
 	{
-		registers.PC = decoded.operand;
+		value = ~value;
 	}
+	if constexpr (Operation == AO_Compare)
+	{
+		carry = 1;
+	}
+
+	uint16_t result = lhs + value + carry;
+
+	// Overflow when both inputs have the same sign and the result doesn't.
+	if constexpr (Operation != AO_Compare)
+	{
+		mOverflowResult = (lhs ^ result) & (value ^ result);
+	}
+	mCarryResult = result;
+	SetZeroNegative(result & 0xFF);
+
+	return result & 0xFF;
 }
 
-void CPU::BIT(DecodedOperand decoded)
+void CPU::ADC(uint8_t value)
 {
-	SPDLOG_INFO("{}", __func__);
+	registers.ACC = Alu<AO_Add>(registers.ACC, value);
+}
+
+void CPU::AND(uint8_t value)
+{
+	uint16_t result = registers.ACC & value;
 
-	// This is only supported with Absolute and Zero Page addressing.
-	uint8_t result = mSystem->Read(decoded.operand);
-	result = registers.ACC & result;
+	SetZeroNegative(result & 0xFF);
 
-	SetProcessorStatus(PS_ZeroFlag, result == 0x00);
-	SetProcessorStatus(PS_OverflowFlag, (result & 0x40) == 0x40);
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
+	registers.ACC = result & 0xFF;
 }
 
-void CPU::BMI(DecodedOperand decoded)
+uint8_t CPU::ASL(uint8_t value)
 {
-	SPDLOG_INFO("{}", __func__);
-	if (GetProcessorStatus(PS_NegativeFlag))
-	{
-		registers.PC = decoded.operand;
-	}
+	uint16_t result = value << 1;
+
+	mCarryResult = result;
+	SetZeroNegative(result & 0xFF);
+
+	return result & 0xFF;
 }
 
-void CPU::BNE(DecodedOperand decoded)
+void CPU::Branch(bool condition, uint16_t target)
 {
-	SPDLOG_INFO("{}", __func__);
-	if (!GetProcessorStatus(PS_ZeroFlag))
+	if (condition)
 	{
-		registers.PC = decoded.operand;
+		// Taken branches cost a cycle, and another if the target is on a
+		// different page (see fetch_relative()).
+		mCycles += mPageCrossed ? 2 : 1;
+		registers.PC = target;
 	}
 }
 
-void CPU::BPL(DecodedOperand decoded)
+void CPU::BCC(uint16_t address)
 {
-	SPDLOG_INFO("{}", __func__);
-	if (!GetProcessorStatus(PS_NegativeFlag))
-	{
-		registers.PC = decoded.operand;
-	}
+	Branch(!(mCarryResult & 0x100), address);
 }
 
-void CPU::BRK(DecodedOperand decoded)
+void CPU::BCS(uint16_t address)
 {
-	// For now, this will halt execution. See CPU::Process().
-	SPDLOG_INFO("{}", __func__);
+	Branch(mCarryResult & 0x100, address);
 }
 
-void CPU::BVC(DecodedOperand decoded)
+void CPU::BEQ(uint16_t address)
 {
-	SPDLOG_INFO("{}", __func__);
-	if (!GetProcessorStatus(PS_OverflowFlag))
-	{
-		registers.PC = decoded.operand;
-	}
+	Branch(mZResult == 0, address);
 }
 
-void CPU::BVS(DecodedOperand decoded)
+void CPU::BIT(uint8_t value)
 {
-	SPDLOG_INFO("{}", __func__);
-	if (GetProcessorStatus(PS_OverflowFlag))
-	{
-		registers.PC = decoded.operand;
-	}
+	// N and V are copied from the operand, Z is from the AND with the
+	// accumulator.
+	mZResult = registers.ACC & value;
+	mNResult = value;
+	mOverflowResult = value << 1;
 }
 
-void CPU::CLC(DecodedOperand decoded)
+void CPU::BMI(uint16_t address)
 {
-	SPDLOG_INFO("{}", __func__);
-	SetProcessorStatus(PS_CarryFlag, false);
+	Branch(mNResult & 0x80, address);
 }
 
-void CPU::CLD(DecodedOperand decoded)
+void CPU::BNE(uint16_t address)
 {
-	SPDLOG_INFO("{}", __func__);
-	SetProcessorStatus(PS_DecimalMode, false);
+	Branch(mZResult != 0, address);
 }
 
-void CPU::CLI(DecodedOperand decoded)
+void CPU::BPL(uint16_t address)
 {
-	SPDLOG_INFO("{}", __func__);
-	SetProcessorStatus(PS_InterruptDisable, false);
+	Branch(!(mNResult & 0x80), address);
 }
 
-void CPU::CLV(DecodedOperand decoded)
+void CPU::BRK()
 {
-	SPDLOG_INFO("{}", __func__);
-	SetProcessorStatus(PS_OverflowFlag, false);
+	// For now, this will halt execution. See CPU::Process().
 }
 
-void CPU::CMP(DecodedOperand decoded)
+void CPU::BVC(uint16_t address)
 {
-	SPDLOG_INFO("{}", __func__);
-	uint8_t value = 0;
-	if (decoded.operandType == OT_Address)
-	{
-		value = mSystem->Read(decoded.operand);
-	}
-	else
-	{
-		value = decoded.operand;
-	}
-	uint16_t result = registers.ACC - value;
+	Branch(!(mOverflowResult & 0x80), address);
+}
 
-	SetProcessorStatus(PS_CarryFlag, result >= 0);
-	SetProcessorStatus(PS_ZeroFlag, result == 0);
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
+void CPU::BVS(uint16_t address)
+{
+	Branch(mOverflowResult & 0x80, address);
 }
 
-void CPU::CPX(DecodedOperand decoded)
+void CPU::CLC()
 {
-	SPDLOG_INFO("{}", __func__);
-	uint8_t value = 0;
-	if (decoded.operandType == OT_Address)
-	{
-		value = mSystem->Read(decoded.operand);
-	}
-	else
-	{
-		value = decoded.operand;
-	}
-	uint16_t result = registers.IX - value;
+	mCarryResult = 0;
+}
 
-	SetProcessorStatus(PS_CarryFlag, result >= 0);
-	SetProcessorStatus(PS_ZeroFlag, result == 0);
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
+void CPU::CLD()
+{
+	SetProcessorStatus(PS_DecimalMode, false);
 }
 
-void CPU::CPY(DecodedOperand decoded)
+void CPU::CLI()
 {
-	SPDLOG_INFO("{}", __func__);
-	uint8_t value = 0;
-	if (decoded.operandType == OT_Address)
-	{
-		value = mSystem->Read(decoded.operand);
-	}
-	else
-	{
-		value = decoded.operand;
-	}
-	uint16_t result = registers.IY - value;
+	SetProcessorStatus(PS_InterruptDisable, false);
+}
 
-	SetProcessorStatus(PS_CarryFlag, result >= 0);
-	SetProcessorStatus(PS_ZeroFlag, result == 0);
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
+void CPU::CLV()
+{
+	mOverflowResult = 0;
 }
 
-void CPU::DEC(DecodedOperand decoded)
+void CPU::CMP(uint8_t value)
 {
-	SPDLOG_INFO("{}", __func__);
-	uint8_t result = mSystem->Read(decoded.operand);
-	--result;
+	Alu<AO_Compare>(registers.ACC, value);
+}
 
-	SetProcessorStatus(PS_ZeroFlag, (result & 0xFF) == 0);
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
+void CPU::CPX(uint8_t value)
+{
+	Alu<AO_Compare>(registers.IX, value);
+}
 
-	mSystem->Write(decoded.operand, result & 0xFF);
+void CPU::CPY(uint8_t value)
+{
+	Alu<AO_Compare>(registers.IY, value);
 }
 
-void CPU::DEX(DecodedOperand decoded)
+uint8_t CPU::DEC(uint8_t value)
+{
+	uint8_t result = value - 1;
+
+	SetZeroNegative(result);
+
+	return result;
+}
+
+void CPU::DEX()
 {
-	SPDLOG_INFO("{}", __func__);
 	uint8_t result = registers.IX - 1;
 
-	SetProcessorStatus(PS_ZeroFlag, (result & 0xFF) == 0);
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
+	SetZeroNegative(result & 0xFF);
 
 	registers.IX = result;
 }
 
-void CPU::DEY(DecodedOperand decoded)
+void CPU::DEY()
 {
-	SPDLOG_INFO("{}", __func__);
 	uint8_t result = registers.IY - 1;
 
-	SetProcessorStatus(PS_ZeroFlag, (result & 0xFF) == 0);
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
+	SetZeroNegative(result & 0xFF);
 
 	registers.IY = result;
 }
 
-void CPU::EOR(DecodedOperand decoded)
+void CPU::EOR(uint8_t value)
 {
-	SPDLOG_INFO("{}", __func__);
-
-	uint8_t value = 0;
-	if (decoded.operandType == OT_Address)
-	{
-		value = mSystem->Read(decoded.operand);
-	}
-	else
-	{
-		value = decoded.operand;
-	}
-
 	uint16_t result = registers.ACC ^ value;
 
-	SetProcessorStatus(PS_ZeroFlag, (result & 0xFF) == 0x00);
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
+	SetZeroNegative(result & 0xFF);
 
 	registers.ACC = result & 0xFF;
 }
 
-void CPU::INC(DecodedOperand decoded)
+uint8_t CPU::INC(uint8_t value)
 {
-	SPDLOG_INFO("{}", __func__);
-	uint8_t result = mSystem->Read(decoded.operand);
-	++result;
+	uint8_t result = value + 1;
 
-	SetProcessorStatus(PS_ZeroFlag, (result & 0xFF) == 0);
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
+	SetZeroNegative(result);
 
-	mSystem->Write(decoded.operand, result & 0xFF);
+	return result;
 }
 
-void CPU::INX(DecodedOperand decoded)
+void CPU::INX()
 {
-	SPDLOG_INFO("{}", __func__);
 	uint8_t result = registers.IX + 1;
 
-	SetProcessorStatus(PS_ZeroFlag, (result & 0xFF) == 0);
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
+	SetZeroNegative(result & 0xFF);
 
 	registers.IX = result;
 }
 
-void CPU::INY(DecodedOperand decoded)
+void CPU::INY()
 {
-	SPDLOG_INFO("{}", __func__);
 	uint8_t result = registers.IY + 1;
 
-	SetProcessorStatus(PS_ZeroFlag, (result & 0xFF) == 0);
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
+	SetZeroNegative(result & 0xFF);
 
 	registers.IY = result;
 }
 
-void CPU::JMP(DecodedOperand decoded)
+void CPU::JMP(uint16_t address)
 {
-	SPDLOG_INFO("{}", __func__);
-	registers.PC = decoded.operand;
+	registers.PC = address;
 }
 
-void CPU::JSR(DecodedOperand decoded)
+void CPU::JSR(uint16_t address)
 {
-	SPDLOG_INFO("{}", __func__);
-
-	mSystem->Write(0x100 + registers.SP--, (registers.PC) >> 8);
-	mSystem->Write(0x100 + registers.SP--, (registers.PC) & 0xFF);
+	mSystem.Write(0x100 + registers.SP--, (registers.PC) >> 8);
+	mSystem.Write(0x100 + registers.SP--, (registers.PC) & 0xFF);
 
-	registers.PC = decoded.operand;
+	registers.PC = address;
 }
 
-void CPU::LDA(DecodedOperand decoded)
+void CPU::LDA(uint8_t value)
 {
-	SPDLOG_INFO("{}", __func__);
-
-	uint8_t value = 0;
-	if (decoded.operandType == OT_Address)
-	{
-		value = mSystem->Read(decoded.operand);
-	}
-	else
-	{
-		value = decoded.operand;
-	}
-
-	SetProcessorStatus(PS_ZeroFlag, (value & 0xFF) == 0);
-	SetProcessorStatus(PS_NegativeFlag, (value & 0x80) == 0x80);
+	SetZeroNegative(value & 0xFF);
 
 	registers.ACC = value;
 }
 
-void CPU::LDX(DecodedOperand decoded)
+void CPU::LDX(uint8_t value)
 {
-	SPDLOG_INFO("{}", __func__);
-
-	uint8_t value = 0;
-	if (decoded.operandType == OT_Address)
-	{
-		value = mSystem->Read(decoded.operand);
-	}
-	else
-	{
-		value = decoded.operand;
-	}
-
-	SetProcessorStatus(PS_ZeroFlag, (value & 0xFF) == 0);
-	SetProcessorStatus(PS_NegativeFlag, (value & 0x80) == 0x80);
+	SetZeroNegative(value & 0xFF);
 
 	registers.IX = value;
 }
 
-void CPU::LDY(DecodedOperand decoded)
+void CPU::LDY(uint8_t value)
 {
-	SPDLOG_INFO("{}", __func__);
-
-	uint8_t value = 0;
-	if (decoded.operandType == OT_Address)
-	{
-		value = mSystem->Read(decoded.operand);
-	}
-	else
-	{
-		value = decoded.operand;
-	}
-
-	SetProcessorStatus(PS_ZeroFlag, (value & 0xFF) == 0);
-	SetProcessorStatus(PS_NegativeFlag, (value & 0x80) == 0x80);
+	SetZeroNegative(value & 0xFF);
 
 	registers.IY = value;
 }
 
-void CPU::LSR(DecodedOperand decoded)
+uint8_t CPU::LSR(uint8_t value)
 {
-	SPDLOG_INFO("{}", __func__);
-	uint8_t value = 0;
-	if (decoded.operandType == OT_Address)
-	{
-		value = mSystem->Read(decoded.operand);
-	}
-	else
-	{
-		value = decoded.operand;
-	}
-
-	SetProcessorStatus(PS_CarryFlag, (value & 0x01) == 0x01);
+	mCarryResult = (value & 0x01) << 8;
 
 	uint16_t result = value >> 1;
 
-	SetProcessorStatus(PS_ZeroFlag, (result & 0xFF) == 0x00);
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
+	SetZeroNegative(result & 0xFF);
 
-	if (decoded.operandType == OT_Address)
-	{
-		mSystem->Write(decoded.operand, result & 0xFF);
-	}
-	else
-	{
-		registers.ACC = result & 0xFF;
-	}
+	return result & 0xFF;
 }
 
-void CPU::NOP(DecodedOperand decoded)
+void CPU::NOP()
 {
-	SPDLOG_INFO("{}", __func__);
 }
 
-void CPU::ORA(DecodedOperand decoded)
+void CPU::ORA(uint8_t value)
 {
-	SPDLOG_INFO("{}", __func__);
-	uint8_t value = 0;
-	if (decoded.operandType == OT_Address)
-	{
-		value = mSystem->Read(decoded.operand);
-	}
-	else
-	{
-		value = decoded.operand;
-	}
-
 	uint8_t result = registers.ACC | (value & 0xFF);
 
-	SetProcessorStatus(PS_ZeroFlag, (result & 0xFF) == 0);
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
+	SetZeroNegative(result & 0xFF);
 
 	registers.ACC = result;
 }
 
-void CPU::PHA(DecodedOperand decoded)
+void CPU::PHA()
 {
-	SPDLOG_INFO("{}", __func__);
-	mSystem->Write(0x100 + registers.SP--, registers.ACC);
+	mSystem.Write(0x100 + registers.SP--, registers.ACC);
 }
 
-void CPU::PHP(DecodedOperand decoded)
+void CPU::PHP()
 {
-	SPDLOG_INFO("{}", __func__);
-	mSystem->Write(0x100 + registers.SP--, registers.PS);
+	mSystem.Write(0x100 + registers.SP--, GetStatus());
 }
 
-void CPU::PLA(DecodedOperand decoded)
+void CPU::PLA()
 {
-	SPDLOG_INFO("{}", __func__);
-	registers.ACC = mSystem->Read(0x100 + ++registers.SP);
+	registers.ACC = mSystem.Read(0x100 + ++registers.SP);
 }
 
-void CPU::PLP(DecodedOperand decoded)
+void CPU::PLP()
 {
-	SPDLOG_INFO("{}", __func__);
-	registers.PS = mSystem->Read(0x100 + ++registers.SP);
+	SetStatus(mSystem.Read(0x100 + ++registers.SP));
 }
 
-void CPU::ROL(DecodedOperand decoded)
+uint8_t CPU::ROL(uint8_t value)
 {
-	SPDLOG_INFO("{}", __func__);
-	uint8_t value = 0;
-	if (decoded.operandType == OT_Address)
-	{
-		value = mSystem->Read(decoded.operand);
-	}
-	else
-	{
-		value = decoded.operand;
-	}
-
-	uint8_t oldCarry = static_cast<uint8_t>(GetProcessorStatus(PS_CarryFlag));
-	SetProcessorStatus(PS_CarryFlag, (value & 0x80) == 0x80);
+	uint8_t oldCarry = mCarryResult >> 8;
+	mCarryResult = value << 1;
 
 	uint16_t result = (value << 1) | oldCarry;
 
-	SetProcessorStatus(PS_ZeroFlag, (result & 0xFF) == 0x00);
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
+	SetZeroNegative(result & 0xFF);
 
-	if (decoded.operandType == OT_Address)
-	{
-		mSystem->Write(decoded.operand, result & 0xFF);
-	}
-	else
-	{
-		registers.ACC = result & 0xFF;
-	}
+	return result & 0xFF;
 }
 
-void CPU::ROR(DecodedOperand decoded)
+uint8_t CPU::ROR(uint8_t value)
 {
-	SPDLOG_INFO("{}", __func__);
-	uint8_t value = 0;
-	if (decoded.operandType == OT_Address)
-	{
-		value = mSystem->Read(decoded.operand);
-	}
-	else
-	{
-		value = decoded.operand;
-	}
-
-	uint8_t oldCarry = static_cast<uint8_t>(GetProcessorStatus(PS_CarryFlag));
-	SetProcessorStatus(PS_CarryFlag, (value & 0x01) == 0x01);
+	uint8_t oldCarry = mCarryResult >> 8;
+	mCarryResult = (value & 0x01) << 8;
 
 	uint16_t result = (oldCarry << 7) | (value >> 1);
 
-	SetProcessorStatus(PS_ZeroFlag, (result & 0xFF) == 0x00);
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
+	SetZeroNegative(result & 0xFF);
 
-	if (decoded.operandType == OT_Address)
-	{
-		mSystem->Write(decoded.operand, result & 0xFF);
-	}
-	else
-	{
-		registers.ACC = result & 0xFF;
-	}
+	return result & 0xFF;
 }
 
-void CPU::RTI(DecodedOperand decoded)
+void CPU::RTI()
 {
-	SPDLOG_INFO("{}", __func__);
+	SetStatus(mSystem.Read(0x100 + ++registers.SP));
+
+	uint8_t lo = mSystem.Read(0x100 + ++registers.SP);
+	uint8_t hi = mSystem.Read(0x100 + ++registers.SP);
 
-	registers.PS = mSystem->Read(0x100 + registers.SP++);
+	registers.PC = lo | hi << 8;
 }
 
-void CPU::RTS(DecodedOperand decoded)
+void CPU::RTS()
 {
-	SPDLOG_INFO("{}", __func__);
-
-	uint8_t lo = mSystem->Read(0x100 + ++registers.SP);
-	uint8_t hi = mSystem->Read(0x100 + ++registers.SP);
+	uint8_t lo = mSystem.Read(0x100 + ++registers.SP);
+	uint8_t hi = mSystem.Read(0x100 + ++registers.SP);
 
 	registers.PC = lo | hi << 8;
 }
 
-void CPU::SBC(DecodedOperand decoded)
+void CPU::SBC(uint8_t value)
 {
-	SPDLOG_INFO("{}", __func__);
-
-	uint8_t value = 0;
-	if (decoded.operandType == OT_Address)
-	{
-		value = mSystem->Read(decoded.operand);
-	}
-	else
-	{
-		value = decoded.operand;
-	}
-
-	uint8_t carry = static_cast<uint8_t>(!GetProcessorStatus(PS_CarryFlag));
-	uint16_t result = registers.ACC - value - carry;
-
-	SetProcessorStatus(PS_CarryFlag, result <= 0xFF);
-	SetProcessorStatus(PS_ZeroFlag, (result & 0xFF) == 0);
-
-	bool overflow = ((value & 0x80) == (registers.ACC & 0x80)) && (((value & 0x80) == 0x80) != (result > 0xFF));
-	SetProcessorStatus(PS_OverflowFlag, overflow);
-
-	SetProcessorStatus(PS_NegativeFlag, (result & 0x80) == 0x80);
-
-	registers.ACC = result & 0xFF;
+	registers.ACC = Alu<AO_Subtract>(registers.ACC, value);
 }
 
-void CPU::SEC(DecodedOperand decoded)
+void CPU::SEC()
 {
-	SPDLOG_INFO("{}", __func__);
-	SetProcessorStatus(PS_CarryFlag, true);
+	mCarryResult = 0x100;
 }
 
-void CPU::SED(DecodedOperand decoded)
+void CPU::SED()
 {
-	SPDLOG_INFO("{}", __func__);
 	SetProcessorStatus(PS_DecimalMode, true);
 }
 
-void CPU::SEI(DecodedOperand decoded)
+void CPU::SEI()
 {
-	SPDLOG_INFO("{}", __func__);
 	SetProcessorStatus(PS_InterruptDisable, true);
 }
 
-void CPU::STA(DecodedOperand decoded)
+void CPU::STA(uint16_t address)
 {
-	SPDLOG_INFO("{}", __func__);
-	mSystem->Write(decoded.operand, registers.ACC);
+	mSystem.Write(address, registers.ACC);
 }
 
-void CPU::STX(DecodedOperand decoded)
+void CPU::STX(uint16_t address)
 {
-	SPDLOG_INFO("{}", __func__);
-	mSystem->Write(decoded.operand, registers.IX);
+	mSystem.Write(address, registers.IX);
 }
 
-void CPU::STY(DecodedOperand decoded)
+void CPU::STY(uint16_t address)
 {
-	SPDLOG_INFO("{}", __func__);
-	mSystem->Write(decoded.operand, registers.IY);
+	mSystem.Write(address, registers.IY);
 }
 
-void CPU::TAX(DecodedOperand decoded)
+void CPU::TAX()
 {
-	SPDLOG_INFO("{}", __func__);
 	registers.IX = registers.ACC;
 
-	SetProcessorStatus(PS_ZeroFlag, registers.IX == 0);
-	SetProcessorStatus(PS_CarryFlag, (registers.IX & 0x80) == 0x80);
+	mZResult = registers.IX;
+	mCarryResult = registers.IX << 1;
 }
 
-void CPU::TAY(DecodedOperand decoded)
+void CPU::TAY()
 {
-	SPDLOG_INFO("{}", __func__);
 	registers.IY = registers.ACC;
 
-	SetProcessorStatus(PS_ZeroFlag, registers.IY == 0);
-	SetProcessorStatus(PS_CarryFlag, (registers.IY & 0x80) == 0x80);
+	mZResult = registers.IY;
+	mCarryResult = registers.IY << 1;
 }
 
-void CPU::TSX(DecodedOperand decoded)
+void CPU::TSX()
 {
-	SPDLOG_INFO("{}", __func__);
 	registers.IX = registers.SP;
 
-	SetProcessorStatus(PS_ZeroFlag, registers.IX == 0);
-	SetProcessorStatus(PS_CarryFlag, (registers.IX & 0x80) == 0x80);
+	mZResult = registers.IX;
+	mCarryResult = registers.IX << 1;
 }
 
-void CPU::TXA(DecodedOperand decoded)
+void CPU::TXA()
 {
-	SPDLOG_INFO("{}", __func__);
 	registers.ACC = registers.IX;
 
-	SetProcessorStatus(PS_ZeroFlag, registers.ACC == 0);
-	SetProcessorStatus(PS_CarryFlag, (registers.ACC & 0x80) == 0x80);
+	mZResult = registers.ACC;
+	mCarryResult = registers.ACC << 1;
 }
 
-void CPU::TXS(DecodedOperand decoded)
+void CPU::TXS()
 {
-	SPDLOG_INFO("{}", __func__);
 	registers.SP = registers.IX;
 
-	SetProcessorStatus(PS_ZeroFlag, registers.SP == 0);
-	SetProcessorStatus(PS_CarryFlag, (registers.SP & 0x80) == 0x80);
+	mZResult = registers.SP;
+	mCarryResult = registers.SP << 1;
 }
 
-void CPU::TYA(DecodedOperand decoded)
+void CPU::TYA()
 {
-	SPDLOG_INFO("{}", __func__);
 	registers.ACC = registers.IY;
 
-	SetProcessorStatus(PS_ZeroFlag, registers.ACC == 0);
-	SetProcessorStatus(PS_CarryFlag, (registers.ACC & 0x80) == 0x80);
+	mZResult = registers.ACC;
+	mCarryResult = registers.ACC << 1;
+}
+
+void CPU::ILL()
+{
+	SPDLOG_ERROR("Illegal opcode {:#04x}", static_cast<uint8_t>(mCurrentOpcode));
+	mJammed = true;
 }
@@ -1,13 +1,18 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
-#include <functional>
-#include <map>
 #include <memory>
+#include <vector>
 
 #include "Opcodes.hpp"
 
+class JIT;
+class StateReader;
+class StateWriter;
 class System;
+class TraceSink;
 
 enum ProcessorStatus : uint8_t
 {
@@ -34,20 +39,60 @@ struct CPURegisters
 class CPU
 {
 public:
-	void ConnectSystem(std::shared_ptr<System> system);
+	explicit CPU(System& system);
+	~CPU();
 
 	void Reset();
+
+	// Executes a single instruction. Returns false if the CPU has halted.
 	bool Process();
 
+	// Executes instructions until at least the given number of cycles have
+	// passed. Returns false if the CPU halted before then.
+	bool RunCycles(uint64_t cycles);
+
+	// Ends the current RunCycles() early, after the instruction that reaches
+	// the given cycle, e.g. so an interrupt can be raised on time.
+	void EndRunAt(uint64_t cycles) { mRunUntilCycles = cycles < mRunUntilCycles ? cycles : mRunUntilCycles; }
+
+	// Interrupt lines, checked before each instruction. NMI is edge triggered,
+	// IRQ is held until whatever raised it is acknowledged.
+	void TriggerNMI() { mNMIPending = true; }
+	void SetIRQ(bool asserted) { mIRQAsserted = asserted; }
+
+	// Cycles spent with the CPU halted, e.g. during OAM DMA.
+	void Stall(uint32_t cycles) { mCycles += cycles; }
+
+	void SaveState(StateWriter& writer) const;
+	void LoadState(StateReader& reader);
+
+	// Has no effect unless built with ENABLE_CPU_TRACE.
+	void SetTraceSink(TraceSink* sink) { mTraceSink = sink; }
+
+	// RunCycles() runs straight-line code in ROM from a cache of decoded
+	// blocks. The cache follows bank switches by itself, anything else that
+	// changes ROM without remapping it has to invalidate it.
+	void SetBlockCacheEnabled(bool enabled) { mBlockCacheEnabled = enabled; }
+	void InvalidateBlocks() { ++mBlockGeneration; }
+
+	// Blocks that run often are compiled to native code. Has no effect unless
+	// built with ENABLE_JIT.
+	void SetJitEnabled(bool enabled) { mJitEnabled = enabled; }
+
 	bool GetProcessorStatus(ProcessorStatus statusFlag)
 	{
-		return (registers.PS & statusFlag) == statusFlag;
+		return (GetStatus() & statusFlag) == statusFlag;
 	}
 
+	// Total CPU cycles executed since power on.
+	uint64_t GetCycles() const { return mCycles; }
+
 	// Used for debugging and testing.
-	CPURegisters GetRegisters()
+	CPURegisters GetRegisters() const
 	{
-		return registers;
+		CPURegisters current = registers;
+		current.PS = GetStatus();
+		return current;
 	}
 
 	Opcodes GetCurrentOpcode()
@@ -55,97 +100,146 @@ public:
 		return mCurrentOpcode;
 	}
 
-	enum OperandType
+	// The operand's address, or its value for immediate addressing.
+	uint16_t GetCurrentOperand()
 	{
-		OT_Address,
-		OT_Value
-	};
+		return mCurrentOperand;
+	}
 
-	struct DecodedOperand
+private:
+	friend class JIT;
+
+	enum AddressingMode
 	{
-		uint16_t operand;
-		OperandType operandType;
+		AM_Implied,
+		AM_Accumulator,
+		AM_Immediate,
+		AM_ZeroPage,
+		AM_ZeroPageX,
+		AM_ZeroPageY,
+		AM_Absolute,
+		AM_AbsoluteX,
+		AM_AbsoluteY,
+		AM_Indirect,
+		AM_IndirectX,
+		AM_IndirectY,
+		AM_Relative
 	};
 
-	DecodedOperand GetCurrentOperand()
+	static constexpr uint8_t GetInstructionLength(AddressingMode mode);
+
+	// Reads the bytes after the opcode, 0, 1 or 2 of them.
+	template <AddressingMode Mode>
+	uint16_t FetchOperandBytes();
+
+	template <AddressingMode Mode>
+	uint16_t GetOperand(uint16_t operandBytes);
+
+	template <AddressingMode Mode>
+	uint8_t ReadOperand(uint16_t operand);
+
+	template <AddressingMode Mode>
+	void WriteOperand(uint16_t operand, uint8_t value);
+
+	// One instruction, with the addressing mode and op combined at compile
+	// time. The decoded version is for when the operand bytes have already
+	// been read and PC moved past them, i.e. from a block.
+	template <AddressingMode Mode, auto Op>
+	void Exec(uint8_t cycles);
+
+	template <AddressingMode Mode, auto Op>
+	void ExecDecoded(uint16_t operandBytes, uint8_t cycles);
+
+	void ADC(uint8_t value);
+	void AND(uint8_t value);
+	uint8_t ASL(uint8_t value);
+	void BCC(uint16_t address);
+	void BCS(uint16_t address);
+	void BEQ(uint16_t address);
+	void BIT(uint8_t value);
+	void BMI(uint16_t address);
+	void BNE(uint16_t address);
+	void BPL(uint16_t address);
+	void BRK();
+	void BVC(uint16_t address);
+	void BVS(uint16_t address);
+	void CLC();
+	void CLD();
+	void CLI();
+	void CLV();
+	void CMP(uint8_t value);
+	void CPX(uint8_t value);
+	void CPY(uint8_t value);
+	uint8_t DEC(uint8_t value);
+	void DEX();
+	void DEY();
+	void EOR(uint8_t value);
+	uint8_t INC(uint8_t value);
+	void INX();
+	void INY();
+	void JMP(uint16_t address);
+	void JSR(uint16_t address);
+	void LDA(uint8_t value);
+	void LDX(uint8_t value);
+	void LDY(uint8_t value);
+	uint8_t LSR(uint8_t value);
+	void NOP();
+	void ORA(uint8_t value);
+	void PHA();
+	void PHP();
+	void PLA();
+	void PLP();
+	uint8_t ROL(uint8_t value);
+	uint8_t ROR(uint8_t value);
+	void RTI();
+	void RTS();
+	void SBC(uint8_t value);
+	void SEC();
+	void SED();
+	void SEI();
+	void STA(uint16_t address);
+	void STX(uint16_t address);
+	void STY(uint16_t address);
+	void TAX();
+	void TAY();
+	void TSX();
+	void TXA();
+	void TXS();
+	void TYA();
+
+	// Unofficial/illegal opcodes, halts execution.
+	void ILL();
+
+	// Only I, D, B and the unused bit are kept in registers.PS. The others
+	// change on almost every instruction, so what set them is kept instead
+	// and only turned into flags when the status byte is read.
+	CPURegisters registers = { 0 };
+
+	uint8_t  mZResult = 1;       // Z is set when this is zero.
+	uint8_t  mNResult = 0;       // N is bit 7.
+	uint16_t mCarryResult = 0;   // C is bit 8.
+	uint8_t  mOverflowResult = 0; // V is bit 7.
+
+	enum AluOperation
 	{
-		return mCurrentOperand;
-	}
+		AO_Add,
+		AO_Subtract,
+		AO_Compare
+	};
 
-private:
+	// Shared by ADC, SBC, CMP, CPX and CPY. Sets the flags and returns the
+	// result.
+	template <AluOperation Operation>
+	uint8_t Alu(uint8_t lhs, uint8_t value);
 
-	DecodedOperand fetch_immediate();
-	DecodedOperand fetch_zeropage();
-	DecodedOperand fetch_zeropage_X();
-	DecodedOperand fetch_zeropage_Y();
-	DecodedOperand fetch_absolute();
-	DecodedOperand fetch_absolute_X();
-	DecodedOperand fetch_absolute_Y();
-	DecodedOperand fetch_indirect();
-	DecodedOperand fetch_indirect_X();
-	DecodedOperand fetch_indirect_Y();
-	DecodedOperand fetch_accumulator();
-	DecodedOperand fetch_relative();
-	DecodedOperand fetch_implied();
-
-	void ADC(DecodedOperand decoded);
-	void AND(DecodedOperand decoded);
-	void ASL(DecodedOperand decoded);
-	void BCC(DecodedOperand decoded);
-	void BCS(DecodedOperand decoded);
-	void BEQ(DecodedOperand decoded);
-	void BIT(DecodedOperand decoded);
-	void BMI(DecodedOperand decoded);
-	void BNE(DecodedOperand decoded);
-	void BPL(DecodedOperand decoded);
-	void BRK(DecodedOperand decoded);
-	void BVC(DecodedOperand decoded);
-	void BVS(DecodedOperand decoded);
-	void CLC(DecodedOperand decoded);
-	void CLD(DecodedOperand decoded);
-	void CLI(DecodedOperand decoded);
-	void CLV(DecodedOperand decoded);
-	void CMP(DecodedOperand decoded);
-	void CPX(DecodedOperand decoded);
-	void CPY(DecodedOperand decoded);
-	void DEC(DecodedOperand decoded);
-	void DEX(DecodedOperand decoded);
-	void DEY(DecodedOperand decoded);
-	void EOR(DecodedOperand decoded);
-	void INC(DecodedOperand decoded);
-	void INX(DecodedOperand decoded);
-	void INY(DecodedOperand decoded);
-	void JMP(DecodedOperand decoded);
-	void JSR(DecodedOperand decoded);
-	void LDA(DecodedOperand decoded);
-	void LDX(DecodedOperand decoded);
-	void LDY(DecodedOperand decoded);
-	void LSR(DecodedOperand decoded);
-	void NOP(DecodedOperand decoded);
-	void ORA(DecodedOperand decoded);
-	void PHA(DecodedOperand decoded);
-	void PHP(DecodedOperand decoded);
-	void PLA(DecodedOperand decoded);
-	void PLP(DecodedOperand decoded);
-	void ROL(DecodedOperand decoded);
-	void ROR(DecodedOperand decoded);
-	void RTI(DecodedOperand decoded);
-	void RTS(DecodedOperand decoded);
-	void SBC(DecodedOperand decoded);
-	void SEC(DecodedOperand decoded);
-	void SED(DecodedOperand decoded);
-	void SEI(DecodedOperand decoded);
-	void STA(DecodedOperand decoded);
-	void STX(DecodedOperand decoded);
-	void STY(DecodedOperand decoded);
-	void TAX(DecodedOperand decoded);
-	void TAY(DecodedOperand decoded);
-	void TSX(DecodedOperand decoded);
-	void TXA(DecodedOperand decoded);
-	void TXS(DecodedOperand decoded);
-	void TYA(DecodedOperand decoded);
+	uint8_t GetStatus() const;
+	void SetStatus(uint8_t status);
 
-	CPURegisters registers = { 0 };
+	void SetZeroNegative(uint8_t result)
+	{
+		mZResult = result;
+		mNResult = result;
+	}
 
 	void SetProcessorStatus(ProcessorStatus statusFlag, bool set)
 	{
@@ -159,217 +253,116 @@ private:
 		}
 	}
 
-	struct OpFuncs
+	using ExecFunc = void (CPU::*)(uint8_t);
+	using DecodedFunc = void (CPU::*)(uint16_t, uint8_t);
+
+	// Most instructions can be followed by the next one in a block. Jumps and
+	// branches end a block, and BRK and illegal opcodes halt so are left out.
+	enum BlockEnd : uint8_t
 	{
-		std::function<DecodedOperand(CPU*)> fetchFunc;
-		std::function<void(CPU*, DecodedOperand)> opFunc;
+		BE_Continue,
+		BE_After,
+		BE_Before
 	};
 
-	const std::map<const Opcodes, const OpFuncs> opTable
+	struct OpEntry
 	{
-		{ Opcodes::ADC_immediate, {&CPU::fetch_immediate, &CPU::ADC} },
-		{ Opcodes::ADC_zeropage, {&CPU::fetch_zeropage, &CPU::ADC} },
-		{ Opcodes::ADC_zeropage_X, {&CPU::fetch_zeropage_X, &CPU::ADC} },
-		{ Opcodes::ADC_absolute, {&CPU::fetch_absolute, &CPU::ADC} },
-		{ Opcodes::ADC_absolute_X, {&CPU::fetch_absolute_X, &CPU::ADC} },
-		{ Opcodes::ADC_absolute_Y, {&CPU::fetch_absolute_Y, &CPU::ADC} },
-		{ Opcodes::ADC_indirect_X, {&CPU::fetch_indirect_X, &CPU::ADC} },
-		{ Opcodes::ADC_indirect_Y, {&CPU::fetch_indirect_Y, &CPU::ADC} },
-
-		{ Opcodes::AND_immediate, {&CPU::fetch_immediate, &CPU::AND} },
-		{ Opcodes::AND_zeropage, {&CPU::fetch_zeropage, &CPU::AND} },
-		{ Opcodes::AND_zeropage_X, {&CPU::fetch_zeropage_X, &CPU::AND} },
-		{ Opcodes::AND_absolute, {&CPU::fetch_absolute, &CPU::AND} },
-		{ Opcodes::AND_absolute_X, {&CPU::fetch_absolute_X, &CPU::AND} },
-		{ Opcodes::AND_absolute_Y, {&CPU::fetch_absolute_Y, &CPU::AND} },
-		{ Opcodes::AND_indirect_X, {&CPU::fetch_indirect_X, &CPU::AND} },
-		{ Opcodes::AND_indirect_Y, {&CPU::fetch_indirect_Y, &CPU::AND} },
-
-		{ Opcodes::ASL_accumulator, {&CPU::fetch_accumulator, &CPU::ASL} },
-		{ Opcodes::ASL_zeropage, {&CPU::fetch_zeropage, &CPU::ASL} },
-		{ Opcodes::ASL_zeropage_X, {&CPU::fetch_zeropage_X, &CPU::ASL} },
-		{ Opcodes::ASL_absolute, {&CPU::fetch_absolute, &CPU::ASL} },
-		{ Opcodes::ASL_absolute_X, {&CPU::fetch_absolute_X, &CPU::ASL} },
-
-		{ Opcodes::BCC_relative, {&CPU::fetch_relative, &CPU::BCC} },
-
-		{ Opcodes::BCS_relative, {&CPU::fetch_relative, &CPU::BCS} },
-
-		{ Opcodes::BEQ_relative, {&CPU::fetch_relative, &CPU::BEQ} },
-
-		{ Opcodes::BIT_zeropage, {&CPU::fetch_zeropage, &CPU::BIT} },
-		{ Opcodes::BIT_absolute, {&CPU::fetch_absolute, &CPU::BIT} },
-
-		{ Opcodes::BMI_relative, {&CPU::fetch_relative, &CPU::BMI} },
+		ExecFunc       execFunc;
+		DecodedFunc    decodedFunc;
+		uint8_t        cycles;
+		uint8_t        length;
+		BlockEnd       blockEnd;
+		AddressingMode mode;
+	};
 
-		{ Opcodes::BNE_relative, {&CPU::fetch_relative, &CPU::BNE} },
-
-		{ Opcodes::BPL_relative, {&CPU::fetch_relative, &CPU::BPL} },
+	template <AddressingMode Mode, auto Op>
+	static constexpr OpEntry MakeEntry(uint8_t cycles);
 
-		{ Opcodes::BRK, {&CPU::fetch_implied, &CPU::BRK} },
+	// One slot per possible opcode byte, built at compile time. Anything not
+	// listed in Opcodes.hpp falls through to ILL.
+	static constexpr std::array<OpEntry, 256> BuildOpTable();
+	static const std::array<OpEntry, 256> kOpTable;
 
-		{ Opcodes::BVC_relative, {&CPU::fetch_relative, &CPU::BVC} },
+	bool Step();
 
-		{ Opcodes::BVS_relative, {&CPU::fetch_relative, &CPU::BVS} },
+	bool IsInterruptPending() const
+	{
+		return mNMIPending || (mIRQAsserted && !(registers.PS & PS_InterruptDisable));
+	}
 
-		{ Opcodes::CLC, {&CPU::fetch_implied, &CPU::CLC} },
+	struct DecodedInstruction
+	{
+		DecodedFunc    func;
+		uint16_t       operandBytes;
+		uint8_t        cycles;
+		uint8_t        length;
+		Opcodes        opcode;
+		AddressingMode mode;
+	};
 
-		{ Opcodes::CLD, {&CPU::fetch_implied, &CPU::CLD} },
+	static constexpr size_t kBlockCacheSize = 1024;
+	static constexpr size_t kMaxBlockLength = 16;
 
-		{ Opcodes::CLI, {&CPU::fetch_implied, &CPU::CLI} },
+	// Runs before a block is worth compiling.
+	static constexpr uint16_t kJitThreshold = 8;
 
-		{ Opcodes::CLV, {&CPU::fetch_implied, &CPU::CLV} },
+	using NativeFunc = void (*)(CPU* cpu);
 
-		{ Opcodes::CMP_immediate, {&CPU::fetch_immediate, &CPU::CMP} },
-		{ Opcodes::CMP_zeropage, {&CPU::fetch_zeropage, &CPU::CMP} },
-		{ Opcodes::CMP_zeropage_X, {&CPU::fetch_zeropage_X, &CPU::CMP} },
-		{ Opcodes::CMP_absolute, {&CPU::fetch_absolute, &CPU::CMP} },
-		{ Opcodes::CMP_absolute_X, {&CPU::fetch_absolute_X, &CPU::CMP} },
-		{ Opcodes::CMP_absolute_Y, {&CPU::fetch_absolute_Y, &CPU::CMP} },
-		{ Opcodes::CMP_indirect_X, {&CPU::fetch_indirect_X, &CPU::CMP} },
-		{ Opcodes::CMP_indirect_Y, {&CPU::fetch_indirect_Y, &CPU::CMP} },
+	// A run of instructions from one page of ROM, up to and including the
+	// first jump or branch. Keyed by PC and the memory mapped at PC's page,
+	// so blocks from different banks at the same address don't clash and a
+	// bank switch doesn't throw away the blocks of the old bank.
+	struct Block
+	{
+		uint16_t       PC = 0;
+		const uint8_t* page = nullptr;
+		uint32_t       generation = 0;
+		uint8_t        length = 0;
+		uint16_t       runs = 0;
+		NativeFunc     native = nullptr;
+		std::array<DecodedInstruction, kMaxBlockLength> instructions;
+	};
 
-		{ Opcodes::CPX_immediate, {&CPU::fetch_immediate, &CPU::CPX} },
-		{ Opcodes::CPX_zeropage, {&CPU::fetch_zeropage, &CPU::CPX} },
-		{ Opcodes::CPX_absolute, {&CPU::fetch_absolute, &CPU::CPX} },
+	// Returns null if the code at PC can't run from a block right now, e.g.
+	// it's in RAM or an interrupt is due.
+	Block* FindBlock();
+	void DecodeBlock(Block& block, const uint8_t* page);
+	void RunBlock(const Block& block);
 
-		{ Opcodes::CPY_immediate, {&CPU::fetch_immediate, &CPU::CPY} },
-		{ Opcodes::CPY_zeropage, {&CPU::fetch_zeropage, &CPU::CPY} },
-		{ Opcodes::CPY_absolute, {&CPU::fetch_absolute, &CPU::CPY} },
+	// Whether the next instruction in a block can run, checked after every
+	// instruction that might have changed something, both here and in
+	// compiled blocks.
+	bool CanContinueBlock(const Block& block) const;
 
-		{ Opcodes::DEC_zeropage, {&CPU::fetch_zeropage, &CPU::DEC} },
-		{ Opcodes::DEC_zeropage_X, {&CPU::fetch_zeropage_X, &CPU::DEC} },
-		{ Opcodes::DEC_absolute, {&CPU::fetch_absolute, &CPU::DEC} },
-		{ Opcodes::DEC_absolute_X, {&CPU::fetch_absolute_X, &CPU::DEC} },
+	// Compiles the block once it's hot, returns null until then.
+	NativeFunc GetNativeCode(Block& block);
 
-		{ Opcodes::DEX, {&CPU::fetch_implied, &CPU::DEX} },
-		{ Opcodes::DEY, {&CPU::fetch_implied, &CPU::DEY} },
+	// Allocated on first use, most instances never run from ROM.
+	std::vector<Block> mBlocks;
+	uint32_t mBlockGeneration = 1;
+	bool     mBlockCacheEnabled = true;
 
-		{ Opcodes::EOR_immediate, {&CPU::fetch_immediate, &CPU::EOR} },
-		{ Opcodes::EOR_zeropage, {&CPU::fetch_zeropage, &CPU::EOR} },
-		{ Opcodes::EOR_zeropage_X, {&CPU::fetch_zeropage_X, &CPU::EOR} },
-		{ Opcodes::EOR_absolute, {&CPU::fetch_absolute, &CPU::EOR} },
-		{ Opcodes::EOR_absolute_X, {&CPU::fetch_absolute, &CPU::EOR} },
-		{ Opcodes::EOR_absolute_Y, {&CPU::fetch_absolute, &CPU::EOR} },
-		{ Opcodes::EOR_indirect_X, {&CPU::fetch_indirect_X, &CPU::EOR} },
-		{ Opcodes::EOR_indirect_Y, {&CPU::fetch_indirect_Y, &CPU::EOR} },
-
-		{ Opcodes::INC_zeropage, {&CPU::fetch_zeropage, &CPU::INC} },
-		{ Opcodes::INC_zeropage_X, {&CPU::fetch_zeropage_X, &CPU::INC} },
-		{ Opcodes::INC_absolute, {&CPU::fetch_absolute, &CPU::INC} },
-		{ Opcodes::INC_absolute_X, {&CPU::fetch_absolute_X, &CPU::INC} },
-
-		{ Opcodes::INX, {&CPU::fetch_implied, &CPU::INX} },
-
-		{ Opcodes::INY, {&CPU::fetch_implied, &CPU::INY} },
-
-		{ Opcodes::JMP_absolute, {&CPU::fetch_absolute, &CPU::JMP} },
-		{ Opcodes::JMP_indirect, {&CPU::fetch_indirect, &CPU::JMP} },
-
-		{ Opcodes::JSR, {&CPU::fetch_absolute, &CPU::JSR} },
-
-		{ Opcodes::LDA_immediate, {&CPU::fetch_immediate, &CPU::LDA} },
-		{ Opcodes::LDA_zeropage, {&CPU::fetch_zeropage, &CPU::LDA} },
-		{ Opcodes::LDA_zeropage_X, {&CPU::fetch_zeropage_X, &CPU::LDA} },
-		{ Opcodes::LDA_absolute, {&CPU::fetch_absolute, &CPU::LDA} },
-		{ Opcodes::LDA_absolute_X, {&CPU::fetch_absolute_X, &CPU::LDA} },
-		{ Opcodes::LDA_absolute_Y, {&CPU::fetch_absolute_Y, &CPU::LDA} },
-		{ Opcodes::LDA_indirect_X, {&CPU::fetch_indirect_X, &CPU::LDA} },
-		{ Opcodes::LDA_indirect_Y, {&CPU::fetch_indirect_Y, &CPU::LDA} },
-
-		{ Opcodes::LDX_immediate, {&CPU::fetch_immediate, &CPU::LDX} },
-		{ Opcodes::LDX_zeropage, {&CPU::fetch_zeropage, &CPU::LDX} },
-		{ Opcodes::LDX_zeropage_Y, {&CPU::fetch_zeropage_Y, &CPU::LDX} },
-		{ Opcodes::LDX_absolute, {&CPU::fetch_absolute, &CPU::LDX} },
-		{ Opcodes::LDX_absolute_Y, {&CPU::fetch_absolute_Y, &CPU::LDX} },
+	std::unique_ptr<JIT> mJit;
+	bool                 mJitEnabled = true;
 
-		{ Opcodes::LDY_immediate, {&CPU::fetch_immediate, &CPU::LDY} },
-		{ Opcodes::LDY_zeropage, {&CPU::fetch_zeropage, &CPU::LDY} },
-		{ Opcodes::LDY_zeropage_X, {&CPU::fetch_zeropage_X, &CPU::LDY} },
-		{ Opcodes::LDY_absolute, {&CPU::fetch_absolute, &CPU::LDY} },
-		{ Opcodes::LDY_absolute_X, {&CPU::fetch_absolute_X, &CPU::LDY} },
+	void Branch(bool condition, uint16_t target);
+	void Interrupt();
 
-		{ Opcodes::LSR_accumulator, {&CPU::fetch_accumulator, &CPU::LSR} },
-		{ Opcodes::LSR_zeropage, {&CPU::fetch_zeropage, &CPU::LSR} },
-		{ Opcodes::LSR_zeropage_X, {&CPU::fetch_zeropage_X, &CPU::LSR} },
-		{ Opcodes::LSR_absolute, {&CPU::fetch_absolute, &CPU::LSR} },
-		{ Opcodes::LSR_absolute_X, {&CPU::fetch_absolute_X, &CPU::LSR} },
+	bool mJammed = false;
+	bool mNMIPending = false;
+	bool mIRQAsserted = false;
+	uint64_t mCycles = 0;
+	uint64_t mRunUntilCycles = 0;
 
-		{ Opcodes::NOP, {&CPU::fetch_implied, &CPU::NOP} },
+	// Set by GetOperand() when indexing crosses into the next page.
+	bool mPageCrossed = false;
 
-		{ Opcodes::ORA_immediate, {&CPU::fetch_immediate, &CPU::ORA} },
-		{ Opcodes::ORA_zeropage, {&CPU::fetch_zeropage, &CPU::ORA} },
-		{ Opcodes::ORA_zeropage_X, {&CPU::fetch_zeropage_X, &CPU::ORA} },
-		{ Opcodes::ORA_absolute, {&CPU::fetch_absolute, &CPU::ORA} },
-		{ Opcodes::ORA_absolute_X, {&CPU::fetch_absolute_X, &CPU::ORA} },
-		{ Opcodes::ORA_absolute_Y, {&CPU::fetch_absolute_Y, &CPU::ORA} },
-		{ Opcodes::ORA_indirect_X, {&CPU::fetch_indirect_X, &CPU::ORA} },
-		{ Opcodes::ORA_indirect_Y, {&CPU::fetch_indirect_Y, &CPU::ORA} },
-
-		{ Opcodes::PHA, {&CPU::fetch_implied, &CPU::PHA} },
-
-		{ Opcodes::PHP, {&CPU::fetch_implied, &CPU::PHP} },
-
-		{ Opcodes::PLA, {&CPU::fetch_implied, &CPU::PLA} },
-
-		{ Opcodes::PLP, {&CPU::fetch_implied, &CPU::PLP} },
-
-		{ Opcodes::ROL_accumulator, {&CPU::fetch_accumulator, &CPU::ROL} },
-		{ Opcodes::ROL_zeropage, {&CPU::fetch_zeropage, &CPU::ROL} },
-		{ Opcodes::ROL_zeropage_X, {&CPU::fetch_zeropage_X, &CPU::ROL} },
-		{ Opcodes::ROL_absolute, {&CPU::fetch_absolute, &CPU::ROL} },
-		{ Opcodes::ROL_absolute_X, {&CPU::fetch_absolute_X, &CPU::ROL} },
-
-		{ Opcodes::ROR_accumulator, {&CPU::fetch_accumulator, &CPU::ROR} },
-		{ Opcodes::ROR_zeropage, {&CPU::fetch_zeropage, &CPU::ROR} },
-		{ Opcodes::ROR_zeropage_X, {&CPU::fetch_zeropage_X, &CPU::ROR} },
-		{ Opcodes::ROR_absolute, {&CPU::fetch_absolute, &CPU::ROR} },
-		{ Opcodes::ROR_absolute_X, {&CPU::fetch_absolute_X, &CPU::ROR} },
-
-		{ Opcodes::RTI, {&CPU::fetch_implied, &CPU::RTI} },
-
-		{ Opcodes::RTS, {&CPU::fetch_implied, &CPU::RTS} },
-
-		{ Opcodes::SBC_immediate, {&CPU::fetch_immediate, &CPU::SBC} },
-		{ Opcodes::SBC_zeropage, {&CPU::fetch_zeropage, &CPU::SBC} },
-		{ Opcodes::SBC_zeropage_X, {&CPU::fetch_zeropage_X, &CPU::SBC} },
-		{ Opcodes::SBC_absolute, {&CPU::fetch_absolute, &CPU::SBC} },
-		{ Opcodes::SBC_absolute_X, {&CPU::fetch_absolute_X, &CPU::SBC} },
-		{ Opcodes::SBC_absolute_Y, {&CPU::fetch_absolute_Y, &CPU::SBC} },
-		{ Opcodes::SBC_indirect_X, {&CPU::fetch_indirect_X, &CPU::SBC} },
-		{ Opcodes::SBC_indirect_Y, {&CPU::fetch_indirect_Y, &CPU::SBC} },
-
-		{ Opcodes::SEC, {&CPU::fetch_implied, &CPU::SEC} },
-		{ Opcodes::SED, {&CPU::fetch_implied, &CPU::SED} },
-		{ Opcodes::SEI, {&CPU::fetch_implied, &CPU::SEI} },
-
-		{ Opcodes::STA_zeropage, {&CPU::fetch_zeropage, &CPU::STA} },
-		{ Opcodes::STA_zeropage_X, {&CPU::fetch_zeropage_X, &CPU::STA} },
-		{ Opcodes::STA_absolute, {&CPU::fetch_absolute, &CPU::STA} },
-		{ Opcodes::STA_absolute_X, {&CPU::fetch_absolute_X, &CPU::STA} },
-		{ Opcodes::STA_absolute_Y, {&CPU::fetch_absolute_Y, &CPU::STA} },
-		{ Opcodes::STA_indirect_X, {&CPU::fetch_indirect_X, &CPU::STA} },
-		{ Opcodes::STA_indirect_Y, {&CPU::fetch_indirect_Y, &CPU::STA} },
-
-		{ Opcodes::STX_zeropage, {&CPU::fetch_zeropage, &CPU::STX} },
-		{ Opcodes::STX_zeropage_Y, {&CPU::fetch_zeropage_Y, &CPU::STX} },
-		{ Opcodes::STX_absolute, {&CPU::fetch_absolute, &CPU::STX} },
-
-		{ Opcodes::STY_zeropage, {&CPU::fetch_zeropage, &CPU::STY} },
-		{ Opcodes::STY_zeropage_X, {&CPU::fetch_zeropage_X, &CPU::STY} },
-		{ Opcodes::STY_absolute, {&CPU::fetch_absolute, &CPU::STY} },
-
-		{ Opcodes::TAX, {&CPU::fetch_implied, &CPU::TAX} },
-		{ Opcodes::TAY, {&CPU::fetch_implied, &CPU::TAY} },
-		{ Opcodes::TSX, {&CPU::fetch_implied, &CPU::TSX} },
-		{ Opcodes::TXA, {&CPU::fetch_implied, &CPU::TXA} },
-		{ Opcodes::TXS, {&CPU::fetch_implied, &CPU::TXS} },
-		{ Opcodes::TYA, {&CPU::fetch_implied, &CPU::TYA} },
-	};
+	void TraceInstruction(uint8_t length);
 
-	std::shared_ptr<System> mSystem;
+	System& mSystem;
+	TraceSink* mTraceSink = nullptr;
 
 	// Debug helper variables
 	Opcodes mCurrentOpcode;
-	DecodedOperand mCurrentOperand;
+	uint16_t mCurrentOperand = 0;
 };
\ No newline at end of file
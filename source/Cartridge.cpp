@@ -1,30 +1,120 @@
 #include "Cartridge.hpp"
 
+#include <algorithm>
+
 #include <spdlog/spdlog.h>
 
 #include "ROM.hpp"
+#include "SaveState.hpp"
+#include "System.hpp"
 
 bool Cartridge::Load(const std::string& filename)
 {
 	mRom = std::make_shared<ROM>();
-	bool isRomValid = mRom->Load(filename);
-
-	return isRomValid;
+	return Init(mRom->Load(filename));
 }
 
 bool Cartridge::Load()
 {
 	mRom = std::make_shared<ROM>();
-	return mRom->Load();
+	return Init(mRom->Load());
+}
+
+template <typename MapperT>
+void Cartridge::BusWriteMapper(void* context, uint16_t address, uint8_t data)
+{
+	Cartridge* cart = static_cast<Cartridge*>(context);
+
+	// MapperT is final, so these are direct calls the compiler can inline.
+	MapperT* mapper = static_cast<MapperT*>(cart->mMapper.get());
+
+	if (!mapper->HasRegisters())
+	{
+		cart->Write(address, data);
+		return;
+	}
+
+	cart->BeginRegisterWrite();
+
+	if (mapper->WriteRegister(address, data))
+	{
+		cart->MapPages();
+	}
+
+	cart->EndRegisterWrite();
+}
+
+template <typename MapperT>
+void Cartridge::BindMapper(Mirroring mirroring)
+{
+	mMapper = std::make_unique<MapperT>(mRom->GetPrgRom().size(), mRom->GetChrRom().size(), mirroring);
+	mWriteHandler = &Cartridge::BusWriteMapper<MapperT>;
+}
+
+bool Cartridge::Init(bool isRomValid)
+{
+	mMapper.reset();
+	mWriteHandler = &Cartridge::BusWrite;
+	mPrgRam.assign(0x2000, static_cast<uint8_t>(0));
+	mIsChrBankDecoded.fill(false);
+
+	if (isRomValid)
+	{
+		NESHeader header = mRom->GetHeader();
+		Mirroring mirroring = header.isHMirrored ? MM_Horizontal : MM_Vertical;
+
+		switch (header.mapper)
+		{
+			case 0: BindMapper<NROM>(mirroring); break;
+			case 1: BindMapper<MMC1>(mirroring); break;
+			case 2: BindMapper<UxROM>(mirroring); break;
+			case 3: BindMapper<CNROM>(mirroring); break;
+			case 4: BindMapper<MMC3>(mirroring); break;
+			default:
+				SPDLOG_ERROR("Mapper {} is not supported.", header.mapper);
+				isRomValid = false;
+				break;
+		}
+	}
+
+	InstallHandlers();
+	MapPages();
+
+	if (mSystem)
+	{
+		mSystem->InvalidateCode();
+	}
+
+	return isRomValid;
+}
+
+void Cartridge::ConnectSystem(System* system)
+{
+	mSystem = system;
+	InstallHandlers();
+	MapPages();
+}
+
+void Cartridge::DisconnectSystem(System* system)
+{
+	if (mSystem == system)
+	{
+		mSystem = nullptr;
+	}
 }
 
 uint8_t Cartridge::Read(uint16_t address)
 {
 	uint8_t data = 0x00;
+	size_t offset = 0;
 
-	if (RemapAddress(address))
+	if (address >= 0x6000 && address < 0x8000 && !mPrgRam.empty())
+	{
+		data = mPrgRam[address - 0x6000];
+	}
+	else if (RemapAddress(address, offset))
 	{
-		data = mRom->GetPrgRom()[address];
+		data = mRom->GetPrgRom()[offset];
 	}
 
 	return data;
@@ -32,20 +122,238 @@ uint8_t Cartridge::Read(uint16_t address)
 
 void Cartridge::Write(uint16_t address, uint8_t data)
 {
-	if (RemapAddress(address))
+	size_t offset = 0;
+
+	if (address >= 0x6000 && address < 0x8000 && !mPrgRam.empty())
+	{
+		mPrgRam[address - 0x6000] = data;
+	}
+	else if (mMapper && address >= 0x8000 && mMapper->HasRegisters())
+	{
+		// Bank switching is done here, once, rather than on every read.
+		BeginRegisterWrite();
+
+		if (mMapper->WriteRegister(address, data))
+		{
+			MapPages();
+		}
+
+		EndRegisterWrite();
+	}
+	else if (RemapAddress(address, offset))
+	{
+		// Patching the image means taking a private copy of PRG, which then
+		// needs mapping in place of the file.
+		bool wasWritable = mRom->IsPrgRomWritable();
+		mRom->GetWritablePrgRom()[offset] = data;
+
+		if (!wasWritable)
+		{
+			MapPages();
+		}
+	}
+}
+
+void Cartridge::SaveState(StateWriter& writer) const
+{
+	writer.Write(static_cast<uint32_t>(mPrgRam.size()));
+	writer.WriteBytes(mPrgRam.data(), mPrgRam.size());
+
+	// ROM straight from the file can't have changed, only copies can.
+	for (bool isChr : { false, true })
+	{
+		bool isWritable = mRom && (isChr ? mRom->IsChrRomWritable() : mRom->IsPrgRomWritable());
+		writer.Write(isWritable);
+
+		if (isWritable)
+		{
+			std::span<const uint8_t> data = isChr ? mRom->GetChrRom() : mRom->GetPrgRom();
+			writer.Write(static_cast<uint32_t>(data.size()));
+			writer.WriteBytes(data.data(), data.size());
+		}
+	}
+
+	writer.Write(mMapper != nullptr);
+	if (mMapper)
+	{
+		mMapper->SaveState(writer);
+	}
+}
+
+void Cartridge::LoadState(StateReader& reader)
+{
+	// Sizes come from the ROM, so a state with different ones isn't for this
+	// cartridge however it got past the CRC check.
+	uint32_t prgRamSize = 0;
+	reader.Read(prgRamSize);
+	if (prgRamSize != mPrgRam.size())
+	{
+		reader.Fail();
+		return;
+	}
+	reader.ReadBytes(mPrgRam.data(), mPrgRam.size());
+
+	for (bool isChr : { false, true })
+	{
+		bool isWritable = false;
+		reader.Read(isWritable);
+
+		if (isWritable)
+		{
+			uint32_t size = 0;
+			reader.Read(size);
+			if (!mRom || size != (isChr ? mRom->GetChrRom() : mRom->GetPrgRom()).size())
+			{
+				reader.Fail();
+				return;
+			}
+
+			std::span<uint8_t> data = isChr ? mRom->GetWritableChrRom() : mRom->GetWritablePrgRom();
+			reader.ReadBytes(data.data(), data.size());
+		}
+	}
+
+	bool hasMapper = false;
+	reader.Read(hasMapper);
+	if (hasMapper && mMapper)
+	{
+		mMapper->LoadState(reader);
+	}
+
+	// Everything may have moved.
+	InstallHandlers();
+	MapPages();
+	mIsChrBankDecoded.fill(false);
+
+	if (mSystem)
 	{
-		mRom->GetPrgRom()[address] = data;
+		mSystem->InvalidateCode();
 	}
 }
 
-bool Cartridge::RemapAddress(uint16_t& address)
+uint8_t Cartridge::BusRead(void* context, uint16_t address)
+{
+	return static_cast<Cartridge*>(context)->Read(address);
+}
+
+void Cartridge::BusWrite(void* context, uint16_t address, uint8_t data)
+{
+	static_cast<Cartridge*>(context)->Write(address, data);
+}
+
+uint8_t Cartridge::ReadChr(uint16_t address)
+{
+	std::span<const uint8_t> chrRom = mRom ? mRom->GetChrRom() : std::span<const uint8_t>();
+	if (!mMapper || chrRom.empty())
+	{
+		return 0x00;
+	}
+
+	size_t offset = mMapper->GetChrBanks()[(address >> 10) & 0x07] + (address & 0x3FF);
+	return chrRom[offset % chrRom.size()];
+}
+
+void Cartridge::WriteChr(uint16_t address, uint8_t data)
+{
+	// Only CHR-RAM can be written to.
+	if (!mMapper || !mRom->IsChrRomWritable())
+	{
+		return;
+	}
+
+	std::span<uint8_t> chrRam = mRom->GetWritableChrRom();
+	size_t offset = mMapper->GetChrBanks()[(address >> 10) & 0x07] + (address & 0x3FF);
+	chrRam[offset % chrRam.size()] = data;
+
+	// The same RAM can be visible in more than one slot.
+	size_t bank = (offset % chrRam.size()) & ~static_cast<size_t>(0x3FF);
+	for (uint8_t slot = 0; slot < 8; ++slot)
+	{
+		if ((mDecodedChrBanks[slot] % chrRam.size()) == bank)
+		{
+			mIsChrBankDecoded[slot] = false;
+		}
+	}
+}
+
+// Mapper registers can switch CHR banks or change when an IRQ is due, so
+// the PPU has to finish everything before the write with the old state and
+// then find out about the new one.
+void Cartridge::BeginRegisterWrite()
+{
+	if (mSystem)
+	{
+		mSystem->SyncPPU();
+	}
+}
+
+void Cartridge::EndRegisterWrite()
+{
+	SyncChrBanks();
+
+	if (mSystem)
+	{
+		mSystem->SyncPPU();
+	}
+}
+
+void Cartridge::SyncChrBanks()
+{
+	const std::array<size_t, 8>& chrBanks = mMapper->GetChrBanks();
+
+	for (uint8_t slot = 0; slot < 8; ++slot)
+	{
+		if (chrBanks[slot] != mDecodedChrBanks[slot])
+		{
+			mIsChrBankDecoded[slot] = false;
+		}
+	}
+}
+
+void Cartridge::DecodeChrBank(uint8_t slot)
+{
+	constexpr size_t kBankSize = 0x400;
+	constexpr size_t kTileCount = kBankSize / kTileBytes;
+
+	uint8_t* decoded = mDecodedTiles.data() + slot * kTileCount * kDecodedTileBytes;
+	std::span<const uint8_t> chrRom = mRom ? mRom->GetChrRom() : std::span<const uint8_t>();
+
+	mIsChrBankDecoded[slot] = true;
+
+	if (!mMapper || chrRom.empty())
+	{
+		std::fill(decoded, decoded + kTileCount * kDecodedTileBytes, 0);
+		return;
+	}
+
+	mDecodedChrBanks[slot] = mMapper->GetChrBanks()[slot];
+	size_t offset = mDecodedChrBanks[slot] % chrRom.size();
+
+	if (offset + kBankSize <= chrRom.size())
+	{
+		DecodeTiles(chrRom.data() + offset, kTileCount, decoded);
+	}
+	else
+	{
+		// Less than 1KB of CHR, mirror it the same way ReadChr() does.
+		std::array<uint8_t, kBankSize> bank;
+		for (size_t i = 0; i < kBankSize; ++i)
+		{
+			bank[i] = chrRom[(offset + i) % chrRom.size()];
+		}
+
+		DecodeTiles(bank.data(), kTileCount, decoded);
+	}
+}
+
+bool Cartridge::RemapAddress(uint16_t address, size_t& offset)
 {
 	bool valid = false;
 
-	if (mRom && address >= 0x8000 && address <= 0xFFFF)
+	if (mMapper && address >= 0x8000 && !mRom->GetPrgRom().empty())
 	{
-		// TODO: This assumes 16KB
-		address = address & 0x3FFF;
+		offset = mMapper->GetPrgBanks()[(address - 0x8000) >> 13] + (address & 0x1FFF);
+		offset %= mRom->GetPrgRom().size();
 		valid = true;
 	}
 	else
@@ -55,3 +363,78 @@ bool Cartridge::RemapAddress(uint16_t& address)
 
 	return valid;
 }
+
+void Cartridge::InstallHandlers()
+{
+	if (!mSystem)
+	{
+		return;
+	}
+
+	mSystem->SetHandlers(0x80, 0x80, &Cartridge::BusRead, mWriteHandler, this);
+
+	// PRG-RAM never moves, so only needs mapping once.
+	if (mPrgRam.empty())
+	{
+		mSystem->UnmapPages(0x60, 0x20);
+	}
+	else
+	{
+		mSystem->MapPages(0x60, 0x20, mPrgRam.data());
+	}
+}
+
+// Called whenever the PRG banks change.
+void Cartridge::MapPages()
+{
+	if (!mSystem)
+	{
+		return;
+	}
+
+	// PRG must be a whole number of pages to map it directly, otherwise leave
+	// it to the slow path.
+	if (!mMapper || mRom->GetPrgRom().empty() || mRom->GetPrgRom().size() % 0x100 != 0)
+	{
+		mSystem->UnmapPages(0x80, 0x80);
+		return;
+	}
+
+	// PRG straight from the file is read only, writes go through Write() to
+	// reach the mapper or make a copy first. Once copied, e.g. for a blank
+	// NROM cartridge, it's left writable so programs can be poked into it.
+	std::span<const uint8_t> prgRom = mRom->GetPrgRom();
+	std::span<uint8_t> writablePrgRom;
+	if (mRom->IsPrgRomWritable() && !mMapper->HasRegisters())
+	{
+		writablePrgRom = mRom->GetWritablePrgRom();
+	}
+
+	const std::array<size_t, 4>& prgBanks = mMapper->GetPrgBanks();
+
+	for (uint8_t slot = 0; slot < 4; ++slot)
+	{
+		// Banks are 8KB (32 pages), unless PRG is smaller than that and has to
+		// be mirrored within the bank.
+		uint16_t pageCount = 0x20;
+		if (prgBanks[slot] + 0x2000 > prgRom.size())
+		{
+			pageCount = 1;
+		}
+
+		for (uint16_t page = 0; page < 0x20; page += pageCount)
+		{
+			size_t offset = (prgBanks[slot] + page * 0x100) % prgRom.size();
+			uint8_t firstPage = 0x80 + slot * 0x20 + page;
+
+			if (writablePrgRom.empty())
+			{
+				mSystem->MapReadOnlyPages(firstPage, pageCount, prgRom.data() + offset);
+			}
+			else
+			{
+				mSystem->MapPages(firstPage, pageCount, writablePrgRom.data() + offset);
+			}
+		}
+	}
+}
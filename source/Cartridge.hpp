@@ -1,9 +1,17 @@
 #pragma once
 
+#include <array>
 #include <memory>
 #include <string>
+#include <vector>
 
+#include "Mapper.hpp"
 #include "ROM.hpp"
+#include "System.hpp"
+#include "TileDecoder.hpp"
+
+class StateReader;
+class StateWriter;
 
 class Cartridge
 {
@@ -11,13 +19,81 @@ public:
 	bool    Load(const std::string& filename);
 	bool    Load();
 
+	// The cartridge maps its memory straight into the system's page table,
+	// and remaps it whenever that changes (e.g. a new ROM is loaded or the
+	// mapper switches banks).
+	void    ConnectSystem(System* system);
+	void    DisconnectSystem(System* system);
+
 	uint8_t Read(uint16_t address);
 	void    Write(uint16_t address, uint8_t data);
 
+	// PPU address space, 0x0000-0x1FFF.
+	uint8_t ReadChr(uint16_t address);
+	void    WriteChr(uint16_t address, uint8_t data);
+
+	// The tile at a pattern table address, already decoded to one byte per
+	// pixel. Tiles are decoded a 1KB bank at a time on first use, and again
+	// after that bank is switched or written to.
+	const uint8_t* GetDecodedTile(uint16_t address)
+	{
+		uint16_t tile = (address >> 4) & 0x1FF;
+		uint8_t slot = static_cast<uint8_t>(tile >> 6);
+
+		if (!mIsChrBankDecoded[slot]) [[unlikely]]
+		{
+			DecodeChrBank(slot);
+		}
+
+		return mDecodedTiles.data() + tile * kDecodedTileBytes;
+	}
+
+	void    OnScanline() { if (mMapper) mMapper->OnScanline(); }
+	bool    IsIRQPending() const { return mMapper && mMapper->IsIRQPending(); }
+	int     GetScanlinesUntilIRQ() const { return mMapper ? mMapper->GetScanlinesUntilIRQ() : 0; }
+
+	Mirroring GetMirroring() const { return mMapper ? mMapper->GetMirroring() : MM_Horizontal; }
+
 	NESHeader GetHeader() { return mRom ? mRom->GetHeader() : NESHeader{}; }
+	uint32_t  GetCRC32() const { return mRom ? mRom->GetCRC32() : 0; }
+
+	// PRG-RAM, any writable PRG or CHR, and the mapper's registers.
+	void    SaveState(StateWriter& writer) const;
+	void    LoadState(StateReader& reader);
+
+	// Page handlers for the system's 0x8000-0xFFFF range. Writes go through
+	// a handler instantiated for the loaded mapper, so register writes don't
+	// need a virtual call.
+	static uint8_t BusRead(void* context, uint16_t address);
+	static void    BusWrite(void* context, uint16_t address, uint8_t data);
 
 private:
-	bool    RemapAddress(uint16_t& address);
+	template <typename MapperT>
+	static void    BusWriteMapper(void* context, uint16_t address, uint8_t data);
+
+	template <typename MapperT>
+	void    BindMapper(Mirroring mirroring);
+
+	bool    Init(bool isRomValid);
+	bool    RemapAddress(uint16_t address, size_t& offset);
+	void    InstallHandlers();
+	void    MapPages();
+	void    BeginRegisterWrite();
+	void    EndRegisterWrite();
+	void    SyncChrBanks();
+	void    DecodeChrBank(uint8_t slot);
+
+	std::shared_ptr<ROM>    mRom;
+	std::unique_ptr<Mapper> mMapper;
+	System::WriteHandler    mWriteHandler = &Cartridge::BusWrite;
+	System*                 mSystem = nullptr;
+
+	// Mapped at 0x6000-0x7FFF.
+	std::vector<uint8_t>    mPrgRam;
 
-	std::shared_ptr<ROM> mRom;
+	// Decoded copies of the 64 tiles in each of the eight 1KB CHR banks, and
+	// which bank each copy was decoded from.
+	alignas(32) std::array<uint8_t, 512 * kDecodedTileBytes> mDecodedTiles = {};
+	std::array<size_t, 8>   mDecodedChrBanks = {};
+	std::array<bool, 8>     mIsChrBankDecoded = {};
 };
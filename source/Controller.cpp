@@ -0,0 +1,58 @@
+#include "Controller.hpp"
+
+#include "SaveState.hpp"
+
+void Controller::SetButtons(uint8_t buttons)
+{
+	mButtons = buttons;
+
+	if (mStrobe)
+	{
+		mShift = mButtons;
+	}
+}
+
+void Controller::Reset()
+{
+	mShift = 0;
+	mStrobe = false;
+}
+
+void Controller::WriteStrobe(uint8_t data)
+{
+	// While the strobe is high the shift register keeps reloading.
+	mStrobe = (data & 0x01) != 0;
+
+	if (mStrobe)
+	{
+		mShift = mButtons;
+	}
+}
+
+uint8_t Controller::Read()
+{
+	if (mStrobe)
+	{
+		return mButtons & CB_A;
+	}
+
+	// Official controllers read 1 once all 8 buttons are out.
+	uint8_t bit = mShift & 0x01;
+	mShift = (mShift >> 1) | 0x80;
+
+	return bit;
+}
+
+void Controller::SaveState(StateWriter& writer) const
+{
+	writer.Write(mButtons);
+	writer.Write(mShift);
+	writer.Write(mStrobe);
+}
+
+void Controller::LoadState(StateReader& reader)
+{
+	reader.Read(mButtons);
+	reader.Read(mShift);
+	reader.Read(mStrobe);
+}
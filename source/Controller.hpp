@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+class StateReader;
+class StateWriter;
+
+// Standard controller. Writing 1 then 0 to 0x4016 latches the buttons into a
+// shift register, which reads of 0x4016 (port 1) or 0x4017 (port 2) shift
+// out one button at a time. See https://www.nesdev.org/wiki/Standard_controller.
+class Controller
+{
+public:
+	// In the order they're read out.
+	enum Buttons : uint8_t
+	{
+		CB_A      = 0x01,
+		CB_B      = 0x02,
+		CB_Select = 0x04,
+		CB_Start  = 0x08,
+		CB_Up     = 0x10,
+		CB_Down   = 0x20,
+		CB_Left   = 0x40,
+		CB_Right  = 0x80,
+	};
+
+	// The buttons currently held, as a mask of Buttons.
+	void    SetButtons(uint8_t buttons);
+	uint8_t GetButtons() const { return mButtons; }
+
+	void    Reset();
+
+	void    WriteStrobe(uint8_t data);
+
+	// Bit 0 is the next button, the rest is left to the caller.
+	uint8_t Read();
+
+	void    SaveState(StateWriter& writer) const;
+	void    LoadState(StateReader& reader);
+
+private:
+	uint8_t mButtons = 0;
+	uint8_t mShift = 0;
+	bool    mStrobe = false;
+};
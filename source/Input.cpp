@@ -0,0 +1,110 @@
+#include "Input.hpp"
+
+#include <algorithm>
+
+#include <spdlog/spdlog.h>
+
+#include <SDL3/SDL.h>
+
+#include "Controller.hpp"
+#include "Scheduler.hpp"
+
+Input::Input(Scheduler& scheduler)
+	: mScheduler(scheduler)
+{
+}
+
+Input::~Input()
+{
+	for (SDL_Gamepad* gamepad : mGamepads)
+	{
+		SDL_CloseGamepad(gamepad);
+	}
+}
+
+void Input::HandleEvent(const SDL_Event& event)
+{
+	if (event.type == SDL_EVENT_GAMEPAD_ADDED)
+	{
+		if (SDL_Gamepad* gamepad = SDL_OpenGamepad(event.gdevice.which))
+		{
+			mGamepads.push_back(gamepad);
+		}
+		else
+		{
+			SPDLOG_ERROR("Failed to open gamepad! Error code: {}", SDL_GetError());
+		}
+	}
+	else if (event.type == SDL_EVENT_GAMEPAD_REMOVED)
+	{
+		auto it = std::find_if(mGamepads.begin(), mGamepads.end(), [&](SDL_Gamepad* gamepad)
+		{
+			return SDL_GetGamepadID(gamepad) == event.gdevice.which;
+		});
+
+		if (it != mGamepads.end())
+		{
+			SDL_CloseGamepad(*it);
+			mGamepads.erase(it);
+		}
+	}
+}
+
+void Input::Update(bool useKeyboard)
+{
+	uint8_t buttons = useKeyboard ? ReadKeyboard() : 0;
+	for (SDL_Gamepad* gamepad : mGamepads)
+	{
+		buttons |= ReadGamepad(gamepad);
+	}
+
+	// A real d-pad can't press opposite directions at once, and some games
+	// misbehave if they see it.
+	constexpr uint8_t kUpDown = Controller::CB_Up | Controller::CB_Down;
+	constexpr uint8_t kLeftRight = Controller::CB_Left | Controller::CB_Right;
+
+	if ((buttons & kUpDown) == kUpDown)
+	{
+		buttons &= ~kUpDown;
+	}
+
+	if ((buttons & kLeftRight) == kLeftRight)
+	{
+		buttons &= ~kLeftRight;
+	}
+
+	mScheduler.SetButtons(0, buttons);
+}
+
+uint8_t Input::ReadKeyboard() const
+{
+	const bool* keys = SDL_GetKeyboardState(nullptr);
+
+	uint8_t buttons = 0;
+	buttons |= keys[SDL_SCANCODE_X] ? Controller::CB_A : 0;
+	buttons |= keys[SDL_SCANCODE_Z] ? Controller::CB_B : 0;
+	buttons |= keys[SDL_SCANCODE_RSHIFT] ? Controller::CB_Select : 0;
+	buttons |= keys[SDL_SCANCODE_RETURN] ? Controller::CB_Start : 0;
+	buttons |= keys[SDL_SCANCODE_UP] ? Controller::CB_Up : 0;
+	buttons |= keys[SDL_SCANCODE_DOWN] ? Controller::CB_Down : 0;
+	buttons |= keys[SDL_SCANCODE_LEFT] ? Controller::CB_Left : 0;
+	buttons |= keys[SDL_SCANCODE_RIGHT] ? Controller::CB_Right : 0;
+
+	return buttons;
+}
+
+// Laid out like an NES pad, B on the left and A on the right.
+uint8_t Input::ReadGamepad(SDL_Gamepad* gamepad) const
+{
+	uint8_t buttons = 0;
+	buttons |= SDL_GetGamepadButton(gamepad, SDL_GAMEPAD_BUTTON_EAST) ? Controller::CB_A : 0;
+	buttons |= SDL_GetGamepadButton(gamepad, SDL_GAMEPAD_BUTTON_SOUTH) ? Controller::CB_B : 0;
+	buttons |= SDL_GetGamepadButton(gamepad, SDL_GAMEPAD_BUTTON_BACK) ? Controller::CB_Select : 0;
+	buttons |= SDL_GetGamepadButton(gamepad, SDL_GAMEPAD_BUTTON_START) ? Controller::CB_Start : 0;
+	buttons |= SDL_GetGamepadButton(gamepad, SDL_GAMEPAD_BUTTON_DPAD_UP) ? Controller::CB_Up : 0;
+	buttons |= SDL_GetGamepadButton(gamepad, SDL_GAMEPAD_BUTTON_DPAD_DOWN) ? Controller::CB_Down : 0;
+	buttons |= SDL_GetGamepadButton(gamepad, SDL_GAMEPAD_BUTTON_DPAD_LEFT) ? Controller::CB_Left : 0;
+	buttons |= SDL_GetGamepadButton(gamepad, SDL_GAMEPAD_BUTTON_DPAD_RIGHT) ? Controller::CB_Right : 0;
+
+	return buttons;
+}
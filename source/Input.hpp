@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class Scheduler;
+struct SDL_Gamepad;
+union SDL_Event;
+
+// Reads the keyboard and any gamepads on the UI thread, and hands the buttons
+// held to the scheduler as controller 1 once per UI frame. Keys are the arrow
+// keys, Z and X for B and A, Right Shift for Select and Enter for Start.
+class Input
+{
+public:
+	explicit Input(Scheduler& scheduler);
+	~Input();
+
+	Input(const Input&) = delete;
+	Input& operator=(const Input&) = delete;
+
+	// Picks up gamepads being connected and disconnected.
+	void HandleEvent(const SDL_Event& event);
+
+	// Call once per UI frame, after handling events. The keyboard is left out
+	// while the UI is using it.
+	void Update(bool useKeyboard);
+
+private:
+	uint8_t ReadKeyboard() const;
+	uint8_t ReadGamepad(SDL_Gamepad* gamepad) const;
+
+	Scheduler&                mScheduler;
+	std::vector<SDL_Gamepad*> mGamepads;
+};
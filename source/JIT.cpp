@@ -0,0 +1,1353 @@
+#include "JIT.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include "System.hpp"
+
+#if defined(COJONES_JIT)
+
+#if !(defined(__x86_64__) || defined(_M_X64))
+#error "The JIT only generates x86-64 code"
+#endif
+
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+	enum HostRegister : uint8_t
+	{
+		RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+		R8, R9, R10, R11, R12, R13, R14, R15
+	};
+
+	// Guest state and pointers kept in callee saved registers, so they survive
+	// calls back into the emulator.
+	constexpr HostRegister kRegA = RBX;
+	constexpr HostRegister kRegX = RBP;
+	constexpr HostRegister kRegY = R12;
+	constexpr HostRegister kRegCalledOut = R13; // Non-zero once a slow path has run.
+	constexpr HostRegister kRegCPU = R14;
+	constexpr HostRegister kRegPages = R15;     // System's read page table.
+
+	// Value for the write half of a read-modify-write, caller saved so it
+	// mustn't be live across a call.
+	constexpr HostRegister kRegValue = R10;
+
+#ifdef _WIN32
+	constexpr HostRegister kArgs[] = { RCX, RDX, R8 };
+
+	// Home space for the callee's arguments, plus 8 to keep the stack 16 byte
+	// aligned after six pushes.
+	constexpr uint8_t kStackReserve = 40;
+#else
+	constexpr HostRegister kArgs[] = { RDI, RSI, RDX };
+	constexpr uint8_t kStackReserve = 8;
+#endif
+
+	// Somewhere to keep ECX across a call.
+	constexpr int32_t kSpillSlot = kStackReserve - 8;
+
+	constexpr size_t kCodeSize = 4 * 1024 * 1024;
+
+	enum Condition : uint8_t
+	{
+		CC_AboveEqual = 0x3,
+		CC_Equal      = 0x4,
+		CC_NotEqual   = 0x5
+	};
+
+	// The /digit of the 0x81 and 0x83 group, times 8 plus 1 gives the reg,
+	// r/m form.
+	enum HostAlu : uint8_t
+	{
+		HA_Add = 0,
+		HA_Or  = 1,
+		HA_And = 4,
+		HA_Sub = 5,
+		HA_Xor = 6,
+		HA_Cmp = 7
+	};
+
+	enum HostShift : uint8_t
+	{
+		HS_Left  = 4,
+		HS_Right = 5
+	};
+
+	// Instructions that get native code, everything else is interpreted. That
+	// includes indirect addressing, so those opcodes aren't listed below.
+	enum JitOp : uint8_t
+	{
+		JO_Interpret,
+		JO_ADC, JO_AND, JO_ASL, JO_BCC, JO_BCS, JO_BEQ, JO_BIT, JO_BMI, JO_BNE, JO_BPL, JO_BVC, JO_BVS,
+		JO_CLC, JO_CLV, JO_CMP, JO_CPX, JO_CPY, JO_DEC, JO_DEX, JO_DEY, JO_EOR, JO_INC, JO_INX, JO_INY,
+		JO_JMP, JO_LDA, JO_LDX, JO_LDY, JO_LSR, JO_NOP, JO_ORA, JO_ROL, JO_ROR, JO_SBC, JO_SEC, JO_STA,
+		JO_STX, JO_STY, JO_TAX, JO_TAY, JO_TXA, JO_TYA
+	};
+
+	JitOp GetJitOp(Opcodes opcode)
+	{
+		switch (opcode)
+		{
+			case Opcodes::ADC_immediate:
+			case Opcodes::ADC_zeropage:
+			case Opcodes::ADC_zeropage_X:
+			case Opcodes::ADC_absolute:
+			case Opcodes::ADC_absolute_X:
+			case Opcodes::ADC_absolute_Y:
+				return JO_ADC;
+
+			case Opcodes::AND_immediate:
+			case Opcodes::AND_zeropage:
+			case Opcodes::AND_zeropage_X:
+			case Opcodes::AND_absolute:
+			case Opcodes::AND_absolute_X:
+			case Opcodes::AND_absolute_Y:
+				return JO_AND;
+
+			case Opcodes::ASL_accumulator:
+			case Opcodes::ASL_zeropage:
+			case Opcodes::ASL_zeropage_X:
+			case Opcodes::ASL_absolute:
+			case Opcodes::ASL_absolute_X:
+				return JO_ASL;
+
+			case Opcodes::BCC_relative:
+				return JO_BCC;
+
+			case Opcodes::BCS_relative:
+				return JO_BCS;
+
+			case Opcodes::BEQ_relative:
+				return JO_BEQ;
+
+			case Opcodes::BIT_zeropage:
+			case Opcodes::BIT_absolute:
+				return JO_BIT;
+
+			case Opcodes::BMI_relative:
+				return JO_BMI;
+
+			case Opcodes::BNE_relative:
+				return JO_BNE;
+
+			case Opcodes::BPL_relative:
+				return JO_BPL;
+
+			case Opcodes::BVC_relative:
+				return JO_BVC;
+
+			case Opcodes::BVS_relative:
+				return JO_BVS;
+
+			case Opcodes::CLC:
+				return JO_CLC;
+
+			case Opcodes::CLV:
+				return JO_CLV;
+
+			case Opcodes::CMP_immediate:
+			case Opcodes::CMP_zeropage:
+			case Opcodes::CMP_zeropage_X:
+			case Opcodes::CMP_absolute:
+			case Opcodes::CMP_absolute_X:
+			case Opcodes::CMP_absolute_Y:
+				return JO_CMP;
+
+			case Opcodes::CPX_immediate:
+			case Opcodes::CPX_zeropage:
+			case Opcodes::CPX_absolute:
+				return JO_CPX;
+
+			case Opcodes::CPY_immediate:
+			case Opcodes::CPY_zeropage:
+			case Opcodes::CPY_absolute:
+				return JO_CPY;
+
+			case Opcodes::DEC_zeropage:
+			case Opcodes::DEC_zeropage_X:
+			case Opcodes::DEC_absolute:
+			case Opcodes::DEC_absolute_X:
+				return JO_DEC;
+
+			case Opcodes::DEX:
+				return JO_DEX;
+
+			case Opcodes::DEY:
+				return JO_DEY;
+
+			case Opcodes::EOR_immediate:
+			case Opcodes::EOR_zeropage:
+			case Opcodes::EOR_zeropage_X:
+			case Opcodes::EOR_absolute:
+			case Opcodes::EOR_absolute_X:
+			case Opcodes::EOR_absolute_Y:
+				return JO_EOR;
+
+			case Opcodes::INC_zeropage:
+			case Opcodes::INC_zeropage_X:
+			case Opcodes::INC_absolute:
+			case Opcodes::INC_absolute_X:
+				return JO_INC;
+
+			case Opcodes::INX:
+				return JO_INX;
+
+			case Opcodes::INY:
+				return JO_INY;
+
+			case Opcodes::JMP_absolute:
+				return JO_JMP;
+
+			case Opcodes::LDA_immediate:
+			case Opcodes::LDA_zeropage:
+			case Opcodes::LDA_zeropage_X:
+			case Opcodes::LDA_absolute:
+			case Opcodes::LDA_absolute_X:
+			case Opcodes::LDA_absolute_Y:
+				return JO_LDA;
+
+			case Opcodes::LDX_immediate:
+			case Opcodes::LDX_zeropage:
+			case Opcodes::LDX_zeropage_Y:
+			case Opcodes::LDX_absolute:
+			case Opcodes::LDX_absolute_Y:
+				return JO_LDX;
+
+			case Opcodes::LDY_immediate:
+			case Opcodes::LDY_zeropage:
+			case Opcodes::LDY_zeropage_X:
+			case Opcodes::LDY_absolute:
+			case Opcodes::LDY_absolute_X:
+				return JO_LDY;
+
+			case Opcodes::LSR_accumulator:
+			case Opcodes::LSR_zeropage:
+			case Opcodes::LSR_zeropage_X:
+			case Opcodes::LSR_absolute:
+			case Opcodes::LSR_absolute_X:
+				return JO_LSR;
+
+			case Opcodes::NOP:
+				return JO_NOP;
+
+			case Opcodes::ORA_immediate:
+			case Opcodes::ORA_zeropage:
+			case Opcodes::ORA_zeropage_X:
+			case Opcodes::ORA_absolute:
+			case Opcodes::ORA_absolute_X:
+			case Opcodes::ORA_absolute_Y:
+				return JO_ORA;
+
+			case Opcodes::ROL_accumulator:
+			case Opcodes::ROL_zeropage:
+			case Opcodes::ROL_zeropage_X:
+			case Opcodes::ROL_absolute:
+			case Opcodes::ROL_absolute_X:
+				return JO_ROL;
+
+			case Opcodes::ROR_accumulator:
+			case Opcodes::ROR_zeropage:
+			case Opcodes::ROR_zeropage_X:
+			case Opcodes::ROR_absolute:
+			case Opcodes::ROR_absolute_X:
+				return JO_ROR;
+
+			case Opcodes::SBC_immediate:
+			case Opcodes::SBC_zeropage:
+			case Opcodes::SBC_zeropage_X:
+			case Opcodes::SBC_absolute:
+			case Opcodes::SBC_absolute_X:
+			case Opcodes::SBC_absolute_Y:
+				return JO_SBC;
+
+			case Opcodes::SEC:
+				return JO_SEC;
+
+			case Opcodes::STA_zeropage:
+			case Opcodes::STA_zeropage_X:
+			case Opcodes::STA_absolute:
+			case Opcodes::STA_absolute_X:
+			case Opcodes::STA_absolute_Y:
+				return JO_STA;
+
+			case Opcodes::STX_zeropage:
+			case Opcodes::STX_zeropage_Y:
+			case Opcodes::STX_absolute:
+				return JO_STX;
+
+			case Opcodes::STY_zeropage:
+			case Opcodes::STY_zeropage_X:
+			case Opcodes::STY_absolute:
+				return JO_STY;
+
+			case Opcodes::TAX:
+				return JO_TAX;
+
+			case Opcodes::TAY:
+				return JO_TAY;
+
+			case Opcodes::TXA:
+				return JO_TXA;
+
+			case Opcodes::TYA:
+				return JO_TYA;
+
+			default:
+				return JO_Interpret;
+		}
+	}
+
+	uint64_t GetAddress(const void* pointer)
+	{
+		return reinterpret_cast<uint64_t>(pointer);
+	}
+
+	template <typename Func>
+	uint64_t GetFunctionAddress(Func* func)
+	{
+		return reinterpret_cast<uint64_t>(func);
+	}
+}
+
+// Just the encodings the JIT needs. Memory operands are always [base +
+// disp32] or [base + index * scale + disp32], 32 bit operations zero the top
+// of the register so values can be built up in 32 bit registers and stored
+// as bytes or words.
+class JIT::Assembler
+{
+public:
+	explicit Assembler(std::vector<uint8_t>& code)
+		: mCode(code)
+	{
+	}
+
+	size_t GetPosition() const { return mCode.size(); }
+
+	// Stubs that are only jumped to, kept out of the way of the straight
+	// line code until the end of the block.
+	void Defer(std::function<void(Assembler&)> emit) { mDeferred.push_back(std::move(emit)); }
+
+	void EmitDeferred()
+	{
+		for (size_t i = 0; i < mDeferred.size(); ++i)
+		{
+			mDeferred[i](*this);
+		}
+		mDeferred.clear();
+	}
+
+	// Set when an instruction's code can call out to a handler.
+	bool hasSlowPath = false;
+
+	void Push(uint8_t reg)
+	{
+		Rex(false, 0, 0, reg);
+		Byte(0x50 | (reg & 7));
+	}
+
+	void Pop(uint8_t reg)
+	{
+		Rex(false, 0, 0, reg);
+		Byte(0x58 | (reg & 7));
+	}
+
+	void Ret() { Byte(0xC3); }
+
+	void CallRax()
+	{
+		Byte(0xFF);
+		Byte(0xD0);
+	}
+
+	void Call(uint64_t function)
+	{
+		MovImm64(RAX, function);
+		CallRax();
+	}
+
+	void MovImm32(uint8_t dst, uint32_t imm)
+	{
+		Rex(false, 0, 0, dst);
+		Byte(0xB8 | (dst & 7));
+		Imm32(imm);
+	}
+
+	void MovImm64(uint8_t dst, uint64_t imm)
+	{
+		Rex(true, 0, 0, dst);
+		Byte(0xB8 | (dst & 7));
+		Imm64(imm);
+	}
+
+	void Mov32(uint8_t dst, uint8_t src)
+	{
+		Rex(false, src, 0, dst);
+		Byte(0x89);
+		ModRMRegister(src, dst);
+	}
+
+	void Mov64(uint8_t dst, uint8_t src)
+	{
+		Rex(true, src, 0, dst);
+		Byte(0x89);
+		ModRMRegister(src, dst);
+	}
+
+	void Alu(HostAlu op, uint8_t dst, uint8_t src)
+	{
+		Rex(false, src, 0, dst);
+		Byte(static_cast<uint8_t>(op << 3 | 1));
+		ModRMRegister(src, dst);
+	}
+
+	void AluImm(HostAlu op, uint8_t dst, uint32_t imm)
+	{
+		Rex(false, 0, 0, dst);
+		Byte(0x81);
+		ModRMRegister(op, dst);
+		Imm32(imm);
+	}
+
+	void Alu64Imm8(HostAlu op, uint8_t dst, uint8_t imm)
+	{
+		Rex(true, 0, 0, dst);
+		Byte(0x83);
+		ModRMRegister(op, dst);
+		Byte(imm);
+	}
+
+	void Shift(HostShift op, uint8_t dst, uint8_t count)
+	{
+		Rex(false, 0, 0, dst);
+		Byte(0xC1);
+		ModRMRegister(op, dst);
+		Byte(count);
+	}
+
+	void Test32(uint8_t lhs, uint8_t rhs)
+	{
+		Rex(false, rhs, 0, lhs);
+		Byte(0x85);
+		ModRMRegister(rhs, lhs);
+	}
+
+	void Test64(uint8_t lhs, uint8_t rhs)
+	{
+		Rex(true, rhs, 0, lhs);
+		Byte(0x85);
+		ModRMRegister(rhs, lhs);
+	}
+
+	void TestAl()
+	{
+		Byte(0x84);
+		Byte(0xC0);
+	}
+
+	// movzx dst, src's low byte.
+	void MovzxByte(uint8_t dst, uint8_t src)
+	{
+		Rex(false, dst, 0, src, src >= RSP);
+		Byte(0x0F);
+		Byte(0xB6);
+		ModRMRegister(dst, src);
+	}
+
+	void LoadByte(uint8_t dst, uint8_t base, int32_t disp)
+	{
+		Rex(false, dst, 0, base);
+		Byte(0x0F);
+		Byte(0xB6);
+		ModRMMemory(dst, base, disp);
+	}
+
+	void Load32(uint8_t dst, uint8_t base, int32_t disp)
+	{
+		Rex(false, dst, 0, base);
+		Byte(0x8B);
+		ModRMMemory(dst, base, disp);
+	}
+
+	void Load64(uint8_t dst, uint8_t base, int32_t disp)
+	{
+		Rex(true, dst, 0, base);
+		Byte(0x8B);
+		ModRMMemory(dst, base, disp);
+	}
+
+	void Cmp64(uint8_t lhs, uint8_t base, int32_t disp)
+	{
+		Rex(true, lhs, 0, base);
+		Byte(0x3B);
+		ModRMMemory(lhs, base, disp);
+	}
+
+	void StoreByte(uint8_t base, int32_t disp, uint8_t src)
+	{
+		Rex(false, src, 0, base, true);
+		Byte(0x88);
+		ModRMMemory(src, base, disp);
+	}
+
+	void StoreWord(uint8_t base, int32_t disp, uint8_t src)
+	{
+		Byte(0x66);
+		Rex(false, src, 0, base);
+		Byte(0x89);
+		ModRMMemory(src, base, disp);
+	}
+
+	void Store32(uint8_t base, int32_t disp, uint8_t src)
+	{
+		Rex(false, src, 0, base);
+		Byte(0x89);
+		ModRMMemory(src, base, disp);
+	}
+
+	void StoreByteImm(uint8_t base, int32_t disp, uint8_t imm)
+	{
+		Rex(false, 0, 0, base);
+		Byte(0xC6);
+		ModRMMemory(0, base, disp);
+		Byte(imm);
+	}
+
+	void StoreWordImm(uint8_t base, int32_t disp, uint16_t imm)
+	{
+		Byte(0x66);
+		Rex(false, 0, 0, base);
+		Byte(0xC7);
+		ModRMMemory(0, base, disp);
+		Byte(static_cast<uint8_t>(imm));
+		Byte(static_cast<uint8_t>(imm >> 8));
+	}
+
+	void Add64MemoryImm8(uint8_t base, int32_t disp, uint8_t imm)
+	{
+		Rex(true, 0, 0, base);
+		Byte(0x83);
+		ModRMMemory(HA_Add, base, disp);
+		Byte(imm);
+	}
+
+	void TestByteImm(uint8_t base, int32_t disp, uint8_t imm)
+	{
+		Rex(false, 0, 0, base);
+		Byte(0xF6);
+		ModRMMemory(0, base, disp);
+		Byte(imm);
+	}
+
+	void Load64Indexed(uint8_t dst, uint8_t base, uint8_t index, int32_t disp)
+	{
+		Rex(true, dst, index, base);
+		Byte(0x8B);
+		ModRMIndexed(dst, base, index, 3, disp);
+	}
+
+	void LoadByteIndexed(uint8_t dst, uint8_t base, uint8_t index)
+	{
+		Rex(false, dst, index, base);
+		Byte(0x0F);
+		Byte(0xB6);
+		ModRMIndexed(dst, base, index, 0, 0);
+	}
+
+	void StoreByteIndexed(uint8_t base, uint8_t index, uint8_t src)
+	{
+		Rex(false, src, index, base, true);
+		Byte(0x88);
+		ModRMIndexed(src, base, index, 0, 0);
+	}
+
+	// Forward jumps return where their offset goes, for Bind().
+	size_t Jcc(Condition condition)
+	{
+		Byte(0x0F);
+		Byte(0x80 | condition);
+		Imm32(0);
+		return GetPosition() - 4;
+	}
+
+	size_t Jmp()
+	{
+		Byte(0xE9);
+		Imm32(0);
+		return GetPosition() - 4;
+	}
+
+	void JccTo(Condition condition, size_t target)
+	{
+		Patch(Jcc(condition), target);
+	}
+
+	void JmpTo(size_t target)
+	{
+		Patch(Jmp(), target);
+	}
+
+	void Bind(size_t fixup)
+	{
+		Patch(fixup, GetPosition());
+	}
+
+private:
+	void Byte(uint8_t value) { mCode.push_back(value); }
+
+	void Imm32(uint32_t value)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			Byte(static_cast<uint8_t>(value >> (i * 8)));
+		}
+	}
+
+	void Imm64(uint64_t value)
+	{
+		for (int i = 0; i < 8; ++i)
+		{
+			Byte(static_cast<uint8_t>(value >> (i * 8)));
+		}
+	}
+
+	void Patch(size_t fixup, size_t target)
+	{
+		uint32_t offset = static_cast<uint32_t>(static_cast<int32_t>(target - (fixup + 4)));
+		for (size_t i = 0; i < 4; ++i)
+		{
+			mCode[fixup + i] = static_cast<uint8_t>(offset >> (i * 8));
+		}
+	}
+
+	// Byte registers 4-7 are AH-BH without a REX prefix, SPL-DIL with one.
+	void Rex(bool wide, uint8_t reg, uint8_t index, uint8_t base, bool isByteRegister = false)
+	{
+		uint8_t rex = static_cast<uint8_t>(0x40 | (wide ? 8 : 0) | (reg & 8) >> 1 | (index & 8) >> 2 | (base & 8) >> 3);
+		if (rex != 0x40 || (isByteRegister && (reg >= RSP || base >= RSP)))
+		{
+			Byte(rex);
+		}
+	}
+
+	void ModRMRegister(uint8_t reg, uint8_t rm)
+	{
+		Byte(static_cast<uint8_t>(0xC0 | (reg & 7) << 3 | (rm & 7)));
+	}
+
+	void ModRMMemory(uint8_t reg, uint8_t base, int32_t disp)
+	{
+		Byte(static_cast<uint8_t>(0x80 | (reg & 7) << 3 | (base & 7)));
+		if ((base & 7) == RSP)
+		{
+			Byte(0x24);
+		}
+		Imm32(static_cast<uint32_t>(disp));
+	}
+
+	void ModRMIndexed(uint8_t reg, uint8_t base, uint8_t index, uint8_t scaleLog2, int32_t disp)
+	{
+		Byte(static_cast<uint8_t>(0x84 | (reg & 7) << 3));
+		Byte(static_cast<uint8_t>(scaleLog2 << 6 | (index & 7) << 3 | (base & 7)));
+		Imm32(static_cast<uint32_t>(disp));
+	}
+
+	std::vector<uint8_t>& mCode;
+	std::vector<std::function<void(Assembler&)>> mDeferred;
+};
+
+JIT::JIT(CPU& cpu, System& system)
+	: mCPU(cpu)
+	, mSystem(system)
+{
+	auto offset = [&cpu](const void* field)
+	{
+		return static_cast<int32_t>(static_cast<const uint8_t*>(field) - reinterpret_cast<const uint8_t*>(&cpu));
+	};
+
+	mFields.PC = offset(&cpu.registers.PC);
+	mFields.ACC = offset(&cpu.registers.ACC);
+	mFields.IX = offset(&cpu.registers.IX);
+	mFields.IY = offset(&cpu.registers.IY);
+	mFields.zResult = offset(&cpu.mZResult);
+	mFields.nResult = offset(&cpu.mNResult);
+	mFields.carryResult = offset(&cpu.mCarryResult);
+	mFields.overflowResult = offset(&cpu.mOverflowResult);
+	mFields.cycles = offset(&cpu.mCycles);
+	mFields.runUntilCycles = offset(&cpu.mRunUntilCycles);
+	mFields.opcode = offset(&cpu.mCurrentOpcode);
+	mFields.operand = offset(&cpu.mCurrentOperand);
+
+	mWritePagesOffset = static_cast<int32_t>(reinterpret_cast<const uint8_t*>(system.GetWritePageTable()) -
+		reinterpret_cast<const uint8_t*>(system.GetReadPageTable()));
+
+#ifdef _WIN32
+	mCode = static_cast<uint8_t*>(VirtualAlloc(nullptr, kCodeSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+#else
+	void* code = mmap(nullptr, kCodeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	mCode = code == MAP_FAILED ? nullptr : static_cast<uint8_t*>(code);
+#endif
+
+	if (!mCode)
+	{
+		SPDLOG_ERROR("Couldn't allocate memory for compiled code");
+	}
+}
+
+JIT::~JIT()
+{
+	if (mCode)
+	{
+#ifdef _WIN32
+		VirtualFree(mCode, 0, MEM_RELEASE);
+#else
+		munmap(mCode, kCodeSize);
+#endif
+	}
+}
+
+void JIT::Reset()
+{
+	mCodeUsed = 0;
+}
+
+CPU::NativeFunc JIT::Compile(const CPU::Block& block)
+{
+	if (!mCode)
+	{
+		return nullptr;
+	}
+
+	mAssembly.clear();
+	Assembler a(mAssembly);
+
+	// Every way out of the block ends up here, so it goes first and the
+	// block's code starts after it.
+	EmitEpilogue(a);
+
+	const size_t entry = a.GetPosition();
+	EmitPrologue(a);
+
+	uint16_t PC = block.PC;
+	for (size_t i = 0; i < block.length; ++i)
+	{
+		EmitInstruction(a, block, i, PC);
+		PC += block.instructions[i].length;
+	}
+
+	a.EmitDeferred();
+
+	const size_t start = (mCodeUsed + 15) & ~size_t(15);
+	if (start + mAssembly.size() > kCodeSize)
+	{
+		return nullptr;
+	}
+
+	// Never writable and executable at the same time.
+#ifdef _WIN32
+	DWORD oldProtection = 0;
+	VirtualProtect(mCode, kCodeSize, PAGE_READWRITE, &oldProtection);
+	std::memcpy(mCode + start, mAssembly.data(), mAssembly.size());
+	VirtualProtect(mCode, kCodeSize, PAGE_EXECUTE_READ, &oldProtection);
+#else
+	mprotect(mCode, kCodeSize, PROT_READ | PROT_WRITE);
+	std::memcpy(mCode + start, mAssembly.data(), mAssembly.size());
+	mprotect(mCode, kCodeSize, PROT_READ | PROT_EXEC);
+#endif
+
+	mCodeUsed = start + mAssembly.size();
+
+	return reinterpret_cast<CPU::NativeFunc>(mCode + start + entry);
+}
+
+void JIT::EmitPrologue(Assembler& a)
+{
+	for (HostRegister reg : { RBX, RBP, R12, R13, R14, R15 })
+	{
+		a.Push(reg);
+	}
+	a.Alu64Imm8(HA_Sub, RSP, kStackReserve);
+
+	a.Mov64(kRegCPU, kArgs[0]);
+	a.MovImm64(kRegPages, GetAddress(mSystem.GetReadPageTable()));
+	a.Alu(HA_Xor, kRegCalledOut, kRegCalledOut);
+
+	a.LoadByte(kRegA, kRegCPU, mFields.ACC);
+	a.LoadByte(kRegX, kRegCPU, mFields.IX);
+	a.LoadByte(kRegY, kRegCPU, mFields.IY);
+}
+
+void JIT::EmitEpilogue(Assembler& a)
+{
+	a.StoreByte(kRegCPU, mFields.ACC, kRegA);
+	a.StoreByte(kRegCPU, mFields.IX, kRegX);
+	a.StoreByte(kRegCPU, mFields.IY, kRegY);
+
+	a.Alu64Imm8(HA_Add, RSP, kStackReserve);
+	for (HostRegister reg : { R15, R14, R13, R12, RBP, RBX })
+	{
+		a.Pop(reg);
+	}
+	a.Ret();
+}
+
+void JIT::EmitInstruction(Assembler& a, const CPU::Block& block, size_t index, uint16_t PC)
+{
+	const CPU::DecodedInstruction& instruction = block.instructions[index];
+	const CPU::AddressingMode mode = instruction.mode;
+	const uint16_t operandBytes = instruction.operandBytes;
+	const uint16_t nextPC = static_cast<uint16_t>(PC + instruction.length);
+	const uint8_t opcode = static_cast<uint8_t>(instruction.opcode);
+
+	const JitOp op = GetJitOp(instruction.opcode);
+	if (op == JO_Interpret)
+	{
+		EmitInterpreterCall(a, block, index, nextPC);
+		return;
+	}
+
+	a.hasSlowPath = false;
+	a.Add64MemoryImm8(kRegCPU, mFields.cycles, instruction.cycles);
+
+	if (mode == CPU::AM_Relative)
+	{
+		// Branches always end a block. Where they go is known now, and so is
+		// whether that's on another page.
+		const uint16_t target = static_cast<uint16_t>(nextPC + static_cast<int8_t>(operandBytes));
+		const bool isPageCrossed = (nextPC & 0xFF00) != (target & 0xFF00);
+
+		struct BranchTest { int32_t field; uint8_t mask; bool isTakenWhenZero; };
+		BranchTest test = {};
+		switch (op)
+		{
+			case JO_BCC: test = { mFields.carryResult + 1, 0x01, true }; break;
+			case JO_BCS: test = { mFields.carryResult + 1, 0x01, false }; break;
+			case JO_BEQ: test = { mFields.zResult, 0xFF, true }; break;
+			case JO_BNE: test = { mFields.zResult, 0xFF, false }; break;
+			case JO_BMI: test = { mFields.nResult, 0x80, false }; break;
+			case JO_BPL: test = { mFields.nResult, 0x80, true }; break;
+			case JO_BVC: test = { mFields.overflowResult, 0x80, true }; break;
+			case JO_BVS: test = { mFields.overflowResult, 0x80, false }; break;
+			default: break;
+		}
+
+		a.StoreByteImm(kRegCPU, mFields.opcode, opcode);
+		a.StoreWordImm(kRegCPU, mFields.operand, target);
+
+		a.TestByteImm(kRegCPU, test.field, test.mask);
+		size_t notTaken = a.Jcc(test.isTakenWhenZero ? CC_NotEqual : CC_Equal);
+
+		a.Add64MemoryImm8(kRegCPU, mFields.cycles, isPageCrossed ? 2 : 1);
+		a.StoreWordImm(kRegCPU, mFields.PC, target);
+		a.JmpTo(0);
+
+		a.Bind(notTaken);
+		a.StoreWordImm(kRegCPU, mFields.PC, nextPC);
+		a.JmpTo(0);
+		return;
+	}
+
+	if (op == JO_JMP)
+	{
+		a.StoreByteImm(kRegCPU, mFields.opcode, opcode);
+		a.StoreWordImm(kRegCPU, mFields.operand, operandBytes);
+		a.StoreWordImm(kRegCPU, mFields.PC, operandBytes);
+		a.JmpTo(0);
+		return;
+	}
+
+	// What GetOperand() returns, indexed addresses are stored as they're
+	// worked out.
+	const bool isIndexed = mode == CPU::AM_ZeroPageX || mode == CPU::AM_ZeroPageY || mode == CPU::AM_AbsoluteX || mode == CPU::AM_AbsoluteY;
+	const uint16_t operand = mode == CPU::AM_Implied || mode == CPU::AM_Accumulator ? 0 : operandBytes;
+
+	EmitAddress(a, mode, operandBytes);
+
+	auto emitIndexedReadCycle = [&]()
+	{
+		if (mode == CPU::AM_AbsoluteX || mode == CPU::AM_AbsoluteY)
+		{
+			a.Mov32(RAX, RCX);
+			a.AluImm(HA_Xor, RAX, operandBytes);
+			a.AluImm(HA_And, RAX, 0xFF00);
+			size_t samePage = a.Jcc(CC_Equal);
+			a.Add64MemoryImm8(kRegCPU, mFields.cycles, 1);
+			a.Bind(samePage);
+		}
+	};
+
+	auto setZeroNegative = [&](uint8_t reg)
+	{
+		a.StoreByte(kRegCPU, mFields.zResult, reg);
+		a.StoreByte(kRegCPU, mFields.nResult, reg);
+	};
+
+	// Same as CPU::Alu(), with the operand in EAX.
+	auto emitAlu = [&](CPU::AluOperation operation, uint8_t lhs)
+	{
+		if (operation != CPU::AO_Add)
+		{
+			a.AluImm(HA_Xor, RAX, 0xFF);
+		}
+
+		if (operation == CPU::AO_Compare)
+		{
+			a.MovImm32(RCX, 1);
+		}
+		else
+		{
+			a.LoadByte(RCX, kRegCPU, mFields.carryResult + 1);
+		}
+
+		a.Alu(HA_Add, RCX, lhs);
+		a.Alu(HA_Add, RCX, RAX);
+
+		if (operation != CPU::AO_Compare)
+		{
+			a.Mov32(RDX, lhs);
+			a.Alu(HA_Xor, RDX, RCX);
+			a.Alu(HA_Xor, RAX, RCX);
+			a.Alu(HA_And, RAX, RDX);
+			a.StoreByte(kRegCPU, mFields.overflowResult, RAX);
+		}
+
+		a.StoreWord(kRegCPU, mFields.carryResult, RCX);
+		setZeroNegative(RCX);
+
+		if (operation != CPU::AO_Compare)
+		{
+			a.MovzxByte(lhs, RCX);
+		}
+	};
+
+	// Read-modify-writes work on EAX. ECX can still hold the address, so only
+	// EDX is free.
+	auto emitModify = [&]()
+	{
+		switch (op)
+		{
+			case JO_ASL:
+				a.Shift(HS_Left, RAX, 1);
+				a.StoreWord(kRegCPU, mFields.carryResult, RAX);
+				a.AluImm(HA_And, RAX, 0xFF);
+				break;
+			case JO_LSR:
+				a.Mov32(RDX, RAX);
+				a.AluImm(HA_And, RDX, 0x01);
+				a.Shift(HS_Left, RDX, 8);
+				a.StoreWord(kRegCPU, mFields.carryResult, RDX);
+				a.Shift(HS_Right, RAX, 1);
+				break;
+			case JO_ROL:
+				a.LoadByte(RDX, kRegCPU, mFields.carryResult + 1);
+				a.Shift(HS_Left, RAX, 1);
+				a.StoreWord(kRegCPU, mFields.carryResult, RAX);
+				a.Alu(HA_Or, RAX, RDX);
+				a.AluImm(HA_And, RAX, 0xFF);
+				break;
+			case JO_ROR:
+				// The old carry goes in above bit 7 and comes out at bit 7.
+				a.LoadByte(RDX, kRegCPU, mFields.carryResult + 1);
+				a.Shift(HS_Left, RDX, 8);
+				a.Alu(HA_Or, RAX, RDX);
+				a.Mov32(RDX, RAX);
+				a.AluImm(HA_And, RDX, 0x01);
+				a.Shift(HS_Left, RDX, 8);
+				a.StoreWord(kRegCPU, mFields.carryResult, RDX);
+				a.Shift(HS_Right, RAX, 1);
+				break;
+			case JO_INC:
+				a.AluImm(HA_Add, RAX, 1);
+				a.AluImm(HA_And, RAX, 0xFF);
+				break;
+			default:
+				a.AluImm(HA_Sub, RAX, 1);
+				a.AluImm(HA_And, RAX, 0xFF);
+				break;
+		}
+
+		setZeroNegative(RAX);
+	};
+
+	// Transfers only set Z, and C from bit 7. See CPU::TAX().
+	auto emitTransfer = [&](uint8_t dst, uint8_t src)
+	{
+		a.Mov32(dst, src);
+		a.StoreByte(kRegCPU, mFields.zResult, dst);
+		a.Mov32(RAX, dst);
+		a.Shift(HS_Left, RAX, 1);
+		a.StoreWord(kRegCPU, mFields.carryResult, RAX);
+	};
+
+	auto emitIncrement = [&](HostAlu alu, uint8_t reg)
+	{
+		a.AluImm(alu, reg, 1);
+		a.AluImm(HA_And, reg, 0xFF);
+		setZeroNegative(reg);
+	};
+
+	switch (op)
+	{
+		case JO_LDA:
+		case JO_LDX:
+		case JO_LDY:
+		{
+			emitIndexedReadCycle();
+			EmitRead(a, mode, operandBytes);
+			uint8_t reg = op == JO_LDA ? kRegA : op == JO_LDX ? kRegX : kRegY;
+			a.Mov32(reg, RAX);
+			setZeroNegative(reg);
+			break;
+		}
+
+		case JO_AND:
+		case JO_ORA:
+		case JO_EOR:
+			emitIndexedReadCycle();
+			EmitRead(a, mode, operandBytes);
+			a.Alu(op == JO_AND ? HA_And : op == JO_ORA ? HA_Or : HA_Xor, kRegA, RAX);
+			setZeroNegative(kRegA);
+			break;
+
+		case JO_ADC:
+		case JO_SBC:
+		case JO_CMP:
+		case JO_CPX:
+		case JO_CPY:
+			emitIndexedReadCycle();
+			EmitRead(a, mode, operandBytes);
+			if (op == JO_ADC || op == JO_SBC)
+			{
+				emitAlu(op == JO_ADC ? CPU::AO_Add : CPU::AO_Subtract, kRegA);
+			}
+			else
+			{
+				emitAlu(CPU::AO_Compare, op == JO_CMP ? kRegA : op == JO_CPX ? kRegX : kRegY);
+			}
+			break;
+
+		case JO_BIT:
+			EmitRead(a, mode, operandBytes);
+			a.StoreByte(kRegCPU, mFields.nResult, RAX);
+			a.Mov32(RCX, RAX);
+			a.Alu(HA_And, RCX, kRegA);
+			a.StoreByte(kRegCPU, mFields.zResult, RCX);
+			a.Shift(HS_Left, RAX, 1);
+			a.StoreByte(kRegCPU, mFields.overflowResult, RAX);
+			break;
+
+		case JO_STA:
+			EmitWrite(a, mode, operandBytes, kRegA);
+			break;
+		case JO_STX:
+			EmitWrite(a, mode, operandBytes, kRegX);
+			break;
+		case JO_STY:
+			EmitWrite(a, mode, operandBytes, kRegY);
+			break;
+
+		case JO_ASL:
+		case JO_LSR:
+		case JO_ROL:
+		case JO_ROR:
+		case JO_INC:
+		case JO_DEC:
+			if (mode == CPU::AM_Accumulator)
+			{
+				a.Mov32(RAX, kRegA);
+				emitModify();
+				a.Mov32(kRegA, RAX);
+			}
+			else
+			{
+				EmitRead(a, mode, operandBytes);
+				emitModify();
+				a.Mov32(kRegValue, RAX);
+				EmitWrite(a, mode, operandBytes, kRegValue);
+			}
+			break;
+
+		case JO_INX: emitIncrement(HA_Add, kRegX); break;
+		case JO_INY: emitIncrement(HA_Add, kRegY); break;
+		case JO_DEX: emitIncrement(HA_Sub, kRegX); break;
+		case JO_DEY: emitIncrement(HA_Sub, kRegY); break;
+
+		case JO_TAX: emitTransfer(kRegX, kRegA); break;
+		case JO_TAY: emitTransfer(kRegY, kRegA); break;
+		case JO_TXA: emitTransfer(kRegA, kRegX); break;
+		case JO_TYA: emitTransfer(kRegA, kRegY); break;
+
+		case JO_CLC: a.StoreWordImm(kRegCPU, mFields.carryResult, 0); break;
+		case JO_SEC: a.StoreWordImm(kRegCPU, mFields.carryResult, 0x100); break;
+		case JO_CLV: a.StoreByteImm(kRegCPU, mFields.overflowResult, 0); break;
+
+		default:
+			break;
+	}
+
+	auto emitExit = [=, this](Assembler& exit)
+	{
+		exit.StoreWordImm(kRegCPU, mFields.PC, nextPC);
+		exit.StoreByteImm(kRegCPU, mFields.opcode, opcode);
+		if (!isIndexed)
+		{
+			exit.StoreWordImm(kRegCPU, mFields.operand, operand);
+		}
+		exit.JmpTo(0);
+	};
+
+	if (index + 1 == block.length)
+	{
+		emitExit(a);
+		return;
+	}
+
+	// The same checks as CPU::RunBlock(), but only the cycle count can have
+	// changed unless something outside the block ran.
+	const bool hasSlowPath = a.hasSlowPath;
+	size_t calledOut = 0;
+	if (hasSlowPath)
+	{
+		a.Test32(kRegCalledOut, kRegCalledOut);
+		calledOut = a.Jcc(CC_NotEqual);
+	}
+
+	a.Load64(RAX, kRegCPU, mFields.cycles);
+	a.Cmp64(RAX, kRegCPU, mFields.runUntilCycles);
+	size_t outOfCycles = a.Jcc(CC_AboveEqual);
+	const size_t resume = a.GetPosition();
+
+	a.Defer([=, this, &block](Assembler& stub)
+	{
+		if (hasSlowPath)
+		{
+			stub.Bind(calledOut);
+			stub.Alu(HA_Xor, kRegCalledOut, kRegCalledOut);
+			EmitCanContinueCall(stub, block);
+			stub.TestAl();
+			stub.JccTo(CC_NotEqual, resume);
+		}
+
+		stub.Bind(outOfCycles);
+		emitExit(stub);
+	});
+}
+
+void JIT::EmitInterpreterCall(Assembler& a, const CPU::Block& block, size_t index, uint16_t nextPC)
+{
+	const CPU::DecodedInstruction& instruction = block.instructions[index];
+
+	// As CPU::RunBlock() leaves things, with the registers where the
+	// interpreter can see them.
+	a.StoreByteImm(kRegCPU, mFields.opcode, static_cast<uint8_t>(instruction.opcode));
+	a.StoreWordImm(kRegCPU, mFields.PC, nextPC);
+	a.StoreByte(kRegCPU, mFields.ACC, kRegA);
+	a.StoreByte(kRegCPU, mFields.IX, kRegX);
+	a.StoreByte(kRegCPU, mFields.IY, kRegY);
+
+	a.MovImm64(kArgs[1], GetAddress(&instruction));
+	a.Mov64(kArgs[0], kRegCPU);
+	a.Call(GetFunctionAddress(&JIT::Interpret));
+
+	a.LoadByte(kRegA, kRegCPU, mFields.ACC);
+	a.LoadByte(kRegX, kRegCPU, mFields.IX);
+	a.LoadByte(kRegY, kRegCPU, mFields.IY);
+
+	// PC is already wherever the instruction left it.
+	if (index + 1 == block.length)
+	{
+		a.JmpTo(0);
+		return;
+	}
+
+	EmitCanContinueCall(a, block);
+	a.TestAl();
+	a.JccTo(CC_Equal, 0);
+}
+
+void JIT::EmitCanContinueCall(Assembler& a, const CPU::Block& block)
+{
+	a.MovImm64(kArgs[1], GetAddress(&block));
+	a.Mov64(kArgs[0], kRegCPU);
+	a.Call(GetFunctionAddress(&JIT::CanContinue));
+}
+
+void JIT::EmitAddress(Assembler& a, CPU::AddressingMode mode, uint16_t operandBytes)
+{
+	const uint8_t index = mode == CPU::AM_ZeroPageX || mode == CPU::AM_AbsoluteX ? kRegX : kRegY;
+
+	switch (mode)
+	{
+		case CPU::AM_ZeroPageX:
+		case CPU::AM_ZeroPageY:
+			// Not wrapped to the zero page, as in CPU::GetOperand().
+			a.Mov32(RCX, index);
+			a.AluImm(HA_Add, RCX, operandBytes);
+			break;
+		case CPU::AM_AbsoluteX:
+		case CPU::AM_AbsoluteY:
+			a.Mov32(RCX, index);
+			a.AluImm(HA_Add, RCX, operandBytes);
+			a.AluImm(HA_And, RCX, 0xFFFF);
+			break;
+		default:
+			return;
+	}
+
+	a.StoreWord(kRegCPU, mFields.operand, RCX);
+}
+
+void JIT::EmitRead(Assembler& a, CPU::AddressingMode mode, uint16_t operandBytes)
+{
+	if (mode == CPU::AM_Immediate)
+	{
+		a.MovImm32(RAX, operandBytes);
+		return;
+	}
+
+	a.hasSlowPath = true;
+
+	if (mode == CPU::AM_ZeroPage || mode == CPU::AM_Absolute)
+	{
+		a.Load64(RAX, kRegPages, (operandBytes >> 8) * 8);
+		a.Test64(RAX, RAX);
+		size_t slow = a.Jcc(CC_Equal);
+		a.LoadByte(RAX, RAX, operandBytes & 0xFF);
+		const size_t resume = a.GetPosition();
+
+		a.Defer([=, this](Assembler& stub)
+		{
+			stub.Bind(slow);
+			stub.MovImm32(kArgs[1], operandBytes);
+			stub.MovImm64(kArgs[0], GetAddress(&mSystem));
+			stub.Call(GetFunctionAddress(&JIT::ReadMemory));
+			stub.MovzxByte(RAX, RAX);
+			stub.MovImm32(kRegCalledOut, 1);
+			stub.JmpTo(resume);
+		});
+		return;
+	}
+
+	a.Mov32(RDX, RCX);
+	a.Shift(HS_Right, RDX, 8);
+	a.Load64Indexed(RAX, kRegPages, RDX, 0);
+	a.Test64(RAX, RAX);
+	size_t slow = a.Jcc(CC_Equal);
+	a.Mov32(RDX, RCX);
+	a.AluImm(HA_And, RDX, 0xFF);
+	a.LoadByteIndexed(RAX, RAX, RDX);
+	const size_t resume = a.GetPosition();
+
+	// The address is still wanted afterwards by read-modify-writes.
+	a.Defer([=, this](Assembler& stub)
+	{
+		stub.Bind(slow);
+		stub.Store32(RSP, kSpillSlot, RCX);
+		stub.Mov32(kArgs[1], RCX);
+		stub.MovImm64(kArgs[0], GetAddress(&mSystem));
+		stub.Call(GetFunctionAddress(&JIT::ReadMemory));
+		stub.MovzxByte(RAX, RAX);
+		stub.MovImm32(kRegCalledOut, 1);
+		stub.Load32(RCX, RSP, kSpillSlot);
+		stub.JmpTo(resume);
+	});
+}
+
+void JIT::EmitWrite(Assembler& a, CPU::AddressingMode mode, uint16_t operandBytes, uint8_t valueRegister)
+{
+	a.hasSlowPath = true;
+
+	if (mode == CPU::AM_ZeroPage || mode == CPU::AM_Absolute)
+	{
+		a.Load64(RAX, kRegPages, mWritePagesOffset + (operandBytes >> 8) * 8);
+		a.Test64(RAX, RAX);
+		size_t slow = a.Jcc(CC_Equal);
+		a.StoreByte(RAX, operandBytes & 0xFF, valueRegister);
+		const size_t resume = a.GetPosition();
+
+		a.Defer([=, this](Assembler& stub)
+		{
+			stub.Bind(slow);
+			stub.Mov32(kArgs[2], valueRegister);
+			stub.MovImm32(kArgs[1], operandBytes);
+			stub.MovImm64(kArgs[0], GetAddress(&mSystem));
+			stub.Call(GetFunctionAddress(&JIT::WriteMemory));
+			stub.MovImm32(kRegCalledOut, 1);
+			stub.JmpTo(resume);
+		});
+		return;
+	}
+
+	a.Mov32(RDX, RCX);
+	a.Shift(HS_Right, RDX, 8);
+	a.Load64Indexed(RAX, kRegPages, RDX, mWritePagesOffset);
+	a.Test64(RAX, RAX);
+	size_t slow = a.Jcc(CC_Equal);
+	a.Mov32(RDX, RCX);
+	a.AluImm(HA_And, RDX, 0xFF);
+	a.StoreByteIndexed(RAX, RDX, valueRegister);
+	const size_t resume = a.GetPosition();
+
+	a.Defer([=, this](Assembler& stub)
+	{
+		stub.Bind(slow);
+		stub.Mov32(kArgs[2], valueRegister);
+		stub.Mov32(kArgs[1], RCX);
+		stub.MovImm64(kArgs[0], GetAddress(&mSystem));
+		stub.Call(GetFunctionAddress(&JIT::WriteMemory));
+		stub.MovImm32(kRegCalledOut, 1);
+		stub.JmpTo(resume);
+	});
+}
+
+#else
+
+JIT::JIT(CPU& cpu, System& system)
+	: mCPU(cpu)
+	, mSystem(system)
+{
+}
+
+JIT::~JIT() = default;
+
+void JIT::Reset()
+{
+	mCodeUsed = 0;
+}
+
+CPU::NativeFunc JIT::Compile(const CPU::Block&)
+{
+	return nullptr;
+}
+
+#endif
+
+uint8_t JIT::ReadMemory(System* system, uint16_t address)
+{
+	return system->Read(address);
+}
+
+void JIT::WriteMemory(System* system, uint16_t address, uint8_t data)
+{
+	system->Write(address, data);
+}
+
+void JIT::Interpret(CPU* cpu, const CPU::DecodedInstruction* instruction)
+{
+	(cpu->*instruction->func)(instruction->operandBytes, instruction->cycles);
+}
+
+bool JIT::CanContinue(const CPU* cpu, const CPU::Block* block)
+{
+	return cpu->CanContinueBlock(*block);
+}
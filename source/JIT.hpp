@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "CPU.hpp"
+
+class System;
+
+// Set by the ENABLE_JIT CMake option. When disabled, Compile() never returns
+// any code and every block runs in the interpreter.
+#if defined(COJONES_JIT)
+constexpr bool kJitEnabled = true;
+#else
+constexpr bool kJitEnabled = false;
+#endif
+
+// Compiles blocks from the CPU's block cache to x86-64. A, X and Y live in host
+// registers while a block runs. Memory accesses go straight through System's
+// page tables, only I/O and mapper registers call out, and the block then
+// checks whether it can carry on the same way the interpreter does after
+// every instruction. Instructions it doesn't translate, e.g. stack operations
+// and indirect addressing, call back into the interpreter one at a time.
+class JIT
+{
+public:
+	JIT(CPU& cpu, System& system);
+	~JIT();
+
+	JIT(const JIT&) = delete;
+	JIT& operator=(const JIT&) = delete;
+
+	// Returns null if there's no room left for the code, see Reset().
+	CPU::NativeFunc Compile(const CPU::Block& block);
+
+	// Throws away everything compiled so far.
+	void Reset();
+
+private:
+	class Assembler;
+
+	void EmitPrologue(Assembler& a);
+	void EmitEpilogue(Assembler& a);
+	void EmitInstruction(Assembler& a, const CPU::Block& block, size_t index, uint16_t PC);
+	void EmitInterpreterCall(Assembler& a, const CPU::Block& block, size_t index, uint16_t nextPC);
+	void EmitCanContinueCall(Assembler& a, const CPU::Block& block);
+
+	// Indexed addresses are worked out at run time and left in ECX, the rest
+	// are known now. Reads leave the value in EAX.
+	void EmitAddress(Assembler& a, CPU::AddressingMode mode, uint16_t operandBytes);
+	void EmitRead(Assembler& a, CPU::AddressingMode mode, uint16_t operandBytes);
+	void EmitWrite(Assembler& a, CPU::AddressingMode mode, uint16_t operandBytes, uint8_t valueRegister);
+
+	// Called from compiled code.
+	static uint8_t ReadMemory(System* system, uint16_t address);
+	static void    WriteMemory(System* system, uint16_t address, uint8_t data);
+	static void    Interpret(CPU* cpu, const CPU::DecodedInstruction* instruction);
+	static bool    CanContinue(const CPU* cpu, const CPU::Block* block);
+
+	CPU&    mCPU;
+	System& mSystem;
+
+	// Where the CPU's fields are, relative to the CPU.
+	struct Fields
+	{
+		int32_t PC;
+		int32_t ACC;
+		int32_t IX;
+		int32_t IY;
+		int32_t zResult;
+		int32_t nResult;
+		int32_t carryResult;
+		int32_t overflowResult;
+		int32_t cycles;
+		int32_t runUntilCycles;
+		int32_t opcode;
+		int32_t operand;
+	};
+
+	Fields  mFields = {};
+
+	// Distance from System's read page table to its write page table.
+	int32_t mWritePagesOffset = 0;
+
+	// Blocks are assembled here, then copied into the executable buffer.
+	std::vector<uint8_t> mAssembly;
+
+	uint8_t* mCode = nullptr;
+	size_t   mCodeUsed = 0;
+};
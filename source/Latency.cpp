@@ -0,0 +1,113 @@
+#include "Latency.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+void LatencyStats::Add(const FrameTiming& timing, int64_t uploadTime, int64_t presentTime)
+{
+	if (timing.inputRead != 0)
+	{
+		AddSample(LS_PollToRead, timing.inputPoll, timing.inputRead);
+		AddSample(LS_ReadToComplete, timing.inputRead, timing.completed);
+		AddSample(LS_PollToPresent, timing.inputPoll, presentTime);
+	}
+
+	AddSample(LS_CompleteToUpload, timing.completed, uploadTime);
+	AddSample(LS_UploadToPresent, uploadTime, presentTime);
+}
+
+void LatencyStats::Clear()
+{
+	mStages = {};
+}
+
+void LatencyStats::AddSample(Stage stage, int64_t from, int64_t to)
+{
+	if (from == 0 || to == 0)
+	{
+		return;
+	}
+
+	StageStats& stats = mStages[stage];
+	double ms = std::max<int64_t>(to - from, 0) / 1e6;
+
+	size_t bucket = std::min(static_cast<size_t>(ms / kBucketMs), kBucketCount - 1);
+	stats.histogram[bucket] += 1.0f;
+	stats.count++;
+	stats.totalMs += ms;
+	stats.maxMs = std::max(stats.maxMs, ms);
+}
+
+double LatencyStats::GetMeanMs(Stage stage) const
+{
+	const StageStats& stats = mStages[stage];
+	return stats.count > 0 ? stats.totalMs / stats.count : 0.0;
+}
+
+double LatencyStats::GetPercentileMs(Stage stage, double percentile) const
+{
+	const StageStats& stats = mStages[stage];
+	if (stats.count == 0)
+	{
+		return 0.0;
+	}
+
+	double target = stats.count * percentile / 100.0;
+	double seen = 0.0;
+	for (size_t i = 0; i < kBucketCount; ++i)
+	{
+		seen += stats.histogram[i];
+		if (seen >= target)
+		{
+			return (i + 1) * kBucketMs;
+		}
+	}
+
+	return kBucketCount * kBucketMs;
+}
+
+bool LatencyStats::WriteCSV(const std::string& filename) const
+{
+	std::ofstream file(filename, std::ios::trunc);
+
+	file << "bucket_ms";
+	for (int stage = 0; stage < LS_Count; ++stage)
+	{
+		file << ',' << GetStageName(static_cast<Stage>(stage));
+	}
+	file << '\n';
+
+	for (size_t i = 0; i < kBucketCount; ++i)
+	{
+		file << fmt::format("{:.1f}", i * kBucketMs);
+		for (const StageStats& stats : mStages)
+		{
+			file << ',' << static_cast<uint64_t>(stats.histogram[i]);
+		}
+		file << '\n';
+	}
+
+	if (!file.good())
+	{
+		SPDLOG_ERROR("Failed to write latency CSV \"{}\".", filename);
+		return false;
+	}
+
+	return true;
+}
+
+const char* LatencyStats::GetStageName(Stage stage)
+{
+	switch (stage)
+	{
+		case LS_PollToRead:       return "poll_to_read";
+		case LS_ReadToComplete:   return "read_to_complete";
+		case LS_CompleteToUpload: return "complete_to_upload";
+		case LS_UploadToPresent:  return "upload_to_present";
+		case LS_PollToPresent:    return "poll_to_present";
+		default:                  return "unknown";
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Nanoseconds on the steady clock, comparable across threads.
+inline int64_t GetTimestamp()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// When each step between reading the host's input and finishing a frame
+// happened, as timestamps. Zero if it didn't happen for this frame.
+struct FrameTiming
+{
+	// The input the frame started with was polled.
+	int64_t inputPoll = 0;
+
+	// The game latched the controller, worked out from how far through the
+	// frame's CPU cycles it was.
+	int64_t inputRead = 0;
+
+	int64_t completed = 0;
+};
+
+// Histograms of how long each stage from polling input to presenting the
+// frame that read it takes, for the frontend's latency panel.
+class LatencyStats
+{
+public:
+	enum Stage
+	{
+		LS_PollToRead,
+		LS_ReadToComplete,
+		LS_CompleteToUpload,
+		LS_UploadToPresent,
+		LS_PollToPresent,
+		LS_Count
+	};
+
+	// Half a millisecond each, anything past the last goes in the last.
+	static constexpr double kBucketMs = 0.5;
+	static constexpr size_t kBucketCount = 100;
+
+	using Histogram = std::array<float, kBucketCount>;
+
+	// Frames the game didn't read input in only count towards the stages
+	// after completion.
+	void Add(const FrameTiming& timing, int64_t uploadTime, int64_t presentTime);
+	void Clear();
+
+	const Histogram& GetHistogram(Stage stage) const { return mStages[stage].histogram; }
+	uint64_t GetCount(Stage stage) const { return mStages[stage].count; }
+	double   GetMeanMs(Stage stage) const;
+	double   GetMaxMs(Stage stage) const { return mStages[stage].maxMs; }
+
+	// To the upper edge of the bucket it falls in.
+	double   GetPercentileMs(Stage stage, double percentile) const;
+
+	// One row per bucket, one column per stage.
+	bool     WriteCSV(const std::string& filename) const;
+
+	static const char* GetStageName(Stage stage);
+
+private:
+	void AddSample(Stage stage, int64_t from, int64_t to);
+
+	struct StageStats
+	{
+		Histogram histogram = {};
+		uint64_t  count = 0;
+		double    totalMs = 0.0;
+		double    maxMs = 0.0;
+	};
+
+	std::array<StageStats, LS_Count> mStages;
+};
@@ -0,0 +1,391 @@
+#include "Mapper.hpp"
+
+#include <algorithm>
+
+#include "SaveState.hpp"
+
+Mapper::Mapper(size_t prgSize, size_t chrSize, Mirroring mirroring)
+	: mPrgSize(prgSize)
+	, mChrSize(chrSize)
+	, mMirroring(mirroring)
+{
+}
+
+size_t Mapper::BankOffset(size_t size, size_t bankSize, int bank)
+{
+	size_t bankCount = std::max<size_t>(size / bankSize, 1);
+
+	if (bank < 0)
+	{
+		bank += static_cast<int>(bankCount);
+	}
+
+	return (static_cast<size_t>(bank) % bankCount) * bankSize;
+}
+
+void Mapper::MapPrg8K(uint8_t slot, int bank)
+{
+	mPrgBanks[slot] = BankOffset(mPrgSize, 0x2000, bank);
+}
+
+void Mapper::MapPrg16K(uint8_t slot, int bank)
+{
+	size_t offset = BankOffset(mPrgSize, 0x4000, bank);
+	mPrgBanks[slot * 2] = offset;
+	mPrgBanks[slot * 2 + 1] = offset + 0x2000;
+}
+
+void Mapper::MapPrg32K(int bank)
+{
+	size_t offset = BankOffset(mPrgSize, 0x8000, bank);
+	for (uint8_t slot = 0; slot < 4; ++slot)
+	{
+		mPrgBanks[slot] = offset + slot * 0x2000;
+	}
+}
+
+void Mapper::MapChr1K(uint8_t slot, int bank)
+{
+	mChrBanks[slot] = BankOffset(mChrSize, 0x400, bank);
+}
+
+void Mapper::MapChr4K(uint8_t slot, int bank)
+{
+	size_t offset = BankOffset(mChrSize, 0x1000, bank);
+	for (uint8_t i = 0; i < 4; ++i)
+	{
+		mChrBanks[slot * 4 + i] = offset + i * 0x400;
+	}
+}
+
+void Mapper::MapChr8K(int bank)
+{
+	size_t offset = BankOffset(mChrSize, 0x2000, bank);
+	for (uint8_t slot = 0; slot < 8; ++slot)
+	{
+		mChrBanks[slot] = offset + slot * 0x400;
+	}
+}
+
+// Bank offsets are saved rather than worked out again from the registers, as
+// mappers without registers have nothing to work them out from.
+void Mapper::SaveState(StateWriter& writer) const
+{
+	writer.Write(mMirroring);
+	writer.Write(mIRQPending);
+
+	for (size_t bank : mPrgBanks)
+	{
+		writer.Write(static_cast<uint64_t>(bank));
+	}
+
+	for (size_t bank : mChrBanks)
+	{
+		writer.Write(static_cast<uint64_t>(bank));
+	}
+}
+
+void Mapper::LoadState(StateReader& reader)
+{
+	reader.Read(mMirroring);
+	reader.Read(mIRQPending);
+
+	for (size_t& bank : mPrgBanks)
+	{
+		uint64_t offset = 0;
+		reader.Read(offset);
+		bank = static_cast<size_t>(offset);
+	}
+
+	for (size_t& bank : mChrBanks)
+	{
+		uint64_t offset = 0;
+		reader.Read(offset);
+		bank = static_cast<size_t>(offset);
+	}
+}
+
+NROM::NROM(size_t prgSize, size_t chrSize, Mirroring mirroring)
+	: Mapper(prgSize, chrSize, mirroring)
+{
+	// 16KB carts are mirrored into both halves.
+	MapPrg16K(0, 0);
+	MapPrg16K(1, -1);
+	MapChr8K(0);
+}
+
+MMC1::MMC1(size_t prgSize, size_t chrSize, Mirroring mirroring)
+	: Mapper(prgSize, chrSize, mirroring)
+{
+	UpdateBanks();
+}
+
+bool MMC1::WriteRegister(uint16_t address, uint8_t data)
+{
+	// Writing with bit 7 set resets the shift register and locks the last
+	// PRG bank at 0xC000.
+	if (data & 0x80)
+	{
+		mShift = 0x10;
+		mControl |= 0x0C;
+		UpdateBanks();
+		return true;
+	}
+
+	// Bits are shifted in LSB first, the register is full once the marker bit
+	// that started at bit 4 reaches bit 0.
+	bool isFull = mShift & 0x01;
+	mShift = (mShift >> 1) | ((data & 0x01) << 4);
+
+	if (!isFull)
+	{
+		return false;
+	}
+
+	switch ((address >> 13) & 0x03)
+	{
+		case 0: mControl = mShift; break;
+		case 1: mChrBank0 = mShift; break;
+		case 2: mChrBank1 = mShift; break;
+		case 3: mPrgBank = mShift & 0x0F; break;
+	}
+
+	mShift = 0x10;
+	UpdateBanks();
+
+	return true;
+}
+
+void MMC1::UpdateBanks()
+{
+	switch (mControl & 0x03)
+	{
+		case 0: mMirroring = MM_SingleScreenLower; break;
+		case 1: mMirroring = MM_SingleScreenUpper; break;
+		case 2: mMirroring = MM_Vertical; break;
+		case 3: mMirroring = MM_Horizontal; break;
+	}
+
+	switch ((mControl >> 2) & 0x03)
+	{
+		case 0:
+		case 1:
+			MapPrg32K(mPrgBank >> 1);
+			break;
+		case 2:
+			MapPrg16K(0, 0);
+			MapPrg16K(1, mPrgBank);
+			break;
+		case 3:
+			MapPrg16K(0, mPrgBank);
+			MapPrg16K(1, -1);
+			break;
+	}
+
+	if (mControl & 0x10)
+	{
+		MapChr4K(0, mChrBank0);
+		MapChr4K(1, mChrBank1);
+	}
+	else
+	{
+		MapChr8K(mChrBank0 >> 1);
+	}
+}
+
+void MMC1::SaveState(StateWriter& writer) const
+{
+	Mapper::SaveState(writer);
+
+	writer.Write(mShift);
+	writer.Write(mControl);
+	writer.Write(mChrBank0);
+	writer.Write(mChrBank1);
+	writer.Write(mPrgBank);
+}
+
+void MMC1::LoadState(StateReader& reader)
+{
+	Mapper::LoadState(reader);
+
+	reader.Read(mShift);
+	reader.Read(mControl);
+	reader.Read(mChrBank0);
+	reader.Read(mChrBank1);
+	reader.Read(mPrgBank);
+}
+
+UxROM::UxROM(size_t prgSize, size_t chrSize, Mirroring mirroring)
+	: Mapper(prgSize, chrSize, mirroring)
+{
+	MapPrg16K(0, 0);
+	MapPrg16K(1, -1);
+	MapChr8K(0);
+}
+
+bool UxROM::WriteRegister(uint16_t /*address*/, uint8_t data)
+{
+	MapPrg16K(0, data);
+	return true;
+}
+
+CNROM::CNROM(size_t prgSize, size_t chrSize, Mirroring mirroring)
+	: Mapper(prgSize, chrSize, mirroring)
+{
+	MapPrg16K(0, 0);
+	MapPrg16K(1, -1);
+	MapChr8K(0);
+}
+
+bool CNROM::WriteRegister(uint16_t /*address*/, uint8_t data)
+{
+	MapChr8K(data);
+	return false;
+}
+
+MMC3::MMC3(size_t prgSize, size_t chrSize, Mirroring mirroring)
+	: Mapper(prgSize, chrSize, mirroring)
+{
+	UpdateBanks();
+}
+
+bool MMC3::WriteRegister(uint16_t address, uint8_t data)
+{
+	// Registers are selected by the address range and whether it's even or odd.
+	bool isOdd = address & 0x01;
+	bool prgBanksChanged = false;
+
+	switch (address & 0xE000)
+	{
+		case 0x8000:
+			if (isOdd)
+			{
+				mBankRegisters[mBankSelect & 0x07] = data;
+			}
+			else
+			{
+				mBankSelect = data;
+			}
+			UpdateBanks();
+			prgBanksChanged = true;
+			break;
+		case 0xA000:
+			// The odd register enables and write protects PRG-RAM (bits 7
+			// and 6). It's ignored, as MMC6 boards share mapper 4 and use
+			// those bits differently, so PRG-RAM is always there.
+			if (!isOdd)
+			{
+				mMirroring = (data & 0x01) ? MM_Horizontal : MM_Vertical;
+			}
+			break;
+		case 0xC000:
+			if (isOdd)
+			{
+				mIRQCounter = 0;
+				mIRQReload = true;
+			}
+			else
+			{
+				mIRQLatch = data;
+			}
+			break;
+		case 0xE000:
+			mIRQEnabled = isOdd;
+			if (!isOdd)
+			{
+				mIRQPending = false;
+			}
+			break;
+	}
+
+	return prgBanksChanged;
+}
+
+void MMC3::OnScanline()
+{
+	if (mIRQCounter == 0 || mIRQReload)
+	{
+		mIRQCounter = mIRQLatch;
+		mIRQReload = false;
+	}
+	else
+	{
+		--mIRQCounter;
+	}
+
+	if (mIRQCounter == 0 && mIRQEnabled)
+	{
+		mIRQPending = true;
+	}
+}
+
+int MMC3::GetScanlinesUntilIRQ() const
+{
+	if (!mIRQEnabled)
+	{
+		return 0;
+	}
+
+	// A reload takes one clock, then the counter needs the latch value more
+	// to reach zero. A latch of zero raises an IRQ on every clock.
+	if (mIRQCounter == 0 || mIRQReload)
+	{
+		return 1 + mIRQLatch;
+	}
+
+	return mIRQCounter;
+}
+
+void MMC3::SaveState(StateWriter& writer) const
+{
+	Mapper::SaveState(writer);
+
+	writer.Write(mBankSelect);
+	writer.WriteArray(mBankRegisters);
+	writer.Write(mIRQLatch);
+	writer.Write(mIRQCounter);
+	writer.Write(mIRQReload);
+	writer.Write(mIRQEnabled);
+}
+
+void MMC3::LoadState(StateReader& reader)
+{
+	Mapper::LoadState(reader);
+
+	reader.Read(mBankSelect);
+	reader.ReadArray(mBankRegisters);
+	reader.Read(mIRQLatch);
+	reader.Read(mIRQCounter);
+	reader.Read(mIRQReload);
+	reader.Read(mIRQEnabled);
+}
+
+void MMC3::UpdateBanks()
+{
+	// Bit 6 swaps the switchable 0x8000 bank with the fixed second to last
+	// bank at 0xC000, bit 7 swaps the 2KB and 1KB CHR halves.
+	if (mBankSelect & 0x40)
+	{
+		MapPrg8K(0, -2);
+		MapPrg8K(2, mBankRegisters[6]);
+	}
+	else
+	{
+		MapPrg8K(0, mBankRegisters[6]);
+		MapPrg8K(2, -2);
+	}
+	MapPrg8K(1, mBankRegisters[7]);
+	MapPrg8K(3, -1);
+
+	uint8_t chrInvert = (mBankSelect & 0x80) ? 4 : 0;
+
+	// 2KB banks ignore the low bit, so map them as pairs of 1KB banks.
+	MapChr1K(0 ^ chrInvert, mBankRegisters[0] & 0xFE);
+	MapChr1K(1 ^ chrInvert, mBankRegisters[0] | 0x01);
+	MapChr1K(2 ^ chrInvert, mBankRegisters[1] & 0xFE);
+	MapChr1K(3 ^ chrInvert, mBankRegisters[1] | 0x01);
+	MapChr1K(4 ^ chrInvert, mBankRegisters[2]);
+	MapChr1K(5 ^ chrInvert, mBankRegisters[3]);
+	MapChr1K(6 ^ chrInvert, mBankRegisters[4]);
+	MapChr1K(7 ^ chrInvert, mBankRegisters[5]);
+}
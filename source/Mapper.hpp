@@ -0,0 +1,149 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+class StateReader;
+class StateWriter;
+
+enum Mirroring : uint8_t
+{
+	MM_Horizontal,
+	MM_Vertical,
+	MM_SingleScreenLower,
+	MM_SingleScreenUpper
+};
+
+// Cartridge bank switching hardware. Mappers only work out which banks are
+// visible when one of their registers is written, the cartridge then remaps
+// the system's page table so reads never have to go through the mapper.
+// See https://www.nesdev.org/wiki/Mapper.
+class Mapper
+{
+public:
+	Mapper(size_t prgSize, size_t chrSize, Mirroring mirroring);
+	virtual ~Mapper() = default;
+
+	// Mappers without registers leave writes to 0x8000-0xFFFF to go to PRG.
+	virtual bool HasRegisters() const { return true; }
+
+	// Handles CPU writes to 0x8000-0xFFFF. Returns true if the PRG banks may
+	// have changed, so the page table needs updating.
+	virtual bool WriteRegister(uint16_t address, uint8_t data) = 0;
+
+	// Called by the PPU once per visible scanline, for mappers that count them.
+	virtual void OnScanline() {}
+
+	// How many more OnScanline() calls until the mapper raises an IRQ, or 0
+	// if it won't. Lets the CPU run right up to the IRQ without stopping.
+	virtual int  GetScanlinesUntilIRQ() const { return 0; }
+
+	bool IsIRQPending() const { return mIRQPending; }
+
+	// Offsets into PRG of the 8KB banks at 0x8000, 0xA000, 0xC000 and 0xE000.
+	const std::array<size_t, 4>& GetPrgBanks() const { return mPrgBanks; }
+
+	// Offsets into CHR of the eight 1KB banks in PPU address space.
+	const std::array<size_t, 8>& GetChrBanks() const { return mChrBanks; }
+
+	Mirroring GetMirroring() const { return mMirroring; }
+
+	// Mappers with registers of their own save them after the base state.
+	virtual void SaveState(StateWriter& writer) const;
+	virtual void LoadState(StateReader& reader);
+
+protected:
+	// Negative banks count back from the end, e.g. -1 is the last bank.
+	void MapPrg8K(uint8_t slot, int bank);
+	void MapPrg16K(uint8_t slot, int bank);
+	void MapPrg32K(int bank);
+	void MapChr1K(uint8_t slot, int bank);
+	void MapChr4K(uint8_t slot, int bank);
+	void MapChr8K(int bank);
+
+	size_t    mPrgSize;
+	size_t    mChrSize;
+	Mirroring mMirroring;
+	bool      mIRQPending = false;
+
+private:
+	static size_t BankOffset(size_t size, size_t bankSize, int bank);
+
+	std::array<size_t, 4> mPrgBanks = {};
+	std::array<size_t, 8> mChrBanks = {};
+};
+
+// Mapper 0, fixed 16KB or 32KB of PRG and 8KB of CHR.
+class NROM final : public Mapper
+{
+public:
+	NROM(size_t prgSize, size_t chrSize, Mirroring mirroring);
+
+	bool HasRegisters() const override { return false; }
+	bool WriteRegister(uint16_t /*address*/, uint8_t /*data*/) override { return false; }
+};
+
+// Mapper 1, configured through a serial shift register.
+class MMC1 final : public Mapper
+{
+public:
+	MMC1(size_t prgSize, size_t chrSize, Mirroring mirroring);
+
+	bool WriteRegister(uint16_t address, uint8_t data) override;
+
+	void SaveState(StateWriter& writer) const override;
+	void LoadState(StateReader& reader) override;
+
+private:
+	void UpdateBanks();
+
+	uint8_t mShift = 0x10;
+	uint8_t mControl = 0x0C;
+	uint8_t mChrBank0 = 0;
+	uint8_t mChrBank1 = 0;
+	uint8_t mPrgBank = 0;
+};
+
+// Mapper 2, switchable 16KB at 0x8000 with the last bank fixed at 0xC000.
+class UxROM final : public Mapper
+{
+public:
+	UxROM(size_t prgSize, size_t chrSize, Mirroring mirroring);
+
+	bool WriteRegister(uint16_t address, uint8_t data) override;
+};
+
+// Mapper 3, fixed PRG with a switchable 8KB CHR bank.
+class CNROM final : public Mapper
+{
+public:
+	CNROM(size_t prgSize, size_t chrSize, Mirroring mirroring);
+
+	bool WriteRegister(uint16_t address, uint8_t data) override;
+};
+
+// Mapper 4, 8KB PRG and 1/2KB CHR banks plus a scanline counter IRQ.
+class MMC3 final : public Mapper
+{
+public:
+	MMC3(size_t prgSize, size_t chrSize, Mirroring mirroring);
+
+	bool WriteRegister(uint16_t address, uint8_t data) override;
+	void OnScanline() override;
+	int  GetScanlinesUntilIRQ() const override;
+
+	void SaveState(StateWriter& writer) const override;
+	void LoadState(StateReader& reader) override;
+
+private:
+	void UpdateBanks();
+
+	uint8_t                mBankSelect = 0;
+	std::array<uint8_t, 8> mBankRegisters = { 0, 2, 4, 5, 6, 7, 0, 1 };
+
+	uint8_t mIRQLatch = 0;
+	uint8_t mIRQCounter = 0;
+	bool    mIRQReload = false;
+	bool    mIRQEnabled = false;
+};
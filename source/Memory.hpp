@@ -2,12 +2,17 @@
 
 #include <cstdint>
 
+// The NES's 2KB of internal RAM.
 class Memory
 {
 public:
-	uint8_t Read(uint16_t address) { return a[address]; }
-	void    Write(uint16_t address, uint8_t data) { a[address] = data; }
+	static constexpr uint16_t kSize = 0x800;
+
+	uint8_t Read(uint16_t address) { return a[address & (kSize - 1)]; }
+	void    Write(uint16_t address, uint8_t data) { a[address & (kSize - 1)] = data; }
+
+	uint8_t* GetData() { return a; }
 
 private:
-	uint8_t a[0xFFFF];
+	uint8_t a[kSize] = {};
 };
\ No newline at end of file
@@ -0,0 +1,142 @@
+#include "Movie.hpp"
+
+#include <fstream>
+#include <iterator>
+
+#include <spdlog/spdlog.h>
+
+#include "NES.hpp"
+#include "SaveState.hpp"
+
+namespace
+{
+	// "CJNM", then the layout version.
+	constexpr uint32_t kMovieMagic = 0x4D4E4A43;
+	constexpr uint16_t kMovieVersion = 1;
+}
+
+void Movie::Start(System& system)
+{
+	system.SaveState(mStartState);
+	mFrames.clear();
+}
+
+bool Movie::RemoveLastFrame()
+{
+	if (mFrames.empty())
+	{
+		return false;
+	}
+
+	mFrames.pop_back();
+	return true;
+}
+
+// Magic, version, padding, frame count, start state size, then the start
+// state and 8 bytes per frame.
+bool Movie::Save(const std::string& filename) const
+{
+	std::vector<uint8_t> data;
+	data.reserve(16 + mStartState.size() + mFrames.size() * 8);
+
+	StateWriter writer(data);
+	writer.Write(kMovieMagic);
+	writer.Write(kMovieVersion);
+	writer.Write(static_cast<uint16_t>(0));
+	writer.Write(static_cast<uint32_t>(mFrames.size()));
+	writer.Write(static_cast<uint32_t>(mStartState.size()));
+	writer.WriteBytes(mStartState.data(), mStartState.size());
+
+	for (const Frame& frame : mFrames)
+	{
+		writer.WriteArray(frame.buttons);
+		writer.Write(frame.cycles);
+		writer.Write(frame.ramHash);
+	}
+
+	std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(data.data()), data.size());
+
+	if (!file.good())
+	{
+		SPDLOG_ERROR("Failed to write movie \"{}\".", filename);
+		return false;
+	}
+
+	return true;
+}
+
+bool Movie::Load(const std::string& filename)
+{
+	std::ifstream file(filename, std::ios::binary);
+
+	if (!file.good())
+	{
+		SPDLOG_ERROR("Failed to open movie \"{}\".", filename);
+		return false;
+	}
+
+	std::vector<uint8_t> data(std::istreambuf_iterator<char>(file), {});
+
+	StateReader reader(data);
+
+	uint32_t magic = 0;
+	uint16_t version = 0;
+	uint16_t padding = 0;
+	uint32_t frameCount = 0;
+	uint32_t stateSize = 0;
+	reader.Read(magic);
+	reader.Read(version);
+	reader.Read(padding);
+	reader.Read(frameCount);
+	reader.Read(stateSize);
+
+	if (!reader.IsValid() || magic != kMovieMagic || version != kMovieVersion)
+	{
+		SPDLOG_ERROR("\"{}\" is not a movie, or is from another version.", filename);
+		return false;
+	}
+
+	if (reader.GetRemaining() != stateSize + static_cast<size_t>(frameCount) * 8)
+	{
+		SPDLOG_ERROR("Movie \"{}\" is truncated.", filename);
+		return false;
+	}
+
+	mStartState.resize(stateSize);
+	reader.ReadBytes(mStartState.data(), stateSize);
+
+	mFrames.resize(frameCount);
+	for (Frame& frame : mFrames)
+	{
+		reader.ReadArray(frame.buttons);
+		reader.Read(frame.cycles);
+		reader.Read(frame.ramHash);
+	}
+
+	return reader.IsValid();
+}
+
+bool Movie::RunFrame(NES& nes, const Frame& frame)
+{
+	System& system = nes.GetSystem();
+
+	for (size_t port = 0; port < frame.buttons.size(); ++port)
+	{
+		system.GetController(port).SetButtons(frame.buttons[port]);
+	}
+
+	return system.RunCycles(frame.cycles);
+}
+
+// FNV-1a, see http://www.isthe.com/chongo/tech/comp/fnv/.
+uint32_t Movie::HashRAM(std::span<const uint8_t> ram)
+{
+	uint32_t hash = 2166136261u;
+	for (uint8_t byte : ram)
+	{
+		hash = (hash ^ byte) * 16777619u;
+	}
+
+	return hash;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+class NES;
+class System;
+
+// A run recorded as each frame's controller input, starting from a save
+// state. Replaying the input from that state reproduces the run exactly, so
+// long as the emulator hasn't changed, and each frame keeps a hash of RAM as
+// it was at the end so a replay that drifts shows the first frame it did.
+class Movie
+{
+public:
+	struct Frame
+	{
+		std::array<uint8_t, 2> buttons;
+
+		// Frames aren't a whole number of CPU cycles, so each one says how
+		// many it ran for.
+		uint16_t cycles;
+		uint32_t ramHash;
+	};
+
+	// Starts again from the system's current state.
+	void Start(System& system);
+
+	void AddFrame(const Frame& frame) { mFrames.push_back(frame); }
+
+	// Returns false if there were no frames left.
+	bool RemoveLastFrame();
+
+	const std::vector<uint8_t>& GetStartState() const { return mStartState; }
+	const std::vector<Frame>&   GetFrames() const { return mFrames; }
+
+	bool Save(const std::string& filename) const;
+	bool Load(const std::string& filename);
+
+	// Sets the frame's buttons and runs it for as long as it ran when it was
+	// recorded. Returns false if the CPU halts.
+	static bool     RunFrame(NES& nes, const Frame& frame);
+
+	static uint32_t HashRAM(std::span<const uint8_t> ram);
+
+private:
+	std::vector<uint8_t> mStartState;
+	std::vector<Frame>   mFrames;
+};
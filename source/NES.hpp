@@ -0,0 +1,45 @@
+#pragma once
+
+#include "CPU.hpp"
+#include "Memory.hpp"
+#include "PPU.hpp"
+#include "APU.hpp"
+#include "System.hpp"
+#include "Cartridge.hpp"
+
+// Everything that makes up one console, owned by value so a whole instance
+// is a single allocation (or none, on the stack). Parts refer to each other by
+// reference, so an NES can't be copied or moved.
+class NES
+{
+public:
+	NES()
+		: mPPU(mCartridge)
+		, mAPU(mCartridge)
+		, mSystem(mCPU, mMemory, mPPU, mAPU, mCartridge)
+		, mCPU(mSystem)
+	{
+	}
+
+	NES(const NES&) = delete;
+	NES& operator=(const NES&) = delete;
+
+	CPU&       GetCPU() { return mCPU; }
+	Memory&    GetMemory() { return mMemory; }
+	PPU&       GetPPU() { return mPPU; }
+	APU&       GetAPU() { return mAPU; }
+	Cartridge& GetCartridge() { return mCartridge; }
+	System&    GetSystem() { return mSystem; }
+
+private:
+	// Declaration order matters, System connects to the cartridge and RAM
+	// when it's constructed so they have to exist first. The CPU and System
+	// need each other, so System is built first with a reference to a CPU
+	// that isn't constructed yet, and mustn't use it in its constructor.
+	Memory    mMemory;
+	Cartridge mCartridge;
+	PPU       mPPU;
+	APU       mAPU;
+	System    mSystem;
+	CPU       mCPU;
+};
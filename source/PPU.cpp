@@ -0,0 +1,702 @@
+#include "PPU.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include "Cartridge.hpp"
+#include "SaveState.hpp"
+
+namespace
+{
+	constexpr uint16_t kScanlineDots = 341;
+	constexpr uint16_t kVBlankScanline = 241;
+	constexpr uint16_t kPreRenderScanline = 261;
+	constexpr uint16_t kScanlinesPerFrame = 262;
+
+	constexpr uint8_t kStatusOverflow = 0x20;
+	constexpr uint8_t kStatusSpriteZeroHit = 0x40;
+	constexpr uint8_t kStatusVBlank = 0x80;
+}
+
+PPU::PPU(Cartridge& cartridge)
+	: mCartridge(cartridge)
+{
+}
+
+void PPU::Reset()
+{
+	mCtrl = 0;
+	mMask = 0;
+	mW = false;
+	mReadBuffer = 0;
+	mOddFrame = false;
+	mSpriteZeroHitDot = 0;
+}
+
+void PPU::SaveState(StateWriter& writer) const
+{
+	writer.Write(mCtrl);
+	writer.Write(mMask);
+	writer.Write(mStatus);
+	writer.Write(mOAMAddress);
+	writer.Write(mReadBuffer);
+	writer.Write(mOpenBus);
+
+	writer.Write(mV);
+	writer.Write(mT);
+	writer.Write(mFineX);
+	writer.Write(mW);
+
+	writer.WriteArray(mNametables);
+	writer.WriteArray(mPalette);
+	writer.WriteArray(mOAM);
+
+	writer.Write(mDot);
+	writer.Write(mScanline);
+	writer.Write(mScanlineDot);
+	writer.Write(mOddFrame);
+	writer.Write(mNMIPending);
+	writer.Write(mSpriteZeroHitDot);
+	writer.Write(mFrameNumber);
+}
+
+void PPU::LoadState(StateReader& reader)
+{
+	reader.Read(mCtrl);
+	reader.Read(mMask);
+	reader.Read(mStatus);
+	reader.Read(mOAMAddress);
+	reader.Read(mReadBuffer);
+	reader.Read(mOpenBus);
+
+	reader.Read(mV);
+	reader.Read(mT);
+	reader.Read(mFineX);
+	reader.Read(mW);
+
+	reader.ReadArray(mNametables);
+	reader.ReadArray(mPalette);
+	reader.ReadArray(mOAM);
+
+	reader.Read(mDot);
+	reader.Read(mScanline);
+	reader.Read(mScanlineDot);
+	reader.Read(mOddFrame);
+	reader.Read(mNMIPending);
+	reader.Read(mSpriteZeroHitDot);
+	reader.Read(mFrameNumber);
+}
+
+void PPU::CatchUp(uint64_t cpuCycles)
+{
+	const uint64_t targetDot = cpuCycles * 3;
+
+	while (mDot < targetDot)
+	{
+		uint16_t eventDot = GetNextEventDot();
+		uint64_t remaining = targetDot - mDot;
+
+		if (static_cast<uint64_t>(eventDot - mScanlineDot) > remaining)
+		{
+			mScanlineDot += static_cast<uint16_t>(remaining);
+			mDot = targetDot;
+			break;
+		}
+
+		mDot += eventDot - mScanlineDot;
+		mScanlineDot = eventDot;
+		RunEvent();
+	}
+}
+
+uint64_t PPU::GetNextVBlankCycle() const
+{
+	uint64_t dots = 0;
+	uint16_t scanline = mScanline;
+	uint16_t scanlineDot = mScanlineDot;
+
+	// Past this frame's vblank, so run to the end of the frame first.
+	if (scanline > kVBlankScanline || (scanline == kVBlankScanline && scanlineDot >= 1))
+	{
+		dots += (kPreRenderScanline - scanline) * kScanlineDots - scanlineDot;
+
+		bool skipsDot = mOddFrame && IsRenderingEnabled();
+		dots += skipsDot ? kScanlineDots - 1 : kScanlineDots;
+
+		scanline = 0;
+		scanlineDot = 0;
+	}
+
+	dots += (kVBlankScanline - scanline) * kScanlineDots + 1 - scanlineDot;
+
+	return (mDot + dots + 2) / 3;
+}
+
+uint64_t PPU::GetNextEventCycle() const
+{
+	uint64_t cycle = std::numeric_limits<uint64_t>::max();
+
+	if (mCtrl & 0x80)
+	{
+		cycle = GetNextVBlankCycle();
+	}
+
+	int clocks = mCartridge.GetScanlinesUntilIRQ();
+	if (clocks > 0 && IsRenderingEnabled())
+	{
+		cycle = std::min(cycle, GetMapperClockCycle(clocks));
+	}
+
+	return cycle;
+}
+
+// Mappers are clocked at dot 256 of every visible scanline and the
+// pre-render scanline, see RunEvent().
+uint64_t PPU::GetMapperClockCycle(int clocks) const
+{
+	uint64_t dots = 0;
+	uint16_t scanline = mScanline;
+	uint16_t scanlineDot = mScanlineDot;
+	bool oddFrame = mOddFrame;
+
+	while (true)
+	{
+		if ((scanline < kHeight || scanline == kPreRenderScanline) && scanlineDot < 256)
+		{
+			dots += 256 - scanlineDot;
+			scanlineDot = 256;
+
+			if (--clocks == 0)
+			{
+				break;
+			}
+		}
+
+		// Only called with rendering enabled, so odd frames are a dot short.
+		uint16_t length = (scanline == kPreRenderScanline && oddFrame) ? kScanlineDots - 1 : kScanlineDots;
+		dots += length - scanlineDot;
+		scanlineDot = 0;
+
+		if (++scanline == kScanlinesPerFrame)
+		{
+			scanline = 0;
+			oddFrame = !oddFrame;
+		}
+	}
+
+	return (mDot + dots + 2) / 3;
+}
+
+uint16_t PPU::GetScanlineLength() const
+{
+	// Odd frames skip the last dot of the pre-render scanline when rendering.
+	if (mScanline == kPreRenderScanline && mOddFrame && IsRenderingEnabled())
+	{
+		return kScanlineDots - 1;
+	}
+
+	return kScanlineDots;
+}
+
+uint16_t PPU::GetNextEventDot() const
+{
+	if (mScanline < kHeight)
+	{
+		if (mScanlineDot < mSpriteZeroHitDot)
+		{
+			return mSpriteZeroHitDot;
+		}
+		else if (mScanlineDot < 256)
+		{
+			return 256;
+		}
+	}
+	else if (mScanline == kVBlankScanline)
+	{
+		if (mScanlineDot < 1)
+		{
+			return 1;
+		}
+	}
+	else if (mScanline == kPreRenderScanline)
+	{
+		if (mScanlineDot < 1)
+		{
+			return 1;
+		}
+		else if (mScanlineDot < 256)
+		{
+			return 256;
+		}
+		else if (mScanlineDot < 304)
+		{
+			return 304;
+		}
+	}
+
+	return GetScanlineLength();
+}
+
+void PPU::RunEvent()
+{
+	if (mScanlineDot == GetScanlineLength())
+	{
+		mScanlineDot = 0;
+		++mScanline;
+
+		if (mScanline == kHeight)
+		{
+			mFrontBuffer ^= 1;
+			++mFrameNumber;
+		}
+		else if (mScanline == kScanlinesPerFrame)
+		{
+			mScanline = 0;
+			mOddFrame = !mOddFrame;
+		}
+
+		mSpriteZeroHitDot = mScanline < kHeight ? FindSpriteZeroHit() : 0;
+		return;
+	}
+
+	if (mScanline < kHeight && mScanlineDot == mSpriteZeroHitDot)
+	{
+		mStatus |= kStatusSpriteZeroHit;
+	}
+	else if (mScanline < kHeight && mScanlineDot == 256)
+	{
+		RenderScanline();
+
+		if (IsRenderingEnabled())
+		{
+			// Dots 256 and 257, move down a line and back to the left edge.
+			IncrementY();
+			mV = (mV & ~0x041F) | (mT & 0x041F);
+
+			mCartridge.OnScanline();
+		}
+	}
+	else if (mScanline == kVBlankScanline && mScanlineDot == 1)
+	{
+		mStatus |= kStatusVBlank;
+
+		if (mCtrl & 0x80)
+		{
+			mNMIPending = true;
+		}
+	}
+	else if (mScanline == kPreRenderScanline && mScanlineDot == 1)
+	{
+		mStatus &= ~(kStatusVBlank | kStatusSpriteZeroHit | kStatusOverflow);
+	}
+	else if (mScanline == kPreRenderScanline && mScanlineDot == 256)
+	{
+		if (IsRenderingEnabled())
+		{
+			mV = (mV & ~0x041F) | (mT & 0x041F);
+			mCartridge.OnScanline();
+		}
+	}
+	else if (mScanline == kPreRenderScanline && mScanlineDot == 304)
+	{
+		// Dots 280-304, back to the top of the screen.
+		if (IsRenderingEnabled())
+		{
+			mV = (mV & ~0x7BE0) | (mT & 0x7BE0);
+		}
+	}
+}
+
+uint16_t PPU::FindSpriteZeroHit() const
+{
+	const uint8_t* sprite = &mOAM[0];
+	int height = (mCtrl & 0x20) ? 16 : 8;
+	int row = mScanline - sprite[0] - 1;
+
+	if ((mMask & 0x18) != 0x18 || row < 0 || row >= height)
+	{
+		return 0;
+	}
+
+	const uint8_t* spritePixels = GetSpriteRow(sprite, row);
+	uint16_t patternTable = (mCtrl & 0x10) ? 0x1000 : 0x0000;
+	uint16_t fineY = (mV >> 12) & 0x07;
+
+	// Neither layer is drawn in the leftmost 8 pixels if either is clipped,
+	// and there's never a hit on the last pixel.
+	int firstX = (mMask & 0x06) == 0x06 ? 0 : 8;
+
+	for (int column = 0; column < 8; ++column)
+	{
+		int x = sprite[3] + column;
+		if (x < firstX || x >= kWidth - 1 || !spritePixels[(sprite[2] & 0x40) ? 7 - column : column])
+		{
+			continue;
+		}
+
+		// Walk v across to the tile under this pixel.
+		uint16_t v = mV;
+		int scrolledX = mFineX + x;
+		for (int tile = 0; tile < scrolledX / 8; ++tile)
+		{
+			IncrementX(v);
+		}
+
+		uint8_t tileIndex = mNametables[MirrorNametable(0x2000 | (v & 0x0FFF))];
+		const uint8_t* pixels = mCartridge.GetDecodedTile(patternTable + tileIndex * 16) + fineY * 8;
+
+		if (pixels[scrolledX & 0x07])
+		{
+			return static_cast<uint16_t>(x + 1);
+		}
+	}
+
+	return 0;
+}
+
+const uint8_t* PPU::GetSpriteRow(const uint8_t* sprite, int row) const
+{
+	int height = (mCtrl & 0x20) ? 16 : 8;
+	uint8_t tileIndex = sprite[1];
+
+	if (sprite[2] & 0x80)
+	{
+		row = height - 1 - row;
+	}
+
+	uint16_t patternAddress;
+	if (height == 16)
+	{
+		patternAddress = ((tileIndex & 0x01) ? 0x1000 : 0x0000) + (tileIndex & 0xFE) * 16;
+		if (row >= 8)
+		{
+			patternAddress += 16;
+			row -= 8;
+		}
+	}
+	else
+	{
+		patternAddress = ((mCtrl & 0x08) ? 0x1000 : 0x0000) + tileIndex * 16;
+	}
+
+	return mCartridge.GetDecodedTile(patternAddress) + row * 8;
+}
+
+void PPU::RenderScanline()
+{
+	uint8_t* line = mFrameBuffers[mFrontBuffer ^ 1].data() + mScanline * kWidth;
+
+	// Bits 0-1 are the pixel's colour, bits 2-3 its palette. Zero is transparent.
+	std::array<uint8_t, kWidth> background = {};
+	std::array<uint8_t, kWidth> sprites = {};
+	std::array<bool, kWidth> spriteBehind = {};
+
+	if (mMask & 0x08)
+	{
+		uint16_t v = mV;
+		uint16_t patternTable = (mCtrl & 0x10) ? 0x1000 : 0x0000;
+		uint16_t fineY = (v >> 12) & 0x07;
+
+		// 33 tiles, as fine X scroll can leave part of one on each side.
+		int x = -mFineX;
+		for (int tile = 0; tile < 33; ++tile)
+		{
+			uint8_t tileIndex = ReadVRAM(0x2000 | (v & 0x0FFF));
+			uint8_t attribute = ReadVRAM(0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07));
+			uint8_t palette = (attribute >> (((v >> 4) & 0x04) | (v & 0x02))) & 0x03;
+
+			const uint8_t* pixels = mCartridge.GetDecodedTile(patternTable + tileIndex * 16) + fineY * 8;
+
+			for (int column = 0; column < 8; ++column, ++x)
+			{
+				if (x >= 0 && x < kWidth && pixels[column])
+				{
+					background[x] = (palette << 2) | pixels[column];
+				}
+			}
+
+			IncrementX(v);
+		}
+
+		if (!(mMask & 0x02))
+		{
+			std::fill(background.begin(), background.begin() + 8, 0);
+		}
+	}
+
+	if (mMask & 0x10)
+	{
+		int height = (mCtrl & 0x20) ? 16 : 8;
+		int count = 0;
+
+		// Sprites are delayed by a scanline, so OAM Y is one less than the
+		// first line they appear on. Earlier sprites have priority.
+		for (int i = 0; i < 64; ++i)
+		{
+			const uint8_t* sprite = &mOAM[i * 4];
+			int row = mScanline - sprite[0] - 1;
+
+			if (row < 0 || row >= height)
+			{
+				continue;
+			}
+
+			if (++count > 8)
+			{
+				mStatus |= kStatusOverflow;
+				break;
+			}
+
+			uint8_t attributes = sprite[2];
+			int spriteX = sprite[3];
+			const uint8_t* pixels = GetSpriteRow(sprite, row);
+
+			for (int column = 0; column < 8; ++column)
+			{
+				int x = spriteX + column;
+				if (x >= kWidth)
+				{
+					break;
+				}
+
+				uint8_t pixel = pixels[(attributes & 0x40) ? 7 - column : column];
+
+				if (!pixel || (x < 8 && !(mMask & 0x04)))
+				{
+					continue;
+				}
+
+				if (i == 0 && background[x] && x != 255)
+				{
+					mStatus |= kStatusSpriteZeroHit;
+				}
+
+				if (!sprites[x])
+				{
+					sprites[x] = ((attributes & 0x03) << 2) | pixel;
+					spriteBehind[x] = attributes & 0x20;
+				}
+			}
+		}
+	}
+
+	uint8_t mask = (mMask & 0x01) ? 0x30 : 0x3F;
+
+	for (int x = 0; x < kWidth; ++x)
+	{
+		uint8_t paletteIndex = 0;
+
+		if (sprites[x] && (!background[x] || !spriteBehind[x]))
+		{
+			paletteIndex = 0x10 | sprites[x];
+		}
+		else if (background[x])
+		{
+			paletteIndex = background[x];
+		}
+
+		line[x] = mPalette[paletteIndex] & mask;
+	}
+}
+
+uint8_t PPU::ReadRegister(uint16_t address)
+{
+	uint8_t data = mOpenBus;
+
+	switch (address & 0x07)
+	{
+		case 2:
+			data = (mStatus & 0xE0) | (mOpenBus & 0x1F);
+			mStatus &= ~kStatusVBlank;
+			mW = false;
+			break;
+		case 4:
+			data = mOAM[mOAMAddress];
+			break;
+		case 7:
+			// Reads are delayed through a buffer, except for the palette.
+			if ((mV & 0x3FFF) < 0x3F00)
+			{
+				data = mReadBuffer;
+				mReadBuffer = ReadVRAM(mV);
+			}
+			else
+			{
+				data = ReadVRAM(mV);
+				mReadBuffer = ReadVRAM(mV - 0x1000);
+			}
+			mV += (mCtrl & 0x04) ? 32 : 1;
+			break;
+		default:
+			return data;
+	}
+
+	mOpenBus = data;
+	return data;
+}
+
+void PPU::WriteRegister(uint16_t address, uint8_t data)
+{
+	mOpenBus = data;
+
+	switch (address & 0x07)
+	{
+		case 0:
+			// Enabling NMI during vblank raises one straight away.
+			if (!(mCtrl & 0x80) && (data & 0x80) && (mStatus & kStatusVBlank))
+			{
+				mNMIPending = true;
+			}
+			mCtrl = data;
+			mT = (mT & ~0x0C00) | ((data & 0x03) << 10);
+			break;
+		case 1:
+			mMask = data;
+			break;
+		case 3:
+			mOAMAddress = data;
+			break;
+		case 4:
+			mOAM[mOAMAddress++] = data;
+			break;
+		case 5:
+			if (!mW)
+			{
+				mT = (mT & ~0x001F) | (data >> 3);
+				mFineX = data & 0x07;
+			}
+			else
+			{
+				mT = (mT & ~0x73E0) | ((data & 0xF8) << 2) | ((data & 0x07) << 12);
+			}
+			mW = !mW;
+			break;
+		case 6:
+			if (!mW)
+			{
+				mT = (mT & 0x00FF) | ((data & 0x3F) << 8);
+			}
+			else
+			{
+				mT = (mT & 0xFF00) | data;
+				mV = mT;
+			}
+			mW = !mW;
+			break;
+		case 7:
+			WriteVRAM(mV, data);
+			mV += (mCtrl & 0x04) ? 32 : 1;
+			break;
+	}
+}
+
+void PPU::WriteOAM(const uint8_t* data)
+{
+	for (int i = 0; i < 0x100; ++i)
+	{
+		mOAM[static_cast<uint8_t>(mOAMAddress + i)] = data[i];
+	}
+}
+
+uint8_t PPU::ReadVRAM(uint16_t address)
+{
+	address &= 0x3FFF;
+
+	if (address < 0x2000)
+	{
+		return mCartridge.ReadChr(address);
+	}
+	else if (address < 0x3F00)
+	{
+		return mNametables[MirrorNametable(address)];
+	}
+
+	return Palette(address);
+}
+
+void PPU::WriteVRAM(uint16_t address, uint8_t data)
+{
+	address &= 0x3FFF;
+
+	if (address < 0x2000)
+	{
+		mCartridge.WriteChr(address, data);
+	}
+	else if (address < 0x3F00)
+	{
+		mNametables[MirrorNametable(address)] = data;
+	}
+	else
+	{
+		Palette(address) = data & 0x3F;
+	}
+}
+
+uint16_t PPU::MirrorNametable(uint16_t address) const
+{
+	uint16_t table = (address >> 10) & 0x03;
+	uint16_t offset = address & 0x03FF;
+
+	switch (mCartridge.GetMirroring())
+	{
+		case MM_Horizontal:        table >>= 1; break;
+		case MM_Vertical:          table &= 0x01; break;
+		case MM_SingleScreenLower: table = 0; break;
+		case MM_SingleScreenUpper: table = 1; break;
+	}
+
+	return table * 0x400 + offset;
+}
+
+uint8_t& PPU::Palette(uint16_t address)
+{
+	// The sprite palettes' backdrop entries mirror the background's.
+	uint16_t index = address & 0x1F;
+	if ((index & 0x13) == 0x10)
+	{
+		index &= ~0x10;
+	}
+
+	return mPalette[index];
+}
+
+void PPU::IncrementX(uint16_t& v) const
+{
+	if ((v & 0x001F) == 31)
+	{
+		v &= ~0x001F;
+		v ^= 0x0400;
+	}
+	else
+	{
+		++v;
+	}
+}
+
+void PPU::IncrementY()
+{
+	if ((mV & 0x7000) != 0x7000)
+	{
+		mV += 0x1000;
+		return;
+	}
+
+	mV &= ~0x7000;
+
+	uint16_t coarseY = (mV & 0x03E0) >> 5;
+	if (coarseY == 29)
+	{
+		coarseY = 0;
+		mV ^= 0x0800;
+	}
+	else if (coarseY == 31)
+	{
+		coarseY = 0;
+	}
+	else
+	{
+		++coarseY;
+	}
+
+	mV = (mV & ~0x03E0) | (coarseY << 5);
+}
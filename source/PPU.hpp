@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+class Cartridge;
+class StateReader;
+class StateWriter;
+
+// Picture processing unit. Rather than stepping dot by dot alongside the CPU,
+// the PPU is left alone until something needs it to be up to date (a register
+// access, vblank, the end of a frame) and then catches up a scanline at a
+// time. Mid-scanline register writes land between scanlines, which is close
+// enough for nearly everything. Sprite 0 hit is the exception, it's worked
+// out at the start of the line so that polling games see it on the right dot.
+// See https://www.nesdev.org/wiki/PPU.
+class PPU
+{
+public:
+	static constexpr int kWidth = 256;
+	static constexpr int kHeight = 240;
+
+	// Palette indices (0x00-0x3F), one byte per pixel.
+	using FrameBuffer = std::array<uint8_t, kWidth * kHeight>;
+
+	explicit PPU(Cartridge& cartridge);
+
+	void Reset();
+
+	// Runs the PPU up to the given CPU cycle.
+	void CatchUp(uint64_t cpuCycles);
+
+	// The first CPU cycle at or after which vblank next starts.
+	uint64_t GetNextVBlankCycle() const;
+
+	// The first CPU cycle at which the PPU next raises an interrupt, either
+	// the vblank NMI or a mapper IRQ clocked by rendering. Anything else only
+	// shows up in the registers, which catch up when they're accessed.
+	uint64_t GetNextEventCycle() const;
+
+	// Returns true once for each NMI the PPU has raised.
+	bool PollNMI()
+	{
+		bool nmi = mNMIPending;
+		mNMIPending = false;
+		return nmi;
+	}
+
+	// 0x2000-0x3FFF, mirrored every 8 bytes. Call CatchUp() first.
+	uint8_t ReadRegister(uint16_t address);
+	void    WriteRegister(uint16_t address, uint8_t data);
+
+	// OAM DMA, 256 bytes copied starting at OAMADDR.
+	void    WriteOAM(const uint8_t* data);
+
+	// Everything but the frame buffers, the picture comes back with the next
+	// frame after loading.
+	void    SaveState(StateWriter& writer) const;
+	void    LoadState(StateReader& reader);
+
+	// The last completed frame.
+	const FrameBuffer& GetFrameBuffer() const { return mFrameBuffers[mFrontBuffer]; }
+	uint64_t GetFrameNumber() const { return mFrameNumber; }
+
+private:
+	bool     IsRenderingEnabled() const { return (mMask & 0x18) != 0; }
+	uint16_t GetScanlineLength() const;
+	uint16_t GetNextEventDot() const;
+	void     RunEvent();
+	void     RenderScanline();
+	uint64_t GetMapperClockCycle(int clocks) const;
+
+	// Returns the dot the current scanline sets the sprite 0 hit flag on, or
+	// 0 if it doesn't.
+	uint16_t FindSpriteZeroHit() const;
+	const uint8_t* GetSpriteRow(const uint8_t* sprite, int row) const;
+
+	uint8_t  ReadVRAM(uint16_t address);
+	void     WriteVRAM(uint16_t address, uint8_t data);
+	uint16_t MirrorNametable(uint16_t address) const;
+	uint8_t& Palette(uint16_t address);
+
+	void     IncrementX(uint16_t& v) const;
+	void     IncrementY();
+
+	Cartridge& mCartridge;
+
+	// Registers, see https://www.nesdev.org/wiki/PPU_registers.
+	uint8_t mCtrl = 0;
+	uint8_t mMask = 0;
+	uint8_t mStatus = 0;
+	uint8_t mOAMAddress = 0;
+	uint8_t mReadBuffer = 0;
+	uint8_t mOpenBus = 0;
+
+	// Internal scroll/address registers, see https://www.nesdev.org/wiki/PPU_scrolling.
+	uint16_t mV = 0;
+	uint16_t mT = 0;
+	uint8_t  mFineX = 0;
+	bool     mW = false;
+
+	std::array<uint8_t, 0x800> mNametables = {};
+	std::array<uint8_t, 0x20>  mPalette = {};
+	std::array<uint8_t, 0x100> mOAM = {};
+
+	// Dots since power on, always 3x the CPU cycle we've caught up to.
+	uint64_t mDot = 0;
+	uint16_t mScanline = 0;
+	uint16_t mScanlineDot = 0;
+	bool     mOddFrame = false;
+	bool     mNMIPending = false;
+	uint16_t mSpriteZeroHitDot = 0;
+
+	std::array<FrameBuffer, 2> mFrameBuffers = {};
+	uint8_t  mFrontBuffer = 0;
+	uint64_t mFrameNumber = 0;
+};
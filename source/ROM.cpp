@@ -1,5 +1,7 @@
 #include "ROM.hpp"
 
+#include <algorithm>
+#include <array>
 #include <fstream>
 #include <vector>
 
@@ -7,138 +9,265 @@
 
 bool ROM::Load(const std::string& filename)
 {
-	bool success = false;
+	mFile.Close();
+	mFileData.clear();
 
-	std::ifstream file(filename, std::ios::binary);
+	std::span<const uint8_t> data;
 
-	if (file.good())
+	if (mFile.Open(filename))
+	{
+		data = mFile.GetData();
+	}
+	else
 	{
-		file.seekg(0, std::ios::end);
-		size_t fileSize = file.tellg();
-		file.seekg(0, std::ios::beg);
-
-		constexpr size_t kHeaderSize = 16;
-		constexpr size_t kTrainerSize = 512;
-
-		mHeader.version = HV_Unknown;
-		mHeader.prgSize = 0;
-		mHeader.chrSize = 0;
-		mHeader.isHMirrored = true;
-		mHeader.hasBattery = false;
-		mHeader.hasTrainer = false;
-		mHeader.mapper = 0;
-
-		// Read header
-		// Based on info from https://www.nesdev.org/wiki/INES.
-		char header[kHeaderSize];
-		if (fileSize >= kHeaderSize)
+		// Fall back to reading the whole file in, e.g. for files that can't be
+		// mapped.
+		std::ifstream file(filename, std::ios::binary);
+
+		if (file.good())
 		{
-			file.read(header, kHeaderSize);
+			file.seekg(0, std::ios::end);
+			size_t fileSize = file.tellg();
+			file.seekg(0, std::ios::beg);
+
+			mFileData.resize(fileSize);
+			file.read(reinterpret_cast<char*>(mFileData.data()), fileSize);
+			data = mFileData;
+		}
+	}
+
+	return Parse(data);
+}
+
+bool ROM::Load()
+{
+	mFile.Close();
+	mFileData.clear();
+
+	mHeader = {};
+	mTrainer = {};
+
+	mPrgRomCopy.assign(16384, static_cast<uint8_t>(0));
+	mChrRomCopy.assign(16384, static_cast<uint8_t>(0));
+	mPrgRom = mPrgRomCopy;
+	mChrRom = mChrRomCopy;
+
+	ComputeCRC32();
+
+	return true;
+}
+
+std::span<uint8_t> ROM::GetWritablePrgRom()
+{
+	if (mPrgRomCopy.empty())
+	{
+		mPrgRomCopy.assign(mPrgRom.begin(), mPrgRom.end());
+		mPrgRom = mPrgRomCopy;
+	}
+
+	return mPrgRomCopy;
+}
+
+std::span<uint8_t> ROM::GetWritableChrRom()
+{
+	if (mChrRomCopy.empty())
+	{
+		mChrRomCopy.assign(mChrRom.begin(), mChrRom.end());
+		mChrRom = mChrRomCopy;
+	}
+
+	return mChrRomCopy;
+}
 
-			success = true;
+// Standard reflected CRC-32, as used by zip and most ROM databases.
+static constexpr std::array<uint32_t, 256> kCRC32Table = []()
+{
+	std::array<uint32_t, 256> table = {};
+
+	for (uint32_t i = 0; i < 256; ++i)
+	{
+		uint32_t crc = i;
+		for (int bit = 0; bit < 8; ++bit)
+		{
+			crc = (crc >> 1) ^ ((crc & 0x01) ? 0xEDB88320 : 0);
 		}
+		table[i] = crc;
+	}
+
+	return table;
+}();
+
+static uint32_t AccumulateCRC32(uint32_t crc, std::span<const uint8_t> data)
+{
+	for (uint8_t byte : data)
+	{
+		crc = kCRC32Table[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+	}
+
+	return crc;
+}
+
+void ROM::ComputeCRC32()
+{
+	uint32_t crc = 0xFFFFFFFF;
+	crc = AccumulateCRC32(crc, mPrgRom);
+	crc = AccumulateCRC32(crc, mChrRom);
+	mCRC32 = ~crc;
+}
+
+// Returns the next size bytes of data, or as many as there are if the file is
+// too short.
+static std::span<const uint8_t> ReadSection(std::span<const uint8_t> data, size_t& offset, size_t size)
+{
+	offset = std::min(offset, data.size());
+	std::span<const uint8_t> section = data.subspan(offset, std::min(size, data.size() - offset));
+	offset += section.size();
+
+	return section;
+}
+
+bool ROM::Parse(std::span<const uint8_t> data)
+{
+	bool success = false;
+
+	mTrainer = {};
+	mPrgRom = {};
+	mChrRom = {};
+	mPrgRomCopy.clear();
+	mChrRomCopy.clear();
+
+	constexpr size_t kHeaderSize = 16;
+	constexpr size_t kTrainerSize = 512;
 
-		if (success)
+	mHeader.version = HV_Unknown;
+	mHeader.prgSize = 0;
+	mHeader.chrSize = 0;
+	mHeader.isHMirrored = true;
+	mHeader.hasBattery = false;
+	mHeader.hasTrainer = false;
+	mHeader.mapper = 0;
+
+	// Read header
+	// Based on info from https://www.nesdev.org/wiki/INES.
+	const uint8_t* header = data.data();
+	if (data.size() >= kHeaderSize)
+	{
+		success = true;
+	}
+
+	if (success)
+	{
+		if (header[0] == 'N' && header[1] == 'E' && header[2] == 'S' && header[3] == 0x1A)
 		{
-			if (header[0] == 'N' && header[1] == 'E' && header[2] == 'S' && header[3] == 0x1A)
+			uint8_t headerVersionByte = header[7] & 0x0C;
+			if (headerVersionByte == 0x08)
+			{
+				mHeader.version = HV_iNES_2_0;
+			}
+			else if (headerVersionByte == 0x04)
 			{
-				uint8_t headerVersionByte = header[7] & 0x0C;
-				if (headerVersionByte == 0x08)
-				{
-					mHeader.version = HV_iNES_2_0;
-				}
-				else if (headerVersionByte == 0x04)
-				{
-					mHeader.version = HV_iNES_Archaic;
-				}
-				else if (headerVersionByte == 0x00)
-				{
-					mHeader.version = HV_iNES_1_0;
-				}
-
-				if (mHeader.version == HV_iNES_2_0)
-				{
-					// TODO: For now ignore MSB nibble being 0x0F
-					mHeader.prgSize = header[4] | (header[9] & 0x0F) << 8;
-					mHeader.prgSize *= 16384;
-					mHeader.chrSize = header[5] | (header[9] & 0xF0) << 8;
-					mHeader.chrSize *= 8192;
-				}
-				else
-				{
-					mHeader.prgSize = header[4] * 16384;
-					mHeader.chrSize = header[5] * 8192;
-				}
-
-				if ((header[6] & 0x01) == 0x01)
-				{
-					mHeader.isHMirrored = false;
-				}
-
-				if ((header[6] & 0x02) == 0x02)
-				{
-					mHeader.hasBattery = true;
-				}
-
-				if ((header[6] & 0x04) == 0x04)
-				{
-					mHeader.hasTrainer = true;
-				}
-
-				if (mHeader.version == HV_iNES_1_0)
-				{
-					// Check mapper
-					mHeader.mapper = (header[6] & 0xF0) >> 4;
-					mHeader.mapper |= (header[7] & 0x0F) << 4;
-				}
-
-				std::string headerVersionStr = HeaderVersionToString(mHeader.version);
-				SPDLOG_INFO("Successfully read iNES header. Version: {} Trainer: {}, Battery: {} Mapper: {} PRG Size: {} CHR Size: {}", headerVersionStr, mHeader.hasTrainer, mHeader.hasBattery, mHeader.mapper, mHeader.prgSize, mHeader.chrSize);
+				mHeader.version = HV_iNES_Archaic;
+			}
+			else if (headerVersionByte == 0x00)
+			{
+				mHeader.version = HV_iNES_1_0;
+			}
+
+			if (mHeader.version == HV_iNES_2_0)
+			{
+				// TODO: For now ignore MSB nibble being 0x0F
+				mHeader.prgSize = header[4] | (header[9] & 0x0F) << 8;
+				mHeader.prgSize *= 16384;
+				mHeader.chrSize = header[5] | (header[9] & 0xF0) << 8;
+				mHeader.chrSize *= 8192;
 			}
 			else
 			{
-				success = false;
+				mHeader.prgSize = header[4] * 16384;
+				mHeader.chrSize = header[5] * 8192;
 			}
-		}
 
-		// Trainer area
-		if (success && mHeader.hasTrainer)
-		{
-			file.seekg(kTrainerSize, std::ios_base::cur);
-		}
+			if ((header[6] & 0x01) == 0x01)
+			{
+				mHeader.isHMirrored = false;
+			}
+
+			if ((header[6] & 0x02) == 0x02)
+			{
+				mHeader.hasBattery = true;
+			}
+
+			if ((header[6] & 0x04) == 0x04)
+			{
+				mHeader.hasTrainer = true;
+			}
+
+			// Mapper number, the low nibble is in byte 6 and the next in
+			// byte 7. NES 2.0 has 4 more bits in byte 8. Archaic headers may
+			// have junk from byte 7 on, so only the low nibble is trusted.
+			mHeader.mapper = (header[6] & 0xF0) >> 4;
+			if (mHeader.version == HV_iNES_1_0 || mHeader.version == HV_iNES_2_0)
+			{
+				mHeader.mapper |= header[7] & 0xF0;
+			}
+			if (mHeader.version == HV_iNES_2_0)
+			{
+				mHeader.mapper |= (header[8] & 0x0F) << 8;
+			}
 
-		// PRG-ROM
-		if (success)
+			std::string headerVersionStr = HeaderVersionToString(mHeader.version);
+			SPDLOG_INFO("Successfully read iNES header. Version: {} Trainer: {}, Battery: {} Mapper: {} PRG Size: {} CHR Size: {}", headerVersionStr, mHeader.hasTrainer, mHeader.hasBattery, mHeader.mapper, mHeader.prgSize, mHeader.chrSize);
+		}
+		else
 		{
-			// TODO: Copying directly to RAM won't work for mappers that use bank switching...
-			mPrgRom.resize(static_cast<size_t>(mHeader.prgSize), static_cast<uint8_t>(0));
-			file.read(reinterpret_cast<char*>(mPrgRom.data()), mHeader.prgSize);
+			success = false;
 		}
+	}
+
+	size_t offset = kHeaderSize;
+
+	// Trainer area
+	if (success && mHeader.hasTrainer)
+	{
+		mTrainer = ReadSection(data, offset, kTrainerSize);
+	}
 
-		// CHR-ROM
-		if (success)
+	// PRG-ROM
+	if (success)
+	{
+		mPrgRom = ReadSection(data, offset, mHeader.prgSize);
+
+		if (mPrgRom.size() < mHeader.prgSize)
 		{
-			mChrRom.resize(static_cast<size_t>(mHeader.chrSize), static_cast<uint8_t>(0));
-			file.read(reinterpret_cast<char*>(mChrRom.data()), mHeader.chrSize);
+			SPDLOG_ERROR("PRG-ROM is truncated, expected {} bytes but got {}.", mHeader.prgSize, mPrgRom.size());
+
+			mPrgRomCopy.assign(mPrgRom.begin(), mPrgRom.end());
+			mPrgRomCopy.resize(mHeader.prgSize, static_cast<uint8_t>(0));
+			mPrgRom = mPrgRomCopy;
 		}
 	}
 
-	return success;
-}
+	// CHR-ROM, or 8KB of CHR-RAM if the cartridge has none.
+	if (success)
+	{
+		mChrRom = ReadSection(data, offset, mHeader.chrSize);
 
-bool ROM::Load()
-{
-	mPrgRom.resize(16384, static_cast<uint8_t>(0));
-	mChrRom.resize(16384, static_cast<uint8_t>(0));
-	return true;
-}
+		if (mHeader.chrSize == 0)
+		{
+			mChrRomCopy.resize(8192, static_cast<uint8_t>(0));
+			mChrRom = mChrRomCopy;
+		}
+		else if (mChrRom.size() < mHeader.chrSize)
+		{
+			SPDLOG_ERROR("CHR-ROM is truncated, expected {} bytes but got {}.", mHeader.chrSize, mChrRom.size());
 
-std::vector<uint8_t>& ROM::GetPrgRom()
-{
-	return mPrgRom;
-}
+			mChrRomCopy.assign(mChrRom.begin(), mChrRom.end());
+			mChrRomCopy.resize(mHeader.chrSize, static_cast<uint8_t>(0));
+			mChrRom = mChrRomCopy;
+		}
+	}
 
-std::vector<uint8_t>& ROM::GetChrRom()
-{
-	return mChrRom;
+	ComputeCRC32();
+
+	return success;
 }
@@ -1,9 +1,12 @@
 #pragma once
 
 #include <cstdint>
+#include <span>
 #include <string>
 #include <vector>
 
+#include "MappedFile.hpp"
+
 enum HeaderVersion : uint8_t
 {
 	HV_Unknown,
@@ -59,12 +62,37 @@ public:
 
 	NESHeader GetHeader() { return mHeader; }
 
-	std::vector<uint8_t>& GetPrgRom();
-	std::vector<uint8_t>& GetChrRom();
+	// These point straight into the memory mapped file where possible.
+	std::span<const uint8_t> GetPrgRom() const { return mPrgRom; }
+	std::span<const uint8_t> GetChrRom() const { return mChrRom; }
+	std::span<const uint8_t> GetTrainer() const { return mTrainer; }
+
+	// Copies the data out of the file the first time they're called, so only
+	// patched images pay for a copy. CHR-RAM is always writable.
+	std::span<uint8_t> GetWritablePrgRom();
+	std::span<uint8_t> GetWritableChrRom();
+
+	bool IsPrgRomWritable() const { return !mPrgRomCopy.empty(); }
+	bool IsChrRomWritable() const { return !mChrRomCopy.empty(); }
+
+	// CRC-32 of PRG and CHR as loaded, before any patching. Identifies the
+	// game, e.g. so a save state can't be loaded into the wrong one.
+	uint32_t GetCRC32() const { return mCRC32; }
 
 private:
+	bool Parse(std::span<const uint8_t> data);
+	void ComputeCRC32();
+
 	NESHeader mHeader;
+	uint32_t  mCRC32 = 0;
+
+	MappedFile           mFile;
+	std::vector<uint8_t> mFileData;
+
+	std::span<const uint8_t> mPrgRom;
+	std::span<const uint8_t> mChrRom;
+	std::span<const uint8_t> mTrainer;
 
-	std::vector<uint8_t> mPrgRom;
-	std::vector<uint8_t> mChrRom;
+	std::vector<uint8_t> mPrgRomCopy;
+	std::vector<uint8_t> mChrRomCopy;
 };
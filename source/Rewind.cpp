@@ -0,0 +1,205 @@
+#include "Rewind.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	// Zero runs shorter than this cost more to encode as a run than to copy.
+	constexpr size_t kMinZeroRun = 4;
+
+	uint8_t* WriteLength(uint8_t* out, size_t length)
+	{
+		while (length >= 0x80)
+		{
+			*out++ = static_cast<uint8_t>(length | 0x80);
+			length >>= 7;
+		}
+		*out++ = static_cast<uint8_t>(length);
+
+		return out;
+	}
+
+	const uint8_t* ReadLength(const uint8_t* in, size_t& length)
+	{
+		length = 0;
+		for (int shift = 0; ; shift += 7)
+		{
+			uint8_t byte = *in++;
+			length |= static_cast<size_t>(byte & 0x7F) << shift;
+
+			if (!(byte & 0x80))
+			{
+				return in;
+			}
+		}
+	}
+}
+
+RewindBuffer::RewindBuffer(size_t capacityBytes, size_t maxStates)
+	: mData(capacityBytes)
+	, mEntries(std::max<size_t>(maxStates, 2) - 1)
+{
+}
+
+size_t RewindBuffer::GetBytesUsed() const
+{
+	size_t bytes = mNewest.size();
+	for (size_t i = 0; i < mEntryCount; ++i)
+	{
+		bytes += GetEntry(i).size;
+	}
+
+	return bytes;
+}
+
+void RewindBuffer::Clear()
+{
+	mHead = 0;
+	mFirstEntry = 0;
+	mEntryCount = 0;
+	mNewest.clear();
+}
+
+void RewindBuffer::Push(std::span<const uint8_t> state)
+{
+	if (mNewest.size() != state.size())
+	{
+		Clear();
+		mNewest.assign(state.begin(), state.end());
+		mScratch.resize(state.size() * 2 + 16);
+		return;
+	}
+
+	size_t size = Encode(state, mNewest, mScratch.data());
+	mNewest.assign(state.begin(), state.end());
+
+	if (size > mData.size())
+	{
+		Clear();
+		mNewest.assign(state.begin(), state.end());
+		return;
+	}
+
+	// Wrap if it won't fit before the end, the gap left there is freed along
+	// with whatever is in it.
+	size_t offset = mHead + size <= mData.size() ? mHead : 0;
+
+	while (mEntryCount > 0)
+	{
+		const Entry& oldest = GetEntry(0);
+		bool isInGap = offset == 0 && mHead != 0 && oldest.offset >= mHead;
+		bool overlaps = oldest.offset < offset + size && offset < oldest.offset + oldest.size;
+
+		if (!isInGap && !overlaps && mEntryCount < mEntries.size())
+		{
+			break;
+		}
+
+		DropOldest();
+	}
+
+	std::memcpy(mData.data() + offset, mScratch.data(), size);
+	mEntries[(mFirstEntry + mEntryCount) % mEntries.size()] = { offset, size };
+	++mEntryCount;
+	mHead = offset + size;
+}
+
+bool RewindBuffer::Pop(std::vector<uint8_t>& state)
+{
+	if (mEntryCount == 0)
+	{
+		return false;
+	}
+
+	const Entry& newest = GetEntry(mEntryCount - 1);
+	Apply(mData.data() + newest.offset, newest.size, mNewest);
+
+	// Deltas are freed newest first, so its space is always at the head.
+	mHead = newest.offset;
+	--mEntryCount;
+
+	state.assign(mNewest.begin(), mNewest.end());
+
+	return true;
+}
+
+void RewindBuffer::DropOldest()
+{
+	mFirstEntry = (mFirstEntry + 1) % mEntries.size();
+	--mEntryCount;
+}
+
+// Pairs of zero run length and literal length, then the literal bytes, until
+// the whole state is covered.
+size_t RewindBuffer::Encode(std::span<const uint8_t> older, std::span<const uint8_t> newer, uint8_t* out) const
+{
+	const size_t size = newer.size();
+	uint8_t* start = out;
+	size_t i = 0;
+
+	auto isSame = [&](size_t index) { return older[index] == newer[index]; };
+
+	while (i < size)
+	{
+		size_t zeroStart = i;
+		while (i < size && isSame(i))
+		{
+			++i;
+		}
+
+		// Carry on through short runs of zeros, up to the next long one.
+		size_t literalStart = i;
+		while (i < size)
+		{
+			if (!isSame(i))
+			{
+				++i;
+				continue;
+			}
+
+			size_t zeros = 0;
+			while (i + zeros < size && zeros < kMinZeroRun && isSame(i + zeros))
+			{
+				++zeros;
+			}
+
+			if (zeros == kMinZeroRun || i + zeros == size)
+			{
+				break;
+			}
+
+			i += zeros;
+		}
+
+		out = WriteLength(out, literalStart - zeroStart);
+		out = WriteLength(out, i - literalStart);
+
+		for (size_t j = literalStart; j < i; ++j)
+		{
+			*out++ = older[j] ^ newer[j];
+		}
+	}
+
+	return out - start;
+}
+
+void RewindBuffer::Apply(const uint8_t* delta, size_t size, std::span<uint8_t> state) const
+{
+	const uint8_t* end = delta + size;
+	uint8_t* out = state.data();
+
+	while (delta < end)
+	{
+		size_t zeroRun = 0;
+		size_t literals = 0;
+		delta = ReadLength(delta, zeroRun);
+		delta = ReadLength(delta, literals);
+
+		out += zeroRun;
+		for (size_t i = 0; i < literals; ++i)
+		{
+			*out++ ^= *delta++;
+		}
+	}
+}
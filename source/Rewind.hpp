@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// History of save states for rewinding. Only the newest state is kept whole,
+// each older one is stored as its XOR against the one after it, which is
+// mostly zeros from one frame to the next, run length encoded. Everything
+// lives in one block of memory allocated up front, and the oldest states are
+// dropped to make room for new ones.
+class RewindBuffer
+{
+public:
+	RewindBuffer(size_t capacityBytes, size_t maxStates);
+
+	// Adds a state as the newest. States must all be the same size, one of a
+	// different size (e.g. from another ROM) starts the history again.
+	void   Push(std::span<const uint8_t> state);
+
+	// Drops the newest state and copies out the one before it, which becomes
+	// the newest. Returns false if there isn't one.
+	bool   Pop(std::vector<uint8_t>& state);
+
+	// Including the newest.
+	size_t GetStateCount() const { return mNewest.empty() ? 0 : mEntryCount + 1; }
+	size_t GetBytesUsed() const;
+
+	void   Clear();
+
+private:
+	struct Entry
+	{
+		size_t offset;
+		size_t size;
+	};
+
+	size_t Encode(std::span<const uint8_t> older, std::span<const uint8_t> newer, uint8_t* out) const;
+	void   Apply(const uint8_t* delta, size_t size, std::span<uint8_t> state) const;
+
+	const Entry& GetEntry(size_t index) const { return mEntries[(mFirstEntry + index) % mEntries.size()]; }
+	void   DropOldest();
+
+	// Deltas, written one after the other and wrapping back to the start
+	// when the next one doesn't fit before the end.
+	std::vector<uint8_t> mData;
+	size_t               mHead = 0;
+
+	// Ring of deltas, oldest first.
+	std::vector<Entry>   mEntries;
+	size_t               mFirstEntry = 0;
+	size_t               mEntryCount = 0;
+
+	std::vector<uint8_t> mNewest;
+	std::vector<uint8_t> mScratch;
+};
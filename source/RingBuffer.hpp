@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Lock-free queue for exactly one producer thread and one consumer thread.
+// Capacity must be a power of two so indices can be masked instead of wrapped.
+template <typename T, size_t Capacity>
+class RingBuffer
+{
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "RingBuffer capacity must be a power of two.");
+
+public:
+	// Producer only. Returns false if the buffer is full, the item is not queued.
+	bool Push(const T& item)
+	{
+		const size_t head = mHead.load(std::memory_order_relaxed);
+		if (head - mTail.load(std::memory_order_acquire) == Capacity)
+		{
+			return false;
+		}
+
+		mItems[head & kMask] = item;
+		mHead.store(head + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	// Consumer only. Returns false if the buffer is empty.
+	bool Pop(T& item)
+	{
+		const size_t tail = mTail.load(std::memory_order_relaxed);
+		if (tail == mHead.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+
+		item = mItems[tail & kMask];
+		mTail.store(tail + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	// Only exact when called from the producer or consumer thread.
+	size_t Size() const
+	{
+		return mHead.load(std::memory_order_acquire) - mTail.load(std::memory_order_acquire);
+	}
+
+	static constexpr size_t GetCapacity() { return Capacity; }
+
+private:
+	static constexpr size_t kMask = Capacity - 1;
+
+	// Keep the indices on separate cache lines so the two threads don't fight over them.
+	alignas(64) std::atomic<size_t> mHead = 0;
+	alignas(64) std::atomic<size_t> mTail = 0;
+	alignas(64) std::array<T, Capacity> mItems;
+};
@@ -0,0 +1,39 @@
+#include "SaveState.hpp"
+
+#include <fstream>
+
+#include <spdlog/spdlog.h>
+
+bool WriteStateFile(const std::string& filename, std::span<const uint8_t> state)
+{
+	std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(state.data()), state.size());
+
+	if (!file.good())
+	{
+		SPDLOG_ERROR("Failed to write save state \"{}\".", filename);
+		return false;
+	}
+
+	return true;
+}
+
+bool ReadStateFile(const std::string& filename, std::vector<uint8_t>& state)
+{
+	std::ifstream file(filename, std::ios::binary);
+
+	if (!file.good())
+	{
+		SPDLOG_ERROR("Failed to open save state \"{}\".", filename);
+		return false;
+	}
+
+	file.seekg(0, std::ios::end);
+	size_t fileSize = file.tellg();
+	file.seekg(0, std::ios::beg);
+
+	state.resize(fileSize);
+	file.read(reinterpret_cast<char*>(state.data()), fileSize);
+
+	return file.good();
+}
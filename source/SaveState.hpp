@@ -0,0 +1,152 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Save states are a flat blob of little-endian fields, written and read back
+// in the same fixed order by each part of the machine. There are no names or
+// tags, a state only has to load into the same build running the same ROM,
+// which the header checks for (see System::SaveState()).
+
+// Appends to a buffer owned by the caller. Reusing the buffer keeps its
+// capacity, so saving again doesn't allocate.
+class StateWriter
+{
+public:
+	explicit StateWriter(std::vector<uint8_t>& buffer) : mBuffer(buffer) {}
+
+	template <typename T>
+	void Write(T value)
+	{
+		static_assert(std::is_integral_v<T> || std::is_enum_v<T>);
+
+		if constexpr (std::is_same_v<T, bool>)
+		{
+			mBuffer.push_back(value ? 1 : 0);
+		}
+		else
+		{
+			auto bits = static_cast<std::make_unsigned_t<ToInteger<T>>>(value);
+
+			uint8_t bytes[sizeof(T)];
+			for (size_t i = 0; i < sizeof(T); ++i)
+			{
+				bytes[i] = static_cast<uint8_t>(bits >> (i * 8));
+			}
+
+			WriteBytes(bytes, sizeof(T));
+		}
+	}
+
+	void WriteBytes(const void* data, size_t size)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		mBuffer.insert(mBuffer.end(), bytes, bytes + size);
+	}
+
+	template <size_t N>
+	void WriteArray(const std::array<uint8_t, N>& array) { WriteBytes(array.data(), N); }
+
+	template <typename T, size_t N>
+	void WriteArray(const std::array<T, N>& array)
+	{
+		for (const T& value : array)
+		{
+			Write(value);
+		}
+	}
+
+private:
+	template <typename T>
+	using ToInteger = typename std::conditional_t<std::is_enum_v<T>, std::underlying_type<T>, std::type_identity<T>>::type;
+
+	std::vector<uint8_t>& mBuffer;
+};
+
+// Reads fields back in the order they were written. Reading past the end
+// zeroes the field and marks the reader invalid, so callers only need to
+// check once at the end.
+class StateReader
+{
+public:
+	explicit StateReader(std::span<const uint8_t> data) : mData(data) {}
+
+	template <typename T>
+	void Read(T& value)
+	{
+		static_assert(std::is_integral_v<T> || std::is_enum_v<T>);
+
+		uint8_t bytes[sizeof(T)];
+		ReadBytes(bytes, sizeof(T));
+
+		if constexpr (std::is_same_v<T, bool>)
+		{
+			value = bytes[0] != 0;
+		}
+		else
+		{
+			std::make_unsigned_t<ToInteger<T>> bits = 0;
+			for (size_t i = 0; i < sizeof(T); ++i)
+			{
+				bits |= static_cast<decltype(bits)>(bytes[i]) << (i * 8);
+			}
+
+			value = static_cast<T>(bits);
+		}
+	}
+
+	void ReadBytes(void* data, size_t size)
+	{
+		if (size > mData.size() - mOffset)
+		{
+			std::memset(data, 0, size);
+			mIsValid = false;
+			mOffset = mData.size();
+			return;
+		}
+
+		std::memcpy(data, mData.data() + mOffset, size);
+		mOffset += size;
+	}
+
+	template <size_t N>
+	void ReadArray(std::array<uint8_t, N>& array) { ReadBytes(array.data(), N); }
+
+	template <typename T, size_t N>
+	void ReadArray(std::array<T, N>& array)
+	{
+		for (T& value : array)
+		{
+			Read(value);
+		}
+	}
+
+	// For fields that read fine but don't fit the machine being loaded into,
+	// e.g. a memory size that differs. Nothing after this is read.
+	void Fail()
+	{
+		mIsValid = false;
+		mOffset = mData.size();
+	}
+
+	bool   IsValid() const { return mIsValid; }
+	size_t GetRemaining() const { return mData.size() - mOffset; }
+
+private:
+	template <typename T>
+	using ToInteger = typename std::conditional_t<std::is_enum_v<T>, std::underlying_type<T>, std::type_identity<T>>::type;
+
+	std::span<const uint8_t> mData;
+	size_t                   mOffset = 0;
+	bool                     mIsValid = true;
+};
+
+// Whole files, for the frontends.
+bool WriteStateFile(const std::string& filename, std::span<const uint8_t> state);
+bool ReadStateFile(const std::string& filename, std::vector<uint8_t>& state);
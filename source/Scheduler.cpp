@@ -0,0 +1,336 @@
+#include "Scheduler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <utility>
+
+Scheduler::Scheduler(NES& nes)
+	: mNES(nes)
+	, mRewind(kRewindBytes, kRewindFrames)
+{
+	mThread = std::thread(&Scheduler::ThreadMain, this);
+}
+
+Scheduler::~Scheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(mSystemMutex);
+		mQuit = true;
+	}
+	mWake.notify_one();
+
+	mThread.join();
+}
+
+void Scheduler::SetLoaded(bool loaded)
+{
+	{
+		std::lock_guard<std::mutex> lock(mSystemMutex);
+		mLoaded = loaded;
+		mRunning = false;
+		mCycleBudget = 0.0;
+		mSnapshotRequested = true;
+		mRewind.Clear();
+		mRewindFrames = 0;
+		mRecording = false;
+	}
+	mWake.notify_one();
+}
+
+void Scheduler::Run()
+{
+	{
+		std::lock_guard<std::mutex> lock(mSystemMutex);
+		mRunning = true;
+	}
+	mWake.notify_one();
+}
+
+void Scheduler::Pause()
+{
+	mRunning = false;
+}
+
+void Scheduler::Step()
+{
+	{
+		std::lock_guard<std::mutex> lock(mSystemMutex);
+		mRunning = false;
+		mStepRequested = true;
+	}
+	mWake.notify_one();
+}
+
+void Scheduler::SetRewinding(bool rewinding)
+{
+	// Called every UI frame, only take the lock when it changes.
+	if (mRewinding == rewinding)
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mSystemMutex);
+		mRewinding = rewinding;
+	}
+	mWake.notify_one();
+}
+
+void Scheduler::StartRecording()
+{
+	std::lock_guard<std::mutex> lock(mSystemMutex);
+
+	if (mLoaded)
+	{
+		mMovie.Start(mNES.GetSystem());
+		mRecording = true;
+	}
+}
+
+void Scheduler::StopRecording(Movie& movie)
+{
+	std::lock_guard<std::mutex> lock(mSystemMutex);
+	mRecording = false;
+	movie = std::move(mMovie);
+	mMovie = Movie();
+}
+
+void Scheduler::EnableAudio(double sampleRate)
+{
+	std::lock_guard<std::mutex> lock(mSystemMutex);
+	mAudioSampleRate = sampleRate;
+	mNES.GetAPU().SetSampleRate(sampleRate);
+}
+
+size_t Scheduler::ReadAudio(int16_t* samples, size_t count)
+{
+	size_t read = 0;
+	while (read < count && mAudio.Pop(samples[read]))
+	{
+		++read;
+	}
+
+	return read;
+}
+
+void Scheduler::ThreadMain()
+{
+	const auto frameDuration = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / kFrameRate));
+
+	// If we fall further behind than this (e.g. the host was suspended), give
+	// up on catching up rather than running flat out until we do.
+	const auto maxLag = frameDuration * 5;
+
+	Clock::time_point speedSampleTime = Clock::now();
+	uint64_t speedSampleCycles = mNES.GetCPU().GetCycles();
+
+	while (!mQuit)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mSystemMutex);
+			mWake.wait(lock, [this]()
+			{
+				return mQuit || mSnapshotRequested || (mLoaded && (mRunning || mRewinding || mStepRequested));
+			});
+
+			if (mQuit)
+			{
+				break;
+			}
+
+			if (mLoaded && mStepRequested)
+			{
+				mStepRequested = false;
+				mNES.GetSystem().Process();
+			}
+			else if (mLoaded && mRewinding)
+			{
+				RewindFrame();
+			}
+			else if (mLoaded && mRunning)
+			{
+				RunFrame();
+			}
+
+			mSnapshotRequested = false;
+			PublishFrame();
+		}
+
+		if (!mRunning && !mRewinding)
+		{
+			mNextFrameTime = Clock::time_point();
+			mEmulationSpeed = 0.0;
+			continue;
+		}
+
+		Clock::time_point now = Clock::now();
+
+		if (mTurbo || mNextFrameTime == Clock::time_point() || now - mNextFrameTime > maxLag)
+		{
+			mNextFrameTime = now;
+		}
+
+		if (!mTurbo)
+		{
+			mNextFrameTime += frameDuration;
+			std::this_thread::sleep_until(mNextFrameTime);
+		}
+
+		// Report how fast we're running relative to real hardware, roughly twice a second.
+		now = Clock::now();
+		std::chrono::duration<double> elapsed = now - speedSampleTime;
+		if (elapsed.count() >= 0.5)
+		{
+			uint64_t cycles = mNES.GetCPU().GetCycles();
+			mEmulationSpeed = cycles >= speedSampleCycles ? ((cycles - speedSampleCycles) / kCPUClockRate) / elapsed.count() : 0.0;
+
+			speedSampleTime = now;
+			speedSampleCycles = cycles;
+		}
+	}
+}
+
+void Scheduler::RunFrame()
+{
+	mCycleBudget += kCyclesPerFrame;
+
+	System& system = mNES.GetSystem();
+
+	Movie::Frame frame;
+	for (size_t port = 0; port < frame.buttons.size(); ++port)
+	{
+		frame.buttons[port] = mButtons[port].load(std::memory_order_relaxed);
+		system.GetController(port).SetButtons(frame.buttons[port]);
+	}
+
+	frame.cycles = static_cast<uint16_t>(std::ceil(mCycleBudget));
+
+	const int64_t inputPollTime = mInputPollTime.load(std::memory_order_relaxed);
+	const uint64_t startLatchCycle = system.GetLatchCycle();
+	const int64_t startTime = GetTimestamp();
+
+	const uint64_t startCycles = mNES.GetCPU().GetCycles();
+	bool shouldContinue = system.RunCycles(frame.cycles);
+
+	// A frame runs in one go, so the time the game read its input is about
+	// as far through that as the cycle it latched on was through the frame.
+	const int64_t endTime = GetTimestamp();
+	const uint64_t endCycles = mNES.GetCPU().GetCycles();
+	const uint64_t latchCycle = system.GetLatchCycle();
+
+	mFrameTiming = {};
+	mFrameTiming.completed = endTime;
+	if (latchCycle != startLatchCycle && latchCycle >= startCycles && endCycles > startCycles)
+	{
+		double fraction = static_cast<double>(latchCycle - startCycles) / (endCycles - startCycles);
+		mFrameTiming.inputPoll = inputPollTime;
+		mFrameTiming.inputRead = startTime + static_cast<int64_t>((endTime - startTime) * fraction);
+	}
+
+	if (!shouldContinue)
+	{
+		mRunning = false;
+		mCycleBudget = 0.0;
+		return;
+	}
+
+	mCycleBudget -= static_cast<double>(endCycles - startCycles);
+	++mFrameNumber;
+
+	if (mRecording)
+	{
+		frame.ramHash = Movie::HashRAM({ mNES.GetMemory().GetData(), Memory::kSize });
+		mMovie.AddFrame(frame);
+	}
+
+	system.SaveState(mRewindState);
+	mRewind.Push(mRewindState);
+	mRewindFrames = mRewind.GetStateCount();
+
+	if (mAudioSampleRate > 0.0 && !mRewinding)
+	{
+		PublishAudio();
+	}
+}
+
+// The picture isn't part of a save state, so go back two frames and run one
+// forward to draw it. That frame's state goes back on the end of the history.
+// A recording loses the frames rewound over and carries on from there.
+void Scheduler::RewindFrame()
+{
+	if (!mRewind.Pop(mRewindState))
+	{
+		return;
+	}
+
+	bool canRedraw = mRewind.Pop(mRewindState);
+
+	if (mRecording)
+	{
+		// Rewinding past the start leaves nothing to record from.
+		for (int i = canRedraw ? 2 : 1; i > 0; --i)
+		{
+			mRecording = mRecording && mMovie.RemoveLastFrame();
+		}
+	}
+
+	mNES.GetSystem().LoadState(mRewindState);
+	mCycleBudget = 0.0;
+	mFrameNumber -= canRedraw ? 2 : 1;
+
+	if (canRedraw)
+	{
+		RunFrame();
+	}
+
+	mRewindFrames = mRewind.GetStateCount();
+}
+
+void Scheduler::PublishAudio()
+{
+	APU& apu = mNES.GetAPU();
+	apu.EndFrame();
+
+	// Never queue more than two frames, anything past that (e.g. in turbo) is
+	// dropped rather than heard late.
+	const double samplesPerFrame = mAudioSampleRate / kFrameRate;
+	const size_t maxQueued = static_cast<size_t>(samplesPerFrame * 2.0);
+
+	int16_t samples[1024];
+	while (size_t count = apu.ReadSamples(samples, std::size(samples)))
+	{
+		for (size_t i = 0; i < count && mAudio.Size() < maxQueued; ++i)
+		{
+			mAudio.Push(samples[i]);
+		}
+	}
+
+	// Run slightly fast when the queue is short and slightly slow when it's
+	// long. Half a percent either way is too little to hear as a change in
+	// pitch, but soaks up the drift between the host's audio and video clocks.
+	// See https://docs.libretro.com/development/cores/dynamic-rate-control/.
+	constexpr double kMaxRateAdjustment = 0.005;
+	double fill = static_cast<double>(mAudio.Size()) / samplesPerFrame;
+	double adjustment = std::clamp((1.0 - fill) * kMaxRateAdjustment, -kMaxRateAdjustment, kMaxRateAdjustment);
+
+	apu.SetSampleRate(mAudioSampleRate * (1.0 + adjustment));
+}
+
+void Scheduler::PublishFrame()
+{
+	FrameSnapshot& frame = mFrames.GetWriteBuffer();
+
+	frame.frameNumber = mFrameNumber;
+	frame.cycles = mNES.GetCPU().GetCycles();
+	frame.registers = mNES.GetCPU().GetRegisters();
+	frame.opcode = mNES.GetCPU().GetCurrentOpcode();
+	frame.operand = mNES.GetCPU().GetCurrentOperand();
+	frame.pixels = mNES.GetPPU().GetFrameBuffer();
+
+	// Only a frame that's just been run has anything to time.
+	frame.timing = mFrameTiming;
+	mFrameTiming = {};
+
+	mFrames.Publish();
+}
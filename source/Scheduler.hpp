@@ -0,0 +1,169 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "CPU.hpp"
+#include "Latency.hpp"
+#include "Movie.hpp"
+#include "NES.hpp"
+#include "Rewind.hpp"
+#include "RingBuffer.hpp"
+#include "TripleBuffer.hpp"
+
+// Everything the UI needs to draw once the emulator has finished a frame.
+struct FrameSnapshot
+{
+	uint64_t frameNumber;
+	uint64_t cycles;
+
+	CPURegisters        registers;
+	Opcodes             opcode;
+	uint16_t            operand;
+
+	PPU::FrameBuffer    pixels;
+
+	FrameTiming         timing;
+};
+
+// Runs the emulator on its own thread, a frame's worth of CPU cycles at a
+// time, and paces it against the wall clock so emulated time keeps up with
+// real time. Finished frames are handed to the UI thread via a triple buffer.
+class Scheduler
+{
+public:
+	// NTSC timings, see https://www.nesdev.org/wiki/Cycle_reference_chart.
+	static constexpr double kCPUClockRate = 1789773.0;
+	static constexpr double kCyclesPerFrame = 29780.5;
+	static constexpr double kFrameRate = kCPUClockRate / kCyclesPerFrame;
+
+	// A state is kept every frame for rewinding, a frame's delta is usually
+	// well under a kilobyte.
+	static constexpr size_t kRewindFrames = 60 * 60;
+	static constexpr size_t kRewindBytes = 8 * 1024 * 1024;
+
+	explicit Scheduler(NES& nes);
+	~Scheduler();
+
+	// Call with true once a ROM has been loaded, nothing runs until then.
+	// Pauses emulation.
+	void SetLoaded(bool loaded);
+
+	void Run();
+	void Pause();
+	void Step();
+	bool IsRunning() const { return mRunning; }
+
+	// Turbo ignores the wall clock and runs as fast as the host allows.
+	void SetTurbo(bool turbo) { mTurbo = turbo; }
+	bool IsTurbo() const { return mTurbo; }
+
+	// While rewinding, emulation runs backwards a frame at a time, at normal
+	// speed (or flat out in turbo).
+	void   SetRewinding(bool rewinding);
+	double GetRewindSeconds() const { return mRewindFrames / kFrameRate; }
+
+	// Gives the calling thread exclusive access to the system between frames,
+	// func is called with a null pointer if no ROM is loaded.
+	template <typename Func>
+	void WithSystem(Func&& func)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mSystemMutex);
+			func(mLoaded ? &mNES.GetSystem() : nullptr);
+			mSnapshotRequested = true;
+		}
+		mWake.notify_one();
+	}
+
+	// UI thread only. Picks up the most recently finished frame, returns true
+	// if there was a new one.
+	bool UpdateFrame() { return mFrames.Update(); }
+
+	// UI thread only.
+	const FrameSnapshot& GetLatestFrame() const { return mFrames.GetReadBuffer(); }
+
+	double GetEmulationSpeed() const { return mEmulationSpeed; }
+
+	// Safe from any thread. The emulation thread takes one snapshot of each
+	// port at the start of every frame, so it never waits on whoever is
+	// producing the input. When is noted for the frame's timing.
+	void SetButtons(size_t port, uint8_t buttons)
+	{
+		mButtons[port].store(buttons, std::memory_order_relaxed);
+		mInputPollTime.store(GetTimestamp(), std::memory_order_relaxed);
+	}
+
+	// Records each frame's input from the current state on. Only frames run
+	// (or rewound) by the scheduler are recorded, changing the system through
+	// WithSystem() in the meantime will throw a replay off. Stopping hands
+	// over the movie.
+	void StartRecording();
+	void StopRecording(Movie& movie);
+	bool IsRecording() const { return mRecording; }
+
+	// Turns on sound, which stays off otherwise to save synthesising it.
+	void   EnableAudio(double sampleRate);
+
+	// Audio thread only. Takes up to count samples, returns how many there were.
+	size_t ReadAudio(int16_t* samples, size_t count);
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	void ThreadMain();
+	void RunFrame();
+	void RewindFrame();
+	void PublishFrame();
+	void PublishAudio();
+
+	NES& mNES;
+	bool mLoaded = false;
+
+	// Held by the emulation thread while it runs a frame.
+	std::mutex              mSystemMutex;
+	std::condition_variable mWake;
+
+	std::thread       mThread;
+	std::atomic<bool> mQuit = false;
+	std::atomic<bool> mRunning = false;
+	std::atomic<bool> mTurbo = false;
+	std::atomic<bool> mRewinding = false;
+	bool              mStepRequested = false;
+	bool              mSnapshotRequested = false;
+
+	// Fractional cycles carried over between frames, as a frame isn't a
+	// whole number of cycles and instructions can overshoot the budget.
+	double   mCycleBudget = 0.0;
+	uint64_t mFrameNumber = 0;
+
+	Clock::time_point   mNextFrameTime;
+	std::atomic<double> mEmulationSpeed = 0.0;
+
+	TripleBuffer<FrameSnapshot> mFrames;
+
+	RewindBuffer          mRewind;
+	std::vector<uint8_t>  mRewindState;
+	std::atomic<size_t>   mRewindFrames = 0;
+
+	std::array<std::atomic<uint8_t>, 2> mButtons = {};
+	std::atomic<int64_t>                mInputPollTime = 0;
+
+	// For the next frame published.
+	FrameTiming                         mFrameTiming;
+
+	Movie                 mMovie;
+	std::atomic<bool>     mRecording = false;
+
+	// Samples on their way to the audio thread. The APU's output rate is
+	// nudged to keep about a frame's worth queued, so the audio device never
+	// runs dry but doesn't lag far behind the picture either.
+	RingBuffer<int16_t, 4096> mAudio;
+	double                    mAudioSampleRate = 0.0;
+};
@@ -0,0 +1,101 @@
+#include "Screen.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include <spdlog/spdlog.h>
+
+#include <SDL3/SDL.h>
+
+namespace
+{
+	// 2C02 colours as 0xRRGGBB, see https://www.nesdev.org/wiki/PPU_palettes.
+	constexpr std::array<uint32_t, 64> kPalette =
+	{
+		0x666666, 0x002A88, 0x1412A7, 0x3B00A4, 0x5C007E, 0x6E0040, 0x6C0600, 0x561D00,
+		0x333500, 0x0B4800, 0x005200, 0x004F08, 0x00404D, 0x000000, 0x000000, 0x000000,
+		0xADADAD, 0x155FD9, 0x4240FF, 0x7527FE, 0xA01ACC, 0xB71E7B, 0xB53120, 0x994E00,
+		0x6B6D00, 0x388700, 0x0C9300, 0x008F32, 0x007C8D, 0x000000, 0x000000, 0x000000,
+		0xFFFEFF, 0x64B0FF, 0x9290FF, 0xC676FF, 0xF36AFF, 0xFE6ECC, 0xFE8170, 0xEA9E22,
+		0xBCBE00, 0x88D800, 0x5CE430, 0x45E082, 0x48CDDE, 0x4F4F4F, 0x000000, 0x000000,
+		0xFFFEFF, 0xC0DFFF, 0xD3D2FF, 0xE8C8FF, 0xFBC2FF, 0xFEC4EA, 0xFECCC5, 0xF7D8A5,
+		0xE4E594, 0xCFEF96, 0xBDF4AB, 0xB3F3CC, 0xB5EBF2, 0xB8B8B8, 0x000000, 0x000000,
+	};
+}
+
+Screen::~Screen()
+{
+	if (mTexture)
+	{
+		SDL_DestroyTexture(mTexture);
+	}
+}
+
+bool Screen::Init(SDL_Renderer* renderer)
+{
+	mRenderer = renderer;
+	mTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_XRGB8888, SDL_TEXTUREACCESS_STREAMING, PPU::kWidth, PPU::kHeight);
+
+	if (!mTexture)
+	{
+		SPDLOG_ERROR("Failed to create screen texture! Error code: {}", SDL_GetError());
+		return false;
+	}
+
+	// Scaling up by whole numbers, so keep the pixels sharp.
+	SDL_SetTextureScaleMode(mTexture, SDL_SCALEMODE_NEAREST);
+
+	// Start black rather than with whatever the texture happened to hold.
+	PPU::FrameBuffer black;
+	black.fill(0x0F);
+	Upload(black);
+
+	return true;
+}
+
+void Screen::Upload(const PPU::FrameBuffer& pixels)
+{
+	void* locked = nullptr;
+	int pitch = 0;
+
+	if (!mTexture || !SDL_LockTexture(mTexture, nullptr, &locked, &pitch))
+	{
+		return;
+	}
+
+	// The locked pixels are write only, so each one is written exactly once.
+	for (int y = 0; y < PPU::kHeight; ++y)
+	{
+		const uint8_t* source = pixels.data() + y * PPU::kWidth;
+		uint32_t* dest = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(locked) + y * pitch);
+
+		for (int x = 0; x < PPU::kWidth; ++x)
+		{
+			dest[x] = kPalette[source[x] & 0x3F];
+		}
+	}
+
+	SDL_UnlockTexture(mTexture);
+}
+
+void Screen::Draw()
+{
+	int outputWidth = 0;
+	int outputHeight = 0;
+
+	if (!mTexture || !SDL_GetCurrentRenderOutputSize(mRenderer, &outputWidth, &outputHeight))
+	{
+		return;
+	}
+
+	int scale = std::max(1, std::min(outputWidth / PPU::kWidth, outputHeight / PPU::kHeight));
+
+	SDL_FRect dest;
+	dest.w = static_cast<float>(PPU::kWidth * scale);
+	dest.h = static_cast<float>(PPU::kHeight * scale);
+	dest.x = static_cast<float>((outputWidth - PPU::kWidth * scale) / 2);
+	dest.y = static_cast<float>((outputHeight - PPU::kHeight * scale) / 2);
+
+	SDL_RenderTexture(mRenderer, mTexture, nullptr, &dest);
+}
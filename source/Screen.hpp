@@ -0,0 +1,32 @@
+#pragma once
+
+#include "PPU.hpp"
+
+struct SDL_Renderer;
+struct SDL_Texture;
+
+// Shows the PPU's picture through one streaming texture. New frames are
+// converted from palette indices straight into the texture's locked pixels,
+// and scaling is left to the renderer.
+class Screen
+{
+public:
+	Screen() = default;
+	~Screen();
+
+	Screen(const Screen&) = delete;
+	Screen& operator=(const Screen&) = delete;
+
+	bool Init(SDL_Renderer* renderer);
+
+	// Call only when the frame has changed, the texture keeps the last one.
+	void Upload(const PPU::FrameBuffer& pixels);
+
+	// Draws the picture centred in the render output, at the largest whole
+	// number scale that fits so every NES pixel is the same size.
+	void Draw();
+
+private:
+	SDL_Renderer* mRenderer = nullptr;
+	SDL_Texture*  mTexture = nullptr;
+};
@@ -1,76 +1,385 @@
 #include "System.hpp"
 
+#include <algorithm>
+
+#include <spdlog/spdlog.h>
+
 #include "CPU.hpp"
 #include "Memory.hpp"
+#include "PPU.hpp"
+#include "APU.hpp"
 #include "Cartridge.hpp"
+#include "SaveState.hpp"
 
-System::System(std::shared_ptr<CPU> cpu, std::shared_ptr<Memory> memory, std::shared_ptr<Cartridge> cartridge)
+System::System(CPU& cpu, Memory& memory, PPU& ppu, APU& apu, Cartridge& cartridge)
 	: mCPU(cpu)
 	, mMemory(memory)
+	, mPPU(ppu)
+	, mAPU(apu)
 	, mCartridge(cartridge)
 {
+	// 2KB of internal RAM, mirrored up to 0x2000.
+	for (uint8_t mirror = 0; mirror < 4; ++mirror)
+	{
+		MapPages(mirror * 0x08, 0x08, mMemory.GetData());
+	}
+
+	// PPU, APU and IO registers, then everything from 0x4020 up belongs to
+	// the cartridge, which maps in whatever it can directly.
+	SetHandlers(0x20, 0xE0, &System::ReadIO, &System::WriteIO, this);
+	mCartridge.ConnectSystem(this);
+}
+
+System::~System()
+{
+	mCartridge.DisconnectSystem(this);
 }
 
 void System::Reset()
 {
-	mCPU->ConnectSystem(shared_from_this());
-	mCPU->Reset();
+	mPPU.Reset();
+	mAPU.Reset();
+	mCPU.Reset();
+
+	for (Controller& controller : mControllers)
+	{
+		controller.Reset();
+	}
+
+	SyncPPU();
+	SyncAPU();
 }
 
 bool System::Process()
 {
-	return mCPU->Process();
+	bool shouldContinue = mCPU.Process();
+
+	if (mCPU.GetCycles() >= mEventCycle)
+	{
+		SyncPPU();
+		SyncAPU();
+	}
+
+	return shouldContinue;
 }
 
-uint8_t System::Read(uint16_t address)
+bool System::RunCycles(uint64_t cycles)
 {
-	if (address < 0x2000)
+	const uint64_t targetCycles = mCPU.GetCycles() + cycles;
+	bool shouldContinue = true;
+
+	while (shouldContinue && mCPU.GetCycles() < targetCycles)
 	{
-		address &= 0x07FF;
-		return mMemory->Read(address);
+		// The CPU can run uninterrupted until the next PPU or APU event. If it
+		// touches either before then, it catches up there and then and may
+		// move the event earlier, which ends the run early.
+		uint64_t stopCycles = std::min(targetCycles, mEventCycle);
+		stopCycles = std::max(stopCycles, mCPU.GetCycles() + 1);
+
+		shouldContinue = mCPU.RunCycles(stopCycles - mCPU.GetCycles());
+
+		if (mCPU.GetCycles() >= mEventCycle)
+		{
+			SyncPPU();
+			SyncAPU();
+		}
 	}
-	else if (address >= 0x2000 && address < 0x4000)
+
+	// Leave both up to date, so the frame's picture and sound are complete
+	// for whoever is waiting for them.
+	SyncPPU();
+	SyncAPU();
+
+	return shouldContinue;
+}
+
+namespace
+{
+	// "CJNS", then the layout version. Bump the version whenever anything
+	// saves a field more or less, or in a different order.
+	constexpr uint32_t kStateMagic = 0x534E4A43;
+	constexpr uint16_t kStateVersion = 2;
+
+	// Magic, version, padding, ROM CRC, payload size.
+	constexpr size_t kStateHeaderSize = 16;
+}
+
+void System::SaveState(std::vector<uint8_t>& state)
+{
+	// Everything has to be at the same cycle.
+	SyncPPU();
+	SyncAPU();
+
+	state.clear();
+	StateWriter writer(state);
+
+	writer.Write(kStateMagic);
+	writer.Write(kStateVersion);
+	writer.Write(static_cast<uint16_t>(0));
+	writer.Write(mCartridge.GetCRC32());
+	writer.Write(static_cast<uint32_t>(0));
+
+	mCPU.SaveState(writer);
+	writer.WriteBytes(mMemory.GetData(), Memory::kSize);
+	mPPU.SaveState(writer);
+	mAPU.SaveState(writer);
+	mCartridge.SaveState(writer);
+
+	for (const Controller& controller : mControllers)
 	{
-		address &= 0x8;
-		address += 0x2000;
+		controller.SaveState(writer);
+	}
+
+	// Now the payload size is known.
+	uint32_t payloadSize = static_cast<uint32_t>(state.size() - kStateHeaderSize);
+	for (size_t i = 0; i < 4; ++i)
+	{
+		state[12 + i] = static_cast<uint8_t>(payloadSize >> (i * 8));
+	}
+}
+
+bool System::LoadState(std::span<const uint8_t> state)
+{
+	StateReader reader(state);
+
+	uint32_t magic = 0;
+	uint16_t version = 0;
+	uint16_t padding = 0;
+	uint32_t crc = 0;
+	uint32_t payloadSize = 0;
+	reader.Read(magic);
+	reader.Read(version);
+	reader.Read(padding);
+	reader.Read(crc);
+	reader.Read(payloadSize);
 
-		// TODO: PPU.
+	// Check the header before touching the machine.
+	if (!reader.IsValid() || magic != kStateMagic)
+	{
+		SPDLOG_ERROR("Not a save state.");
+		return false;
+	}
+
+	if (version != kStateVersion)
+	{
+		SPDLOG_ERROR("Save state is version {}, expected {}.", version, kStateVersion);
+		return false;
 	}
-	else if (address >= 0x4000 && address < 0x4018)
+
+	if (crc != mCartridge.GetCRC32())
+	{
+		SPDLOG_ERROR("Save state is for a different ROM (CRC {:08X}, loaded ROM is {:08X}).", crc, mCartridge.GetCRC32());
+		return false;
+	}
+
+	if (payloadSize != reader.GetRemaining())
 	{
-		// TODO: APU and IO registers.
+		SPDLOG_ERROR("Save state is truncated, expected {} bytes but got {}.", payloadSize, reader.GetRemaining());
+		return false;
+	}
+
+	// Each part loads straight into the machine, and whether the payload fits
+	// is only known once it's all been read. Snapshot what's there first so
+	// a bad state leaves the machine as it was.
+	SaveState(mUndoState);
+
+	if (!LoadPayload(reader))
+	{
+		SPDLOG_ERROR("Save state doesn't match this ROM's layout.");
+
+		StateReader undo(std::span<const uint8_t>(mUndoState).subspan(kStateHeaderSize));
+		LoadPayload(undo);
+
+		return false;
+	}
+
+	return true;
+}
+
+bool System::LoadPayload(StateReader& reader)
+{
+	mCPU.LoadState(reader);
+	reader.ReadBytes(mMemory.GetData(), Memory::kSize);
+	mPPU.LoadState(reader);
+	mAPU.LoadState(reader);
+	mCartridge.LoadState(reader);
+
+	for (Controller& controller : mControllers)
+	{
+		controller.LoadState(reader);
+	}
+
+	// Catching up to a cycle count from a bad payload could take forever.
+	if (!reader.IsValid() || reader.GetRemaining() != 0)
+	{
+		return false;
+	}
+
+	// Interrupt lines and events follow from the loaded state.
+	SyncPPU();
+	SyncAPU();
+
+	return true;
+}
+
+void System::SyncPPU()
+{
+	mPPU.CatchUp(mCPU.GetCycles());
+
+	if (mPPU.PollNMI())
+	{
+		mCPU.TriggerNMI();
+	}
+
+	mCPU.SetIRQ(mCartridge.IsIRQPending() || mAPU.IsIRQPending());
+
+	ScheduleNextEvent();
+}
+
+void System::SyncAPU()
+{
+	mAPU.CatchUp(mCPU.GetCycles());
+
+	// DMC sample fetches hold the CPU off the bus.
+	if (uint32_t stallCycles = mAPU.TakeStallCycles())
+	{
+		mCPU.Stall(stallCycles);
+	}
+
+	mCPU.SetIRQ(mCartridge.IsIRQPending() || mAPU.IsIRQPending());
+
+	ScheduleNextEvent();
+}
+
+void System::ScheduleNextEvent()
+{
+	mEventCycle = std::min(mPPU.GetNextEventCycle(), mAPU.GetNextEventCycle());
+	mCPU.EndRunAt(mEventCycle);
+}
+
+void System::MapPages(uint8_t firstPage, uint16_t pageCount, uint8_t* memory)
+{
+	for (uint16_t i = 0; i < pageCount; ++i)
+	{
+		mReadPages[firstPage + i] = memory + i * 0x100;
+		mWritePages[firstPage + i] = memory + i * 0x100;
+	}
+}
+
+void System::MapReadOnlyPages(uint8_t firstPage, uint16_t pageCount, const uint8_t* memory)
+{
+	for (uint16_t i = 0; i < pageCount; ++i)
+	{
+		mReadPages[firstPage + i] = memory + i * 0x100;
+		mWritePages[firstPage + i] = nullptr;
+	}
+}
+
+void System::UnmapPages(uint8_t firstPage, uint16_t pageCount)
+{
+	for (uint16_t i = 0; i < pageCount; ++i)
+	{
+		mReadPages[firstPage + i] = nullptr;
+		mWritePages[firstPage + i] = nullptr;
+	}
+}
+
+void System::InvalidateCode()
+{
+	mCPU.InvalidateBlocks();
+}
+
+void System::SetHandlers(uint8_t firstPage, uint16_t pageCount, ReadHandler read, WriteHandler write, void* context)
+{
+	for (uint16_t i = 0; i < pageCount; ++i)
+	{
+		mHandlers[firstPage + i] = { read, write, context };
+	}
+}
+
+uint8_t System::ReadIO(void* context, uint16_t address)
+{
+	System* system = static_cast<System*>(context);
+
+	if (address < 0x4000)
+	{
+		system->SyncPPU();
+		return system->mPPU.ReadRegister(address);
+	}
+	else if (address == 0x4015)
+	{
+		system->SyncAPU();
+		uint8_t status = system->mAPU.ReadStatus();
+
+		// Reading acknowledges the frame IRQ.
+		system->SyncAPU();
+		return status;
+	}
+	else if (address == 0x4016 || address == 0x4017)
+	{
+		// The upper bits are open bus, which is usually the high byte of the
+		// address.
+		return 0x40 | system->mControllers[address - 0x4016].Read();
 	}
 	else if (address >= 0x4020)
 	{
-		return mCartridge->Read(address);
+		return system->mCartridge.Read(address);
 	}
 
-	// Fall back to RAM for now.
 	// TODO: Open bus behaviour.
-	return mMemory->Read(address);
+	return 0x00;
 }
 
-void System::Write(uint16_t address, uint8_t data)
+void System::WriteIO(void* context, uint16_t address, uint8_t data)
 {
-	if (address < 0x2000)
+	System* system = static_cast<System*>(context);
+
+	if (address < 0x4000)
 	{
-		address &= 0x07FF;
+		system->SyncPPU();
+		system->mPPU.WriteRegister(address, data);
 
-		mMemory->Write(address, data);
+		// Enabling NMI during vblank raises one immediately, and turning NMI
+		// or rendering on or off moves the next event.
+		system->SyncPPU();
 	}
-	else if (address >= 0x2000 && address < 0x4000)
+	else if (address == 0x4014)
 	{
-		address &= 0x8;
-		address += 0x2000;
+		// OAM DMA copies a page of CPU memory to OAM, halting the CPU while
+		// it does.
+		uint8_t page[0x100];
+		for (uint16_t i = 0; i < 0x100; ++i)
+		{
+			page[i] = system->Read((data << 8) | i);
+		}
 
-		// TODO: PPU.
+		system->SyncPPU();
+		system->mPPU.WriteOAM(page);
+		system->mCPU.Stall(513 + (system->mCPU.GetCycles() & 0x01));
 	}
-	else if (address >= 0x4000 && address < 0x4018)
+	else if (address <= 0x4013 || address == 0x4015 || address == 0x4017)
 	{
-		// TODO: APU and IO registers.
+		system->SyncAPU();
+		system->mAPU.WriteRegister(address, data);
+
+		// Lengths, IRQ flags and the frame counter may all have changed.
+		system->SyncAPU();
+	}
+	else if (address == 0x4016)
+	{
+		for (Controller& controller : system->mControllers)
+		{
+			controller.WriteStrobe(data);
+		}
+
+		// The buttons are held once the strobe goes low.
+		if (!(data & 0x01))
+		{
+			system->mLatchCycle = system->mCPU.GetCycles();
+		}
 	}
 	else if (address >= 0x4020)
 	{
-		return mCartridge->Write(address, data);
+		system->mCartridge.Write(address, data);
 	}
-}
\ No newline at end of file
+}
@@ -1,24 +1,157 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
-#include <memory>
+#include <span>
+#include <vector>
+
+#include "Controller.hpp"
 
 class CPU;
 class Memory;
+class PPU;
+class APU;
 class Cartridge;
+class StateReader;
 
-class System : public std::enable_shared_from_this<System>
+class System
 {
 public:
-	System(std::shared_ptr<CPU> cpu, std::shared_ptr<Memory> memory, std::shared_ptr<Cartridge> cartridge);
+	System(CPU& cpu, Memory& memory, PPU& ppu, APU& apu, Cartridge& cartridge);
+	~System();
+
+	System(const System&) = delete;
+	System& operator=(const System&) = delete;
 
 	void Reset();
 	bool Process();
+	bool RunCycles(uint64_t cycles);
+
+	// Snapshots the whole machine into state, replacing what was there. The
+	// buffer keeps its capacity, so saving into the same one again doesn't
+	// allocate. Loading rejects states from other versions or other ROMs.
+	void SaveState(std::vector<uint8_t>& state);
+	bool LoadState(std::span<const uint8_t> state);
+
+	// Ports 0 and 1, read at 0x4016 and 0x4017.
+	Controller& GetController(size_t port) { return mControllers[port]; }
+
+	// The CPU cycle the game last latched the controllers' buttons on, for
+	// measuring input latency. Not part of save states.
+	uint64_t GetLatchCycle() const { return mLatchCycle; }
+
+	// The address space is split into 256 byte pages. Pages backed by plain
+	// memory (RAM, ROM) point straight at it, so the common case is a single
+	// indexed load. Everything else (I/O registers, unmapped areas) goes
+	// through a handler.
+	uint8_t Read(uint16_t address)
+	{
+		const uint8_t page = address >> 8;
+		if (const uint8_t* memory = mReadPages[page])
+		{
+			return memory[address & 0xFF];
+		}
+
+		return mHandlers[page].read(mHandlers[page].context, address);
+	}
+
+	void Write(uint16_t address, uint8_t data)
+	{
+		const uint8_t page = address >> 8;
+		if (uint8_t* memory = mWritePages[page])
+		{
+			memory[address & 0xFF] = data;
+			return;
+		}
+
+		mHandlers[page].write(mHandlers[page].context, address, data);
+	}
+
+	// Read() without the side effects of reading I/O registers, for debug
+	// views. Pages that go through a handler read as 0x00.
+	uint8_t Peek(uint16_t address) const
+	{
+		const uint8_t page = address >> 8;
+		if (const uint8_t* memory = mReadPages[page])
+		{
+			return memory[address & 0xFF];
+		}
+
+		return 0x00;
+	}
+
+	using ReadHandler = uint8_t (*)(void* context, uint16_t address);
+	using WriteHandler = void (*)(void* context, uint16_t address, uint8_t data);
+
+	// Points pageCount pages, starting at firstPage, at consecutive 256 byte
+	// blocks of memory. Read-only pages send writes to the page's handler.
+	void MapPages(uint8_t firstPage, uint16_t pageCount, uint8_t* memory);
+	void MapReadOnlyPages(uint8_t firstPage, uint16_t pageCount, const uint8_t* memory);
+
+	// Removes any direct mapping, so accesses go through the handlers.
+	void UnmapPages(uint8_t firstPage, uint16_t pageCount);
+
+	// The memory behind a page if it's mapped read only, i.e. ROM.
+	const uint8_t* GetReadOnlyPage(uint8_t page) const
+	{
+		return mWritePages[page] ? nullptr : mReadPages[page];
+	}
+
+	// The page tables themselves, so compiled code can do the fast path of
+	// Read() and Write() inline.
+	const uint8_t* const* GetReadPageTable() const { return mReadPages.data(); }
+	uint8_t* const*       GetWritePageTable() const { return mWritePages.data(); }
+
+	// For when ROM changes in place rather than being remapped, e.g. a new
+	// ROM or a save state, so the CPU doesn't run code it decoded earlier.
+	void InvalidateCode();
+
+	void SetHandlers(uint8_t firstPage, uint16_t pageCount, ReadHandler read, WriteHandler write, void* context);
+
+	// Brings the PPU up to the CPU's current cycle, passes on any interrupts
+	// that raises and works out when it next needs to catch up. Called before
+	// and after anything that changes what the PPU will do, e.g. a register
+	// write or a mapper switching CHR banks.
+	void SyncPPU();
+
+	// The same for the APU, before and after its registers are touched.
+	void SyncAPU();
 
-	uint8_t Read(uint16_t address);
-	void    Write(uint16_t address, uint8_t data);
 private:
-	std::shared_ptr<CPU>       mCPU;
-	std::shared_ptr<Memory>    mMemory;
-	std::shared_ptr<Cartridge> mCartridge;
-};
\ No newline at end of file
+	// Everything after the header, in the order SaveState() writes it.
+	bool LoadPayload(StateReader& reader);
+
+	void ScheduleNextEvent();
+
+	static uint8_t ReadIO(void* context, uint16_t address);
+	static void    WriteIO(void* context, uint16_t address, uint8_t data);
+
+	CPU&       mCPU;
+	Memory&    mMemory;
+	PPU&       mPPU;
+	APU&       mAPU;
+	Cartridge& mCartridge;
+
+	// The CPU cycle the PPU or APU next does something the CPU can see without
+	// asking, i.e. raises an interrupt. Until then they're left to fall behind.
+	uint64_t   mEventCycle = 0;
+
+	std::array<Controller, 2> mControllers;
+	uint64_t                  mLatchCycle = 0;
+
+	// What LoadState() puts back if a state fails part way through. Kept so
+	// loading, e.g. every frame while rewinding, doesn't allocate.
+	std::vector<uint8_t> mUndoState;
+
+	struct PageHandlers
+	{
+		ReadHandler  read;
+		WriteHandler write;
+		void*        context;
+	};
+
+	// Kept apart from the handlers so the fast path only touches these.
+	std::array<const uint8_t*, 256> mReadPages = {};
+	std::array<uint8_t*, 256>       mWritePages = {};
+	std::array<PageHandlers, 256>   mHandlers = {};
+};
@@ -0,0 +1,149 @@
+#include "TileDecoder.hpp"
+
+#include <bit>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COJONES_TILE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define COJONES_TILE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+	// One bit per byte, in the order pixels are stored: bit 7 goes to the
+	// first byte in memory, bit 0 to the last.
+	constexpr uint64_t kPixelBits = std::endian::native == std::endian::little ? 0x0102040810204080ull : 0x8040201008040201ull;
+
+	// Copies an 8 bit row into every byte, keeps each byte's own bit, then
+	// turns any set bit into 0x01. Adding 0x7F to a byte only carries into
+	// bit 7, so no byte disturbs its neighbour.
+	inline uint64_t SpreadRow(uint8_t row)
+	{
+		uint64_t bits = (row * 0x0101010101010101ull) & kPixelBits;
+		return ((bits + 0x7F7F7F7F7F7F7F7Full) >> 7) & 0x0101010101010101ull;
+	}
+}
+
+void DecodeTilesScalar(const uint8_t* chr, size_t tileCount, uint8_t* out)
+{
+	for (size_t tile = 0; tile < tileCount; ++tile, chr += kTileBytes, out += kDecodedTileBytes)
+	{
+		for (int row = 0; row < 8; ++row)
+		{
+			uint64_t pixels = SpreadRow(chr[row]) | (SpreadRow(chr[row + 8]) << 1);
+			std::memcpy(out + row * 8, &pixels, sizeof(pixels));
+		}
+	}
+}
+
+#if defined(__AVX2__)
+
+void DecodeTiles(const uint8_t* chr, size_t tileCount, uint8_t* out)
+{
+	// Both lanes get the whole tile, then each shuffle broadcasts four of its
+	// rows, 8 bytes per row. Low plane rows are bytes 0-7, high plane 8-15.
+	const __m256i lowRows0 = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+	const __m256i lowRows4 = _mm256_add_epi8(lowRows0, _mm256_set1_epi8(4));
+	const __m256i highRows0 = _mm256_add_epi8(lowRows0, _mm256_set1_epi8(8));
+	const __m256i highRows4 = _mm256_add_epi8(lowRows0, _mm256_set1_epi8(12));
+	const __m256i bits = _mm256_set1_epi64x(static_cast<long long>(kPixelBits));
+
+	// Compares give 0xFF (-1) for a set bit, so pixel = -(low + 2 * high).
+	auto decode = [&](__m256i tile, __m256i lowIndices, __m256i highIndices)
+	{
+		__m256i low = _mm256_shuffle_epi8(tile, lowIndices);
+		__m256i high = _mm256_shuffle_epi8(tile, highIndices);
+		low = _mm256_cmpeq_epi8(_mm256_and_si256(low, bits), bits);
+		high = _mm256_cmpeq_epi8(_mm256_and_si256(high, bits), bits);
+		return _mm256_sub_epi8(_mm256_setzero_si256(), _mm256_add_epi8(low, _mm256_add_epi8(high, high)));
+	};
+
+	for (size_t tile = 0; tile < tileCount; ++tile, chr += kTileBytes, out += kDecodedTileBytes)
+	{
+		__m256i data = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(chr)));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), decode(data, lowRows0, highRows0));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 32), decode(data, lowRows4, highRows4));
+	}
+}
+
+const char* GetTileDecoderName() { return "AVX2"; }
+
+#elif defined(COJONES_TILE_SSE2)
+
+void DecodeTiles(const uint8_t* chr, size_t tileCount, uint8_t* out)
+{
+	const __m128i bits = _mm_set1_epi64x(static_cast<long long>(kPixelBits));
+
+	// Compares give 0xFF (-1) for a set bit, so pixel = -(low + 2 * high).
+	auto decode = [&](__m128i low, __m128i high)
+	{
+		low = _mm_cmpeq_epi8(_mm_and_si128(low, bits), bits);
+		high = _mm_cmpeq_epi8(_mm_and_si128(high, bits), bits);
+		return _mm_sub_epi8(_mm_setzero_si128(), _mm_add_epi8(low, _mm_add_epi8(high, high)));
+	};
+
+	for (size_t tile = 0; tile < tileCount; ++tile, chr += kTileBytes, out += kDecodedTileBytes)
+	{
+		// Without a byte shuffle, unpacking a register with itself doubles
+		// each byte. Three rounds give two rows of 8 copies per register.
+		__m128i low = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(chr));
+		__m128i high = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(chr + 8));
+		low = _mm_unpacklo_epi8(low, low);
+		high = _mm_unpacklo_epi8(high, high);
+
+		__m128i low0123 = _mm_unpacklo_epi16(low, low);
+		__m128i low4567 = _mm_unpackhi_epi16(low, low);
+		__m128i high0123 = _mm_unpacklo_epi16(high, high);
+		__m128i high4567 = _mm_unpackhi_epi16(high, high);
+
+		__m128i* dest = reinterpret_cast<__m128i*>(out);
+		_mm_storeu_si128(dest + 0, decode(_mm_unpacklo_epi32(low0123, low0123), _mm_unpacklo_epi32(high0123, high0123)));
+		_mm_storeu_si128(dest + 1, decode(_mm_unpackhi_epi32(low0123, low0123), _mm_unpackhi_epi32(high0123, high0123)));
+		_mm_storeu_si128(dest + 2, decode(_mm_unpacklo_epi32(low4567, low4567), _mm_unpacklo_epi32(high4567, high4567)));
+		_mm_storeu_si128(dest + 3, decode(_mm_unpackhi_epi32(low4567, low4567), _mm_unpackhi_epi32(high4567, high4567)));
+	}
+}
+
+const char* GetTileDecoderName() { return "SSE2"; }
+
+#elif defined(COJONES_TILE_NEON)
+
+void DecodeTiles(const uint8_t* chr, size_t tileCount, uint8_t* out)
+{
+	const uint8x8_t bits = vcreate_u8(kPixelBits);
+	const uint8x8_t one = vdup_n_u8(1);
+	const uint8x8_t two = vdup_n_u8(2);
+
+	for (size_t tile = 0; tile < tileCount; ++tile, chr += kTileBytes, out += kDecodedTileBytes)
+	{
+		uint8x8_t low = vld1_u8(chr);
+		uint8x8_t high = vld1_u8(chr + 8);
+
+		for (uint8_t row = 0; row < 8; ++row)
+		{
+			// Broadcast the row with a table lookup, then test each byte's bit.
+			uint8x8_t index = vdup_n_u8(row);
+			uint8x8_t lowBits = vand_u8(vtst_u8(vtbl1_u8(low, index), bits), one);
+			uint8x8_t highBits = vand_u8(vtst_u8(vtbl1_u8(high, index), bits), two);
+			vst1_u8(out + row * 8, vorr_u8(lowBits, highBits));
+		}
+	}
+}
+
+const char* GetTileDecoderName() { return "NEON"; }
+
+#else
+
+void DecodeTiles(const uint8_t* chr, size_t tileCount, uint8_t* out)
+{
+	DecodeTilesScalar(chr, tileCount, out);
+}
+
+const char* GetTileDecoderName() { return "scalar"; }
+
+#endif
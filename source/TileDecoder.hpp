@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Pattern tables store each 8x8 tile as two bitplanes, 8 bytes of low bits
+// followed by 8 bytes of high bits, with the leftmost pixel in bit 7.
+// See https://www.nesdev.org/wiki/PPU_pattern_tables.
+constexpr size_t kTileBytes = 16;
+
+// Decoded tiles are one byte per pixel (0-3), row by row, leftmost first.
+constexpr size_t kDecodedTileBytes = 64;
+
+// Decodes tileCount tiles from chr into out, which needs room for
+// tileCount * kDecodedTileBytes. Uses the widest SIMD available at compile
+// time: AVX2 (with ENABLE_AVX2), SSE2, NEON, otherwise DecodeTilesScalar().
+void DecodeTiles(const uint8_t* chr, size_t tileCount, uint8_t* out);
+
+// Portable version, spreads each bitplane row across 8 bytes with a multiply.
+void DecodeTilesScalar(const uint8_t* chr, size_t tileCount, uint8_t* out);
+
+// Which version DecodeTiles() was built with, e.g. "SSE2".
+const char* GetTileDecoderName();
@@ -0,0 +1,157 @@
+#include "Trace.hpp"
+
+#include <chrono>
+#include <string_view>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include "Opcodes.hpp"
+
+std::string FormatTraceRecord(const TraceRecord& record)
+{
+	std::string_view name = OpcodeToString(static_cast<Opcodes>(record.opcode));
+
+	// Opcode names are "MNEMONIC_addressingmode", e.g. "LDA_zeropage_X".
+	std::string_view mnemonic = name.substr(0, 3);
+	std::string_view mode;
+	if (name.size() > 4)
+	{
+		mode = name.substr(4);
+	}
+
+	uint16_t operand8 = record.operand[0];
+	uint16_t operand16 = record.operand[0] | record.operand[1] << 8;
+
+	std::string disassembly;
+	if (name == "unknown")
+	{
+		disassembly = "ILL";
+	}
+	else if (mode == "immediate")
+	{
+		disassembly = fmt::format("{} #${:02X}", mnemonic, operand8);
+	}
+	else if (mode == "zeropage")
+	{
+		disassembly = fmt::format("{} ${:02X}", mnemonic, operand8);
+	}
+	else if (mode == "zeropage_X" || mode == "zeropage_Y")
+	{
+		disassembly = fmt::format("{} ${:02X},{}", mnemonic, operand8, mode.back());
+	}
+	else if (mode == "absolute_X" || mode == "absolute_Y")
+	{
+		disassembly = fmt::format("{} ${:04X},{}", mnemonic, operand16, mode.back());
+	}
+	else if (mode == "indirect")
+	{
+		disassembly = fmt::format("{} (${:04X})", mnemonic, operand16);
+	}
+	else if (mode == "indirect_X")
+	{
+		disassembly = fmt::format("{} (${:02X},X)", mnemonic, operand8);
+	}
+	else if (mode == "indirect_Y")
+	{
+		disassembly = fmt::format("{} (${:02X}),Y", mnemonic, operand8);
+	}
+	else if (mode == "accumulator")
+	{
+		disassembly = fmt::format("{} A", mnemonic);
+	}
+	else if (mode == "relative")
+	{
+		uint16_t target = record.PC + 2 + static_cast<int8_t>(record.operand[0]);
+		disassembly = fmt::format("{} ${:04X}", mnemonic, target);
+	}
+	else if (mode == "absolute" || record.length == 3)
+	{
+		// JSR has no addressing mode in its name, but is always absolute.
+		disassembly = fmt::format("{} ${:04X}", mnemonic, operand16);
+	}
+	else
+	{
+		disassembly = std::string(mnemonic);
+	}
+
+	std::string bytes = fmt::format("{:02X}", record.opcode);
+	for (uint8_t i = 1; i < record.length && i < 3; ++i)
+	{
+		bytes += fmt::format(" {:02X}", record.operand[i - 1]);
+	}
+
+	return fmt::format("{:04X}  {:<8}  {:<32}A:{:02X} X:{:02X} Y:{:02X} P:{:02X} SP:{:02X} CYC:{}", record.PC, bytes, disassembly, record.ACC, record.IX, record.IY, record.PS, record.SP, record.cycles);
+}
+
+TraceSink::~TraceSink()
+{
+	Stop();
+}
+
+bool TraceSink::Start(const std::string& filename)
+{
+	Stop();
+
+	mFile.open(filename, std::ios::out | std::ios::trunc);
+	if (!mFile.good())
+	{
+		SPDLOG_ERROR("Failed to open trace log \"{}\"", filename);
+		return false;
+	}
+
+	mDropped = 0;
+	mRunning = true;
+	mThread = std::thread(&TraceSink::Drain, this);
+
+	SPDLOG_INFO("Writing CPU trace to \"{}\"", filename);
+
+	return true;
+}
+
+void TraceSink::Stop()
+{
+	if (mThread.joinable())
+	{
+		mRunning = false;
+		mThread.join();
+	}
+
+	if (mFile.is_open())
+	{
+		mFile.close();
+
+		uint64_t dropped = GetDroppedCount();
+		if (dropped > 0)
+		{
+			SPDLOG_WARN("CPU trace dropped {} records, the log is incomplete.", dropped);
+		}
+	}
+}
+
+void TraceSink::Drain()
+{
+	TraceRecord record;
+
+	// Check mRunning before emptying the buffer, so anything pushed before
+	// Stop() was called is still written out.
+	bool running = true;
+	while (running)
+	{
+		running = mRunning.load();
+
+		bool wroteAny = false;
+		while (mRecords.Pop(record))
+		{
+			mFile << FormatTraceRecord(record) << '\n';
+			wroteAny = true;
+		}
+
+		if (!wroteAny && running)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	mFile.flush();
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include "RingBuffer.hpp"
+
+// Set by the ENABLE_CPU_TRACE CMake option. When disabled, every trace call
+// site is discarded at compile time.
+#if defined(COJONES_TRACE)
+constexpr bool kTraceEnabled = true;
+#else
+constexpr bool kTraceEnabled = false;
+#endif
+
+// Snapshot of one instruction, taken before it executes.
+struct TraceRecord
+{
+	uint16_t PC;
+	uint8_t  opcode;
+	uint8_t  operand[2];
+	uint8_t  length;
+	uint8_t  ACC;
+	uint8_t  IX;
+	uint8_t  IY;
+	uint8_t  PS;
+	uint8_t  SP;
+	uint64_t cycles;
+};
+
+// Formats a record in the same layout as the well known nestest.log, e.g.
+// "C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD CYC:7"
+std::string FormatTraceRecord(const TraceRecord& record);
+
+// Collects trace records from the emulation thread and writes them to a text
+// log on a background thread. Pushing never blocks, if the writer can't keep
+// up then records are dropped and counted instead.
+class TraceSink
+{
+public:
+	~TraceSink();
+
+	bool Start(const std::string& filename);
+	void Stop();
+
+	void Push(const TraceRecord& record)
+	{
+		if (!mRecords.Push(record))
+		{
+			mDropped.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	uint64_t GetDroppedCount() const { return mDropped.load(std::memory_order_relaxed); }
+
+private:
+	void Drain();
+
+	RingBuffer<TraceRecord, 1 << 16> mRecords;
+
+	std::ofstream     mFile;
+	std::thread       mThread;
+	std::atomic<bool> mRunning = false;
+	std::atomic<uint64_t> mDropped = 0;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Hands whole objects (e.g. finished frames) from one producer thread to one
+// consumer thread without either ever waiting on the other. The producer
+// always has a buffer to write into, the consumer always has the most
+// recently published one to read, and the third is the one in flight.
+template <typename T>
+class TripleBuffer
+{
+public:
+	// Producer only.
+	T& GetWriteBuffer() { return mBuffers[mWriteIndex]; }
+
+	// Producer only. Makes the write buffer available to the consumer and
+	// swaps in a fresh one to write the next item into.
+	void Publish()
+	{
+		mWriteIndex = mShared.exchange(mWriteIndex | kNewBit, std::memory_order_acq_rel) & kIndexMask;
+	}
+
+	// Consumer only. Picks up the latest published item, if there is one.
+	// Returns true if the read buffer changed.
+	bool Update()
+	{
+		if ((mShared.load(std::memory_order_relaxed) & kNewBit) == 0)
+		{
+			return false;
+		}
+
+		mReadIndex = mShared.exchange(mReadIndex, std::memory_order_acq_rel) & kIndexMask;
+		return true;
+	}
+
+	// Consumer only.
+	const T& GetReadBuffer() const { return mBuffers[mReadIndex]; }
+
+private:
+	static constexpr uint8_t kIndexMask = 0x03;
+	static constexpr uint8_t kNewBit = 0x04;
+
+	std::array<T, 3> mBuffers = {};
+
+	uint8_t mWriteIndex = 0;
+	uint8_t mReadIndex = 1;
+	std::atomic<uint8_t> mShared = 2;
+};
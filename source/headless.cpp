@@ -0,0 +1,357 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#include "Movie.hpp"
+#include "NES.hpp"
+#include "SaveState.hpp"
+
+// Runs ROMs without any windowing, rendering or input, as fast as the host
+// allows, or replays a movie's input. Results are printed to stdout as a JSON
+// array, logging goes to stderr.
+
+struct RunResult
+{
+	std::string romPath;
+	bool        isRomValid = false;
+	uint16_t    mapper = 0;
+	uint64_t    cycles = 0;
+	const char* haltReason = "invalid";
+	uint16_t    finalPC = 0;
+	double      seconds = 0.0;
+
+	// Movies only. The first frame whose RAM didn't match the recording, or
+	// -1 if none.
+	uint64_t    frames = 0;
+	int64_t     desyncFrame = -1;
+};
+
+struct RunOptions
+{
+	uint64_t    maxCycles = 17897730;
+	std::string loadStatePath;
+	std::string saveStatePath;
+	std::string moviePath;
+};
+
+// Runs every frame of the movie, however many cycles that takes, and stops at
+// the first one that doesn't end with the recorded RAM.
+static void ReplayMovie(NES& nes, const std::string& moviePath, RunResult& result)
+{
+	CPU& cpu = nes.GetCPU();
+
+	Movie movie;
+	if (!movie.Load(moviePath) || !nes.GetSystem().LoadState(movie.GetStartState()))
+	{
+		result.haltReason = "bad movie";
+		return;
+	}
+
+	result.haltReason = "movie end";
+
+	const uint64_t startCycles = cpu.GetCycles();
+	auto start = std::chrono::steady_clock::now();
+
+	for (const Movie::Frame& frame : movie.GetFrames())
+	{
+		bool shouldContinue = Movie::RunFrame(nes, frame);
+		++result.frames;
+
+		if (Movie::HashRAM({ nes.GetMemory().GetData(), Memory::kSize }) != frame.ramHash)
+		{
+			result.haltReason = "desync";
+			result.desyncFrame = static_cast<int64_t>(result.frames - 1);
+			break;
+		}
+
+		if (!shouldContinue)
+		{
+			result.haltReason = cpu.GetCurrentOpcode() == Opcodes::BRK ? "brk" : "jam";
+			break;
+		}
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	result.seconds = std::chrono::duration<double>(end - start).count();
+	result.cycles = cpu.GetCycles() - startCycles;
+	result.finalPC = cpu.GetRegisters().PC;
+}
+
+static RunResult RunROM(const std::string& romPath, const RunOptions& options)
+{
+	const uint64_t maxCycles = options.maxCycles;
+
+	RunResult result;
+	result.romPath = romPath;
+
+	std::unique_ptr<NES> nes = std::make_unique<NES>();
+	CPU& cpu = nes->GetCPU();
+	System& system = nes->GetSystem();
+
+	result.isRomValid = nes->GetCartridge().Load(romPath);
+	if (!result.isRomValid)
+	{
+		SPDLOG_ERROR("File \"{}\" is not a valid NES ROM.", romPath);
+		return result;
+	}
+
+	result.mapper = nes->GetCartridge().GetHeader().mapper;
+
+	system.Reset();
+
+	if (!options.loadStatePath.empty())
+	{
+		std::vector<uint8_t> state;
+		if (!ReadStateFile(options.loadStatePath, state) || !system.LoadState(state))
+		{
+			result.haltReason = "bad state";
+			return result;
+		}
+	}
+
+	if (!options.moviePath.empty())
+	{
+		ReplayMovie(*nes, options.moviePath, result);
+		return result;
+	}
+
+	result.haltReason = "budget";
+
+	// Run a frame's worth of cycles at a time, checking for halts in between.
+	constexpr uint64_t kSliceCycles = 29781;
+
+	const uint64_t startCycles = cpu.GetCycles();
+	auto start = std::chrono::steady_clock::now();
+
+	while (result.cycles < maxCycles)
+	{
+		bool shouldContinue = system.RunCycles(std::min(kSliceCycles, maxCycles - result.cycles));
+		result.cycles = cpu.GetCycles() - startCycles;
+
+		if (!shouldContinue)
+		{
+			result.haltReason = cpu.GetCurrentOpcode() == Opcodes::BRK ? "brk" : "jam";
+			break;
+		}
+
+		// Test ROMs usually finish by spinning on a jump to itself.
+		uint16_t PC = cpu.GetRegisters().PC;
+		uint16_t jumpTarget = system.Read(PC + 1) | system.Read(PC + 2) << 8;
+		if (system.Read(PC) == static_cast<uint8_t>(Opcodes::JMP_absolute) && jumpTarget == PC)
+		{
+			result.haltReason = "loop";
+			break;
+		}
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	result.seconds = std::chrono::duration<double>(end - start).count();
+	result.finalPC = cpu.GetRegisters().PC;
+
+	if (!options.saveStatePath.empty())
+	{
+		std::vector<uint8_t> state;
+		system.SaveState(state);
+		WriteStateFile(options.saveStatePath, state);
+	}
+
+	return result;
+}
+
+static std::string JsonEscape(const std::string& str)
+{
+	std::string escaped;
+	escaped.reserve(str.size());
+
+	for (char c : str)
+	{
+		switch (c)
+		{
+			case '"':  escaped += "\\\""; break;
+			case '\\': escaped += "\\\\"; break;
+			case '\n': escaped += "\\n"; break;
+			case '\t': escaped += "\\t"; break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20)
+				{
+					escaped += fmt::format("\\u{:04x}", static_cast<int>(c));
+				}
+				else
+				{
+					escaped += c;
+				}
+				break;
+		}
+	}
+
+	return escaped;
+}
+
+static void PrintUsage()
+{
+	fmt::print(stderr,
+		"Usage: cojoNES_headless [options] <rom or directory>...\n"
+		"\n"
+		"Directories are searched recursively for .nes files.\n"
+		"\n"
+		"Options:\n"
+		"  --cycles <n>   Stop each ROM after n CPU cycles (default 10 seconds' worth).\n"
+		"  --jobs <n>     Number of ROMs to run in parallel, 0 uses every core (default 1).\n"
+		"  --load-state <file>\n"
+		"                 Start from a save state instead of reset.\n"
+		"  --save-state <file>\n"
+		"                 Save the state when the ROM stops, only with a single ROM.\n"
+		"  --movie <file> Replay a recorded movie from its own start state, checking\n"
+		"                 RAM every frame, only with a single ROM.\n"
+		"  --verbose      Log emulator output to stderr.\n");
+}
+
+int main(int argc, char** argv)
+{
+	RunOptions options;
+	unsigned int jobs = 1;
+	bool verbose = false;
+	std::vector<std::string> romPaths;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+
+		if (arg == "--cycles" && i + 1 < argc)
+		{
+			options.maxCycles = std::strtoull(argv[++i], nullptr, 10);
+		}
+		else if (arg == "--jobs" && i + 1 < argc)
+		{
+			jobs = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (arg == "--load-state" && i + 1 < argc)
+		{
+			options.loadStatePath = argv[++i];
+		}
+		else if (arg == "--save-state" && i + 1 < argc)
+		{
+			options.saveStatePath = argv[++i];
+		}
+		else if (arg == "--movie" && i + 1 < argc)
+		{
+			options.moviePath = argv[++i];
+		}
+		else if (arg == "--verbose")
+		{
+			verbose = true;
+		}
+		else if (arg == "--help" || arg == "-h")
+		{
+			PrintUsage();
+			return 0;
+		}
+		else if (arg.starts_with("--"))
+		{
+			fmt::print(stderr, "Unknown option \"{}\"\n\n", arg);
+			PrintUsage();
+			return 1;
+		}
+		else if (std::filesystem::is_directory(arg))
+		{
+			for (const auto& entry : std::filesystem::recursive_directory_iterator(arg))
+			{
+				if (entry.is_regular_file() && entry.path().extension() == ".nes")
+				{
+					romPaths.push_back(entry.path().string());
+				}
+			}
+		}
+		else
+		{
+			romPaths.push_back(arg);
+		}
+	}
+
+	if (romPaths.empty())
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	if ((!options.saveStatePath.empty() || !options.moviePath.empty()) && romPaths.size() > 1)
+	{
+		fmt::print(stderr, "--save-state and --movie need a single ROM\n\n");
+		PrintUsage();
+		return 1;
+	}
+
+	// Keep stdout clean for the JSON output.
+	spdlog::set_default_logger(spdlog::stderr_color_mt("headless"));
+	spdlog::set_level(verbose ? spdlog::level::info : spdlog::level::err);
+
+	if (jobs == 0)
+	{
+		jobs = std::max(1u, std::thread::hardware_concurrency());
+	}
+	jobs = std::min(jobs, static_cast<unsigned int>(romPaths.size()));
+
+	// Every ROM gets its own System, so workers only need to agree on which
+	// ROM to run next.
+	std::vector<RunResult> results(romPaths.size());
+	std::atomic<size_t> nextRom = 0;
+
+	auto worker = [&]()
+	{
+		for (size_t i = nextRom++; i < romPaths.size(); i = nextRom++)
+		{
+			results[i] = RunROM(romPaths[i], options);
+		}
+	};
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < jobs; ++i)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	auto end = std::chrono::steady_clock::now();
+
+	fmt::print("[\n");
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const RunResult& r = results[i];
+		double cyclesPerSecond = r.seconds > 0.0 ? r.cycles / r.seconds : 0.0;
+
+		// Speed is relative to a real NTSC NES.
+		double speed = cyclesPerSecond / 1789773.0;
+
+		std::string movieFields;
+		if (!options.moviePath.empty())
+		{
+			movieFields = fmt::format(", \"frames\": {}, \"desync_frame\": {}", r.frames, r.desyncFrame);
+		}
+
+		fmt::print("  {{\"rom\": \"{}\", \"valid\": {}, \"mapper\": {}, \"halt\": \"{}\", \"pc\": \"{:04X}\", \"cycles\": {}, \"seconds\": {:.6f}, \"cycles_per_second\": {:.0f}, \"speed\": {:.2f}{}}}{}\n",
+			JsonEscape(r.romPath), r.isRomValid, r.mapper, r.haltReason, r.finalPC, r.cycles, r.seconds, cyclesPerSecond, speed,
+			movieFields, i + 1 < results.size() ? "," : "");
+	}
+	fmt::print("]\n");
+
+	fmt::print(stderr, "Ran {} ROMs on {} threads in {:.3f}s\n", results.size(), jobs, std::chrono::duration<double>(end - start).count());
+
+	return 0;
+}
@@ -13,10 +13,14 @@
 #include <imgui_impl_sdl3.h>
 #include <imgui_impl_sdlrenderer3.h>
 
-#include "CPU.hpp"
-#include "Memory.hpp"
-#include "System.hpp"
-#include "Cartridge.hpp"
+#include "Audio.hpp"
+#include "Input.hpp"
+#include "Latency.hpp"
+#include "NES.hpp"
+#include "SaveState.hpp"
+#include "Scheduler.hpp"
+#include "Screen.hpp"
+#include "Trace.hpp"
 
 static bool shouldOpenROM = false;
 static std::string romPath;
@@ -42,11 +46,21 @@ int main(int argc, char** argv)
 	constexpr int kScreenWidth = 640;
 	constexpr int kScreenHeight = 480;
 
-	std::shared_ptr<CPU>    cpu = std::make_shared<CPU>();
-	std::shared_ptr<Memory> memory = std::make_shared<Memory>();
-	std::shared_ptr<Cartridge> cart = std::make_shared<Cartridge>();
+	NES nes;
+	Cartridge& cart = nes.GetCartridge();
 
-	std::shared_ptr<System> system;
+	TraceSink traceSink;
+	if constexpr (kTraceEnabled)
+	{
+		if (traceSink.Start("cojoNES_trace.log"))
+		{
+			nes.GetCPU().SetTraceSink(&traceSink);
+		}
+	}
+
+	// Emulation runs on its own thread from here on, anything that touches
+	// the system from the UI must go through the scheduler.
+	Scheduler scheduler(nes);
 
 	if (argc >= 2)
 	{
@@ -59,7 +73,7 @@ int main(int argc, char** argv)
 		SPDLOG_INFO("No ROM file specified.");
 	}
 
-	if (SDL_Init(SDL_INIT_VIDEO))
+	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMEPAD))
 	{
 		Uint32 windowFlags = SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_HIDDEN | SDL_WINDOW_INPUT_FOCUS;
 		SDL_Window* window = SDL_CreateWindow("cojoNES", kScreenWidth, kScreenHeight, windowFlags);
@@ -92,7 +106,17 @@ int main(int argc, char** argv)
 		ImGui_ImplSDL3_InitForSDLRenderer(window, renderer);
 		ImGui_ImplSDLRenderer3_Init(renderer);
 
-		bool running = false;
+		// Owns a texture, so has to go before the renderer does.
+		std::unique_ptr<Screen> screen = std::make_unique<Screen>();
+		screen->Init(renderer);
+
+		// Pulls from the scheduler on SDL's audio thread, so has to go before
+		// the scheduler does. Without it the APU doesn't synthesise anything.
+		std::unique_ptr<Audio> audio = std::make_unique<Audio>(scheduler);
+		audio->Init();
+
+		// Controller 1, from the keyboard and any gamepads.
+		std::unique_ptr<Input> input = std::make_unique<Input>(scheduler);
 
 		// Hack to get window to stay up
 		SDL_Event e;
@@ -107,13 +131,20 @@ int main(int argc, char** argv)
 				{
 					quit = true;
 				}
-				else if (e.type == SDL_EVENT_KEY_DOWN)
-				{
-					switch (e.key.scancode)
-					{
-						// Nothing yet...
-					}
-				}
+
+				input->HandleEvent(e);
+			}
+
+			input->Update(!io.WantCaptureKeyboard);
+
+			// The emulator publishes frames at its own pace, only convert the
+			// picture when there's a new one.
+			bool hasNewFrame = scheduler.UpdateFrame();
+			int64_t uploadTime = 0;
+			if (hasNewFrame)
+			{
+				screen->Upload(scheduler.GetLatestFrame().pixels);
+				uploadTime = GetTimestamp();
 			}
 
 			// Start the Dear ImGui frame
@@ -141,7 +172,7 @@ int main(int argc, char** argv)
 
 						ImGui::Separator();
 
-						NESHeader romHeader = cart->GetHeader();
+						NESHeader romHeader = cart.GetHeader();
 						ImGui::Text("Header version: %s", HeaderVersionToString(romHeader.version));
 						ImGui::Text("prgSize: %d", romHeader.prgSize);
 						ImGui::Text("chrSize: %d", romHeader.chrSize);
@@ -157,24 +188,29 @@ int main(int argc, char** argv)
 					{
 						if (ImGui::Button("Init blank cartridge"))
 						{
-							// Currently required to init memory above 0x8000.
-							bool loaded = cart->Load();
+							scheduler.Pause();
 
-							system = std::make_shared<System>(cpu, memory, cart);
+							// Currently required to init memory above 0x8000.
+							bool loaded = false;
+							scheduler.WithSystem([&](System*) { loaded = cart.Load(); });
+							scheduler.SetLoaded(loaded);
 
-							// Write reset vector 0x8000 to simulate cart.
-							system->Write(0xFFFC, 0x00);
-							system->Write(0xFFFD, 0x80);
+							scheduler.WithSystem([](System* system)
+							{
+								// Write reset vector 0x8000 to simulate cart.
+								system->Write(0xFFFC, 0x00);
+								system->Write(0xFFFD, 0x80);
 
-							system->Reset();
+								system->Reset();
+							});
 
 							// This can be used to debug and test small programs:
 							//uint16_t write_addr = 0x8000;
-							//cart->Write(write_addr++, 0xA9); // LDA_immediate
-							//cart->Write(write_addr++, 0x2A); // literal 42
-							//cart->Write(write_addr++, 0x8D); // STA_absolute
-							//cart->Write(write_addr++, 0x00); // Memory offset 0x00
-							//cart->Write(write_addr++, 0x00); // Memory page 0x00
+							//cart.Write(write_addr++, 0xA9); // LDA_immediate
+							//cart.Write(write_addr++, 0x2A); // literal 42
+							//cart.Write(write_addr++, 0x8D); // STA_absolute
+							//cart.Write(write_addr++, 0x00); // Memory offset 0x00
+							//cart.Write(write_addr++, 0x00); // Memory page 0x00
 						}
 
 						static int addr = 0;
@@ -187,7 +223,13 @@ int main(int argc, char** argv)
 
 						if (ImGui::Button("Set Memory Value"))
 						{
-							system->Write(addr, val);
+							scheduler.WithSystem([&](System* system)
+							{
+								if (system)
+								{
+									system->Write(addr, val);
+								}
+							});
 						}
 
 						ImGui::EndTabItem();
@@ -202,19 +244,21 @@ int main(int argc, char** argv)
 			if (shouldOpenROM)
 			{
 				shouldOpenROM = false;
-				bool isRomValid = cart->Load(romPath);
+
+				scheduler.Pause();
+
+				bool isRomValid = false;
+				scheduler.WithSystem([&](System*) { isRomValid = cart.Load(romPath); });
+				scheduler.SetLoaded(isRomValid);
 
 				if (isRomValid)
 				{
-					// Initialise system now that ROM is loaded.
-					system = std::make_shared<System>(cpu, memory, cart);
-					system->Reset();
-					running = true;
+					scheduler.WithSystem([](System* system) { system->Reset(); });
+					scheduler.Run();
 				}
 				else
 				{
 					SPDLOG_ERROR("File \"{}\" is not a valid NES ROM.", romPath);
-					running = false;
 				}
 			}
 
@@ -230,9 +274,19 @@ int main(int argc, char** argv)
 
 				memStart = memStart - memStart % 0x10;
 
+				uint8_t page[0x100];
+				scheduler.WithSystem([&](System* system)
+				{
+					for (uint16_t i = 0; i < 0x100; ++i)
+					{
+						uint16_t address = static_cast<uint16_t>(memStart + i);
+						page[i] = system ? system->Peek(address) : 0x00;
+					}
+				});
+
 				for (uint16_t i = static_cast<uint16_t>(memStart); i < static_cast<uint16_t>(memStart + 0x100); ++i)
 				{
-					uint8_t val = system ? system->Read(i) : memory->Read(i);
+					uint8_t val = page[i - memStart];
 
 					if (i % 0x10 == 0x00)
 					{
@@ -257,26 +311,114 @@ int main(int argc, char** argv)
 			static bool stepMode = false;
 			{
 				ImGui::SetNextWindowPos(ImVec2(5.0f, 230.0f), ImGuiCond_FirstUseEver);
-				ImGui::SetNextWindowSize(ImVec2(190.0f, 195.0f), ImGuiCond_FirstUseEver);
+				ImGui::SetNextWindowSize(ImVec2(190.0f, 245.0f), ImGuiCond_FirstUseEver);
 				ImGui::Begin("CPU");
 
 				ImGui::Checkbox("Step mode", &stepMode);
-				if (ImGui::Button(stepMode ? "Step" : "Run"))
+				ImGui::SameLine();
+				bool turbo = scheduler.IsTurbo();
+				if (ImGui::Checkbox("Turbo", &turbo))
+				{
+					scheduler.SetTurbo(turbo);
+				}
+
+				if (scheduler.IsRunning())
+				{
+					if (ImGui::Button("Pause"))
+					{
+						scheduler.Pause();
+					}
+				}
+				else if (ImGui::Button(stepMode ? "Step" : "Run"))
+				{
+					if (stepMode)
+					{
+						scheduler.Step();
+					}
+					else
+					{
+						scheduler.Run();
+					}
+				}
+				ImGui::SameLine();
+				if (ImGui::Button("Reset"))
+				{
+					scheduler.WithSystem([](System* system)
+					{
+						if (system)
+						{
+							system->Reset();
+						}
+					});
+				}
+
+				// One slot per ROM, kept next to it.
+				static std::vector<uint8_t> state;
+				if (ImGui::Button("Save state"))
 				{
-					running = true;
+					bool saved = false;
+					scheduler.WithSystem([&](System* system)
+					{
+						if (system)
+						{
+							system->SaveState(state);
+							saved = true;
+						}
+					});
+
+					if (saved)
+					{
+						WriteStateFile(romPath + ".state", state);
+					}
 				}
 				ImGui::SameLine();
-				if (ImGui::Button("Reset") && system)
+				if (ImGui::Button("Load state") && ReadStateFile(romPath + ".state", state))
+				{
+					scheduler.WithSystem([&](System* system)
+					{
+						if (system)
+						{
+							system->LoadState(state);
+						}
+					});
+				}
+
+				// Movies are kept next to the ROM too, for the headless runner to replay.
+				if (!scheduler.IsRecording())
 				{
-					system->Reset();
+					if (ImGui::Button("Record"))
+					{
+						scheduler.StartRecording();
+					}
+				}
+				else if (ImGui::Button("Stop recording"))
+				{
+					Movie movie;
+					scheduler.StopRecording(movie);
+					movie.Save(romPath + ".movie");
 				}
+				ImGui::SameLine();
+
+				// Rewinds for as long as it's held.
+				ImGui::Button("Rewind");
+				scheduler.SetRewinding(ImGui::IsItemActive());
+				ImGui::SameLine();
+				ImGui::Text("%.1fs", scheduler.GetRewindSeconds());
+
+				const FrameSnapshot& frame = scheduler.GetLatestFrame();
+				auto GetProcessorStatus = [&frame](ProcessorStatus statusFlag)
+				{
+					return (frame.registers.PS & statusFlag) == statusFlag;
+				};
 
-				CPURegisters r = cpu->GetRegisters();
+				ImGui::Text("Speed: %.0f%%", scheduler.GetEmulationSpeed() * 100.0);
+				ImGui::Text("Frame: %llu", static_cast<unsigned long long>(frame.frameNumber));
 
-				ImGui::Text("Opcode: %s (%02X)", OpcodeToString(cpu->GetCurrentOpcode()), cpu->GetCurrentOpcode());
+				CPURegisters r = frame.registers;
 
-				CPU::DecodedOperand operand = cpu->GetCurrentOperand();
-				ImGui::Text("Operand: %s %04X", operand.operandType == CPU::OT_Address ? "Address" : "Value", operand.operand);
+				ImGui::Text("Opcode: %s (%02X)", OpcodeToString(frame.opcode), frame.opcode);
+
+				ImGui::Text("Operand: %04X", frame.operand);
 
 				ImGui::Separator();
 
@@ -285,47 +427,118 @@ int main(int argc, char** argv)
 
 				ImGui::Separator();
 
-				ImGui::Text("C: %d", cpu->GetProcessorStatus(PS_CarryFlag));
+				ImGui::Text("C: %d", GetProcessorStatus(PS_CarryFlag));
 				ImGui::SameLine();
-				ImGui::Text("Z: %d", cpu->GetProcessorStatus(PS_ZeroFlag));
+				ImGui::Text("Z: %d", GetProcessorStatus(PS_ZeroFlag));
 				ImGui::SameLine();
-				ImGui::Text("I: %d", cpu->GetProcessorStatus(PS_InterruptDisable));
+				ImGui::Text("I: %d", GetProcessorStatus(PS_InterruptDisable));
 				ImGui::SameLine();
-				ImGui::Text("D: %d", cpu->GetProcessorStatus(PS_DecimalMode));
+				ImGui::Text("D: %d", GetProcessorStatus(PS_DecimalMode));
 
-				ImGui::Text("B: %d", cpu->GetProcessorStatus(PS_BreakCommand));
+				ImGui::Text("B: %d", GetProcessorStatus(PS_BreakCommand));
 				ImGui::SameLine();
-				ImGui::Text("-: %d", cpu->GetProcessorStatus(PS_Ignored));
+				ImGui::Text("-: %d", GetProcessorStatus(PS_Ignored));
 				ImGui::SameLine();
-				ImGui::Text("V: %d", cpu->GetProcessorStatus(PS_OverflowFlag));
+				ImGui::Text("V: %d", GetProcessorStatus(PS_OverflowFlag));
 				ImGui::SameLine();
-				ImGui::Text("N: %d", cpu->GetProcessorStatus(PS_NegativeFlag));
+				ImGui::Text("N: %d", GetProcessorStatus(PS_NegativeFlag));
 
 				ImGui::End();
 			}
 
-
-			if (running && system)
+			static LatencyStats latency;
 			{
-				running = system->Process();
-				if (stepMode)
+				ImGui::SetNextWindowPos(ImVec2(200.0f, 350.0f), ImGuiCond_FirstUseEver);
+				ImGui::SetNextWindowSize(ImVec2(420.0f, 125.0f), ImGuiCond_FirstUseEver);
+				ImGui::Begin("Latency");
+
+				static bool vsync = true;
+				if (ImGui::Checkbox("VSync", &vsync))
 				{
-					running = false;
+					SDL_SetRenderVSync(renderer, vsync ? 1 : 0);
+					latency.Clear();
 				}
+				ImGui::SameLine();
+				if (ImGui::Button("Clear"))
+				{
+					latency.Clear();
+				}
+				ImGui::SameLine();
+				if (ImGui::Button("Export CSV"))
+				{
+					latency.WriteCSV("cojoNES_latency.csv");
+				}
+
+				// From polling input to the game reading it, and on to the
+				// frame it read it in being presented.
+				if (ImGui::BeginTable("##latency", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+				{
+					ImGui::TableSetupColumn("Stage");
+					ImGui::TableSetupColumn("Count");
+					ImGui::TableSetupColumn("Mean");
+					ImGui::TableSetupColumn("p50");
+					ImGui::TableSetupColumn("p99");
+					ImGui::TableSetupColumn("Max");
+					ImGui::TableHeadersRow();
+
+					for (int i = 0; i < LatencyStats::LS_Count; ++i)
+					{
+						auto stage = static_cast<LatencyStats::Stage>(i);
+
+						ImGui::TableNextRow();
+						ImGui::TableNextColumn();
+						ImGui::Text("%s", LatencyStats::GetStageName(stage));
+						ImGui::TableNextColumn();
+						ImGui::Text("%llu", static_cast<unsigned long long>(latency.GetCount(stage)));
+						ImGui::TableNextColumn();
+						ImGui::Text("%.2f", latency.GetMeanMs(stage));
+						ImGui::TableNextColumn();
+						ImGui::Text("%.1f", latency.GetPercentileMs(stage, 50.0));
+						ImGui::TableNextColumn();
+						ImGui::Text("%.1f", latency.GetPercentileMs(stage, 99.0));
+						ImGui::TableNextColumn();
+						ImGui::Text("%.2f", latency.GetMaxMs(stage));
+					}
+
+					ImGui::EndTable();
+				}
+
+				static int shownStage = LatencyStats::LS_PollToPresent;
+				const char* stageNames[LatencyStats::LS_Count];
+				for (int i = 0; i < LatencyStats::LS_Count; ++i)
+				{
+					stageNames[i] = LatencyStats::GetStageName(static_cast<LatencyStats::Stage>(i));
+				}
+				ImGui::Combo("Stage", &shownStage, stageNames, LatencyStats::LS_Count);
+
+				const LatencyStats::Histogram& histogram = latency.GetHistogram(static_cast<LatencyStats::Stage>(shownStage));
+				ImGui::PlotHistogram("##histogram", histogram.data(), static_cast<int>(histogram.size()), 0, "0-50ms", 0.0f, 3.4e38f, ImVec2(0.0f, 80.0f));
+
+				ImGui::End();
 			}
 
 			// Rendering
 			ImVec4 clearColor = ImVec4(0.1f, 0.4f, 0.8f, 1.00f);
 
 			ImGui::Render();
-			SDL_SetRenderScale(renderer, io.DisplayFramebufferScale.x, io.DisplayFramebufferScale.y);
+			SDL_SetRenderScale(renderer, 1.0f, 1.0f);
 			SDL_SetRenderDrawColorFloat(renderer, clearColor.x, clearColor.y, clearColor.z, clearColor.w);
 			SDL_RenderClear(renderer);
+			screen->Draw();
+			SDL_SetRenderScale(renderer, io.DisplayFramebufferScale.x, io.DisplayFramebufferScale.y);
 			ImGui_ImplSDLRenderer3_RenderDrawData(ImGui::GetDrawData(), renderer);
 			SDL_RenderPresent(renderer);
+
+			if (hasNewFrame)
+			{
+				latency.Add(scheduler.GetLatestFrame().timing, uploadTime, GetTimestamp());
+			}
 		}
 
 		// Cleanup
+		input.reset();
+		audio.reset();
+		screen.reset();
 		ImGui_ImplSDLRenderer3_Shutdown();
 		ImGui_ImplSDL3_Shutdown();
 		ImGui::DestroyContext();
@@ -0,0 +1,429 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "NES.hpp"
+#include "Rewind.hpp"
+#include "SaveState.hpp"
+#include "TileDecoder.hpp"
+
+// Benchmarks are hidden by default, run with: cojoNES_tests "[!benchmark]"
+
+// From test.cpp.
+std::filesystem::path WriteTestROM(std::span<const uint8_t> prg, uint8_t mapper, std::span<const uint8_t> chr);
+
+TEST_CASE("Tight loop", "[!benchmark][CPU]")
+{
+	// Logging would dominate the results.
+	spdlog::set_level(spdlog::level::off);
+
+	std::unique_ptr<NES> nes = std::make_unique<NES>();
+	CPU&       cpu = nes->GetCPU();
+	Cartridge& cart = nes->GetCartridge();
+	System&    system = nes->GetSystem();
+
+	cart.Load();
+
+	system.Write(0xFFFC, 0x00);
+	system.Write(0xFFFD, 0x80);
+
+	uint16_t write_addr = 0x8000;
+	cart.Write(write_addr++, 0xA9); // LDA_immediate
+	cart.Write(write_addr++, 0x01); // literal 1
+	cart.Write(write_addr++, 0x69); // ADC_immediate    <- loop
+	cart.Write(write_addr++, 0x01); // literal 1
+	cart.Write(write_addr++, 0x8D); // STA_absolute
+	cart.Write(write_addr++, 0x00); // Memory offset 0x00
+	cart.Write(write_addr++, 0x00); // Memory page 0x00
+	cart.Write(write_addr++, 0xE8); // INX
+	cart.Write(write_addr++, 0x88); // DEY
+	cart.Write(write_addr++, 0x4C); // JMP_absolute
+	cart.Write(write_addr++, 0x02); // loop offset 0x02
+	cart.Write(write_addr++, 0x80); // loop page 0x80
+
+	system.Reset();
+
+	constexpr int kInstructions = 100000;
+
+	BENCHMARK("100000 instructions")
+	{
+		for (int i = 0; i < kInstructions; ++i)
+		{
+			system.Process();
+		}
+
+		return cpu.GetRegisters().ACC;
+	};
+
+	spdlog::set_level(spdlog::level::info);
+}
+
+TEST_CASE("Flag-heavy loop", "[!benchmark][CPU]")
+{
+	spdlog::set_level(spdlog::level::off);
+
+	std::unique_ptr<NES> nes = std::make_unique<NES>();
+	CPU&       cpu = nes->GetCPU();
+	Cartridge& cart = nes->GetCartridge();
+	System&    system = nes->GetSystem();
+
+	cart.Load();
+
+	system.Write(0xFFFC, 0x00);
+	system.Write(0xFFFD, 0x80);
+
+	// Every instruction sets flags and the branch at the end reads them.
+	uint16_t write_addr = 0x8000;
+	cart.Write(write_addr++, 0xA5); // LDA_zeropage     <- loop
+	cart.Write(write_addr++, 0x00); // Memory offset 0x00
+	cart.Write(write_addr++, 0x69); // ADC_immediate
+	cart.Write(write_addr++, 0x37); // literal 0x37
+	cart.Write(write_addr++, 0x2A); // ROL_accumulator
+	cart.Write(write_addr++, 0x49); // EOR_immediate
+	cart.Write(write_addr++, 0x5A); // literal 0x5A
+	cart.Write(write_addr++, 0xC9); // CMP_immediate
+	cart.Write(write_addr++, 0x80); // literal 0x80
+	cart.Write(write_addr++, 0x29); // AND_immediate
+	cart.Write(write_addr++, 0xF7); // literal 0xF7
+	cart.Write(write_addr++, 0xE9); // SBC_immediate
+	cart.Write(write_addr++, 0x11); // literal 0x11
+	cart.Write(write_addr++, 0x85); // STA_zeropage
+	cart.Write(write_addr++, 0x00); // Memory offset 0x00
+	cart.Write(write_addr++, 0xCA); // DEX
+	cart.Write(write_addr++, 0xD0); // BNE_relative
+	cart.Write(write_addr++, 0xEE); // loop, -18
+	cart.Write(write_addr++, 0xC8); // INY
+	cart.Write(write_addr++, 0x4C); // JMP_absolute
+	cart.Write(write_addr++, 0x00); // loop offset 0x00
+	cart.Write(write_addr++, 0x80); // loop page 0x80
+
+	system.Reset();
+
+	constexpr int kInstructions = 100000;
+
+	BENCHMARK("100000 instructions")
+	{
+		for (int i = 0; i < kInstructions; ++i)
+		{
+			system.Process();
+		}
+
+		return cpu.GetRegisters().PS;
+	};
+
+	// Instructions run between events, as RunCycles() does for a frame.
+	BENCHMARK("A frame of cycles")
+	{
+		system.RunCycles(29781);
+		return cpu.GetRegisters().PS;
+	};
+
+	spdlog::set_level(spdlog::level::info);
+}
+
+TEST_CASE("Running from the block cache", "[!benchmark][CPU]")
+{
+	spdlog::set_level(spdlog::level::off);
+
+	// The flag-heavy loop again, but from a ROM file so it's read only and
+	// can be cached.
+	std::filesystem::path romPath;
+
+	{
+		std::vector<uint8_t> prg(0x4000, 0);
+
+		const uint8_t program[] =
+		{
+			0xA5, 0x00,       // LDA_zeropage $00    <- loop
+			0x69, 0x37,       // ADC_immediate 0x37
+			0x2A,             // ROL_accumulator
+			0x49, 0x5A,       // EOR_immediate 0x5A
+			0xC9, 0x80,       // CMP_immediate 0x80
+			0x29, 0xF7,       // AND_immediate 0xF7
+			0xE9, 0x11,       // SBC_immediate 0x11
+			0x85, 0x00,       // STA_zeropage $00
+			0xCA,             // DEX
+			0xD0, 0xEE,       // BNE_relative loop
+			0xC8,             // INY
+			0x4C, 0x00, 0x80, // JMP_absolute loop
+		};
+
+		std::copy(std::begin(program), std::end(program), prg.begin());
+
+		// Reset vector 0x8000.
+		prg[0x4000 - 4] = 0x00;
+		prg[0x4000 - 3] = 0x80;
+
+		romPath = WriteTestROM(prg, 0, {});
+	}
+
+	std::unique_ptr<NES> nes = std::make_unique<NES>();
+	CPU&    cpu = nes->GetCPU();
+	System& system = nes->GetSystem();
+
+	REQUIRE(nes->GetCartridge().Load(romPath.string()));
+	std::filesystem::remove(romPath);
+
+	system.Reset();
+
+	// Only different from the next one when built with ENABLE_JIT.
+	BENCHMARK("A frame from compiled blocks")
+	{
+		system.RunCycles(29781);
+		return cpu.GetRegisters().PS;
+	};
+
+	cpu.SetJitEnabled(false);
+
+	BENCHMARK("A frame from decoded blocks")
+	{
+		system.RunCycles(29781);
+		return cpu.GetRegisters().PS;
+	};
+
+	cpu.SetBlockCacheEnabled(false);
+
+	BENCHMARK("A frame decoding every instruction")
+	{
+		system.RunCycles(29781);
+		return cpu.GetRegisters().PS;
+	};
+
+	spdlog::set_level(spdlog::level::info);
+}
+
+TEST_CASE("MMC1 bank switching", "[!benchmark][Mapper]")
+{
+	spdlog::set_level(spdlog::level::off);
+
+	// 128KB of PRG on mapper 1. The program lives in the last bank, which
+	// MMC1 powers on with fixed at 0xC000.
+	std::filesystem::path romPath;
+
+	{
+		constexpr size_t kPrgSize = 0x20000;
+		std::vector<uint8_t> prg(kPrgSize, 0);
+
+		const uint8_t program[] =
+		{
+			0xA2, 0x00,       // LDX_immediate 0
+			0x8A,             // TXA                 <- loop
+			0x8D, 0x00, 0xE0, // STA_absolute $E000  PRG bank, shifted in LSB first
+			0x4A,             // LSR_accumulator
+			0x8D, 0x00, 0xE0, // STA_absolute $E000
+			0x4A,             // LSR_accumulator
+			0x8D, 0x00, 0xE0, // STA_absolute $E000
+			0x4A,             // LSR_accumulator
+			0x8D, 0x00, 0xE0, // STA_absolute $E000
+			0x4A,             // LSR_accumulator
+			0x8D, 0x00, 0xE0, // STA_absolute $E000
+			0xAD, 0x00, 0x80, // LDA_absolute $8000  read from the new bank
+			0xE8,             // INX
+			0x4C, 0x02, 0xC0, // JMP_absolute loop
+		};
+
+		size_t lastBank = kPrgSize - 0x4000;
+		std::copy(std::begin(program), std::end(program), prg.begin() + static_cast<std::ptrdiff_t>(lastBank));
+
+		// Reset vector 0xC000.
+		prg[kPrgSize - 4] = 0x00;
+		prg[kPrgSize - 3] = 0xC0;
+
+		romPath = WriteTestROM(prg, 1, {});
+	}
+
+	std::unique_ptr<NES> nes = std::make_unique<NES>();
+	CPU&       cpu = nes->GetCPU();
+	Cartridge& cart = nes->GetCartridge();
+	System&    system = nes->GetSystem();
+
+	REQUIRE(cart.Load(romPath.string()));
+
+	system.Reset();
+
+	constexpr int kInstructions = 100000;
+
+	BENCHMARK("Templated mapper writes")
+	{
+		for (int i = 0; i < kInstructions; ++i)
+		{
+			system.Process();
+		}
+
+		return cpu.GetRegisters().ACC;
+	};
+
+	// Swap in the generic handlers, which go through Mapper's vtable.
+	system.SetHandlers(0x80, 0x80, &Cartridge::BusRead, &Cartridge::BusWrite, &cart);
+
+	BENCHMARK("Virtual mapper writes")
+	{
+		for (int i = 0; i < kInstructions; ++i)
+		{
+			system.Process();
+		}
+
+		return cpu.GetRegisters().ACC;
+	};
+
+	REQUIRE(cpu.GetRegisters().PC >= 0xC002);
+
+	nes.reset();
+	std::filesystem::remove(romPath);
+
+	spdlog::set_level(spdlog::level::info);
+}
+
+TEST_CASE("Create and destroy", "[!benchmark][System]")
+{
+	BENCHMARK("NES")
+	{
+		std::unique_ptr<NES> nes = std::make_unique<NES>();
+		return nes->GetCPU().GetCycles();
+	};
+}
+
+TEST_CASE("Pattern table decoding", "[!benchmark][PPU]")
+{
+	// A full 256KB of CHR, the most MMC3 can address, is 1M pixels.
+	constexpr size_t kTileCount = 0x40000 / kTileBytes;
+
+	std::vector<uint8_t> chr(kTileCount * kTileBytes);
+	std::mt19937 random(1234);
+	for (uint8_t& byte : chr)
+	{
+		byte = static_cast<uint8_t>(random());
+	}
+
+	std::vector<uint8_t> decoded(kTileCount * kDecodedTileBytes);
+
+	// How the PPU decoded tiles before, one pixel at a time.
+	BENCHMARK("1M pixels, per pixel")
+	{
+		for (size_t tile = 0; tile < kTileCount; ++tile)
+		{
+			for (int row = 0; row < 8; ++row)
+			{
+				uint8_t lo = chr[tile * kTileBytes + row];
+				uint8_t hi = chr[tile * kTileBytes + row + 8];
+
+				for (int bit = 7; bit >= 0; --bit)
+				{
+					decoded[tile * kDecodedTileBytes + row * 8 + 7 - bit] = ((lo >> bit) & 0x01) | (((hi >> bit) & 0x01) << 1);
+				}
+			}
+		}
+
+		return decoded[0];
+	};
+
+	BENCHMARK("1M pixels, scalar")
+	{
+		DecodeTilesScalar(chr.data(), kTileCount, decoded.data());
+		return decoded[0];
+	};
+
+	BENCHMARK(std::string("1M pixels, ") + GetTileDecoderName())
+	{
+		DecodeTiles(chr.data(), kTileCount, decoded.data());
+		return decoded[0];
+	};
+}
+
+TEST_CASE("Save state snapshots", "[!benchmark][System]")
+{
+	spdlog::set_level(spdlog::level::off);
+
+	std::unique_ptr<NES> nes = std::make_unique<NES>();
+	Cartridge& cart = nes->GetCartridge();
+	System&    system = nes->GetSystem();
+
+	cart.Load();
+
+	system.Write(0xFFFC, 0x00);
+	system.Write(0xFFFD, 0x80);
+
+	uint16_t write_addr = 0x8000;
+	cart.Write(write_addr++, 0x4C); // JMP_absolute
+	cart.Write(write_addr++, 0x00); // loop offset 0x00
+	cart.Write(write_addr++, 0x80); // loop page 0x80
+
+	system.Reset();
+	system.RunCycles(29781);
+
+	// The blank cartridge has writable PRG and CHR, so this is the large case.
+	std::vector<uint8_t> state;
+	system.SaveState(state);
+
+	BENCHMARK("Save")
+	{
+		system.SaveState(state);
+		return state.size();
+	};
+
+	BENCHMARK("Load")
+	{
+		return system.LoadState(state);
+	};
+
+	spdlog::set_level(spdlog::level::info);
+}
+
+TEST_CASE("Rewind history", "[!benchmark][System]")
+{
+	spdlog::set_level(spdlog::level::off);
+
+	std::unique_ptr<NES> nes = std::make_unique<NES>();
+	Cartridge& cart = nes->GetCartridge();
+	System&    system = nes->GetSystem();
+
+	cart.Load();
+
+	system.Write(0xFFFC, 0x00);
+	system.Write(0xFFFD, 0x80);
+
+	// Counts in 0x0000 with rendering on.
+	uint16_t write_addr = 0x8000;
+	cart.Write(write_addr++, 0xA9); // LDA_immediate
+	cart.Write(write_addr++, 0x1E); // literal 0x1E, rendering on
+	cart.Write(write_addr++, 0x8D); // STA_absolute
+	cart.Write(write_addr++, 0x01); // PPUMASK offset 0x01
+	cart.Write(write_addr++, 0x20); // PPUMASK page 0x20
+	cart.Write(write_addr++, 0xE6); // INC_zeropage    <- loop
+	cart.Write(write_addr++, 0x00); // Memory offset 0x00
+	cart.Write(write_addr++, 0x4C); // JMP_absolute
+	cart.Write(write_addr++, 0x05); // loop offset 0x05
+	cart.Write(write_addr++, 0x80); // loop page 0x80
+
+	system.Reset();
+
+	// A minute's worth, as the frontend keeps.
+	RewindBuffer rewind(8 * 1024 * 1024, 60 * 60);
+	std::vector<uint8_t> state;
+	for (int i = 0; i < 60 * 60; ++i)
+	{
+		system.RunCycles(29781);
+		system.SaveState(state);
+		rewind.Push(state);
+	}
+
+	INFO("Bytes used for a minute: " << rewind.GetBytesUsed());
+	CHECK(rewind.GetStateCount() == 60 * 60);
+	CHECK(rewind.GetBytesUsed() < 4 * 1024 * 1024);
+
+	BENCHMARK("Push and pop")
+	{
+		rewind.Push(state);
+		return rewind.Pop(state);
+	};
+
+	spdlog::set_level(spdlog::level::info);
+}
@@ -1,27 +1,40 @@
 #include <catch2/catch_test_macros.hpp>
 
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <limits>
 #include <memory>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
 
 #include <spdlog/spdlog.h>
 
-#include "CPU.hpp"
-#include "Memory.hpp"
-#include "System.hpp"
-#include "Cartridge.hpp"
-
-std::shared_ptr<CPU>       sCpu;
-std::shared_ptr<Memory>    sMemory;
-std::shared_ptr<Cartridge> sCart;
-std::shared_ptr<System>    sSystem;
+#include "BlipBuffer.hpp"
+#include "Latency.hpp"
+#include "Mapper.hpp"
+#include "Movie.hpp"
+#include "NES.hpp"
+#include "ROM.hpp"
+#include "Rewind.hpp"
+#include "SaveState.hpp"
+#include "TileDecoder.hpp"
+
+std::unique_ptr<NES> sNES;
+CPU*                 sCpu;
+Cartridge*           sCart;
+System*              sSystem;
 
 void InitSystem()
 {
 	spdlog::set_level(spdlog::level::trace);
 
-	sCpu = std::make_shared<CPU>();
-	sMemory = std::make_shared<Memory>();
-	sCart = std::make_shared<Cartridge>();
-	sSystem = std::make_shared<System>(sCpu, sMemory, sCart);
+	sNES = std::make_unique<NES>();
+	sCpu = &sNES->GetCPU();
+	sCart = &sNES->GetCartridge();
+	sSystem = &sNES->GetSystem();
 
 	bool loaded = sCart->Load();
 
@@ -41,6 +54,33 @@ void ExecuteSystem()
 	}
 }
 
+// Writes an iNES 1.0 image to a new file in the temp directory, for tests
+// that need a real ROM file. PRG and CHR are in 16KB and 8KB banks, no CHR
+// means CHR-RAM. The caller removes the file.
+std::filesystem::path WriteTestROM(std::span<const uint8_t> prg, uint8_t mapper, std::span<const uint8_t> chr)
+{
+	static int sFileCount = 0;
+	std::filesystem::path romPath = std::filesystem::temp_directory_path() / ("cojoNES_test_" + std::to_string(sFileCount++) + ".nes");
+
+	std::vector<uint8_t> image(16, 0);
+	image[0] = 'N';
+	image[1] = 'E';
+	image[2] = 'S';
+	image[3] = 0x1A;
+	image[4] = static_cast<uint8_t>(prg.size() / 0x4000);
+	image[5] = static_cast<uint8_t>(chr.size() / 0x2000);
+	image[6] = static_cast<uint8_t>(mapper << 4);
+	image[7] = static_cast<uint8_t>(mapper & 0xF0);
+
+	image.insert(image.end(), prg.begin(), prg.end());
+	image.insert(image.end(), chr.begin(), chr.end());
+
+	std::ofstream file(romPath, std::ios::binary);
+	file.write(reinterpret_cast<const char*>(image.data()), static_cast<std::streamsize>(image.size()));
+
+	return romPath;
+}
+
 TEST_CASE("ADC", "[CPU]")
 {
 	InitSystem();
@@ -168,7 +208,7 @@ TEST_CASE("BEQ", "[CPU]")
 	sCart->Write(write_addr++, 0x69); // ADC_immediate
 	sCart->Write(write_addr++, 0x10); // literal 16
 	sCart->Write(write_addr++, 0xF0); // BEQ_relative
-	sCart->Write(write_addr++, 0x09); // literal 9
+	sCart->Write(write_addr++, 0x08); // literal 8, to the LDA_immediate of 0
 	sCart->Write(write_addr++, 0xA9); // LDA_immediate
 	sCart->Write(write_addr++, 0x2A); // literal 42
 	sCart->Write(write_addr++, 0x8D); // STA_absolute
@@ -703,11 +743,11 @@ TEST_CASE("LDA", "[CPU]")
 	sSystem->Write(0x0004, 0xFF); // 255
 	sSystem->Write(0x0005, 0x4B); // 75
 	sSystem->Write(0x0006, 0x8D); // 141
-	sSystem->Write(0x0007, 0x2A); // 42
+	sSystem->Write(0x0007, 0x00); // 0
 
-	// For LDA_indirect_X / LDA_indirect_Y
+	// For LDA_indirect_X / LDA_indirect_Y, both through the pointer at 0x06.
 	sSystem->Write(0x008D, 0x9F); // 159
-	sSystem->Write(0x002A, 0xC2); // 194
+	sSystem->Write(0x0092, 0xC2); // 194
 
 	uint16_t write_addr = 0x8000;
 
@@ -765,7 +805,7 @@ TEST_CASE("LDA", "[CPU]")
 	sCart->Write(write_addr++, 0xA0); // LDY_immediate
 	sCart->Write(write_addr++, 0x05); // literal 5
 	sCart->Write(write_addr++, 0xB1); // LDA_indirect_Y
-	sCart->Write(write_addr++, 0x02); // Memory offset 0x02
+	sCart->Write(write_addr++, 0x06); // Memory offset 0x06
 	sCart->Write(write_addr++, 0x8D); // STA_absolute
 	sCart->Write(write_addr++, 0x0F); // Memory offset 0x0F
 	sCart->Write(write_addr++, 0x00); // Memory page 0x00
@@ -1076,6 +1116,33 @@ TEST_CASE("SBC", "[CPU]")
 	REQUIRE(sCpu->GetProcessorStatus(PS_NegativeFlag) == false);
 }
 
+TEST_CASE("SBC overflow and compare borrow", "[CPU]")
+{
+	InitSystem();
+
+	uint16_t write_addr = 0x8000;
+	sCart->Write(write_addr++, 0xA9); // LDA_immediate
+	sCart->Write(write_addr++, 0x80); // literal -128
+	sCart->Write(write_addr++, 0x38); // SEC
+	sCart->Write(write_addr++, 0xE9); // SBC_immediate
+	sCart->Write(write_addr++, 0x01); // literal 1
+	sCart->Write(write_addr++, 0x85); // STA_zeropage
+	sCart->Write(write_addr++, 0x00); // Memory offset 0x00
+	sCart->Write(write_addr++, 0xC9); // CMP_immediate
+	sCart->Write(write_addr++, 0x90); // literal 0x90
+	sCart->Write(write_addr++, 0xEA); // NOP
+
+	ExecuteSystem();
+
+	// -128 - 1 doesn't fit in a signed byte. 0x7F < 0x90, so the compare
+	// borrows and clears carry, but leaves V alone.
+	REQUIRE(sSystem->Read(0x0000) == 0x7F);
+	REQUIRE(sCpu->GetProcessorStatus(PS_CarryFlag) == false);
+	REQUIRE(sCpu->GetProcessorStatus(PS_ZeroFlag) == false);
+	REQUIRE(sCpu->GetProcessorStatus(PS_OverflowFlag) == true);
+	REQUIRE(sCpu->GetProcessorStatus(PS_NegativeFlag) == true);
+}
+
 TEST_CASE("SEC", "[CPU]")
 {
 	InitSystem();
@@ -1175,13 +1242,15 @@ TEST_CASE("STA", "[CPU]")
 	sCart->Write(write_addr++, 0xA9); // LDA_immediate
 	sCart->Write(write_addr++, 0x29); // literal 41
 	sCart->Write(write_addr++, 0xA0); // LDY_immediate
-	sCart->Write(write_addr++, 0x07); // literal 7
+	sCart->Write(write_addr++, 0x01); // literal 1
 	sCart->Write(write_addr++, 0x91); // STA_indirect_Y
 	sCart->Write(write_addr++, 0x12); // Memory offset 0x12
 
-	// For STA_indirect_X & STA_indirect_Y
+	// Pointers for STA_indirect_X & STA_indirect_Y
+	sSystem->Write(0x0012, 0x05);
+	sSystem->Write(0x0013, 0x00);
 	sSystem->Write(0x0018, 0x05);
-	sSystem->Write(0x0019, 0x06);
+	sSystem->Write(0x0019, 0x00);
 
 	ExecuteSystem();
 
@@ -1362,3 +1431,1428 @@ TEST_CASE("TYA", "[CPU]")
 	REQUIRE(registers.ACC == 0x9E);
 	REQUIRE(sSystem->Read(0x00) == 0x9E);
 }
+
+TEST_CASE("Cycles", "[CPU]")
+{
+	InitSystem();
+
+	uint16_t write_addr = 0x8000;
+	sCart->Write(write_addr++, 0xA9); // LDA_immediate              2 cycles
+	sCart->Write(write_addr++, 0x01); // literal 1
+	sCart->Write(write_addr++, 0x8D); // STA_absolute               4 cycles
+	sCart->Write(write_addr++, 0x00); // Memory offset 0x00
+	sCart->Write(write_addr++, 0x02); // Memory page 0x02
+	sCart->Write(write_addr++, 0xA2); // LDX_immediate              2 cycles
+	sCart->Write(write_addr++, 0xFF); // literal 255
+	sCart->Write(write_addr++, 0xBD); // LDA_absolute_X             4 cycles + 1 for crossing into page 0x03
+	sCart->Write(write_addr++, 0x01); // Memory offset 0x01
+	sCart->Write(write_addr++, 0x02); // Memory page 0x02
+	sCart->Write(write_addr++, 0xA0); // LDY_immediate              2 cycles
+	sCart->Write(write_addr++, 0x00); // literal 0
+	sCart->Write(write_addr++, 0xF0); // BEQ_relative               2 cycles + 1 for being taken
+	sCart->Write(write_addr++, 0x01); // literal 1
+	sCart->Write(write_addr++, 0xEA); // NOP                        skipped
+	sCart->Write(write_addr++, 0xEA); // NOP                        2 cycles
+	sCart->Write(write_addr++, 0x00); // BRK                        7 cycles
+
+	ExecuteSystem();
+
+	REQUIRE(sCpu->GetCycles() == 27);
+}
+
+TEST_CASE("Cycles indirect Y", "[CPU]")
+{
+	InitSystem();
+
+	uint16_t write_addr = 0x8000;
+	sCart->Write(write_addr++, 0xA0); // LDY_immediate              2 cycles
+	sCart->Write(write_addr++, 0x10); // literal 16
+	sCart->Write(write_addr++, 0xB1); // LDA_indirect_Y             5 cycles + 1 if the pointer plus Y crosses a page
+	sCart->Write(write_addr++, 0xF0); // Memory offset 0xF0
+	sCart->Write(write_addr++, 0x00); // BRK                        7 cycles
+
+	SECTION("Same page")
+	{
+		// 0x0200 + 0x10, the zero page address plus Y is past 0xFF but that
+		// doesn't matter.
+		sSystem->Write(0x00F0, 0x00);
+		sSystem->Write(0x00F1, 0x02);
+
+		ExecuteSystem();
+
+		REQUIRE(sCpu->GetCycles() == 14);
+	}
+
+	SECTION("Crossing a page")
+	{
+		// 0x02F8 + 0x10 is on page 0x03.
+		sSystem->Write(0x00F0, 0xF8);
+		sSystem->Write(0x00F1, 0x02);
+
+		ExecuteSystem();
+
+		REQUIRE(sCpu->GetCycles() == 15);
+	}
+}
+
+TEST_CASE("Memory map", "[System]")
+{
+	InitSystem();
+
+	// Internal RAM is mirrored every 2KB up to 0x2000.
+	sSystem->Write(0x0042, 0x2A);
+	REQUIRE(sSystem->Read(0x0842) == 0x2A);
+	REQUIRE(sSystem->Read(0x1842) == 0x2A);
+
+	sSystem->Write(0x1FFF, 0x55);
+	REQUIRE(sSystem->Read(0x07FF) == 0x55);
+
+	// A 16KB cartridge is mirrored into both halves of 0x8000-0xFFFF.
+	sCart->Write(0x8010, 0xEA);
+	REQUIRE(sSystem->Read(0x8010) == 0xEA);
+	REQUIRE(sSystem->Read(0xC010) == 0xEA);
+
+	// PRG-RAM.
+	sSystem->Write(0x6123, 0x11);
+	REQUIRE(sSystem->Read(0x6123) == 0x11);
+
+	// Pages are remapped when a new ROM is loaded.
+	sCart->Load();
+	REQUIRE(sSystem->Read(0x8010) == 0x00);
+}
+
+TEST_CASE("ROM loading", "[ROM]")
+{
+	// 1x16KB PRG, no CHR (so 8KB of CHR-RAM), mapper 0.
+	std::vector<uint8_t> prg(16384, 0);
+	prg[0] = 0xA9;
+	prg[16383] = 0x42;
+
+	std::filesystem::path romPath = WriteTestROM(prg, 0, {});
+
+	{
+		ROM rom;
+		REQUIRE(rom.Load(romPath.string()));
+		REQUIRE(rom.GetPrgRom().size() == 16384);
+		REQUIRE(rom.GetPrgRom()[0] == 0xA9);
+		REQUIRE(rom.GetPrgRom()[16383] == 0x42);
+		REQUIRE(rom.GetChrRom().size() == 8192);
+		REQUIRE(rom.IsChrRomWritable());
+
+		// PRG is only copied once something writes to it.
+		REQUIRE_FALSE(rom.IsPrgRomWritable());
+		rom.GetWritablePrgRom()[0] = 0xEA;
+		REQUIRE(rom.IsPrgRomWritable());
+		REQUIRE(rom.GetPrgRom()[0] == 0xEA);
+		REQUIRE(rom.GetPrgRom()[16383] == 0x42);
+	}
+
+	std::filesystem::remove(romPath);
+}
+
+TEST_CASE("NES 2.0 headers", "[ROM]")
+{
+	InitSystem();
+
+	// MMC3 with a NES 2.0 header, byte 8 holds mapper bits 8-11.
+	std::vector<uint8_t> prg(0x8000, 0);
+	std::vector<uint8_t> chr(0x2000, 0);
+	std::filesystem::path romPath = WriteTestROM(prg, 4, chr);
+
+	auto setMapperHigh = [&romPath](uint8_t bits)
+	{
+		std::fstream file(romPath, std::ios::binary | std::ios::in | std::ios::out);
+		const char bytes[] = { 0x08, static_cast<char>(bits) };
+		file.seekp(7);
+		file.write(bytes, sizeof(bytes));
+	};
+
+	setMapperHigh(0x00);
+	{
+		ROM rom;
+		REQUIRE(rom.Load(romPath.string()));
+		REQUIRE(rom.GetHeader().version == HV_iNES_2_0);
+		REQUIRE(rom.GetHeader().mapper == 4);
+	}
+	REQUIRE(sCart->Load(romPath.string()));
+
+	// Mapper 260 isn't MMC3.
+	setMapperHigh(0x01);
+	{
+		ROM rom;
+		REQUIRE(rom.Load(romPath.string()));
+		REQUIRE(rom.GetHeader().mapper == 0x104);
+	}
+	REQUIRE_FALSE(sCart->Load(romPath.string()));
+
+	std::filesystem::remove(romPath);
+}
+
+TEST_CASE("Mappers", "[Mapper]")
+{
+	SECTION("NROM")
+	{
+		NROM nrom16(0x4000, 0x2000, MM_Horizontal);
+		REQUIRE(nrom16.GetPrgBanks() == std::array<size_t, 4>{ 0x0000, 0x2000, 0x0000, 0x2000 });
+
+		NROM nrom32(0x8000, 0x2000, MM_Horizontal);
+		REQUIRE(nrom32.GetPrgBanks() == std::array<size_t, 4>{ 0x0000, 0x2000, 0x4000, 0x6000 });
+		REQUIRE_FALSE(nrom32.HasRegisters());
+	}
+
+	SECTION("MMC1")
+	{
+		MMC1 mmc1(0x40000, 0x20000, MM_Horizontal);
+
+		// Powers on with the last bank fixed at 0xC000.
+		REQUIRE(mmc1.GetPrgBanks()[2] == 0x3C000);
+
+		// Select PRG bank 5, five writes LSB first.
+		uint8_t bank = 0x05;
+		for (int i = 0; i < 5; ++i)
+		{
+			mmc1.WriteRegister(0xE000, (bank >> i) & 0x01);
+		}
+		REQUIRE(mmc1.GetPrgBanks()[0] == 0x14000);
+		REQUIRE(mmc1.GetPrgBanks()[1] == 0x16000);
+		REQUIRE(mmc1.GetPrgBanks()[2] == 0x3C000);
+
+		// Control, vertical mirroring with 4KB CHR banks.
+		uint8_t control = 0x1E;
+		for (int i = 0; i < 5; ++i)
+		{
+			mmc1.WriteRegister(0x8000, (control >> i) & 0x01);
+		}
+		REQUIRE(mmc1.GetMirroring() == MM_Vertical);
+	}
+
+	SECTION("UxROM")
+	{
+		UxROM uxrom(0x20000, 0x2000, MM_Vertical);
+		uxrom.WriteRegister(0x8000, 0x03);
+		REQUIRE(uxrom.GetPrgBanks()[0] == 0xC000);
+		REQUIRE(uxrom.GetPrgBanks()[2] == 0x1C000);
+	}
+
+	SECTION("CNROM")
+	{
+		CNROM cnrom(0x8000, 0x8000, MM_Vertical);
+		cnrom.WriteRegister(0x8000, 0x02);
+		REQUIRE(cnrom.GetChrBanks()[0] == 0x4000);
+	}
+
+	SECTION("MMC3")
+	{
+		MMC3 mmc3(0x20000, 0x20000, MM_Vertical);
+		REQUIRE(mmc3.GetPrgBanks()[2] == 0x1C000);
+		REQUIRE(mmc3.GetPrgBanks()[3] == 0x1E000);
+
+		// R6 = bank 3, then swap it to 0xC000.
+		mmc3.WriteRegister(0x8000, 0x06);
+		mmc3.WriteRegister(0x8001, 0x03);
+		REQUIRE(mmc3.GetPrgBanks()[0] == 0x6000);
+		mmc3.WriteRegister(0x8000, 0x46);
+		REQUIRE(mmc3.GetPrgBanks()[0] == 0x1C000);
+		REQUIRE(mmc3.GetPrgBanks()[2] == 0x6000);
+
+		// IRQ after 2 scanlines, counting the reload.
+		mmc3.WriteRegister(0xC000, 0x02);
+		mmc3.WriteRegister(0xC001, 0x00);
+		mmc3.WriteRegister(0xE001, 0x00);
+		mmc3.OnScanline();
+		mmc3.OnScanline();
+		REQUIRE_FALSE(mmc3.IsIRQPending());
+		mmc3.OnScanline();
+		REQUIRE(mmc3.IsIRQPending());
+
+		mmc3.WriteRegister(0xE000, 0x00);
+		REQUIRE_FALSE(mmc3.IsIRQPending());
+	}
+}
+
+TEST_CASE("Block cache", "[CPU]")
+{
+	spdlog::set_level(spdlog::level::off);
+
+	// 64KB of PRG on UxROM. The main loop in the fixed bank calls into bank
+	// 0, which switches to bank 1 part way through a block and has to carry
+	// on with bank 1's code.
+	std::filesystem::path romPath;
+
+	{
+		constexpr size_t kPrgSize = 0x10000;
+		std::vector<uint8_t> prg(kPrgSize, 0);
+
+		const uint8_t loop[] =
+		{
+			0xA2, 0x00,       // LDX_immediate 0
+			0xA0, 0x00,       // LDY_immediate 0
+			0xA9, 0x00,       // LDA_immediate 0     <- loop
+			0x8D, 0x00, 0xC1, // STA_absolute $C100  switch to bank 0
+			0x20, 0x00, 0x80, // JSR $8000
+			0x18,             // CLC
+			0xA5, 0x10,       // LDA_zeropage $10
+			0x69, 0x03,       // ADC_immediate 3
+			0x85, 0x10,       // STA_zeropage $10
+			0x4C, 0x04, 0xC0, // JMP_absolute loop
+		};
+
+		const uint8_t bank0[] =
+		{
+			0xA9, 0x01,       // LDA_immediate 1
+			0x8D, 0x00, 0xC1, // STA_absolute $C100  switch to bank 1
+			0xC8,             // INY
+			0x60,             // RTS
+		};
+
+		const uint8_t bank1[] =
+		{
+			0xEA,             // NOP
+			0xEA,             // NOP
+			0xEA,             // NOP
+			0xEA,             // NOP
+			0xEA,             // NOP
+			0xE8,             // INX                 <- after the switch
+			0x60,             // RTS
+		};
+
+		std::copy(std::begin(bank0), std::end(bank0), prg.begin());
+		std::copy(std::begin(bank1), std::end(bank1), prg.begin() + 0x4000);
+		std::copy(std::begin(loop), std::end(loop), prg.begin() + kPrgSize - 0x4000);
+
+		// Reset vector 0xC000.
+		prg[kPrgSize - 4] = 0x00;
+		prg[kPrgSize - 3] = 0xC0;
+
+		romPath = WriteTestROM(prg, 2, {});
+	}
+
+	std::unique_ptr<NES> cached = std::make_unique<NES>();
+	std::unique_ptr<NES> stepped = std::make_unique<NES>();
+	stepped->GetCPU().SetBlockCacheEnabled(false);
+
+	for (NES* nes : { cached.get(), stepped.get() })
+	{
+		REQUIRE(nes->GetCartridge().Load(romPath.string()));
+		nes->GetSystem().Reset();
+		REQUIRE(nes->GetSystem().RunCycles(100000));
+	}
+
+	std::filesystem::remove(romPath);
+
+	CPURegisters expected = stepped->GetCPU().GetRegisters();
+	CPURegisters actual = cached->GetCPU().GetRegisters();
+
+	REQUIRE(cached->GetCPU().GetCycles() == stepped->GetCPU().GetCycles());
+	REQUIRE(actual.PC == expected.PC);
+	REQUIRE(actual.ACC == expected.ACC);
+	REQUIRE(actual.IX == expected.IX);
+	REQUIRE(actual.IY == expected.IY);
+	REQUIRE(actual.SP == expected.SP);
+	REQUIRE(actual.PS == expected.PS);
+	REQUIRE(cached->GetSystem().Read(0x0010) == stepped->GetSystem().Read(0x0010));
+
+	// Bank 0's INY is never reached.
+	REQUIRE(expected.IX > 0);
+	REQUIRE(expected.IY == 0);
+
+	spdlog::set_level(spdlog::level::info);
+}
+
+TEST_CASE("Compiled blocks against the interpreter", "[CPU]")
+{
+	spdlog::set_level(spdlog::level::off);
+
+	// Random programs on UxROM, run on one machine that only steps and one
+	// that runs from the block cache and, with ENABLE_JIT, compiled code. They
+	// have to agree after every slice. The main loop in the fixed bank calls
+	// into the switchable banks, which switch banks themselves part way
+	// through, and polls PPU and APU registers while NMIs and IRQs come in.
+	std::mt19937 random(0x6502);
+
+	auto pick = [&random](uint32_t count) { return random() % count; };
+	auto randomByte = [&random]() { return static_cast<uint8_t>(random()); };
+	auto op = [](Opcodes opcode) { return static_cast<uint8_t>(opcode); };
+
+	const std::vector<Opcodes> implied =
+	{
+		Opcodes::INX, Opcodes::INY, Opcodes::DEX, Opcodes::DEY, Opcodes::TAX, Opcodes::TAY, Opcodes::TXA,
+		Opcodes::TYA, Opcodes::CLC, Opcodes::SEC, Opcodes::CLV, Opcodes::CLD, Opcodes::SED, Opcodes::CLI,
+		Opcodes::SEI, Opcodes::NOP, Opcodes::ASL_accumulator, Opcodes::LSR_accumulator,
+		Opcodes::ROL_accumulator, Opcodes::ROR_accumulator,
+	};
+
+	const std::vector<Opcodes> immediate =
+	{
+		Opcodes::LDA_immediate, Opcodes::LDX_immediate, Opcodes::LDY_immediate, Opcodes::ADC_immediate,
+		Opcodes::SBC_immediate, Opcodes::AND_immediate, Opcodes::ORA_immediate, Opcodes::EOR_immediate,
+		Opcodes::CMP_immediate, Opcodes::CPX_immediate, Opcodes::CPY_immediate,
+	};
+
+	// Anywhere in the zero page.
+	const std::vector<Opcodes> zeroPage =
+	{
+		Opcodes::LDA_zeropage, Opcodes::LDX_zeropage, Opcodes::LDY_zeropage, Opcodes::ADC_zeropage,
+		Opcodes::SBC_zeropage, Opcodes::AND_zeropage, Opcodes::ORA_zeropage, Opcodes::EOR_zeropage,
+		Opcodes::CMP_zeropage, Opcodes::CPX_zeropage, Opcodes::CPY_zeropage, Opcodes::BIT_zeropage,
+		Opcodes::STA_zeropage, Opcodes::STX_zeropage, Opcodes::STY_zeropage, Opcodes::ASL_zeropage,
+		Opcodes::LSR_zeropage, Opcodes::ROL_zeropage, Opcodes::ROR_zeropage, Opcodes::INC_zeropage,
+		Opcodes::DEC_zeropage, Opcodes::LDA_zeropage_X, Opcodes::ADC_zeropage_X, Opcodes::CMP_zeropage_X,
+		Opcodes::LDX_zeropage_Y, Opcodes::LDY_zeropage_X, Opcodes::LDA_indirect_X, Opcodes::LDA_indirect_Y,
+		Opcodes::ADC_indirect_Y,
+	};
+
+	// Indexing doesn't wrap to the zero page, so these stay near the bottom of
+	// it to keep away from the stack.
+	const std::vector<Opcodes> zeroPageIndexedWrites =
+	{
+		Opcodes::STA_zeropage_X, Opcodes::STY_zeropage_X, Opcodes::STX_zeropage_Y, Opcodes::INC_zeropage_X,
+		Opcodes::ROR_zeropage_X,
+	};
+
+	// Reads from RAM, ROM or I/O registers.
+	const std::vector<Opcodes> absoluteReads =
+	{
+		Opcodes::LDA_absolute, Opcodes::LDX_absolute, Opcodes::LDY_absolute, Opcodes::ADC_absolute,
+		Opcodes::SBC_absolute, Opcodes::CMP_absolute, Opcodes::BIT_absolute, Opcodes::LDA_absolute_X,
+		Opcodes::LDA_absolute_Y, Opcodes::EOR_absolute_X, Opcodes::SBC_absolute_Y, Opcodes::LDX_absolute_Y,
+		Opcodes::LDY_absolute_X,
+	};
+
+	// Writes to RAM above the stack.
+	const std::vector<Opcodes> absoluteWrites =
+	{
+		Opcodes::STA_absolute, Opcodes::STX_absolute, Opcodes::STY_absolute, Opcodes::STA_absolute_X,
+		Opcodes::STA_absolute_Y, Opcodes::INC_absolute, Opcodes::DEC_absolute_X, Opcodes::ASL_absolute_X,
+		Opcodes::LSR_absolute,
+	};
+
+	const std::vector<Opcodes> branches =
+	{
+		Opcodes::BCC_relative, Opcodes::BCS_relative, Opcodes::BEQ_relative, Opcodes::BNE_relative,
+		Opcodes::BMI_relative, Opcodes::BPL_relative, Opcodes::BVC_relative, Opcodes::BVS_relative,
+	};
+
+	const uint16_t kIOAddresses[] = { 0x2002, 0x4015, 0x4016 };
+
+	auto emit = [&](std::vector<uint8_t>& out, uint8_t length, bool canSwitchBanks)
+	{
+		if (length == 1)
+		{
+			out.push_back(op(implied[pick(static_cast<uint32_t>(implied.size()))]));
+		}
+		else if (length == 2)
+		{
+			if (pick(3) == 0)
+			{
+				out.push_back(op(immediate[pick(static_cast<uint32_t>(immediate.size()))]));
+				out.push_back(randomByte());
+			}
+			else if (pick(4) == 0)
+			{
+				out.push_back(op(zeroPageIndexedWrites[pick(static_cast<uint32_t>(zeroPageIndexedWrites.size()))]));
+				out.push_back(static_cast<uint8_t>(pick(0x10)));
+			}
+			else
+			{
+				out.push_back(op(zeroPage[pick(static_cast<uint32_t>(zeroPage.size()))]));
+				out.push_back(randomByte());
+			}
+		}
+		else
+		{
+			uint16_t address = 0;
+			uint32_t kind = pick(10);
+			if (canSwitchBanks && kind == 0)
+			{
+				out.push_back(op(Opcodes::STA_absolute));
+				address = static_cast<uint16_t>(0x8000 | random());
+			}
+			else if (kind < 5)
+			{
+				out.push_back(op(absoluteReads[pick(static_cast<uint32_t>(absoluteReads.size()))]));
+				switch (pick(3))
+				{
+					case 0: address = kIOAddresses[pick(3)]; break;
+					case 1: address = static_cast<uint16_t>(0x8000 | random()); break;
+					default: address = static_cast<uint16_t>(0x0200 + pick(0x600)); break;
+				}
+			}
+			else
+			{
+				out.push_back(op(absoluteWrites[pick(static_cast<uint32_t>(absoluteWrites.size()))]));
+				address = static_cast<uint16_t>(0x0200 + pick(0x500));
+			}
+
+			out.push_back(static_cast<uint8_t>(address));
+			out.push_back(static_cast<uint8_t>(address >> 8));
+		}
+	};
+
+	constexpr size_t kPrgSize = 0x10000;
+	constexpr int kPrograms = 24;
+	int finishedCount = 0;
+
+	for (int program = 0; program < kPrograms; ++program)
+	{
+		std::vector<uint8_t> prg(kPrgSize, 0);
+
+		// A subroutine at 0x8000 in each switchable bank, in 3 byte slots so
+		// switching banks part way through always lands on an instruction.
+		for (size_t bank = 0; bank < 3; ++bank)
+		{
+			std::vector<uint8_t> code;
+			for (int slot = 0; slot < 12; ++slot)
+			{
+				switch (pick(3))
+				{
+					case 0: emit(code, 3, true); break;
+					case 1: emit(code, 2, false); emit(code, 1, false); break;
+					default: emit(code, 1, false); emit(code, 1, false); emit(code, 1, false); break;
+				}
+			}
+			code.push_back(op(Opcodes::RTS));
+
+			std::copy(code.begin(), code.end(), prg.begin() + static_cast<std::ptrdiff_t>(bank * 0x4000));
+		}
+
+		std::vector<uint8_t> code =
+		{
+			0xA9, 0x80,       // LDA_immediate 0x80
+			0x8D, 0x00, 0x20, // STA_absolute $2000  NMI on
+		};
+		const uint16_t loop = static_cast<uint16_t>(0xC000 + code.size());
+
+		for (int item = 0; item < 48; ++item)
+		{
+			switch (pick(16))
+			{
+				case 0:
+					code.push_back(op(Opcodes::JSR));
+					code.push_back(0x00);
+					code.push_back(0x80);
+					break;
+				case 1:
+				{
+					code.push_back(op(Opcodes::LDA_immediate));
+					code.push_back(static_cast<uint8_t>(pick(3)));
+					code.push_back(op(Opcodes::STA_absolute));
+					code.push_back(0x00);
+					code.push_back(0xC0);
+					break;
+				}
+				case 2:
+				{
+					bool status = pick(2) == 0;
+					code.push_back(op(status ? Opcodes::PHP : Opcodes::PHA));
+					emit(code, static_cast<uint8_t>(1 + pick(3)), false);
+					code.push_back(op(status ? Opcodes::PLP : Opcodes::PLA));
+					break;
+				}
+				case 3:
+				case 4:
+				{
+					// Over the next instruction, sometimes onto another page.
+					code.push_back(op(branches[pick(static_cast<uint32_t>(branches.size()))]));
+					size_t offsetIndex = code.size();
+					code.push_back(0);
+					emit(code, static_cast<uint8_t>(1 + pick(3)), false);
+					code[offsetIndex] = static_cast<uint8_t>(code.size() - offsetIndex - 1);
+					break;
+				}
+				default:
+					emit(code, static_cast<uint8_t>(1 + pick(3)), false);
+					break;
+			}
+		}
+
+		code.push_back(op(Opcodes::JMP_absolute));
+		code.push_back(static_cast<uint8_t>(loop));
+		code.push_back(static_cast<uint8_t>(loop >> 8));
+
+		// Interrupt handlers at 0xF000 acknowledge the vblank and frame IRQ.
+		const uint8_t handlers[] =
+		{
+			0x48,             // PHA                 <- NMI
+			0xAD, 0x02, 0x20, // LDA_absolute $2002
+			0x68,             // PLA
+			0x40,             // RTI
+			0x48,             // PHA                 <- IRQ
+			0xAD, 0x15, 0x40, // LDA_absolute $4015
+			0x68,             // PLA
+			0x40,             // RTI
+		};
+
+		const size_t fixedBank = kPrgSize - 0x4000;
+		std::copy(code.begin(), code.end(), prg.begin() + static_cast<std::ptrdiff_t>(fixedBank));
+		std::copy(std::begin(handlers), std::end(handlers), prg.begin() + static_cast<std::ptrdiff_t>(fixedBank + 0x3000));
+
+		const uint8_t vectors[] = { 0x00, 0xF0, 0x00, 0xC0, 0x06, 0xF0 };
+		std::copy(std::begin(vectors), std::end(vectors), prg.end() - 6);
+
+		std::filesystem::path romPath = WriteTestROM(prg, 2, {});
+
+		std::unique_ptr<NES> fast = std::make_unique<NES>();
+		std::unique_ptr<NES> stepped = std::make_unique<NES>();
+		stepped->GetCPU().SetBlockCacheEnabled(false);
+
+		for (NES* nes : { fast.get(), stepped.get() })
+		{
+			REQUIRE(nes->GetCartridge().Load(romPath.string()));
+			nes->GetSystem().Reset();
+		}
+
+		std::filesystem::remove(romPath);
+
+		INFO("Program " << program);
+
+		bool isRunning = true;
+		for (int slice = 0; slice < 40 && isRunning; ++slice)
+		{
+			INFO("Slice " << slice);
+
+			isRunning = fast->GetSystem().RunCycles(2500);
+			REQUIRE(stepped->GetSystem().RunCycles(2500) == isRunning);
+
+			CPURegisters expected = stepped->GetCPU().GetRegisters();
+			CPURegisters actual = fast->GetCPU().GetRegisters();
+
+			REQUIRE(fast->GetCPU().GetCycles() == stepped->GetCPU().GetCycles());
+			REQUIRE(actual.PC == expected.PC);
+			REQUIRE(actual.ACC == expected.ACC);
+			REQUIRE(actual.IX == expected.IX);
+			REQUIRE(actual.IY == expected.IY);
+			REQUIRE(actual.SP == expected.SP);
+			REQUIRE(actual.PS == expected.PS);
+			REQUIRE(fast->GetCPU().GetCurrentOpcode() == stepped->GetCPU().GetCurrentOpcode());
+			REQUIRE(fast->GetCPU().GetCurrentOperand() == stepped->GetCPU().GetCurrentOperand());
+
+			const uint8_t* fastRAM = fast->GetMemory().GetData();
+			REQUIRE(std::equal(fastRAM, fastRAM + Memory::kSize, stepped->GetMemory().GetData()));
+		}
+
+		finishedCount += isRunning;
+	}
+
+	// Random code can wander off and jam, but most shouldn't.
+	REQUIRE(finishedCount > kPrograms / 2);
+
+	spdlog::set_level(spdlog::level::info);
+}
+
+TEST_CASE("PPU registers", "[PPU]")
+{
+	InitSystem();
+
+	// Write two bytes to the first nametable through PPUADDR/PPUDATA.
+	sSystem->Write(0x2006, 0x20);
+	sSystem->Write(0x2006, 0x00);
+	sSystem->Write(0x2007, 0x12);
+	sSystem->Write(0x2007, 0x34);
+
+	// Reads are buffered, so the first one returns stale data.
+	sSystem->Write(0x2006, 0x20);
+	sSystem->Write(0x2006, 0x00);
+	sSystem->Read(0x2007);
+	REQUIRE(sSystem->Read(0x2007) == 0x12);
+	REQUIRE(sSystem->Read(0x2007) == 0x34);
+
+	// Palette reads aren't, and 0x3F10 mirrors 0x3F00.
+	sSystem->Write(0x2006, 0x3F);
+	sSystem->Write(0x2006, 0x10);
+	sSystem->Write(0x2007, 0x0F);
+	sSystem->Write(0x2006, 0x3F);
+	sSystem->Write(0x2006, 0x00);
+	REQUIRE(sSystem->Read(0x2007) == 0x0F);
+
+	// Registers are mirrored every 8 bytes.
+	sSystem->Write(0x3FFE, 0x21);
+	sSystem->Write(0x3FFE, 0x00);
+	sSystem->Write(0x3FFF, 0x56);
+	sSystem->Write(0x2006, 0x21);
+	sSystem->Write(0x2006, 0x00);
+	sSystem->Read(0x2007);
+	REQUIRE(sSystem->Read(0x2007) == 0x56);
+}
+
+TEST_CASE("PPU vblank NMI", "[PPU]")
+{
+	InitSystem();
+
+	// NMI handler at 0x8100 counts NMIs in 0x0000.
+	sSystem->Write(0xFFFA, 0x00);
+	sSystem->Write(0xFFFB, 0x81);
+
+	uint16_t write_addr = 0x8000;
+	sCart->Write(write_addr++, 0xA9); // LDA_immediate
+	sCart->Write(write_addr++, 0x80); // literal 0x80, NMI enable
+	sCart->Write(write_addr++, 0x8D); // STA_absolute
+	sCart->Write(write_addr++, 0x00); // PPUCTRL offset 0x00
+	sCart->Write(write_addr++, 0x20); // PPUCTRL page 0x20
+	sCart->Write(write_addr++, 0x4C); // JMP_absolute
+	sCart->Write(write_addr++, 0x05); // loop offset 0x05
+	sCart->Write(write_addr++, 0x80); // loop page 0x80
+
+	write_addr = 0x8100;
+	sCart->Write(write_addr++, 0xE6); // INC_zeropage
+	sCart->Write(write_addr++, 0x00); // Memory offset 0x00
+	sCart->Write(write_addr++, 0x40); // RTI
+
+	sSystem->Reset();
+
+	// 3 frames.
+	REQUIRE(sSystem->RunCycles(29781 * 3));
+	REQUIRE(sSystem->Read(0x0000) == 3);
+
+	// Reading PPUSTATUS clears the vblank flag.
+	sSystem->RunCycles(sNES->GetPPU().GetNextVBlankCycle() - sCpu->GetCycles() + 100);
+	REQUIRE((sSystem->Read(0x2002) & 0x80) == 0x80);
+	REQUIRE((sSystem->Read(0x2002) & 0x80) == 0x00);
+}
+
+TEST_CASE("Tile decoding", "[PPU]")
+{
+	// Every possible pair of bitplane bytes, one per row.
+	constexpr size_t kTileCount = 0x10000 / 8;
+	std::vector<uint8_t> chr(kTileCount * kTileBytes);
+	for (size_t row = 0; row < 0x10000; ++row)
+	{
+		chr[(row / 8) * kTileBytes + row % 8] = row & 0xFF;
+		chr[(row / 8) * kTileBytes + row % 8 + 8] = row >> 8;
+	}
+
+	std::vector<uint8_t> scalar(kTileCount * kDecodedTileBytes);
+	std::vector<uint8_t> simd(kTileCount * kDecodedTileBytes);
+	DecodeTilesScalar(chr.data(), kTileCount, scalar.data());
+	DecodeTiles(chr.data(), kTileCount, simd.data());
+
+	for (size_t row = 0; row < 0x10000; ++row)
+	{
+		uint8_t lo = row & 0xFF;
+		uint8_t hi = row >> 8;
+
+		for (int column = 0; column < 8; ++column)
+		{
+			uint8_t pixel = ((lo >> (7 - column)) & 0x01) | (((hi >> (7 - column)) & 0x01) << 1);
+			REQUIRE(scalar[row * 8 + column] == pixel);
+		}
+	}
+
+	INFO("DecodeTiles() built with " << GetTileDecoderName());
+	REQUIRE(simd == scalar);
+}
+
+TEST_CASE("Tile cache", "[PPU]")
+{
+	// CNROM, 16KB PRG and 32KB CHR. The first row of tile 0 in each 8KB bank
+	// is filled with its bank number.
+	std::vector<uint8_t> prg(0x4000, 0);
+	std::vector<uint8_t> chr(0x8000, 0);
+	for (size_t bank = 0; bank < 4; ++bank)
+	{
+		chr[bank * 0x2000] = static_cast<uint8_t>(bank);
+	}
+
+	std::filesystem::path romPath = WriteTestROM(prg, 3, chr);
+
+	InitSystem();
+
+	SECTION("Bank switching")
+	{
+		REQUIRE(sCart->Load(romPath.string()));
+
+		// Bank 0 has no bits set, bank 1 sets the last pixel's low bit.
+		REQUIRE(sCart->GetDecodedTile(0x0000)[7] == 0);
+
+		sSystem->Write(0x8000, 0x01);
+		REQUIRE(sCart->GetDecodedTile(0x0000)[7] == 1);
+
+		sSystem->Write(0x8000, 0x03);
+		REQUIRE(sCart->GetDecodedTile(0x0000)[6] == 1);
+		REQUIRE(sCart->GetDecodedTile(0x0000)[7] == 1);
+	}
+
+	SECTION("CHR-RAM writes")
+	{
+		// The blank cartridge has writable CHR.
+		REQUIRE(sCart->GetDecodedTile(0x1010)[0] == 0);
+
+		sSystem->Write(0x2006, 0x10);
+		sSystem->Write(0x2006, 0x18);
+		sSystem->Write(0x2007, 0x80);
+		REQUIRE(sCart->GetDecodedTile(0x1010)[0] == 2);
+	}
+
+	std::filesystem::remove(romPath);
+}
+
+TEST_CASE("PPU events", "[PPU]")
+{
+	InitSystem();
+	PPU& ppu = sNES->GetPPU();
+
+	SECTION("Sprite 0 hit")
+	{
+		// Tile 1 is solid, placed at column 5 row 1 of the background and
+		// used for sprite 0 at (40, 10).
+		sSystem->Write(0x2006, 0x00);
+		sSystem->Write(0x2006, 0x10);
+		for (int row = 0; row < 8; ++row)
+		{
+			sSystem->Write(0x2007, 0xFF);
+		}
+
+		sSystem->Write(0x2006, 0x20);
+		sSystem->Write(0x2006, 0x25);
+		sSystem->Write(0x2007, 0x01);
+
+		sSystem->Write(0x2003, 0x00);
+		sSystem->Write(0x2004, 9);
+		sSystem->Write(0x2004, 1);
+		sSystem->Write(0x2004, 0);
+		sSystem->Write(0x2004, 40);
+
+		sSystem->Write(0x2006, 0x00);
+		sSystem->Write(0x2006, 0x00);
+		sSystem->Write(0x2001, 0x1E);
+
+		// The hit is on scanline 10, dot 41, well before the line is drawn.
+		ppu.CatchUp((10 * 341 + 41) / 3);
+		REQUIRE((ppu.ReadRegister(0x2002) & 0x40) == 0x00);
+		ppu.CatchUp((10 * 341 + 41) / 3 + 1);
+		REQUIRE((ppu.ReadRegister(0x2002) & 0x40) == 0x40);
+	}
+
+	SECTION("MMC3 IRQ")
+	{
+		std::vector<uint8_t> prg(0x8000, 0);
+		std::vector<uint8_t> chr(0x2000, 0);
+		std::filesystem::path romPath = WriteTestROM(prg, 4, chr);
+
+		REQUIRE(sCart->Load(romPath.string()));
+		std::filesystem::remove(romPath);
+
+		// No NMI and no IRQ, nothing to stop for.
+		REQUIRE(ppu.GetNextEventCycle() == std::numeric_limits<uint64_t>::max());
+
+		sSystem->Write(0xC000, 5);
+		sSystem->Write(0xC001, 0);
+		sSystem->Write(0xE001, 0);
+		sSystem->Write(0x2001, 0x18);
+
+		// Reload plus 5 clocks, the 6th is at dot 256 of scanline 5.
+		constexpr uint64_t kIRQCycle = (5 * 341 + 256 + 2) / 3;
+		REQUIRE(ppu.GetNextEventCycle() == kIRQCycle);
+
+		ppu.CatchUp(kIRQCycle - 1);
+		REQUIRE_FALSE(sCart->IsIRQPending());
+		ppu.CatchUp(kIRQCycle);
+		REQUIRE(sCart->IsIRQPending());
+
+		// Acknowledging and disabling the IRQ leaves NMI as the next event.
+		sSystem->Write(0xE000, 0);
+		REQUIRE_FALSE(sCart->IsIRQPending());
+		sSystem->Write(0x2000, 0x80);
+		REQUIRE(ppu.GetNextEventCycle() == ppu.GetNextVBlankCycle());
+	}
+}
+
+TEST_CASE("APU length counters", "[APU]")
+{
+	InitSystem();
+
+	uint16_t write_addr = 0x8000;
+	sCart->Write(write_addr++, 0x4C); // JMP_absolute
+	sCart->Write(write_addr++, 0x00); // loop offset 0x00
+	sCart->Write(write_addr++, 0x80); // loop page 0x80
+
+	sSystem->Reset();
+
+	// Lengths only load while the channel is enabled.
+	sSystem->Write(0x4003, 0x08);
+	REQUIRE((sSystem->Read(0x4015) & 0x0F) == 0x00);
+
+	sSystem->Write(0x4015, 0x0F);
+	sSystem->Write(0x4003, 0x08); // 254
+	sSystem->Write(0x4007, 0x18); // 2
+	sSystem->Write(0x400B, 0x08); // 254
+	sSystem->Write(0x400F, 0x08); // 254
+	REQUIRE((sSystem->Read(0x4015) & 0x0F) == 0x0F);
+
+	// Two half frames run pulse 2 out.
+	REQUIRE(sSystem->RunCycles(29830 + 10));
+	REQUIRE((sSystem->Read(0x4015) & 0x0F) == 0x0D);
+
+	// Length halt.
+	sSystem->Write(0x4000, 0x20);
+	sSystem->Write(0x4003, 0x18);
+	REQUIRE(sSystem->RunCycles(29830 * 2));
+	REQUIRE((sSystem->Read(0x4015) & 0x01) == 0x01);
+
+	sSystem->Write(0x4015, 0x00);
+	REQUIRE((sSystem->Read(0x4015) & 0x0F) == 0x00);
+}
+
+TEST_CASE("APU frame IRQ", "[APU]")
+{
+	InitSystem();
+
+	// IRQ handler at 0x8100 counts IRQs in 0x0000.
+	sSystem->Write(0xFFFE, 0x00);
+	sSystem->Write(0xFFFF, 0x81);
+
+	uint16_t write_addr = 0x8000;
+	sCart->Write(write_addr++, 0xA9); // LDA_immediate
+	sCart->Write(write_addr++, 0x00); // literal 0x00, 4 step sequence with IRQ
+	sCart->Write(write_addr++, 0x8D); // STA_absolute
+	sCart->Write(write_addr++, 0x17); // frame counter offset 0x17
+	sCart->Write(write_addr++, 0x40); // frame counter page 0x40
+	sCart->Write(write_addr++, 0x58); // CLI
+	sCart->Write(write_addr++, 0x4C); // JMP_absolute
+	sCart->Write(write_addr++, 0x06); // loop offset 0x06
+	sCart->Write(write_addr++, 0x80); // loop page 0x80
+
+	write_addr = 0x8100;
+	sCart->Write(write_addr++, 0xE6); // INC_zeropage
+	sCart->Write(write_addr++, 0x00); // Memory offset 0x00
+	sCart->Write(write_addr++, 0xAD); // LDA_absolute, acknowledges the IRQ
+	sCart->Write(write_addr++, 0x15); // APU status offset 0x15
+	sCart->Write(write_addr++, 0x40); // APU status page 0x40
+	sCart->Write(write_addr++, 0x40); // RTI
+
+	sSystem->Reset();
+
+	// One IRQ at the end of each 29830 cycle sequence.
+	REQUIRE(sSystem->RunCycles(29830 * 3 + 100));
+	REQUIRE(sSystem->Read(0x0000) == 3);
+
+	// Inhibited.
+	sSystem->Write(0x4017, 0x40);
+	REQUIRE(sSystem->RunCycles(29830 * 2));
+	REQUIRE(sSystem->Read(0x0000) == 3);
+
+	// The 5 step sequence never raises one.
+	sSystem->Write(0x4017, 0x80);
+	REQUIRE(sSystem->RunCycles(37282 * 2));
+	REQUIRE(sSystem->Read(0x0000) == 3);
+}
+
+TEST_CASE("APU DMC", "[APU]")
+{
+	InitSystem();
+	APU& apu = sNES->GetAPU();
+
+	uint16_t write_addr = 0x8000;
+	sCart->Write(write_addr++, 0x78); // SEI
+	sCart->Write(write_addr++, 0x4C); // JMP_absolute
+	sCart->Write(write_addr++, 0x01); // loop offset 0x01
+	sCart->Write(write_addr++, 0x80); // loop page 0x80
+
+	sSystem->Reset();
+	REQUIRE(sSystem->RunCycles(10));
+
+	sSystem->Write(0x4010, 0x8F); // IRQ, 54 cycles per bit
+	sSystem->Write(0x4012, 0x00); // 0xC000
+	sSystem->Write(0x4013, 0x01); // 17 bytes
+
+	// The first byte is fetched straight away, taking the bus from the CPU.
+	uint64_t cycles = sCpu->GetCycles();
+	sSystem->Write(0x4015, 0x10);
+	REQUIRE(sCpu->GetCycles() == cycles + 4);
+	REQUIRE((sSystem->Read(0x4015) & 0x90) == 0x10);
+
+	// The rest are fetched a byte's worth of bits apart, once the timer has
+	// finished its current period and the output unit its current byte.
+	uint64_t irqCycle = apu.GetNextEventCycle();
+	REQUIRE(irqCycle > cycles + 15 * 8 * 54);
+	REQUIRE(irqCycle <= cycles + 428 + 16 * 8 * 54);
+
+	apu.CatchUp(irqCycle - 1);
+	REQUIRE_FALSE(apu.IsIRQPending());
+	apu.CatchUp(irqCycle);
+	REQUIRE(apu.IsIRQPending());
+	REQUIRE((sSystem->Read(0x4015) & 0x90) == 0x80);
+
+	// Unlike the frame IRQ, reading doesn't acknowledge it, writing does.
+	REQUIRE((sSystem->Read(0x4015) & 0x80) == 0x80);
+	sSystem->Write(0x4015, 0x00);
+	REQUIRE((sSystem->Read(0x4015) & 0x80) == 0x00);
+}
+
+TEST_CASE("APU synthesis", "[APU]")
+{
+	InitSystem();
+	APU& apu = sNES->GetAPU();
+
+	uint16_t write_addr = 0x8000;
+	sCart->Write(write_addr++, 0x4C); // JMP_absolute
+	sCart->Write(write_addr++, 0x00); // loop offset 0x00
+	sCart->Write(write_addr++, 0x80); // loop page 0x80
+
+	sSystem->Reset();
+	apu.SetSampleRate(48000.0);
+
+	// Pulse 1, 50% duty at constant full volume, 1789773 / (16 * 254) = 440Hz.
+	sSystem->Write(0x4015, 0x01);
+	sSystem->Write(0x4000, 0xBF);
+	sSystem->Write(0x4002, 0xFD);
+	sSystem->Write(0x4003, 0x00);
+
+	std::vector<int16_t> samples;
+	const uint64_t startCycles = sCpu->GetCycles();
+
+	for (int frame = 0; frame < 10; ++frame)
+	{
+		REQUIRE(sSystem->RunCycles(29781));
+		apu.EndFrame();
+
+		size_t count = samples.size();
+		samples.resize(count + apu.GetSamplesAvailable());
+		REQUIRE(apu.ReadSamples(samples.data() + count, samples.size() - count) == samples.size() - count);
+	}
+
+	const double expectedSamples = (sCpu->GetCycles() - startCycles) * 48000.0 / APU::kClockRate;
+	REQUIRE(static_cast<double>(samples.size()) > expectedSamples - 2.0);
+	REQUIRE(static_cast<double>(samples.size()) < expectedSamples + 2.0);
+
+	// Full swing of a volume 15 square, give or take the ringing at its edges,
+	// once the DC blocker has centred it.
+	auto [minSample, maxSample] = std::minmax_element(samples.begin() + samples.size() / 2, samples.end());
+	REQUIRE(*maxSample - *minSample > 3500);
+	REQUIRE(*maxSample - *minSample < 5500);
+
+	// Count rising edges to check the pitch.
+	int edges = 0;
+	for (size_t i = samples.size() / 2 + 1; i < samples.size(); ++i)
+	{
+		edges += samples[i - 1] < 0 && samples[i] >= 0;
+	}
+
+	const double seconds = (samples.size() - samples.size() / 2) / 48000.0;
+	REQUIRE(edges >= static_cast<int>(440.0 * seconds) - 2);
+	REQUIRE(edges <= static_cast<int>(440.0 * seconds) + 2);
+}
+
+TEST_CASE("Band-limited steps", "[APU]")
+{
+	BlipBuffer buffer(1024);
+	buffer.SetRates(1000.0, 100.0);
+
+	// A step half way between samples 10 and 11.
+	buffer.AddDelta(105, 1000.0f);
+	buffer.EndFrame(1000);
+	REQUIRE(buffer.GetSamplesAvailable() == 100);
+
+	int16_t samples[100];
+	REQUIRE(buffer.ReadSamples(samples, 100) == 100);
+
+	REQUIRE(samples[0] == 0);
+
+	// Settled, apart from the DC blocker slowly pulling it back down.
+	for (int i = 30; i < 40; ++i)
+	{
+		REQUIRE(samples[i] > 950);
+		REQUIRE(samples[i] <= 1000);
+	}
+
+	REQUIRE(buffer.GetSamplesAvailable() == 0);
+}
+
+TEST_CASE("Save states", "[System]")
+{
+	InitSystem();
+
+	// Counts in 0x0000 and keeps the PPU and APU busy.
+	uint16_t write_addr = 0x8000;
+	sCart->Write(write_addr++, 0xA9); // LDA_immediate
+	sCart->Write(write_addr++, 0x1E); // literal 0x1E, rendering on
+	sCart->Write(write_addr++, 0x8D); // STA_absolute
+	sCart->Write(write_addr++, 0x01); // PPUMASK offset 0x01
+	sCart->Write(write_addr++, 0x20); // PPUMASK page 0x20
+	sCart->Write(write_addr++, 0xA9); // LDA_immediate
+	sCart->Write(write_addr++, 0x10); // literal 0x10, DMC on
+	sCart->Write(write_addr++, 0x8D); // STA_absolute
+	sCart->Write(write_addr++, 0x15); // APU status offset 0x15
+	sCart->Write(write_addr++, 0x40); // APU status page 0x40
+	sCart->Write(write_addr++, 0xE6); // INC_zeropage    <- loop
+	sCart->Write(write_addr++, 0x00); // Memory offset 0x00
+	sCart->Write(write_addr++, 0x4C); // JMP_absolute
+	sCart->Write(write_addr++, 0x0A); // loop offset 0x0A
+	sCart->Write(write_addr++, 0x80); // loop page 0x80
+
+	sSystem->Reset();
+	REQUIRE(sSystem->RunCycles(29781 * 2 + 1234));
+
+	std::vector<uint8_t> saved;
+	sSystem->SaveState(saved);
+	const uint64_t savedCycles = sCpu->GetCycles();
+	const uint8_t savedCount = sSystem->Read(0x0000);
+
+	// Running on from a loaded state ends up exactly where running on from
+	// the original did.
+	REQUIRE(sSystem->RunCycles(29781 * 3));
+	std::vector<uint8_t> expected;
+	sSystem->SaveState(expected);
+
+	REQUIRE(sSystem->LoadState(saved));
+	REQUIRE(sCpu->GetCycles() == savedCycles);
+	REQUIRE(sSystem->Read(0x0000) == savedCount);
+
+	REQUIRE(sSystem->RunCycles(29781 * 3));
+	std::vector<uint8_t> actual;
+	sSystem->SaveState(actual);
+	REQUIRE(actual == expected);
+
+	SECTION("Bad states are rejected")
+	{
+		std::vector<uint8_t> state = saved;
+
+		state[0] ^= 0xFF;
+		REQUIRE_FALSE(sSystem->LoadState(state));
+		state[0] ^= 0xFF;
+
+		state[4] += 1;
+		REQUIRE_FALSE(sSystem->LoadState(state));
+		state[4] -= 1;
+
+		state[8] ^= 0x01;
+		REQUIRE_FALSE(sSystem->LoadState(state));
+		state[8] ^= 0x01;
+
+		state.pop_back();
+		REQUIRE_FALSE(sSystem->LoadState(state));
+
+		REQUIRE(sSystem->LoadState(saved));
+	}
+
+	SECTION("Payloads that don't fit leave the machine as it was")
+	{
+		// The header agrees with the payload's size, so these are only
+		// caught once the payload has been read.
+		auto setPayloadSize = [](std::vector<uint8_t>& state)
+		{
+			uint32_t payloadSize = static_cast<uint32_t>(state.size() - 16);
+			for (size_t i = 0; i < 4; ++i)
+			{
+				state[12 + i] = static_cast<uint8_t>(payloadSize >> (i * 8));
+			}
+		};
+
+		std::vector<uint8_t> shorter = saved;
+		shorter.pop_back();
+		setPayloadSize(shorter);
+
+		std::vector<uint8_t> longer = saved;
+		longer.push_back(0);
+		setPayloadSize(longer);
+
+		for (const std::vector<uint8_t>* state : { &shorter, &longer })
+		{
+			REQUIRE_FALSE(sSystem->LoadState(*state));
+
+			std::vector<uint8_t> after;
+			sSystem->SaveState(after);
+			REQUIRE(after == actual);
+		}
+	}
+
+	SECTION("Other ROMs are rejected")
+	{
+		std::vector<uint8_t> prg(0x4000, 0);
+		std::vector<uint8_t> chr(0x2000, 0);
+		std::filesystem::path romPath = WriteTestROM(prg, 0, chr);
+
+		REQUIRE(sCart->Load(romPath.string()));
+		std::filesystem::remove(romPath);
+
+		const uint64_t cycles = sCpu->GetCycles();
+		REQUIRE_FALSE(sSystem->LoadState(saved));
+		REQUIRE(sCpu->GetCycles() == cycles);
+	}
+}
+
+TEST_CASE("Rewind", "[System]")
+{
+	SECTION("Frames come back in reverse")
+	{
+		InitSystem();
+
+		// Counts in 0x0000 with rendering on.
+		uint16_t write_addr = 0x8000;
+		sCart->Write(write_addr++, 0xA9); // LDA_immediate
+		sCart->Write(write_addr++, 0x1E); // literal 0x1E, rendering on
+		sCart->Write(write_addr++, 0x8D); // STA_absolute
+		sCart->Write(write_addr++, 0x01); // PPUMASK offset 0x01
+		sCart->Write(write_addr++, 0x20); // PPUMASK page 0x20
+		sCart->Write(write_addr++, 0xE6); // INC_zeropage    <- loop
+		sCart->Write(write_addr++, 0x00); // Memory offset 0x00
+		sCart->Write(write_addr++, 0x4C); // JMP_absolute
+		sCart->Write(write_addr++, 0x05); // loop offset 0x05
+		sCart->Write(write_addr++, 0x80); // loop page 0x80
+
+		sSystem->Reset();
+
+		RewindBuffer rewind(1024 * 1024, 60);
+		std::vector<std::vector<uint8_t>> frames;
+
+		for (int i = 0; i < 20; ++i)
+		{
+			REQUIRE(sSystem->RunCycles(29781));
+			frames.emplace_back();
+			sSystem->SaveState(frames.back());
+			rewind.Push(frames.back());
+		}
+
+		REQUIRE(rewind.GetStateCount() == frames.size());
+
+		// Most of a state doesn't change from one frame to the next.
+		REQUIRE(rewind.GetBytesUsed() < frames[0].size() * 2);
+
+		std::vector<uint8_t> state;
+		for (size_t i = frames.size() - 1; i > 0; --i)
+		{
+			REQUIRE(rewind.Pop(state));
+			REQUIRE(state == frames[i - 1]);
+		}
+
+		REQUIRE_FALSE(rewind.Pop(state));
+		REQUIRE(rewind.GetStateCount() == 1);
+
+		REQUIRE(sSystem->LoadState(state));
+		REQUIRE(sSystem->RunCycles(29781));
+		sSystem->SaveState(state);
+		REQUIRE(state == frames[1]);
+	}
+
+	SECTION("The oldest states make room")
+	{
+		std::mt19937 random(1234);
+		std::vector<std::vector<uint8_t>> states(1, std::vector<uint8_t>(1000, 0));
+
+		// Too little room for all of them, and wrapping at odd places.
+		RewindBuffer rewind(997, 100);
+
+		for (int i = 0; i < 300; ++i)
+		{
+			std::vector<uint8_t> state = states.back();
+			for (int j = random() % 40; j > 0; --j)
+			{
+				state[random() % state.size()] = static_cast<uint8_t>(random());
+			}
+
+			states.push_back(state);
+			rewind.Push(state);
+		}
+
+		REQUIRE(rewind.GetStateCount() > 1);
+		REQUIRE(rewind.GetStateCount() <= 100);
+		REQUIRE(rewind.GetBytesUsed() <= 997 + 1000);
+
+		std::vector<uint8_t> state;
+		size_t count = rewind.GetStateCount();
+		for (size_t i = 1; i < count; ++i)
+		{
+			REQUIRE(rewind.Pop(state));
+			REQUIRE(state == states[states.size() - 1 - i]);
+		}
+		REQUIRE_FALSE(rewind.Pop(state));
+
+		// A different size starts again.
+		rewind.Push(std::vector<uint8_t>(10, 1));
+		REQUIRE(rewind.GetStateCount() == 1);
+	}
+}
+
+TEST_CASE("Controllers", "[System]")
+{
+	InitSystem();
+
+	Controller& controller = sSystem->GetController(0);
+	controller.SetButtons(Controller::CB_A | Controller::CB_Start | Controller::CB_Right);
+	sSystem->GetController(1).SetButtons(Controller::CB_B);
+
+	// While the strobe is high, reads keep returning A.
+	sSystem->Write(0x4016, 0x01);
+	REQUIRE((sSystem->Read(0x4016) & 0x01) == 1);
+	REQUIRE((sSystem->Read(0x4016) & 0x01) == 1);
+
+	sSystem->Write(0x4016, 0x00);
+
+	// A, B, Select, Start, Up, Down, Left, Right, then 1s.
+	const uint8_t expected[] = { 1, 0, 0, 1, 0, 0, 0, 1, 1, 1 };
+	for (uint8_t bit : expected)
+	{
+		REQUIRE(sSystem->Read(0x4016) == (0x40 | bit));
+	}
+
+	// Port 2 shifts on its own.
+	REQUIRE((sSystem->Read(0x4017) & 0x01) == 0);
+	REQUIRE((sSystem->Read(0x4017) & 0x01) == 1);
+
+	// Buttons changing after the latch don't show until the next one.
+	sSystem->Write(0x4016, 0x01);
+	sSystem->Write(0x4016, 0x00);
+	controller.SetButtons(0);
+	REQUIRE((sSystem->Read(0x4016) & 0x01) == 1);
+}
+
+TEST_CASE("Movies", "[System]")
+{
+	auto writeProgram = []()
+	{
+		// Latches the controller and copies the buttons to 0x0010-0x0018, forever.
+		uint16_t write_addr = 0x8000;
+		sCart->Write(write_addr++, 0xA9); // LDA_immediate    <- loop
+		sCart->Write(write_addr++, 0x01); // literal 1
+		sCart->Write(write_addr++, 0x8D); // STA_absolute
+		sCart->Write(write_addr++, 0x16); // Controller offset 0x16
+		sCart->Write(write_addr++, 0x40); // Controller page 0x40
+		sCart->Write(write_addr++, 0xA9); // LDA_immediate
+		sCart->Write(write_addr++, 0x00); // literal 0
+		sCart->Write(write_addr++, 0x8D); // STA_absolute
+		sCart->Write(write_addr++, 0x16); // Controller offset 0x16
+		sCart->Write(write_addr++, 0x40); // Controller page 0x40
+		sCart->Write(write_addr++, 0xA2); // LDX_immediate
+		sCart->Write(write_addr++, 0x00); // literal 0
+		sCart->Write(write_addr++, 0xAD); // LDA_absolute     <- bits
+		sCart->Write(write_addr++, 0x16); // Controller offset 0x16
+		sCart->Write(write_addr++, 0x40); // Controller page 0x40
+		sCart->Write(write_addr++, 0x95); // STA_zeropage_X
+		sCart->Write(write_addr++, 0x10); // Memory offset 0x10
+		sCart->Write(write_addr++, 0xE8); // INX
+		sCart->Write(write_addr++, 0xE0); // CPX_immediate
+		sCart->Write(write_addr++, 0x09); // literal 9
+		sCart->Write(write_addr++, 0xD0); // BNE_relative
+		sCart->Write(write_addr++, 0xF6); // bits, -10
+		sCart->Write(write_addr++, 0xE6); // INC_zeropage
+		sCart->Write(write_addr++, 0x00); // Memory offset 0x00
+		sCart->Write(write_addr++, 0x4C); // JMP_absolute
+		sCart->Write(write_addr++, 0x00); // loop offset 0x00
+		sCart->Write(write_addr++, 0x80); // loop page 0x80
+	};
+
+	InitSystem();
+	writeProgram();
+	sSystem->Reset();
+	REQUIRE(sSystem->RunCycles(29781));
+
+	Movie recorded;
+	recorded.Start(*sSystem);
+
+	for (int i = 0; i < 30; ++i)
+	{
+		Movie::Frame frame;
+		frame.buttons = { static_cast<uint8_t>(i * 37), static_cast<uint8_t>(i) };
+		frame.cycles = static_cast<uint16_t>(29780 + (i & 1));
+
+		REQUIRE(Movie::RunFrame(*sNES, frame));
+		frame.ramHash = Movie::HashRAM({ sNES->GetMemory().GetData(), Memory::kSize });
+		recorded.AddFrame(frame);
+	}
+
+	REQUIRE((sSystem->Read(0x0010) & 0x01) == ((29 * 37) & 0x01));
+
+	std::filesystem::path moviePath = std::filesystem::temp_directory_path() / "cojoNES_movie_test.movie";
+	REQUIRE(recorded.Save(moviePath.string()));
+
+	Movie movie;
+	REQUIRE(movie.Load(moviePath.string()));
+	std::filesystem::remove(moviePath);
+
+	REQUIRE(movie.GetStartState() == recorded.GetStartState());
+	REQUIRE(movie.GetFrames().size() == recorded.GetFrames().size());
+
+	// A fresh machine replays it exactly.
+	InitSystem();
+	writeProgram();
+	REQUIRE(sSystem->LoadState(movie.GetStartState()));
+
+	for (const Movie::Frame& frame : movie.GetFrames())
+	{
+		REQUIRE(Movie::RunFrame(*sNES, frame));
+		REQUIRE(Movie::HashRAM({ sNES->GetMemory().GetData(), Memory::kSize }) == frame.ramHash);
+	}
+
+	SECTION("Divergence shows on the frame it happens")
+	{
+		REQUIRE(sSystem->LoadState(movie.GetStartState()));
+
+		size_t firstMismatch = movie.GetFrames().size();
+		for (size_t i = 0; i < movie.GetFrames().size(); ++i)
+		{
+			Movie::Frame frame = movie.GetFrames()[i];
+			if (i == 17)
+			{
+				frame.buttons[0] ^= Controller::CB_A;
+			}
+
+			REQUIRE(Movie::RunFrame(*sNES, frame));
+			if (Movie::HashRAM({ sNES->GetMemory().GetData(), Memory::kSize }) != frame.ramHash)
+			{
+				firstMismatch = i;
+				break;
+			}
+		}
+
+		REQUIRE(firstMismatch == 17);
+	}
+}
+
+TEST_CASE("Latency histograms", "[Latency]")
+{
+	constexpr int64_t kMs = 1000000;
+
+	LatencyStats stats;
+
+	// Input read 3ms after polling, the frame done 1ms later, uploaded 2ms
+	// after that and presented 10ms after that.
+	FrameTiming timing;
+	timing.inputPoll = 100 * kMs;
+	timing.inputRead = 103 * kMs;
+	timing.completed = 104 * kMs;
+	stats.Add(timing, 106 * kMs, 116 * kMs);
+
+	// A frame that didn't read input only counts from completion on.
+	timing.inputPoll = 0;
+	timing.inputRead = 0;
+	stats.Add(timing, 105 * kMs, 105 * kMs + kMs / 2);
+
+	REQUIRE(stats.GetCount(LatencyStats::LS_PollToRead) == 1);
+	REQUIRE(stats.GetCount(LatencyStats::LS_PollToPresent) == 1);
+	REQUIRE(stats.GetCount(LatencyStats::LS_UploadToPresent) == 2);
+
+	REQUIRE(stats.GetMeanMs(LatencyStats::LS_PollToRead) == 3.0);
+	REQUIRE(stats.GetMeanMs(LatencyStats::LS_PollToPresent) == 16.0);
+	REQUIRE(stats.GetMaxMs(LatencyStats::LS_UploadToPresent) == 10.0);
+
+	const LatencyStats::Histogram& histogram = stats.GetHistogram(LatencyStats::LS_PollToPresent);
+	REQUIRE(histogram[32] == 1.0f);
+
+	REQUIRE(stats.GetPercentileMs(LatencyStats::LS_UploadToPresent, 50.0) == 1.0);
+	REQUIRE(stats.GetPercentileMs(LatencyStats::LS_UploadToPresent, 100.0) == 10.5);
+
+	// Anything too long to fit goes in the last bucket.
+	timing.completed = 0;
+	stats.Add(timing, 200 * kMs, 400 * kMs);
+	REQUIRE(stats.GetHistogram(LatencyStats::LS_UploadToPresent).back() == 1.0f);
+
+	std::filesystem::path csvPath = std::filesystem::temp_directory_path() / "cojoNES_latency_test.csv";
+	REQUIRE(stats.WriteCSV(csvPath.string()));
+
+	std::ifstream csv(csvPath);
+	std::string header;
+	std::getline(csv, header);
+	REQUIRE(header == "bucket_ms,poll_to_read,read_to_complete,complete_to_upload,upload_to_present,poll_to_present");
+
+	size_t rows = 0;
+	for (std::string row; std::getline(csv, row); ++rows)
+	{
+	}
+	REQUIRE(rows == LatencyStats::kBucketCount);
+
+	csv.close();
+	std::filesystem::remove(csvPath);
+
+	stats.Clear();
+	REQUIRE(stats.GetCount(LatencyStats::LS_UploadToPresent) == 0);
+}